@@ -20,4 +20,5 @@ option(TEST_PHI2 "Enable tests for Phi2" OFF)
 option(ENABLE_MODEL_BENCHMARK "Build model benchmark program" ON)
 
 # diagnostics
+option(ENABLE_CXX17 "Build as C++17, as the CUDA and Android builds do" OFF)
 option(ENABLE_TRACING "Enable recording of tracing data" OFF)
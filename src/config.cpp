@@ -227,6 +227,10 @@ struct DecoderInputs_Element : JSON::Element {
       v_.past_value_names = JSON::Get<std::string_view>(value);
     } else if (name == "past_names") {
       v_.past_names = JSON::Get<std::string_view>(value);
+    } else if (name == "past_key_scale_names") {
+      v_.past_key_scale_names = JSON::Get<std::string_view>(value);
+    } else if (name == "past_value_scale_names") {
+      v_.past_value_scale_names = JSON::Get<std::string_view>(value);
     } else if (name == "cross_past_key_names") {
       v_.cross_past_key_names = JSON::Get<std::string_view>(value);
     } else if (name == "cross_past_value_names") {
@@ -268,6 +272,10 @@ struct DecoderOutputs_Element : JSON::Element {
       v_.present_value_names = JSON::Get<std::string_view>(value);
     } else if (name == "present_names") {
       v_.present_names = JSON::Get<std::string_view>(value);
+    } else if (name == "present_key_scale_names") {
+      v_.present_key_scale_names = JSON::Get<std::string_view>(value);
+    } else if (name == "present_value_scale_names") {
+      v_.present_value_scale_names = JSON::Get<std::string_view>(value);
     } else if (name == "output_cross_qk_names") {
       v_.output_cross_qk_names = JSON::Get<std::string_view>(value);
     } else if (name == "rnn_states") {
@@ -398,6 +406,23 @@ struct SlidingWindow_Element : JSON::Element {
   std::optional<Config::Model::Decoder::SlidingWindow>& v_;
 };
 
+struct KeyValueQuantization_Element : JSON::Element {
+  explicit KeyValueQuantization_Element(std::optional<Config::Model::Decoder::KeyValueQuantization>& v) : v_{v} {}
+
+  void OnValue(std::string_view name, JSON::Value value) override {
+    if (name == "type") {
+      v_->type = JSON::Get<std::string_view>(value);
+    } else if (name == "group_size") {
+      v_->group_size = static_cast<int>(JSON::Get<double>(value));
+    } else {
+      throw JSON::unknown_value_error{};
+    }
+  }
+
+ private:
+  std::optional<Config::Model::Decoder::KeyValueQuantization>& v_;
+};
+
 struct Encoder_Element : JSON::Element {
   explicit Encoder_Element(Config::Model::Encoder& v) : v_{v} {}
 
@@ -474,6 +499,10 @@ struct Decoder_Element : JSON::Element {
       v_.sliding_window = Config::Model::Decoder::SlidingWindow{};
       return sliding_window_;
     }
+    if (name == "kv_cache_quantization") {
+      v_.kv_cache_quantization = Config::Model::Decoder::KeyValueQuantization{};
+      return kv_cache_quantization_;
+    }
     throw JSON::unknown_value_error{};
   }
 
@@ -491,6 +520,7 @@ struct Decoder_Element : JSON::Element {
   DecoderOutputs_Element outputs_{v_.outputs};
   Pipeline_Element pipeline_{v_.pipeline};
   SlidingWindow_Element sliding_window_{v_.sliding_window};
+  KeyValueQuantization_Element kv_cache_quantization_{v_.kv_cache_quantization};
 };
 
 struct VisionInputs_Element : JSON::Element {
@@ -768,6 +798,10 @@ struct Search_Element : JSON::Element {
       v_.temperature = static_cast<float>(JSON::Get<double>(value));
     } else if (name == "repetition_penalty") {
       v_.repetition_penalty = static_cast<float>(JSON::Get<double>(value));
+    } else if (name == "presence_penalty") {
+      v_.presence_penalty = static_cast<float>(JSON::Get<double>(value));
+    } else if (name == "frequency_penalty") {
+      v_.frequency_penalty = static_cast<float>(JSON::Get<double>(value));
     } else if (name == "length_penalty") {
       v_.length_penalty = static_cast<float>(JSON::Get<double>(value));
     } else if (name == "no_repeat_ngram_size") {
@@ -778,12 +812,22 @@ struct Search_Element : JSON::Element {
       v_.length_penalty = static_cast<float>(JSON::Get<double>(value));
     } else if (name == "random_seed") {
       v_.random_seed = static_cast<int>(JSON::Get<double>(value));
+    } else if (name == "prompt_lookup_num_tokens") {
+      v_.prompt_lookup_num_tokens = static_cast<int>(JSON::Get<double>(value));
+    } else if (name == "prompt_lookup_min_ngram_size") {
+      v_.prompt_lookup_min_ngram_size = static_cast<int>(JSON::Get<double>(value));
+    } else if (name == "top_logprobs") {
+      v_.top_logprobs = static_cast<int>(JSON::Get<double>(value));
     } else if (name == "do_sample") {
       v_.do_sample = JSON::Get<bool>(value);
     } else if (name == "past_present_share_buffer") {
       v_.past_present_share_buffer = JSON::Get<bool>(value);
+    } else if (name == "growable_kv_cache") {
+      v_.growable_kv_cache = JSON::Get<bool>(value);
     } else if (name == "early_stopping") {
       v_.early_stopping = JSON::Get<bool>(value);
+    } else if (name == "logprobs") {
+      v_.logprobs = JSON::Get<bool>(value);
     } else {
       throw JSON::unknown_value_error{};
     }
@@ -793,6 +837,50 @@ struct Search_Element : JSON::Element {
   Config::Search& v_;
 };
 
+struct DynamicBatching_Element : JSON::Element {
+  explicit DynamicBatching_Element(Config::Engine::DynamicBatching& v) : v_{v} {}
+
+  void OnValue(std::string_view name, JSON::Value value) override {
+    if (name == "block_size") {
+      v_.block_size = static_cast<int>(JSON::Get<double>(value));
+    } else if (name == "num_blocks") {
+      v_.num_blocks = static_cast<int>(JSON::Get<double>(value));
+    } else if (name == "max_batch_size") {
+      v_.max_batch_size = static_cast<int>(JSON::Get<double>(value));
+    } else if (name == "max_num_tokens") {
+      v_.max_num_tokens = static_cast<int>(JSON::Get<double>(value));
+    } else if (name == "prefill_chunk_size") {
+      v_.prefill_chunk_size = static_cast<int>(JSON::Get<double>(value));
+    } else if (name == "enable_prefix_caching") {
+      v_.enable_prefix_caching = JSON::Get<bool>(value);
+    } else if (name == "scheduling_policy") {
+      v_.scheduling_policy = JSON::Get<std::string_view>(value);
+    } else if (name == "preemption_mode") {
+      v_.preemption_mode = JSON::Get<std::string_view>(value);
+    } else {
+      throw JSON::unknown_value_error{};
+    }
+  }
+
+ private:
+  Config::Engine::DynamicBatching& v_;
+};
+
+struct Engine_Element : JSON::Element {
+  explicit Engine_Element(Config::Engine& v) : v_{v} {}
+
+  Element& OnObject(std::string_view name) override {
+    if (name == "dynamic_batching") {
+      return dynamic_batching_;
+    }
+    throw JSON::unknown_value_error{};
+  }
+
+ private:
+  Config::Engine& v_;
+  DynamicBatching_Element dynamic_batching_{v_.dynamic_batching};
+};
+
 void SetSearchNumber(Config::Search& search, std::string_view name, double value) {
   try {
     Search_Element(search).OnValue(name, value);
@@ -892,12 +980,16 @@ struct Root_Element : JSON::Element {
     if (name == "search") {
       return search_element_;
     }
+    if (name == "engine") {
+      return engine_element_;
+    }
     throw JSON::unknown_value_error{};
   }
 
   Config& config_;
   Model_Element model_element_{config_.model};
   Search_Element search_element_{config_.search};
+  Engine_Element engine_element_{config_.engine};
 };
 
 struct RootObject_Element : JSON::Element {
@@ -21,6 +21,10 @@ struct Config {
     static constexpr std::string_view LogitsName = "logits";
     static constexpr std::string_view PresentKeyName = "present.%d.key";
     static constexpr std::string_view PresentValueName = "present.%d.value";
+    static constexpr std::string_view PastKeyScaleName = "past_key_values.%d.key_scale";
+    static constexpr std::string_view PastValueScaleName = "past_key_values.%d.value_scale";
+    static constexpr std::string_view PresentKeyScaleName = "present.%d.key_scale";
+    static constexpr std::string_view PresentValueScaleName = "present.%d.value_scale";
     static constexpr std::string_view RnnStatesName = "rnn_states";
     static constexpr std::string_view RnnStatesPrevName = "rnn_states_prev";
     static constexpr std::string_view CumulativeSequenceLengthsName = "cumulative_sequence_lengths";
@@ -196,6 +200,12 @@ struct Config {
       };
       std::optional<SlidingWindow> sliding_window;
 
+      struct KeyValueQuantization {  // For models that read and write the key-value cache quantized, with a scale per group of elements
+        std::string type{"int8"};    // Storage type of the key-value cache, either "int8" or "fp8" (float8 e4m3)
+        int group_size{};            // Elements of a head that share a scale, per token. 0 means head_size, a single scale per head and token
+      };
+      std::optional<KeyValueQuantization> kv_cache_quantization;
+
       struct Inputs {
         std::string input_ids{Defaults::InputIdsName};
         std::string embeddings{Defaults::InputsEmbedsName};
@@ -204,6 +214,8 @@ struct Config {
         std::string past_key_names{Defaults::PastKeyName};
         std::string past_value_names{Defaults::PastValueName};
         std::string past_names;  // When key/value pairs are combined
+        std::string past_key_scale_names{Defaults::PastKeyScaleName};  // Only with kv_cache_quantization
+        std::string past_value_scale_names{Defaults::PastValueScaleName};
         std::string cross_past_key_names, cross_past_value_names;
         std::string past_key_values_length{Defaults::PastKeyValuesLengthName};
         std::string past_sequence_length{Defaults::PastSequenceLengthName};
@@ -223,6 +235,8 @@ struct Config {
         std::string present_key_names{Defaults::PresentKeyName};
         std::string present_value_names{Defaults::PresentValueName};
         std::string present_names;  // When key/value pairs are combined
+        std::string present_key_scale_names{Defaults::PresentKeyScaleName};  // Only with kv_cache_quantization
+        std::string present_value_scale_names{Defaults::PresentValueScaleName};
         std::string output_cross_qk_names{"output_cross_qk_%d"};
         std::string rnn_states{Defaults::RnnStatesName};
       } outputs;
@@ -257,17 +271,38 @@ struct Config {
     int num_beams{1};                  // 1 means no beam search.
     int num_return_sequences{1};       // Number of sequences to return after search. Default is 1.
     float repetition_penalty{1.0f};    // 1.0 means no penalty.
+    float presence_penalty{};          // Subtracted from the logits of tokens that are already in the sequence. 0.0 means no penalty.
+    float frequency_penalty{};         // Subtracted from the logits of tokens once for every time they are in the sequence. 0.0 means no penalty.
     int top_k{50};                     // Number of highest probability vocabulary tokens to keep for top-k-filtering that will be used by default in the generate method of the model.
     float top_p{};                     // If set to float >0 and <1, only the most probable tokens with probabilities that add up to top_p or higher are kept for generation.
     float temperature{1.0f};           // Temperature to control during generation. Default is 1.0.
     bool early_stopping{true};         //  Whether to stop the beam search when at least num_beams sentences are finished per batch or not.
-    int no_repeat_ngram_size{};        // Unused param
+    int no_repeat_ngram_size{};        // If set to int > 0, n-grams of that size can only occur once in the sequence (CPU only)
     float diversity_penalty{};         // Unused param
     float length_penalty{1.0f};        // Exponential penalty to the length that is used with beam-based generation. length_penalty > 0.0 promotes longer sequences, while length_penalty < 0.0 encourages shorter sequences.
     bool past_present_share_buffer{};  // The past/present kv tensors are shared and allocated once to max_length (cuda only)
+    bool growable_kv_cache{};          // Like past_present_share_buffer, but the shared kv tensors start small and double in length as the sequence grows. Also works with beam search (cpu only)
     int random_seed{-1};               // -1 = Seed with random device, otherwise use value to seed RNG
+    int prompt_lookup_num_tokens{};    // If set to int > 0, decode speculatively with up to that many tokens copied from earlier in the sequence (batch_size 1, num_beams 1)
+    // Shortest match of the last tokens of the sequence that prompt lookup copies the following tokens of
+    int prompt_lookup_min_ngram_size{2};
+    bool logprobs{};                   // Compute the log probability of every generated token (CPU only, num_beams 1)
+    int top_logprobs{};                // If set to int > 0, also return that many of the most likely tokens and their log probabilities every step, implies logprobs
   } search;
 
+  struct Engine {
+    struct DynamicBatching {
+      int block_size{256};            // Number of tokens held by each key-value cache block
+      std::optional<int> num_blocks;  // Number of key-value cache blocks to preallocate. If omitted, enough blocks for max_batch_size sequences of search.max_length are allocated
+      int max_batch_size{16};         // Maximum number of requests that can be in progress at the same time
+      int max_num_tokens{2048};       // Maximum number of tokens processed by the model in a single step across all requests
+      int prefill_chunk_size{};       // Maximum number of prompt tokens of a single request processed in one step. 0 processes the whole prompt at once
+      bool enable_prefix_caching{};   // Reuse the key-value cache blocks of prompt prefixes shared between requests
+      std::string scheduling_policy{"fcfs"};  // Order in which requests are served: fcfs, priority, shortest_prompt_first or deadline
+      std::string preemption_mode{"recompute"};  // What happens to the key-value cache of a preempted request: recompute (dropped) or swap (copied to host memory)
+    } dynamic_batching;
+  } engine;
+
   void AddMapping(const std::string& nominal_name, const std::string& graph_name);
   // Returns graph name and true if the nominal name is found in the mapping
   // otherwise returns the nominal name and false
@@ -4,6 +4,7 @@
 #include "../generators.h"
 #include "../search.h"
 #include "../models/utils.h"
+#include "../models/beam_reorder.h"
 #include "interface.h"
 
 namespace Generators {
@@ -150,6 +151,10 @@ struct CpuInterface : DeviceInterface {
     return true;
   }
 
+  void UpdateCacheIndirection(int32_t* tgt_indir_cache, const int32_t* src_indir_cache, const int32_t* beam_ids, int batch_size, int beam_width, int input_seq_length, int max_seq_length, int current_length) override {
+    UpdateCacheIndirectionTable(tgt_indir_cache, src_indir_cache, beam_ids, batch_size, beam_width, input_seq_length, max_seq_length, current_length);
+  }
+
   std::unique_ptr<Search> CreateGreedy(const GeneratorParams& params) override { return std::make_unique<GreedySearch_Cpu>(params); }
   std::unique_ptr<Search> CreateBeam(const GeneratorParams& params) override { return std::make_unique<BeamSearch_Cpu>(params); }
 
@@ -58,6 +58,11 @@ struct GpuMemory final : DeviceBuffer {
     ::cudaMemcpyAsync(p_device_, p_cpu_, size_in_bytes_, ::cudaMemcpyHostToDevice, GetStream());
   }
 
+  void CopyRangeCpuToDevice(size_t begin, size_t size_in_bytes) override {
+    assert(p_cpu_ && begin + size_in_bytes <= size_in_bytes_);
+    ::cudaMemcpyAsync(p_device_ + begin, p_cpu_ + begin, size_in_bytes, ::cudaMemcpyHostToDevice, GetStream());
+  }
+
   void CopyFrom(size_t begin_dest, DeviceBuffer& source, size_t begin_source, size_t size_in_bytes) override {
     if (source.GetType() == device_label)
       ::cudaMemcpyAsync(p_device_ + begin_dest, source.p_device_ + begin_source, size_in_bytes, ::cudaMemcpyDeviceToDevice, GetStream());
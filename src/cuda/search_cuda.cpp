@@ -21,6 +21,8 @@ void OnCudaError(cudaError_t error) {
 
 Search_Cuda::Search_Cuda(const GeneratorParams& params)
     : Search{params} {
+  if (params.search.logprobs || params.search.top_logprobs > 0)
+    throw std::runtime_error("logprobs are only supported by the CPU search");
   auto batch_beam_size = params.BatchBeamSize();
   sequence_lengths_ = params.p_device->Allocate<int32_t>(batch_beam_size);
 
@@ -155,7 +157,10 @@ void GreedySearch_Cuda::SampleTopKTopP(int k, float p, float temperature) {
   assert(scores.size() == params_->search.batch_size * params_->config.model.vocab_size);
   cuda::GetSample(samplingdata_.get(), GetStream(), next_tokens_.data(), scores.data(), int(scores.size() / params_->search.batch_size),
                   params_->search.batch_size, k, p, temperature);
+  AppendNextTokensToSequences();
+}
 
+void GreedySearch_Cuda::AppendNextTokensToSequences() {
   // Check for EOS
   assert(next_tokens_.size() == eos_seen_.size());
   cuda::Launch_CheckForEOSAndPad(next_tokens_.data(), static_cast<int>(next_tokens_.size()), eos_seen_.data(), eos_token_ids_.Span().data(), static_cast<int>(eos_token_ids_.Span().size()), params_->config.model.pad_token_id, done_cpu_.get(), GetStream());
@@ -219,6 +224,7 @@ void GreedySearch_Cuda::AppendTokens(DeviceSpan<int32_t>& next_tokens) {
   auto next_tokens_gpu = next_tokens.Span();
   cuda::Launch_AppendNextTokensToSequences(next_tokens_gpu, sequences_.GetSequences().Span(), params_->BatchBeamSize(), sequences_.GetSequenceLength(), sequences_.max_length_, GetStream());
   sequences_.AfterAppendNextTokens(next_tokens, params_->BatchBeamSize());
+  appended_length_ = sequences_.GetSequenceLength();
 
   if (sequences_.GetSequenceLength() >= params_->search.max_length) {
     if (GetLogItems().enabled && GetLogItems().hit_max_length)
@@ -240,13 +246,30 @@ void BeamSearch_Cuda::AppendTokens(DeviceSpan<int32_t>& next_tokens) {
 }
 
 void GreedySearch_Cuda::RewindTo(size_t index) {
-  cudaMemsetAsync(eos_seen_.data(), 0, eos_seen_.size_bytes(), GetStream());
-  *done_cpu_ = false;
+  // Rows that sampled EOS within the kept tokens stay done, the others continue. The EOS is found in the sequences since
+  // only the device knows where each row sampled it.
+  appended_length_ = std::min(appended_length_, index);
+  auto sequences = sequences_.GetSequences().CopyDeviceToCpu();
+  auto eos_seen = std::make_unique<bool[]>(eos_seen_.size());
+  bool done = true;
+  for (size_t i = 0; i < eos_seen_.size(); i++) {
+    auto sampled = sequences.subspan(i * sequences_.max_length_ + appended_length_, index - appended_length_);
+    eos_seen[i] = std::any_of(sampled.begin(), sampled.end(), [this](int32_t token) { return contains(params_->config.model.eos_token_id, token); });
+    done &= eos_seen[i];
+  }
+  cudaMemcpyAsync(eos_seen_.data(), eos_seen.get(), eos_seen_.size_bytes(), cudaMemcpyHostToDevice, GetStream());
+  *done_cpu_ = done;
+
   if (index > 0)
     cuda::Launch_GetLastTokens(next_tokens_.data(), sequences_.GetSequences().Span().data(), static_cast<int>(params_->BatchBeamSize()), static_cast<int>(index), sequences_.max_length_, GetStream());
   else
     cudaMemsetAsync(next_tokens_.data(), 0, params_->search.batch_size * sizeof(int32_t), GetStream());
   sequences_.RewindTo(index);
+  cudaStreamSynchronize(GetStream());  // eos_seen is copied from pageable memory
+}
+
+void GreedySearch_Cuda::AppendRewoundTokens() {
+  AppendNextTokensToSequences();
 }
 
 void Search_Cuda::ApplyMinLength(int min_length) {
@@ -53,9 +53,13 @@ struct GreedySearch_Cuda : Search_Cuda {
   void SampleTopKTopP(int k, float p, float t) override;
   void AppendTokens(DeviceSpan<int32_t>& next_tokens) override;  // shape (batch_size, sequence_length)
   void RewindTo(size_t index) override;
+  void AppendRewoundTokens() override;
 
  private:
+  void AppendNextTokensToSequences();  // Pads the rows that are done, then appends next_tokens_
+
   DeviceSpan<int32_t> next_tokens_buffer_;
+  size_t appended_length_{};  // Sequence length after the last AppendTokens, the tokens before it never end a row
   std::unique_ptr<cuda::ArgMaxData> argmaxdata_;
   std::unique_ptr<cuda::SamplingData> samplingdata_;
 };
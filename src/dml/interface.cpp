@@ -69,6 +69,12 @@ struct GpuMemory final : DeviceBuffer {
     dml_pooled_upload_heap_->BeginUploadToGpu(gpu_resource_.Get(), 0, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, source);
   }
 
+  void CopyRangeCpuToDevice(size_t begin, size_t size_in_bytes) override {
+    assert(p_cpu_ && begin + size_in_bytes <= size_in_bytes_);
+    auto source = std::span(p_cpu_ + begin, size_in_bytes);
+    dml_pooled_upload_heap_->BeginUploadToGpu(gpu_resource_.Get(), begin, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, source);
+  }
+
   void CopyFrom(size_t begin_dest, DeviceBuffer& source, size_t begin_source, size_t size_in_bytes) override {
     if (source.GetType() == device_label) {
       auto& source_gpu = dynamic_cast<GpuMemory&>(source);
@@ -0,0 +1,127 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../span.h"
+
+/**
+ * @file block_pool.h
+ * @brief Defines the BlockPool class, which hands out fixed-size key-value cache
+ *        blocks from a preallocated pool.
+ */
+
+namespace Generators {
+
+/**
+ * @class BlockPool
+ * @brief Tracks which blocks of a preallocated key-value cache pool are in use.
+ *
+ * The pool itself only deals in block ids. The memory backing the blocks is owned
+ * by the cache manager, which lays out the key-value cache as [num_blocks, block_size, ...]
+ * so that a block id directly indexes into the cache tensors.
+ *
+ * Blocks are reference counted so that a block holding a shared prompt prefix can be used
+ * by several requests at once. A block returns to the pool once its last reference is freed.
+ */
+struct BlockPool {
+  /**
+   * @brief Constructs a BlockPool with the given number of blocks of the given size.
+   * @param num_blocks The total number of blocks in the pool.
+   * @param block_size The number of tokens each block can hold.
+   */
+  BlockPool(size_t num_blocks, size_t block_size)
+      : num_blocks_{num_blocks}, block_size_{block_size}, ref_counts_(num_blocks) {
+    if (num_blocks_ == 0 || block_size_ == 0) {
+      throw std::runtime_error("Block pool requires a non-zero number of blocks and block size.");
+    }
+
+    // Free blocks are handed out from the back, so keep the lowest block ids at the back
+    // to hand them out first.
+    free_blocks_.resize(num_blocks_);
+    std::iota(free_blocks_.rbegin(), free_blocks_.rend(), 0);
+  }
+
+  size_t NumBlocks() const { return num_blocks_; }
+
+  size_t BlockSize() const { return block_size_; }
+
+  size_t NumFreeBlocks() const { return free_blocks_.size(); }
+
+  /**
+   * @brief Returns the number of blocks needed to hold the given number of tokens.
+   */
+  size_t BlocksNeeded(size_t num_tokens) const {
+    return (num_tokens + block_size_ - 1) / block_size_;
+  }
+
+  bool CanAllocate(size_t num_blocks) const { return num_blocks <= free_blocks_.size(); }
+
+  /**
+   * @brief Takes num_blocks blocks out of the pool and appends their ids to block_table.
+   * @throws std::runtime_error if the pool does not have enough free blocks.
+   */
+  void Allocate(size_t num_blocks, std::vector<int32_t>& block_table) {
+    if (!CanAllocate(num_blocks)) {
+      throw std::runtime_error("Unable to allocate " + std::to_string(num_blocks) +
+                               " key-value cache blocks. Only " + std::to_string(free_blocks_.size()) +
+                               " out of " + std::to_string(num_blocks_) + " blocks are free.");
+    }
+
+    for (size_t i = 0; i < num_blocks; ++i) {
+      block_table.push_back(free_blocks_.back());
+      ref_counts_[free_blocks_.back()] = 1;
+      free_blocks_.pop_back();
+    }
+  }
+
+  /**
+   * @brief Adds a reference to a block that is already in use.
+   */
+  void AddRef(int32_t block) {
+    if (RefCount(block) == 0) {
+      throw std::runtime_error("Attempted to reference key-value cache block " + std::to_string(block) +
+                               " which is not in use.");
+    }
+    ++ref_counts_[block];
+  }
+
+  size_t RefCount(int32_t block) const {
+    if (block < 0 || static_cast<size_t>(block) >= num_blocks_) {
+      throw std::runtime_error("Key-value cache block " + std::to_string(block) + " does not belong to the pool.");
+    }
+    return ref_counts_[block];
+  }
+
+  /**
+   * @brief Releases a reference to each of the given blocks. Blocks that are no longer
+   *        referenced are returned back to the pool.
+   */
+  void Free(std::span<const int32_t> block_table) {
+    // Blocks are pushed back in reverse so that a freed table is handed out again in the same order.
+    for (size_t i = block_table.size(); i-- > 0;) {
+      const int32_t block = block_table[i];
+      if (RefCount(block) == 0) {
+        throw std::runtime_error("Key-value cache block " + std::to_string(block) + " was freed more than once.");
+      }
+      if (--ref_counts_[block] == 0) {
+        free_blocks_.push_back(block);
+      }
+    }
+  }
+
+ private:
+  size_t num_blocks_;
+  size_t block_size_;
+  std::vector<size_t> ref_counts_;
+  std::vector<int32_t> free_blocks_;
+};
+
+}  // namespace Generators
@@ -5,7 +5,32 @@
 
 namespace Generators {
 
+namespace {
+
+size_t NumBlocks(const Config& config) {
+  const auto& options = config.engine.dynamic_batching;
+  if (options.block_size <= 0) {
+    throw std::runtime_error("engine.dynamic_batching.block_size must be greater than 0. Got: " +
+                             std::to_string(options.block_size));
+  }
+
+  if (options.num_blocks.has_value()) {
+    return static_cast<size_t>(*options.num_blocks);
+  }
+
+  // Enough blocks for max_batch_size requests that all reach max_length
+  const size_t blocks_per_sequence = (static_cast<size_t>(config.search.max_length) + options.block_size - 1) / options.block_size;
+  return blocks_per_sequence * static_cast<size_t>(options.max_batch_size);
+}
+
+}  // namespace
+
 std::unique_ptr<CacheManager> CreateCacheManager(std::shared_ptr<Model> model) {
+  // Models exported with paged attention consume the key-value cache through a block table,
+  // which allows requests to be added to and removed from the batch at every step.
+  if (model->session_info_.HasInput(model->config_->model.decoder.inputs.block_table)) {
+    return std::make_unique<PagedCacheManager>(model);
+  }
   return std::make_unique<StaticCacheManager>(model);
 }
 
@@ -93,4 +118,280 @@ std::vector<std::shared_ptr<Request>> StaticCacheManager::AllocatedRequests() co
   return cache_allocated_requests_;
 }
 
+PagedCacheManager::PagedCacheManager(std::shared_ptr<Model> model)
+    : CacheManager(model),
+      options_{model->config_->engine.dynamic_batching},
+      params_{std::make_shared<GeneratorParams>(*model)},
+      block_pool_{NumBlocks(*model->config_), static_cast<size_t>(options_.block_size)},
+      prefix_cache_{options_.enable_prefix_caching ? std::make_unique<PrefixCache>(block_pool_) : nullptr} {
+  const auto& decoder = model_->config_->model.decoder;
+  const int layer_count = decoder.num_hidden_layers;
+
+  for (int i = 0; i < layer_count; ++i) {
+    input_name_strings_.emplace_back(ComposeKeyValueName(decoder.inputs.past_key_names, i));
+    input_name_strings_.emplace_back(ComposeKeyValueName(decoder.inputs.past_value_names, i));
+
+    output_name_strings_.emplace_back(ComposeKeyValueName(decoder.outputs.present_key_names, i));
+    output_name_strings_.emplace_back(ComposeKeyValueName(decoder.outputs.present_value_names, i));
+  }
+
+  // Derive the KV data type from the KV input 0
+  const auto type = model_->session_info_.GetInputDataType(input_name_strings_[0]);
+  const std::array<int64_t, 4> shape{static_cast<int64_t>(block_pool_.NumBlocks()),
+                                     static_cast<int64_t>(block_pool_.BlockSize()),
+                                     decoder.num_key_value_heads,
+                                     decoder.head_size};
+
+  if (options_.preemption_mode == "swap") {
+    swap_on_preemption_ = true;
+  } else if (options_.preemption_mode != "recompute") {
+    throw std::runtime_error("Unknown preemption mode: " + options_.preemption_mode + ". Expected recompute or swap.");
+  }
+
+  block_bytes_ = static_cast<size_t>(shape[1] * shape[2] * shape[3]) * Ort::SizeOf(type);
+
+  auto& device = *model_->p_device_kvcache_;
+  try {
+    for (int i = 0; i < layer_count * 2; ++i) {
+      key_value_caches_.push_back(OrtValue::CreateTensor(device.GetAllocator(), shape, type));
+
+      // Zero the memory so we don't leak any data from the previous run
+      // WebGPU device has no Zero() implementation yet. Since this zeroing is optional we disable it for WebGPU for now
+      if (device.GetType() != DeviceType::WEBGPU) {
+        ByteWrapTensor(device, *key_value_caches_.back()).Zero();
+      }
+    }
+  } catch (const Ort::Exception&) {
+    std::ostringstream oss;
+    oss << "Could not allocate the paged key-value cache of shape: ["
+        << "num_blocks (" << shape[0] << "), block_size (" << shape[1] << "), num_key_value_heads ("
+        << shape[2] << "), head_size (" << shape[3] << ")] for " << layer_count << " layers. "
+        << "Try reducing engine.dynamic_batching.num_blocks or engine.dynamic_batching.block_size.";
+    throw std::runtime_error(oss.str());
+  }
+
+  // The model reads from and writes to the same blocks, so the past and present tensors are shared.
+  key_value_cache_state_ = std::make_unique<KeyValueCacheState>(*params_, *model_);
+  for (int i = 0; i < layer_count * 2; ++i) {
+    key_value_cache_state_->inputs_.push_back(key_value_caches_[i].get());
+    key_value_cache_state_->input_names_.push_back(input_name_strings_[i].c_str());
+    key_value_cache_state_->outputs_.push_back(key_value_caches_[i].get());
+    key_value_cache_state_->output_names_.push_back(output_name_strings_[i].c_str());
+  }
+}
+
+size_t PagedCacheManager::BlocksToGrow(const Request& request, size_t num_allocated_blocks) const {
+  const size_t blocks_needed = block_pool_.BlocksNeeded(static_cast<size_t>(request.CurrentSequenceLength()));
+  return blocks_needed > num_allocated_blocks ? blocks_needed - num_allocated_blocks : 0;
+}
+
+size_t PagedCacheManager::NumAvailableBlocks() const {
+  return block_pool_.NumFreeBlocks() + (prefix_cache_ ? prefix_cache_->NumEvictableBlocks() : 0);
+}
+
+void PagedCacheManager::AllocateBlocks(size_t num_blocks, std::vector<int32_t>& block_table) {
+  if (prefix_cache_ && !block_pool_.CanAllocate(num_blocks)) {
+    prefix_cache_->Evict(num_blocks - block_pool_.NumFreeBlocks());
+  }
+  block_pool_.Allocate(num_blocks, block_table);
+}
+
+void PagedCacheManager::CacheProcessedBlocks(Request& request, Allocation& allocation) {
+  const size_t num_processed_blocks = static_cast<size_t>(request.ProcessedSequenceLength()) / block_pool_.BlockSize();
+  if (num_processed_blocks <= allocation.num_cached_blocks) {
+    return;
+  }
+
+  auto tokens = request.Sequence().CopyDeviceToCpu();
+  prefix_cache_->Insert(tokens.subspan(0, num_processed_blocks * block_pool_.BlockSize()), allocation.block_table);
+  allocation.num_cached_blocks = num_processed_blocks;
+}
+
+void PagedCacheManager::SwapOut(std::span<const int32_t> block_table, std::vector<uint8_t>& host_blocks) {
+  auto& device = *model_->p_device_kvcache_;
+  host_blocks.resize(key_value_caches_.size() * block_table.size() * block_bytes_);
+
+  auto host = host_blocks.begin();
+  for (auto& key_value_cache : key_value_caches_) {
+    auto cache_bytes = ByteWrapTensor(device, *key_value_cache);
+    for (int32_t block : block_table) {
+      auto block_bytes = cache_bytes.subspan(static_cast<size_t>(block) * block_bytes_, block_bytes_).CopyDeviceToCpu();
+      host = std::copy(block_bytes.begin(), block_bytes.end(), host);
+    }
+  }
+}
+
+void PagedCacheManager::SwapIn(std::span<const int32_t> block_table, std::span<const uint8_t> host_blocks) {
+  auto& device = *model_->p_device_kvcache_;
+
+  auto host = host_blocks.begin();
+  for (auto& key_value_cache : key_value_caches_) {
+    auto cache_bytes = ByteWrapTensor(device, *key_value_cache);
+    for (int32_t block : block_table) {
+      auto block_bytes = cache_bytes.subspan(static_cast<size_t>(block) * block_bytes_, block_bytes_);
+      std::copy_n(host, block_bytes_, block_bytes.CpuSpan().begin());
+      block_bytes.CopyCpuToDevice();
+      host += block_bytes_;
+    }
+  }
+}
+
+bool PagedCacheManager::CanAllocate(const std::vector<std::shared_ptr<Request>>& requests) const {
+  if (cache_allocated_requests_.size() + requests.size() > static_cast<size_t>(options_.max_batch_size)) {
+    return false;
+  }
+
+  // Requests that are already in progress have priority on the remaining blocks.
+  size_t blocks_needed = 0;
+  for (const auto& [request, allocation] : allocations_) {
+    if (request->status_ != RequestStatus::Completed) {
+      blocks_needed += BlocksToGrow(*request, allocation.block_table.size());
+    }
+  }
+
+  // Cached prefixes are not accounted for here, so this is a conservative estimate.
+  for (const auto& request : requests) {
+    blocks_needed += BlocksToGrow(*request, 0);
+  }
+
+  return blocks_needed <= NumAvailableBlocks();
+}
+
+void PagedCacheManager::Allocate(const std::vector<std::shared_ptr<Request>>& requests) {
+  for (const auto& request : requests) {
+    if (allocations_.count(request)) {
+      throw std::runtime_error("Request has already been allocated in the key-value cache.");
+    }
+
+    auto& allocation = allocations_[request];
+    if (auto swapped = swapped_blocks_.find(request); swapped != swapped_blocks_.end()) {
+      // Resume a preempted request by restoring its blocks from host memory
+      const size_t num_swapped_blocks = swapped->second.size() / (key_value_caches_.size() * block_bytes_);
+      AllocateBlocks(num_swapped_blocks, allocation.block_table);
+      SwapIn(allocation.block_table, swapped->second);
+      num_swap_bytes_ -= swapped->second.size();
+      swapped_blocks_.erase(swapped);
+    } else if (prefix_cache_ && request->CurrentSequenceLength() > 0) {
+      // The last token is always processed since its logits are needed to generate the next token
+      auto tokens = request->Sequence().CopyDeviceToCpu();
+      const size_t num_cached_tokens = prefix_cache_->Match(tokens.subspan(0, tokens.size() - 1), allocation.block_table);
+      request->SetCachedPrefixLength(num_cached_tokens);
+      allocation.num_cached_blocks = allocation.block_table.size();
+    }
+
+    AllocateBlocks(BlocksToGrow(*request, allocation.block_table.size()), allocation.block_table);
+    cache_allocated_requests_.push_back(request);
+  }
+}
+
+void PagedCacheManager::Step() {
+  for (const auto& request : cache_allocated_requests_) {
+    if (request->status_ == RequestStatus::Completed) {
+      continue;
+    }
+
+    auto& allocation = allocations_.at(request);
+    if (prefix_cache_) {
+      CacheProcessedBlocks(*request, allocation);
+    }
+    AllocateBlocks(BlocksToGrow(*request, allocation.block_table.size()), allocation.block_table);
+  }
+}
+
+void PagedCacheManager::Deallocate(std::vector<std::shared_ptr<Request>>& requests) {
+  // Copy the requests since the caller may pass in the result of AllocatedRequests()
+  const std::vector<std::shared_ptr<Request>> requests_to_deallocate = requests;
+  for (const auto& request : requests_to_deallocate) {
+    if (auto swapped = swapped_blocks_.find(request); swapped != swapped_blocks_.end()) {
+      num_swap_bytes_ -= swapped->second.size();
+      swapped_blocks_.erase(swapped);
+    }
+
+    auto allocation = allocations_.find(request);
+    if (allocation == allocations_.end()) {
+      continue;
+    }
+
+    if (prefix_cache_) {
+      CacheProcessedBlocks(*request, allocation->second);
+    }
+    block_pool_.Free(allocation->second.block_table);
+    allocations_.erase(allocation);
+    cache_allocated_requests_.erase(std::remove(cache_allocated_requests_.begin(), cache_allocated_requests_.end(), request),
+                                    cache_allocated_requests_.end());
+  }
+}
+
+void PagedCacheManager::Preempt(const std::shared_ptr<Request>& request) {
+  auto allocation = allocations_.find(request);
+  if (allocation == allocations_.end()) {
+    throw std::runtime_error("Cannot preempt a request that has not been allocated in the key-value cache.");
+  }
+
+  // Only the blocks holding processed tokens have valid contents
+  auto& block_table = allocation->second.block_table;
+  const size_t num_processed_blocks = block_pool_.BlocksNeeded(static_cast<size_t>(request->ProcessedSequenceLength()));
+  if (swap_on_preemption_) {
+    auto& host_blocks = swapped_blocks_[request];
+    SwapOut(std::span<const int32_t>(block_table).subspan(0, std::min(num_processed_blocks, block_table.size())), host_blocks);
+    num_swap_bytes_ += host_blocks.size();
+  }
+
+  if (prefix_cache_) {
+    CacheProcessedBlocks(*request, allocation->second);
+  }
+  block_pool_.Free(block_table);
+  allocations_.erase(allocation);
+  cache_allocated_requests_.erase(std::remove(cache_allocated_requests_.begin(), cache_allocated_requests_.end(), request),
+                                  cache_allocated_requests_.end());
+
+  request->Preempt(!swap_on_preemption_);
+  ++num_preemptions_;
+}
+
+bool PagedCacheManager::SupportsDynamicBatching() const { return true; }
+
+std::vector<std::shared_ptr<Request>> PagedCacheManager::AllocatedRequests() const {
+  return cache_allocated_requests_;
+}
+
+std::optional<double> PagedCacheManager::GetStatistic(std::string_view name) const {
+  if (name == "free_blocks") {
+    return static_cast<double>(block_pool_.NumFreeBlocks());
+  } else if (name == "preemptions") {
+    return static_cast<double>(num_preemptions_);
+  } else if (name == "swapped_requests") {
+    return static_cast<double>(swapped_blocks_.size());
+  } else if (name == "swap_bytes") {
+    return static_cast<double>(num_swap_bytes_);
+  }
+
+  if (name.rfind("prefix_cache_", 0) == 0) {
+    const auto stats = prefix_cache_ ? prefix_cache_->GetStats() : PrefixCache::Stats{};
+    if (name == "prefix_cache_lookups") {
+      return static_cast<double>(stats.lookups);
+    } else if (name == "prefix_cache_hits") {
+      return static_cast<double>(stats.hits);
+    } else if (name == "prefix_cache_queried_tokens") {
+      return static_cast<double>(stats.queried_tokens);
+    } else if (name == "prefix_cache_hit_tokens") {
+      return static_cast<double>(stats.hit_tokens);
+    } else if (name == "prefix_cache_hit_rate") {
+      return stats.HitRate();
+    } else if (name == "prefix_cache_blocks") {
+      return static_cast<double>(prefix_cache_ ? prefix_cache_->NumCachedBlocks() : 0);
+    }
+  }
+
+  return std::nullopt;
+}
+
+std::span<const int32_t> PagedCacheManager::BlockTable(const std::shared_ptr<Request>& request) const {
+  auto allocation = allocations_.find(request);
+  if (allocation == allocations_.end()) {
+    throw std::runtime_error("Request has not been allocated in the key-value cache.");
+  }
+  return allocation->second.block_table;
+}
+
 }  // namespace Generators
@@ -4,6 +4,8 @@
 #pragma once
 
 #include "request.h"
+#include "block_pool.h"
+#include "prefix_cache.h"
 #include "../models/kv_cache.h"
 
 namespace Generators {
@@ -35,6 +37,23 @@ struct CacheManager {
 
   virtual std::vector<std::shared_ptr<Request>> AllocatedRequests() const = 0;
 
+  /**
+   * @brief Looks up a statistic tracked by the cache manager.
+   * @param name The name of the statistic.
+   * @return The value of the statistic, or std::nullopt if the cache manager does not track it.
+   */
+  virtual std::optional<double> GetStatistic(std::string_view name) const { return std::nullopt; }
+
+  /**
+   * @brief Releases the cache of a request that is in progress so that it can be resumed later.
+   * @param request The request to preempt. It is moved back to the Assigned state.
+   *
+   * A preempted request is resumed by allocating it again.
+   */
+  virtual void Preempt(const std::shared_ptr<Request>& request) {
+    throw std::runtime_error("The cache manager does not support preemption.");
+  }
+
   virtual ~CacheManager() = default;
 
  protected:
@@ -65,8 +84,23 @@ struct StaticCacheManager : CacheManager {
   std::vector<std::shared_ptr<Request>> cache_allocated_requests_;
 };
 
+/**
+ * @brief Manages the key-value cache as a pool of fixed-size blocks shared by all requests.
+ *
+ * The cache for each layer is preallocated as [num_blocks, block_size, num_key_value_heads, head_size].
+ * Every request owns a block table listing the blocks holding its tokens, in order. Blocks are
+ * allocated on demand as the request grows and returned to the pool as soon as the request
+ * finishes, so requests can join and leave the batch at every step.
+ *
+ * When the pool runs out, a running request can be preempted. Its blocks are either copied to
+ * host memory and restored once it is resumed, or dropped and recomputed from its tokens.
+ *
+ * With prefix caching enabled, the full blocks of every request are also added to a prefix cache.
+ * A new request then starts from the blocks of its longest cached prompt prefix and only
+ * processes the rest of its prompt.
+ */
 struct PagedCacheManager : CacheManager {
-  PagedCacheManager(std::shared_ptr<Model> model) : CacheManager(model) {}
+  PagedCacheManager(std::shared_ptr<Model> model);
 
   bool CanAllocate(const std::vector<std::shared_ptr<Request>>& requests) const override;
 
@@ -79,6 +113,56 @@ struct PagedCacheManager : CacheManager {
   bool SupportsDynamicBatching() const override;
 
   std::vector<std::shared_ptr<Request>> AllocatedRequests() const override;
+
+  std::optional<double> GetStatistic(std::string_view name) const override;
+
+  void Preempt(const std::shared_ptr<Request>& request) override;
+
+  /**
+   * @brief Returns the ids of the blocks holding the given request's tokens, in sequence order.
+   */
+  std::span<const int32_t> BlockTable(const std::shared_ptr<Request>& request) const;
+
+  size_t BlockSize() const { return block_pool_.BlockSize(); }
+
+  size_t NumFreeBlocks() const { return block_pool_.NumFreeBlocks(); }
+
+ private:
+  struct Allocation {
+    std::vector<int32_t> block_table;
+    size_t num_cached_blocks{};  // Number of leading blocks of the block table that are in the prefix cache
+  };
+
+  // Number of blocks the request still needs to hold the tokens it will have after the next step
+  size_t BlocksToGrow(const Request& request, size_t num_allocated_blocks) const;
+
+  // Number of blocks that are free or can be made free by evicting unused prefixes
+  size_t NumAvailableBlocks() const;
+
+  // Allocates blocks from the pool, evicting unused prefixes if the pool runs low
+  void AllocateBlocks(size_t num_blocks, std::vector<int32_t>& block_table);
+
+  // Adds the full blocks the request has processed so far to the prefix cache
+  void CacheProcessedBlocks(Request& request, Allocation& allocation);
+
+  // Copies the contents of the given blocks of every layer from the device to host memory and back
+  void SwapOut(std::span<const int32_t> block_table, std::vector<uint8_t>& host_blocks);
+  void SwapIn(std::span<const int32_t> block_table, std::span<const uint8_t> host_blocks);
+
+  const Config::Engine::DynamicBatching& options_;
+  std::shared_ptr<GeneratorParams> params_;
+  BlockPool block_pool_;
+  std::unique_ptr<PrefixCache> prefix_cache_;                // Only set if prefix caching is enabled
+  std::vector<std::unique_ptr<OrtValue>> key_value_caches_;  // Key and value cache blocks for every layer
+  size_t block_bytes_{};                                     // Size of a single block in one layer's key or value cache
+  std::vector<std::string> input_name_strings_, output_name_strings_;
+  std::vector<std::shared_ptr<Request>> cache_allocated_requests_;
+  std::unordered_map<std::shared_ptr<Request>, Allocation> allocations_;
+
+  bool swap_on_preemption_{};                                                       // Otherwise the cache of preempted requests is recomputed
+  std::unordered_map<std::shared_ptr<Request>, std::vector<uint8_t>> swapped_blocks_;  // Host copies of the blocks of swapped out requests
+  size_t num_swap_bytes_{};
+  size_t num_preemptions_{};
 };
 
 }  // namespace Generators
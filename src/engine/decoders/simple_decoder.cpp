@@ -3,18 +3,37 @@
 
 #include "simple_decoder.h"
 
+#include <algorithm>
+#include <array>
 #include <typeinfo>
 
 namespace Generators {
 
+bool StaticBatchIOArena::Buffer::Reshape(DeviceInterface* device, ONNXTensorElementDataType type, std::span<const int64_t> shape) {
+  const size_t element_count = static_cast<size_t>(ElementCountFromShape(shape));
+  const bool reallocate = !tensor || tensor->type_ != type || element_count > capacity;
+  if (reallocate) {
+    // Grow geometrically so that a slowly growing sequence does not reallocate on every step
+    capacity = std::max(element_count, tensor && tensor->type_ == type ? capacity * 2 : size_t{0});
+    tensor = std::make_unique<Tensor>(device, type);
+    const std::array<int64_t, 1> capacity_shape{static_cast<int64_t>(capacity)};
+    tensor->CreateTensor(capacity_shape, true);
+    bytes = tensor->GetByteSpan();
+  }
+  tensor->CreateTensor(shape, true);
+  return reallocate;
+}
+
 StaticBatchDecoderIO::StaticBatchDecoderIO(std::shared_ptr<DecoderOnly_Model> model,
                                            ScheduledRequests& scheduled_requests,
-                                           std::shared_ptr<CacheManager> cache_manager)
-    : DecoderIO(model, scheduled_requests, cache_manager) {
-  PrepareInputIds(model, scheduled_requests);
-  PrepareAttentionMask(model, scheduled_requests);
-  PreparePositionIds(model, scheduled_requests);
-  PrepareLogits(model, scheduled_requests);
+                                           std::shared_ptr<CacheManager> cache_manager,
+                                           StaticBatchIOArena& arena)
+    : DecoderIO(model, scheduled_requests, cache_manager), arena_{arena} {
+  GatherRequestInputs(scheduled_requests);
+  PrepareInputIds(model);
+  PrepareAttentionMask(model);
+  PreparePositionIds(model);
+  PrepareLogits(model);
 
   auto cache = cache_manager->Cache();
   for (size_t i = 0; i < cache->input_names_.size(); ++i) {
@@ -28,168 +47,169 @@ StaticBatchDecoderIO::StaticBatchDecoderIO(std::shared_ptr<DecoderOnly_Model> mo
   }
 }
 
-void StaticBatchDecoderIO::PrepareInputIds(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests) {
-  auto request_with_max_sequence_length =
-      std::max_element(
-          scheduled_requests.begin(), scheduled_requests.end(),
-          [](const std::shared_ptr<Request>& a, const std::shared_ptr<Request>& b) {
-            return a->UnprocessedTokens().size() < b->UnprocessedTokens().size();
-          });
+void StaticBatchDecoderIO::GatherRequestInputs(ScheduledRequests& scheduled_requests) {
+  arena_.requests.clear();
+  arena_.max_num_tokens = 0;
+  arena_.max_sequence_length = 0;
+
+  for (auto& request : scheduled_requests) {
+    auto& inputs = arena_.requests.emplace_back();
+    inputs.request = request.get();
+    inputs.tokens = request->UnprocessedTokens().CopyDeviceToCpu();
+    inputs.sequence_length = request->CurrentSequenceLength();
+    inputs.is_prefill = request->IsPrefill();
+    arena_.max_num_tokens = std::max(arena_.max_num_tokens, inputs.tokens.size());
+    arena_.max_sequence_length = std::max(arena_.max_sequence_length, inputs.sequence_length);
+  }
+}
 
-  const size_t max_sequence_length = (*request_with_max_sequence_length)->UnprocessedTokens().size();
-  const size_t batch_size = scheduled_requests.size();
-  const std::vector<int64_t> input_ids_shape = {static_cast<int64_t>(batch_size), static_cast<int64_t>(max_sequence_length)};
-  auto input_ids_tensor = std::make_unique<Tensor>(model->p_device_inputs_, Ort::TypeToTensorType<int64_t>);
-  input_ids_tensor->CreateTensor(input_ids_shape);
-  auto device_span = input_ids_tensor->GetDeviceSpan<int64_t>();
-  auto cpu_span = device_span.CpuSpan();
+void StaticBatchDecoderIO::PrepareInputIds(std::shared_ptr<DecoderOnly_Model> model) {
+  const size_t max_sequence_length = arena_.max_num_tokens;
+  const size_t batch_size = arena_.requests.size();
+  const std::array<int64_t, 2> input_ids_shape{static_cast<int64_t>(batch_size), static_cast<int64_t>(max_sequence_length)};
+  arena_.input_ids.Reshape(model->p_device_inputs_, Ort::TypeToTensorType<int64_t>, input_ids_shape);
+  auto cpu_span = arena_.input_ids.CpuSpan<int64_t>(batch_size * max_sequence_length);
 
   for (size_t i = 0; i < batch_size; ++i) {
-    auto request = scheduled_requests[i];
-    auto input_ids = request->UnprocessedTokens().CopyDeviceToCpu();
-    for (size_t j = 0; j < max_sequence_length; ++j) {
-      cpu_span[i * max_sequence_length + j] = (j < input_ids.size()) ? input_ids[j] : model->config_->model.pad_token_id;
-    }
+    auto input_ids = arena_.requests[i].tokens;
+    auto row = cpu_span.subspan(i * max_sequence_length, max_sequence_length);
+    std::copy(input_ids.begin(), input_ids.end(), row.begin());
+    std::fill(row.begin() + input_ids.size(), row.end(), model->config_->model.pad_token_id);
   }
 
-  device_span.CopyCpuToDevice();
+  arena_.input_ids.CopyCpuToDevice<int64_t>(batch_size * max_sequence_length);
 
   input_names_.push_back(model->config_->model.decoder.inputs.input_ids.c_str());
-  inputs_.push_back(input_ids_tensor->GetOrtTensor());
-  owned_inputs_.push_back(std::move(input_ids_tensor));
-}
-
-void StaticBatchDecoderIO::PrepareAttentionMask(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests) {
-  auto request_with_max_sequence_length =
-      std::max_element(
-          scheduled_requests.begin(), scheduled_requests.end(),
-          [](const std::shared_ptr<Request>& a, const std::shared_ptr<Request>& b) {
-            return a->CurrentSequenceLength() < b->CurrentSequenceLength();
-          });
-
-  const size_t max_sequence_length = (*request_with_max_sequence_length)->CurrentSequenceLength();
-  const size_t batch_size = scheduled_requests.size();
-  const std::vector<int64_t> attention_mask_shape = {static_cast<int64_t>(batch_size), static_cast<int64_t>(max_sequence_length)};
-  auto attention_mask_tensor = std::make_unique<Tensor>(model->p_device_inputs_, Ort::TypeToTensorType<int64_t>);
-  attention_mask_tensor->CreateTensor(attention_mask_shape);
-  auto device_span = attention_mask_tensor->GetDeviceSpan<int64_t>();
-  auto cpu_span = device_span.CpuSpan();
+  inputs_.push_back(arena_.input_ids.tensor->GetOrtTensor());
+}
 
-  for (size_t i = 0; i < batch_size; ++i) {
-    auto request = scheduled_requests[i];
-    const size_t current_sequence_length = static_cast<size_t>(request->CurrentSequenceLength());
+bool StaticBatchDecoderIO::CanExtendAttentionMask() const {
+  if (arena_.attention_mask_requests.size() != arena_.requests.size() ||
+      arena_.max_sequence_length != arena_.attention_mask_width + 1) {
+    return false;
+  }
 
-    for (size_t j = 0; j < max_sequence_length; ++j) {
-      cpu_span[i * max_sequence_length + j] = (j < current_sequence_length) ? 1 : 0;
+  for (size_t i = 0; i < arena_.requests.size(); ++i) {
+    const auto& inputs = arena_.requests[i];
+    if (inputs.is_prefill || inputs.request != arena_.attention_mask_requests[i] ||
+        inputs.sequence_length != arena_.attention_mask_lengths[i] + 1) {
+      return false;
     }
   }
+  return true;
+}
 
-  device_span.CopyCpuToDevice();
+void StaticBatchDecoderIO::PrepareAttentionMask(std::shared_ptr<DecoderOnly_Model> model) {
+  const size_t max_sequence_length = static_cast<size_t>(arena_.max_sequence_length);
+  const size_t batch_size = arena_.requests.size();
+  const std::array<int64_t, 2> attention_mask_shape{static_cast<int64_t>(batch_size), static_cast<int64_t>(max_sequence_length)};
+  const bool can_extend = CanExtendAttentionMask();
+  const bool reallocated = arena_.attention_mask.Reshape(model->p_device_inputs_, Ort::TypeToTensorType<int64_t>, attention_mask_shape);
+  auto cpu_span = arena_.attention_mask.CpuSpan<int64_t>(batch_size * max_sequence_length);
+
+  if (can_extend && !reallocated) {
+    // Every sequence grew by one token, so each row moves to its wider stride and gains a single
+    // attended position. Rows are moved back to front since the rows below move further.
+    const size_t previous_width = max_sequence_length - 1;
+    for (size_t i = batch_size; i-- > 0;) {
+      std::copy_backward(cpu_span.begin() + i * previous_width, cpu_span.begin() + (i + 1) * previous_width,
+                         cpu_span.begin() + i * max_sequence_length + previous_width);
+      const size_t current_sequence_length = static_cast<size_t>(arena_.requests[i].sequence_length);
+      cpu_span[i * max_sequence_length + previous_width] = 0;
+      cpu_span[i * max_sequence_length + current_sequence_length - 1] = 1;
+    }
+  } else {
+    for (size_t i = 0; i < batch_size; ++i) {
+      const size_t current_sequence_length = static_cast<size_t>(arena_.requests[i].sequence_length);
+      auto row = cpu_span.subspan(i * max_sequence_length, max_sequence_length);
+      std::fill(row.begin(), row.begin() + current_sequence_length, 1);
+      std::fill(row.begin() + current_sequence_length, row.end(), 0);
+    }
+  }
+
+  arena_.attention_mask.CopyCpuToDevice<int64_t>(batch_size * max_sequence_length);
+
+  arena_.attention_mask_requests.clear();
+  arena_.attention_mask_lengths.clear();
+  for (const auto& inputs : arena_.requests) {
+    arena_.attention_mask_requests.push_back(inputs.request);
+    arena_.attention_mask_lengths.push_back(inputs.sequence_length);
+  }
+  arena_.attention_mask_width = arena_.max_sequence_length;
 
   input_names_.push_back(model->config_->model.decoder.inputs.attention_mask.c_str());
-  inputs_.push_back(attention_mask_tensor->GetOrtTensor());
-  owned_inputs_.push_back(std::move(attention_mask_tensor));
+  inputs_.push_back(arena_.attention_mask.tensor->GetOrtTensor());
 }
 
-void StaticBatchDecoderIO::PreparePositionIds(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests) {
+void StaticBatchDecoderIO::PreparePositionIds(std::shared_ptr<DecoderOnly_Model> model) {
   if (!model->session_info_.HasInput(model->config_->model.decoder.inputs.position_ids)) {
     return;
   }
 
-  auto request_with_max_sequence_length =
-      std::max_element(
-          scheduled_requests.begin(), scheduled_requests.end(),
-          [](const std::shared_ptr<Request>& a, const std::shared_ptr<Request>& b) {
-            return a->UnprocessedTokens().size() < b->UnprocessedTokens().size();
-          });
-
-  const size_t max_sequence_length = (*request_with_max_sequence_length)->UnprocessedTokens().size();
-  const size_t batch_size = scheduled_requests.size();
-  const std::vector<int64_t> position_ids_shape = {static_cast<int64_t>(batch_size), static_cast<int64_t>(max_sequence_length)};
-  auto position_ids_tensor = std::make_unique<Tensor>(model->p_device_inputs_, Ort::TypeToTensorType<int64_t>);
-  position_ids_tensor->CreateTensor(position_ids_shape);
-  auto device_span = position_ids_tensor->GetDeviceSpan<int64_t>();
-  auto cpu_span = device_span.CpuSpan();
+  const size_t max_sequence_length = arena_.max_num_tokens;
+  const size_t batch_size = arena_.requests.size();
+  const std::array<int64_t, 2> position_ids_shape{static_cast<int64_t>(batch_size), static_cast<int64_t>(max_sequence_length)};
+  arena_.position_ids.Reshape(model->p_device_inputs_, Ort::TypeToTensorType<int64_t>, position_ids_shape);
+  auto cpu_span = arena_.position_ids.CpuSpan<int64_t>(batch_size * max_sequence_length);
 
   for (size_t i = 0; i < batch_size; ++i) {
-    auto request = scheduled_requests[i];
-    auto input_ids = request->UnprocessedTokens().CopyDeviceToCpu();
-    auto current_sequence_length = request->IsPrefill() ? 1 : request->CurrentSequenceLength();
+    const auto& inputs = arena_.requests[i];
+    const int64_t current_sequence_length = inputs.is_prefill ? 1 : inputs.sequence_length;
 
     for (size_t j = 0; j < max_sequence_length; ++j) {
-      cpu_span[i * max_sequence_length + j] = (j < input_ids.size() && input_ids[j] != model->config_->model.pad_token_id) ? current_sequence_length - 1 + j : 0;
+      cpu_span[i * max_sequence_length + j] = (j < inputs.tokens.size() && inputs.tokens[j] != model->config_->model.pad_token_id) ? current_sequence_length - 1 + j : 0;
     }
   }
 
-  device_span.CopyCpuToDevice();
+  arena_.position_ids.CopyCpuToDevice<int64_t>(batch_size * max_sequence_length);
 
   input_names_.push_back(model->config_->model.decoder.inputs.position_ids.c_str());
-  inputs_.push_back(position_ids_tensor->GetOrtTensor());
-  owned_inputs_.push_back(std::move(position_ids_tensor));
+  inputs_.push_back(arena_.position_ids.tensor->GetOrtTensor());
 }
 
-void StaticBatchDecoderIO::PrepareLogits(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests) {
-  auto request_with_max_sequence_length =
-      std::max_element(
-          scheduled_requests.begin(), scheduled_requests.end(),
-          [](const std::shared_ptr<Request>& a, const std::shared_ptr<Request>& b) {
-            return a->UnprocessedTokens().size() < b->UnprocessedTokens().size();
-          });
-
-  const int64_t max_sequence_length = (*request_with_max_sequence_length)->UnprocessedTokens().size();
-  const int64_t batch_size = scheduled_requests.size();
-  const std::vector<int64_t> logits_shape = {batch_size, max_sequence_length, model->config_->model.vocab_size};
-  logits_ = std::make_unique<Tensor>(model->p_device_inputs_, model->session_info_.GetOutputDataType(model->config_->model.decoder.outputs.logits));
-  logits_->CreateTensor(logits_shape);
+void StaticBatchDecoderIO::PrepareLogits(std::shared_ptr<DecoderOnly_Model> model) {
+  const std::array<int64_t, 3> logits_shape{static_cast<int64_t>(arena_.requests.size()),
+                                            static_cast<int64_t>(arena_.max_num_tokens),
+                                            model->config_->model.vocab_size};
+  arena_.logits.Reshape(model->p_device_inputs_, model->session_info_.GetOutputDataType(model->config_->model.decoder.outputs.logits), logits_shape);
 
   output_names_.push_back(model->config_->model.decoder.outputs.logits.c_str());
-  outputs_.push_back(logits_->GetOrtTensor());
+  outputs_.push_back(arena_.logits.tensor->GetOrtTensor());
 }
 
 std::vector<DeviceSpan<float>> StaticBatchDecoderIO::ProcessLogits() {
-  std::vector<int64_t> valid_token_indices;
-  for (auto& request : scheduled_requests_) {
-    if (request->IsPrefill()) {
-      valid_token_indices.push_back(request->CurrentSequenceLength() - 1);
-    } else {
-      valid_token_indices.push_back(0);
-    }
-  }
+  auto& logits = *arena_.logits.tensor;
 
   // [batch_size, max_sequence_length, vocab_size]
-  const auto all_tokens_logits_shape = logits_->GetShape();
+  const auto all_tokens_logits_shape = logits.GetShape();
   const int64_t batch_size = all_tokens_logits_shape[0],
                 max_sequence_length = all_tokens_logits_shape[1],
                 vocab_size = all_tokens_logits_shape[2];
-  const int64_t element_size = static_cast<int64_t>(Ort::SizeOf(logits_->GetType()));
+  const int64_t element_size = static_cast<int64_t>(Ort::SizeOf(logits.GetType()));
 
-  auto logits_bytes = logits_->GetByteSpan();
-  std::vector<decltype(logits_bytes)> logits_bytes_vector;
-  for (size_t i = 0; i < valid_token_indices.size(); ++i) {
-    auto logits_of_last_token = logits_bytes.subspan((i * max_sequence_length * vocab_size + valid_token_indices[i] * vocab_size) * element_size,
-                                                     vocab_size);
-    logits_bytes_vector.push_back(logits_of_last_token);
+  const bool requires_cast = logits.GetType() != Ort::TypeToTensorType<float>;
+  if (requires_cast) {
+    const std::array<int64_t, 2> logits_shape{batch_size, vocab_size};
+    arena_.logits_fp32.Reshape(model_.p_device_inputs_, Ort::TypeToTensorType<float>, logits_shape);
   }
 
+  auto logits_bytes = logits.GetByteSpan();
   std::vector<DeviceSpan<float>> logits_vector;
-  const std::vector<int64_t> logits_shape{batch_size, vocab_size};
+  for (int64_t i = 0; i < batch_size; ++i) {
+    const auto& inputs = arena_.requests[i];
+    const int64_t valid_token_index = inputs.is_prefill ? inputs.sequence_length - 1 : 0;
+    auto logits_of_last_token = logits_bytes.subspan((i * max_sequence_length + valid_token_index) * vocab_size * element_size,
+                                                     vocab_size * element_size);
 
-  const bool requires_cast = logits_->GetType() != Ort::TypeToTensorType<float>;
-  if (requires_cast) {
-    logits_fp32_ = std::make_unique<Tensor>(model_.p_device_inputs_, Ort::TypeToTensorType<float>);
-    logits_fp32_->CreateTensor(logits_shape);
-  }
-
-  for (size_t i = 0; i < logits_bytes_vector.size(); ++i) {
     if (requires_cast) {
-      auto logits_of_last_token_fp32 = logits_fp32_->GetDeviceSpan<float>().subspan(i * vocab_size, vocab_size);
-      void* src_data = logits_bytes_vector[i].Span().data();
+      auto logits_of_last_token_fp32 = arena_.logits_fp32.tensor->GetDeviceSpan<float>().subspan(i * vocab_size, vocab_size);
+      void* src_data = logits_of_last_token.Span().data();
       void* dst_data = logits_of_last_token_fp32.Span().data();
-      model_.p_device_inputs_->Cast(src_data, dst_data, logits_->GetType(), Ort::TypeToTensorType<float>, vocab_size);
+      model_.p_device_inputs_->Cast(src_data, dst_data, logits.GetType(), Ort::TypeToTensorType<float>, vocab_size);
       logits_vector.push_back(logits_of_last_token_fp32);
     } else {
       auto logits_of_last_token_fp32 = model_.p_device_inputs_->WrapMemory<float>(
-          std::span(reinterpret_cast<float*>(logits_bytes_vector[i].Span().data()), vocab_size));
+          std::span(reinterpret_cast<float*>(logits_of_last_token.Span().data()), vocab_size));
       logits_vector.push_back(logits_of_last_token_fp32);
     }
   }
@@ -201,6 +221,176 @@ VarlenDecoderIO::VarlenDecoderIO(std::shared_ptr<DecoderOnly_Model> model,
                                  ScheduledRequests& scheduled_requests,
                                  std::shared_ptr<CacheManager> cache_manager)
     : DecoderIO(model, scheduled_requests, cache_manager) {
+  PrepareInputIds(model, scheduled_requests);
+  PreparePositionIds(model, scheduled_requests);
+  PrepareSequenceLengths(model, scheduled_requests);
+  PrepareBlockTable(model, scheduled_requests);
+  PrepareLogits(model);
+
+  auto cache = cache_manager->Cache();
+  for (size_t i = 0; i < cache->input_names_.size(); ++i) {
+    input_names_.push_back(cache->input_names_[i]);
+    inputs_.push_back(cache->inputs_[i]);
+  }
+
+  for (size_t i = 0; i < cache->output_names_.size(); ++i) {
+    output_names_.push_back(cache->output_names_[i]);
+    outputs_.push_back(cache->outputs_[i]);
+  }
+}
+
+void VarlenDecoderIO::AddInput(const std::string& name, std::unique_ptr<Tensor> tensor) {
+  input_names_.push_back(name.c_str());
+  inputs_.push_back(tensor->GetOrtTensor());
+  owned_inputs_.push_back(std::move(tensor));
+}
+
+void VarlenDecoderIO::PrepareInputIds(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests) {
+  const auto& input_ids_name = model->config_->model.decoder.inputs.input_ids;
+  packed_batch_dimension_ = model->session_info_.GetInputSymbolicShape(input_ids_name).size() == 2;
+
+  cumulative_lengths_.assign(1, 0);
+  for (auto& request : scheduled_requests) {
+    cumulative_lengths_.push_back(cumulative_lengths_.back() + static_cast<int32_t>(request->UnprocessedTokens().size()));
+  }
+
+  const int64_t total_tokens = cumulative_lengths_.back();
+  const std::vector<int64_t> input_ids_shape = packed_batch_dimension_ ? std::vector<int64_t>{1, total_tokens}
+                                                                       : std::vector<int64_t>{total_tokens};
+  auto input_ids_tensor = std::make_unique<Tensor>(model->p_device_inputs_, Ort::TypeToTensorType<int64_t>);
+  input_ids_tensor->CreateTensor(input_ids_shape);
+  auto device_span = input_ids_tensor->GetDeviceSpan<int64_t>();
+  auto cpu_span = device_span.CpuSpan();
+
+  for (size_t i = 0; i < scheduled_requests.size(); ++i) {
+    auto input_ids = scheduled_requests[i]->UnprocessedTokens().CopyDeviceToCpu();
+    std::copy(input_ids.begin(), input_ids.end(), cpu_span.begin() + cumulative_lengths_[i]);
+  }
+
+  device_span.CopyCpuToDevice();
+  AddInput(input_ids_name, std::move(input_ids_tensor));
+}
+
+void VarlenDecoderIO::PreparePositionIds(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests) {
+  const auto& position_ids_name = model->config_->model.decoder.inputs.position_ids;
+  if (!model->session_info_.HasInput(position_ids_name)) {
+    return;
+  }
+
+  const int64_t total_tokens = cumulative_lengths_.back();
+  const std::vector<int64_t> position_ids_shape = packed_batch_dimension_ ? std::vector<int64_t>{1, total_tokens}
+                                                                          : std::vector<int64_t>{total_tokens};
+  auto position_ids_tensor = std::make_unique<Tensor>(model->p_device_inputs_, Ort::TypeToTensorType<int64_t>);
+  position_ids_tensor->CreateTensor(position_ids_shape);
+  auto device_span = position_ids_tensor->GetDeviceSpan<int64_t>();
+  auto cpu_span = device_span.CpuSpan();
+
+  for (size_t i = 0; i < scheduled_requests.size(); ++i) {
+    const int64_t past_sequence_length = scheduled_requests[i]->ProcessedSequenceLength();
+    std::iota(cpu_span.begin() + cumulative_lengths_[i], cpu_span.begin() + cumulative_lengths_[i + 1], past_sequence_length);
+  }
+
+  device_span.CopyCpuToDevice();
+  AddInput(position_ids_name, std::move(position_ids_tensor));
+}
+
+void VarlenDecoderIO::PrepareSequenceLengths(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests) {
+  const auto& inputs = model->config_->model.decoder.inputs;
+  const int64_t batch_size = static_cast<int64_t>(scheduled_requests.size());
+
+  auto cumulative_sequence_lengths_tensor = std::make_unique<Tensor>(model->p_device_inputs_, Ort::TypeToTensorType<int32_t>);
+  const std::vector<int64_t> cumulative_sequence_lengths_shape{batch_size + 1};
+  cumulative_sequence_lengths_tensor->CreateTensor(cumulative_sequence_lengths_shape);
+  auto cumulative_device_span = cumulative_sequence_lengths_tensor->GetDeviceSpan<int32_t>();
+  std::copy(cumulative_lengths_.begin(), cumulative_lengths_.end(), cumulative_device_span.CpuSpan().begin());
+  cumulative_device_span.CopyCpuToDevice();
+  AddInput(inputs.cumulative_sequence_lengths, std::move(cumulative_sequence_lengths_tensor));
+
+  auto past_sequence_lengths_tensor = std::make_unique<Tensor>(model->p_device_inputs_, Ort::TypeToTensorType<int32_t>);
+  const std::vector<int64_t> past_sequence_lengths_shape{batch_size};
+  past_sequence_lengths_tensor->CreateTensor(past_sequence_lengths_shape);
+  auto past_device_span = past_sequence_lengths_tensor->GetDeviceSpan<int32_t>();
+  auto past_cpu_span = past_device_span.CpuSpan();
+  for (size_t i = 0; i < scheduled_requests.size(); ++i) {
+    past_cpu_span[i] = static_cast<int32_t>(scheduled_requests[i]->ProcessedSequenceLength());
+  }
+  past_device_span.CopyCpuToDevice();
+  AddInput(inputs.past_sequence_lengths, std::move(past_sequence_lengths_tensor));
+}
+
+void VarlenDecoderIO::PrepareBlockTable(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests) {
+  auto paged_cache_manager = dynamic_cast<PagedCacheManager*>(cache_manager_.get());
+  if (!paged_cache_manager) {
+    throw std::runtime_error("Variable length batching requires a paged key-value cache.");
+  }
+
+  size_t max_blocks = 0;
+  for (auto& request : scheduled_requests) {
+    max_blocks = std::max(max_blocks, paged_cache_manager->BlockTable(request).size());
+  }
+
+  const int64_t batch_size = static_cast<int64_t>(scheduled_requests.size());
+  const std::vector<int64_t> block_table_shape{batch_size, static_cast<int64_t>(max_blocks)};
+  auto block_table_tensor = std::make_unique<Tensor>(model->p_device_inputs_, Ort::TypeToTensorType<int32_t>);
+  block_table_tensor->CreateTensor(block_table_shape);
+  auto device_span = block_table_tensor->GetDeviceSpan<int32_t>();
+  auto cpu_span = device_span.CpuSpan();
+
+  // Unused entries are never read since the sequence lengths bound the blocks that are visited
+  std::fill(cpu_span.begin(), cpu_span.end(), 0);
+  for (size_t i = 0; i < scheduled_requests.size(); ++i) {
+    auto block_table = paged_cache_manager->BlockTable(scheduled_requests[i]);
+    std::copy(block_table.begin(), block_table.end(), cpu_span.begin() + i * max_blocks);
+  }
+
+  device_span.CopyCpuToDevice();
+  AddInput(model->config_->model.decoder.inputs.block_table, std::move(block_table_tensor));
+}
+
+void VarlenDecoderIO::PrepareLogits(std::shared_ptr<DecoderOnly_Model> model) {
+  const int64_t total_tokens = cumulative_lengths_.back();
+  const int64_t vocab_size = model->config_->model.vocab_size;
+  const std::vector<int64_t> logits_shape = packed_batch_dimension_ ? std::vector<int64_t>{1, total_tokens, vocab_size}
+                                                                    : std::vector<int64_t>{total_tokens, vocab_size};
+  logits_ = std::make_unique<Tensor>(model->p_device_inputs_, model->session_info_.GetOutputDataType(model->config_->model.decoder.outputs.logits));
+  logits_->CreateTensor(logits_shape);
+
+  output_names_.push_back(model->config_->model.decoder.outputs.logits.c_str());
+  outputs_.push_back(logits_->GetOrtTensor());
+}
+
+std::vector<DeviceSpan<float>> VarlenDecoderIO::ProcessLogits() {
+  // [total_tokens, vocab_size] or [1, total_tokens, vocab_size]
+  const int64_t vocab_size = logits_->GetShape().back();
+  const size_t batch_size = cumulative_lengths_.size() - 1;
+  const size_t element_size = Ort::SizeOf(logits_->GetType());
+  auto logits_bytes = logits_->GetByteSpan();
+
+  const bool requires_cast = logits_->GetType() != Ort::TypeToTensorType<float>;
+  if (requires_cast) {
+    const std::vector<int64_t> logits_shape{static_cast<int64_t>(batch_size), vocab_size};
+    logits_fp32_ = std::make_unique<Tensor>(model_.p_device_inputs_, Ort::TypeToTensorType<float>);
+    logits_fp32_->CreateTensor(logits_shape);
+  }
+
+  std::vector<DeviceSpan<float>> logits_vector;
+  for (size_t i = 0; i < batch_size; ++i) {
+    // Only the last token of every request is used to generate the next token
+    const size_t last_token_index = static_cast<size_t>(cumulative_lengths_[i + 1] - 1);
+    auto logits_of_last_token = logits_bytes.subspan(last_token_index * vocab_size * element_size, vocab_size * element_size);
+
+    if (requires_cast) {
+      auto logits_of_last_token_fp32 = logits_fp32_->GetDeviceSpan<float>().subspan(i * vocab_size, vocab_size);
+      model_.p_device_inputs_->Cast(logits_of_last_token.Span().data(), logits_of_last_token_fp32.Span().data(),
+                                    logits_->GetType(), Ort::TypeToTensorType<float>, vocab_size);
+      logits_vector.push_back(logits_of_last_token_fp32);
+    } else {
+      logits_vector.push_back(model_.p_device_inputs_->WrapMemory<float>(
+          std::span(reinterpret_cast<float*>(logits_of_last_token.Span().data()), vocab_size)));
+    }
+  }
+
+  return logits_vector;
 }
 
 SimpleDecoder::SimpleDecoder(std::shared_ptr<DecoderOnly_Model> model,
@@ -212,7 +402,7 @@ void SimpleDecoder::Decode(ScheduledRequests& scheduled_requests) {
   std::unique_ptr<DecoderIO> decoder_state =
       cache_manager_->SupportsDynamicBatching()
           ? static_cast<std::unique_ptr<DecoderIO>>(std::make_unique<VarlenDecoderIO>(model_, scheduled_requests, cache_manager_))
-          : static_cast<std::unique_ptr<DecoderIO>>(std::make_unique<StaticBatchDecoderIO>(model_, scheduled_requests, cache_manager_));
+          : static_cast<std::unique_ptr<DecoderIO>>(std::make_unique<StaticBatchDecoderIO>(model_, scheduled_requests, cache_manager_, static_batch_arena_));
 
   auto run_options = scheduled_requests.RunOptions();
   decoder_state->DumpInputs();
@@ -9,32 +9,102 @@
 
 namespace Generators {
 
+/**
+ * @brief Input and output tensors of StaticBatchDecoderIO that persist across steps.
+ *
+ * The buffers only ever grow, so once the batch has reached its largest shape a step no longer
+ * allocates. While the same batch keeps decoding one token at a time, the attention mask is
+ * widened in place instead of being rebuilt.
+ */
+struct StaticBatchIOArena {
+  // A tensor whose buffer is reused for every shape that fits into it
+  struct Buffer {
+    // Points the tensor at the given shape and returns true if the buffer had to be reallocated
+    bool Reshape(DeviceInterface* device, ONNXTensorElementDataType type, std::span<const int64_t> shape);
+
+    template <typename T>
+    std::span<T> CpuSpan(size_t count) { return {reinterpret_cast<T*>(bytes.CpuSpan().data()), count}; }
+    // Copies the first count elements to the device, the rest of the capacity is unused this step
+    template <typename T>
+    void CopyCpuToDevice(size_t count) { bytes.subspan(0, count * sizeof(T)).CopyRangeCpuToDevice(); }
+
+    std::unique_ptr<Tensor> tensor;
+    DeviceSpan<uint8_t> bytes;  // The whole buffer, kept so that its CPU copy persists across steps
+    size_t capacity{};          // Number of elements the buffer can hold
+  };
+
+  // What the inputs need to know about each scheduled request, gathered once per step
+  struct RequestInputs {
+    const Request* request{};
+    std::span<const int32_t> tokens;  // Unprocessed tokens
+    int64_t sequence_length{};        // Current sequence length
+    bool is_prefill{};
+  };
+
+  Buffer input_ids;
+  Buffer attention_mask;
+  Buffer position_ids;
+  Buffer logits;
+  Buffer logits_fp32;
+
+  std::vector<RequestInputs> requests;
+  size_t max_num_tokens{};       // Longest span of unprocessed tokens in the batch
+  int64_t max_sequence_length{};  // Longest sequence in the batch
+
+  // State of the attention mask after the previous step, used to update it in place
+  std::vector<const Request*> attention_mask_requests;
+  std::vector<int64_t> attention_mask_lengths;
+  int64_t attention_mask_width{};
+};
+
 struct StaticBatchDecoderIO : DecoderIO {
   StaticBatchDecoderIO(std::shared_ptr<DecoderOnly_Model> model,
                        ScheduledRequests& scheduled_requests,
-                       std::shared_ptr<CacheManager> cache_manager);
+                       std::shared_ptr<CacheManager> cache_manager,
+                       StaticBatchIOArena& arena);
 
   std::vector<DeviceSpan<float>> ProcessLogits() override;
 
  private:
-  void PrepareInputIds(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests);
-  void PrepareAttentionMask(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests);
-  void PreparePositionIds(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests);
-  void PrepareLogits(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests);
+  void GatherRequestInputs(ScheduledRequests& scheduled_requests);
+  void PrepareInputIds(std::shared_ptr<DecoderOnly_Model> model);
+  void PrepareAttentionMask(std::shared_ptr<DecoderOnly_Model> model);
+  void PreparePositionIds(std::shared_ptr<DecoderOnly_Model> model);
+  void PrepareLogits(std::shared_ptr<DecoderOnly_Model> model);
 
-  std::vector<std::unique_ptr<Tensor>> owned_inputs_;
-  std::unique_ptr<Tensor> logits_;
-  std::unique_ptr<Tensor> logits_fp32_;
+  // Returns true if the attention mask of the previous step can be updated in place for this step
+  bool CanExtendAttentionMask() const;
+
+  StaticBatchIOArena& arena_;
 };
 
+/**
+ * @brief Packs the unprocessed tokens of all scheduled requests into a single sequence without padding.
+ *
+ * The boundaries between requests are described by cumulative_sequence_lengths, the tokens each
+ * request already has in the key-value cache by past_sequence_lengths, and the location of those
+ * tokens in the paged key-value cache by block_table.
+ */
 struct VarlenDecoderIO : DecoderIO {
   VarlenDecoderIO(std::shared_ptr<DecoderOnly_Model> model,
                   ScheduledRequests& scheduled_requests,
                   std::shared_ptr<CacheManager> cache_manager);
 
-  std::vector<DeviceSpan<float>> ProcessLogits() override { return {}; };
+  std::vector<DeviceSpan<float>> ProcessLogits() override;
 
  private:
+  void PrepareInputIds(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests);
+  void PreparePositionIds(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests);
+  void PrepareSequenceLengths(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests);
+  void PrepareBlockTable(std::shared_ptr<DecoderOnly_Model> model, ScheduledRequests& scheduled_requests);
+  void PrepareLogits(std::shared_ptr<DecoderOnly_Model> model);
+
+  void AddInput(const std::string& name, std::unique_ptr<Tensor> tensor);
+
+  bool packed_batch_dimension_{};             // True if the model expects the packed tokens as [1, total_tokens]
+  std::vector<int32_t> cumulative_lengths_;  // [batch_size + 1] offsets of every request in the packed tokens
+  std::vector<std::unique_ptr<Tensor>> owned_inputs_;
+  std::unique_ptr<Tensor> logits_fp32_;
 };
 
 struct SimpleDecoder : public Decoder {
@@ -45,6 +115,7 @@ struct SimpleDecoder : public Decoder {
  private:
   std::shared_ptr<DecoderOnly_Model> model_;
   std::shared_ptr<CacheManager> cache_manager_;
+  StaticBatchIOArena static_batch_arena_;
 };
 
 }  // namespace Generators
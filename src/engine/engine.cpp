@@ -11,16 +11,75 @@ Engine::Engine(std::shared_ptr<Model> model)
       scheduler_{std::make_unique<Scheduler>(model, cache_manager_)},
       model_executor_{std::make_unique<ModelExecutor>(model, cache_manager_)} {}
 
+Engine::~Engine() {
+  if (running_in_background_) {
+    try {
+      Stop();
+    } catch (const std::exception& e) {
+      if (g_log.enabled && g_log.warning)
+        Log("warning", std::string("The engine background thread stopped with an error: ") + e.what());
+    }
+  }
+}
+
 void Engine::AddRequest(std::shared_ptr<Request> request) {
+  // Without a callback, the application would read the tokens while the background thread writes them
+  if (running_in_background_ && !request->HasTokenCallback()) {
+    throw std::runtime_error("Requests added while the engine is running in the background need a token callback.");
+  }
+
   request->Assign(shared_from_this());
+
+  if (running_in_background_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (background_error_) {
+      std::rethrow_exception(background_error_);
+    }
+    submissions_.emplace_back(SubmissionType::Add, request);
+    submitted_.notify_one();
+    return;
+  }
+
   scheduler_->AddRequest(request);
 }
 
 void Engine::RemoveRequest(std::shared_ptr<Request> request) {
+  if (running_in_background_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    submissions_.emplace_back(SubmissionType::Remove, request);
+    submitted_.notify_one();
+    return;
+  }
+
   scheduler_->RemoveRequest(request);
+  request->status_ = RequestStatus::Unassigned;
+}
+
+std::vector<std::shared_ptr<Request>> Engine::RunStep() {
+  auto scheduled_requests = scheduler_->Schedule();
+  model_executor_->Decode(scheduled_requests);
+  scheduled_requests.GenerateNextTokens();
+
+  std::vector<std::shared_ptr<Request>> callback_requests;
+  for (auto& request : scheduled_requests) {
+    if (!request->HasUnseenTokens()) {
+      continue;
+    }
+
+    if (request->HasTokenCallback()) {
+      callback_requests.push_back(request);
+    } else if (!running_in_background_) {
+      ready_requests_.push(request);
+    }
+  }
+  return callback_requests;
 }
 
 std::shared_ptr<Request> Engine::Step() {
+  if (running_in_background_) {
+    throw std::runtime_error("Engine::Step cannot be called while the engine is running in the background.");
+  }
+
   if (!HasPendingRequests()) {
     return nullptr;
   }
@@ -31,19 +90,16 @@ std::shared_ptr<Request> Engine::Step() {
     return request;
   }
 
-  if (auto scheduled_requests = scheduler_->Schedule()) {
-    model_executor_->Decode(scheduled_requests);
-    scheduled_requests.GenerateNextTokens();
-
-    for (auto& request : scheduled_requests) {
-      if (request->HasUnseenTokens()) {
-        ready_requests_.push(request);
-      }
+  // Steps that only process chunks of prompts, or whose tokens are delivered through
+  // token callbacks, leave no request to return. Keep stepping until there is one.
+  while (ready_requests_.empty() && scheduler_->HasPendingRequests()) {
+    for (auto& request : RunStep()) {
+      request->InvokeTokenCallback();
     }
   }
 
   if (ready_requests_.empty()) {
-    throw std::runtime_error("Expected at least one request to be ready, but none were found.");
+    return nullptr;
   }
 
   auto request = ready_requests_.front();
@@ -51,8 +107,114 @@ std::shared_ptr<Request> Engine::Step() {
   return request;
 }
 
+void Engine::Start() {
+  if (running_in_background_) {
+    throw std::runtime_error("The engine is already running in the background.");
+  }
+  if (!ready_requests_.empty() || !scheduler_->PendingRequestsHaveTokenCallbacks()) {
+    throw std::runtime_error("The engine can only run in the background when every pending request has a token callback.");
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_requested_ = false;
+    background_error_ = nullptr;
+    has_scheduled_requests_ = scheduler_->HasPendingRequests();
+  }
+
+  running_in_background_ = true;
+  background_thread_ = std::thread(&Engine::Run, this);
+}
+
+void Engine::Stop() {
+  if (!running_in_background_) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_requested_ = true;
+    submitted_.notify_one();
+  }
+  background_thread_.join();
+  running_in_background_ = false;
+
+  // Requests submitted after the last background step are handed to the scheduler
+  // so that they can be processed by calling Step() or Start() again.
+  ApplySubmissions(submissions_);
+
+  if (auto error = std::exchange(background_error_, nullptr)) {
+    std::rethrow_exception(error);
+  }
+}
+
+void Engine::Run() {
+  try {
+    std::vector<std::pair<SubmissionType, std::shared_ptr<Request>>> submissions;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        submitted_.wait(lock, [this] { return stop_requested_ || !submissions_.empty() || has_scheduled_requests_; });
+        if (stop_requested_) {
+          return;
+        }
+        submissions.swap(submissions_);
+        // Keep reporting pending requests until the scheduler has taken over the submitted ones
+        has_scheduled_requests_ = has_scheduled_requests_ || !submissions.empty();
+      }
+
+      std::vector<std::shared_ptr<Request>> callback_requests;
+      const bool has_scheduled_requests = [&] {
+        std::lock_guard<std::mutex> lock(step_mutex_);
+        ApplySubmissions(submissions);
+        if (scheduler_->HasPendingRequests()) {
+          callback_requests = RunStep();
+        }
+        return scheduler_->HasPendingRequests();
+      }();
+
+      // Only this thread steps the requests, so their tokens can be delivered without holding step_mutex_.
+      // This lets the callbacks query the engine, for example through GetStatistic.
+      for (auto& request : callback_requests) {
+        request->InvokeTokenCallback();
+      }
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      has_scheduled_requests_ = has_scheduled_requests;
+    }
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    background_error_ = std::current_exception();
+    has_scheduled_requests_ = false;
+  }
+}
+
+void Engine::ApplySubmissions(std::vector<std::pair<SubmissionType, std::shared_ptr<Request>>>& submissions) {
+  for (auto& [type, request] : submissions) {
+    if (type == SubmissionType::Add) {
+      scheduler_->AddRequest(request);
+    } else {
+      scheduler_->RemoveRequest(request);
+      request->status_ = RequestStatus::Unassigned;
+    }
+  }
+  submissions.clear();
+}
+
 bool Engine::HasPendingRequests() const {
+  if (running_in_background_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !submissions_.empty() || has_scheduled_requests_;
+  }
   return !ready_requests_.empty() || scheduler_->HasPendingRequests();
 }
 
+double Engine::GetStatistic(std::string_view name) const {
+  std::lock_guard<std::mutex> lock(step_mutex_);
+  if (auto value = cache_manager_->GetStatistic(name)) {
+    return *value;
+  }
+  throw std::runtime_error("Unknown engine statistic: " + std::string(name));
+}
+
 }  // namespace Generators
@@ -3,6 +3,12 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+
 #include "request.h"
 #include "model_executor.h"
 #include "scheduler.h"
@@ -24,6 +30,11 @@ namespace Generators {
  * The Engine class is designed to handle multiple requests concurrently, allowing
  * for efficient execution of models by dynamically batching requests.
  * It is the entry point for adding and processing requests.
+ *
+ * The Engine can either be driven by the application calling Step(), or run its
+ * own step loop on a background thread after calling Start(). In the background
+ * mode, requests can be added and removed from any thread and new tokens are
+ * delivered through the token callback of each request.
  */
 struct Engine : std::enable_shared_from_this<Engine>,
                 LeakChecked<Engine>,
@@ -35,15 +46,26 @@ struct Engine : std::enable_shared_from_this<Engine>,
    */
   Engine(std::shared_ptr<Model> model);
 
+  /**
+   * @brief Stops the background thread if the Engine is running in the background.
+   */
+  ~Engine();
+
   /**
    * @brief Adds a request to the Engine for processing.
    * @param request A shared pointer to the Request object to be added.
+   *
+   * When the Engine runs in the background, this function can be called from any thread.
+   * The request is handed to the background thread and picked up before its next step.
+   * @throws std::runtime_error if the Engine runs in the background and the request has no token callback.
    */
   void AddRequest(std::shared_ptr<Request> request);
 
   /**
    * @brief Removes a previously added request from the Engine.
    * @param request A shared pointer to the Request object to be removed.
+   *
+   * When the Engine runs in the background, this function can be called from any thread.
    */
   void RemoveRequest(std::shared_ptr<Request> request);
 
@@ -55,22 +77,76 @@ struct Engine : std::enable_shared_from_this<Engine>,
    * that are ready to be processed (as determined by the scheduling strategy).
    * Once these requests are scheduled, the Engine offloads the execution to the
    * model executor and updates the requests' states with the newly generated
-   * tokens.
+   * tokens. Requests with a token callback receive their tokens through the
+   * callback and are not returned by this function.
+   *
+   * Must not be called while the Engine runs in the background.
    */
   std::shared_ptr<Request> Step();
 
+  /**
+   * @brief Starts running the step loop on a background thread.
+   *
+   * The background thread sleeps while there are no pending requests.
+   * @throws std::runtime_error if a pending request has no token callback.
+   */
+  void Start();
+
+  /**
+   * @brief Stops the background thread once its current step has finished.
+   *
+   * Requests that are still pending remain in the Engine and can be processed by calling
+   * Step() or Start() again. Rethrows the error that stopped the background thread, if any.
+   */
+  void Stop();
+
   /**
    * @brief Checks if there are any pending requests in the Engine.
    * @return True if there are pending requests; otherwise, false.
    */
   bool HasPendingRequests() const;
 
+  /**
+   * @brief Gets the value of a statistic tracked by the Engine, such as the prefix cache hit rate.
+   * @param name The name of the statistic.
+   * @return The value of the statistic.
+   * @throws std::runtime_error if the statistic is unknown.
+   */
+  double GetStatistic(std::string_view name) const;
+
  private:
+  enum class SubmissionType {
+    Add,
+    Remove,
+  };
+
+  // Schedules and runs a single step. Requests without a token callback are queued in ready_requests_,
+  // and the ones with a token callback are returned for the caller to invoke it.
+  std::vector<std::shared_ptr<Request>> RunStep();
+
+  // The step loop of the background thread.
+  void Run();
+
+  // Applies the requests submitted to the background thread since its previous step.
+  void ApplySubmissions(std::vector<std::pair<SubmissionType, std::shared_ptr<Request>>>& submissions);
+
   std::shared_ptr<Model> model_;                         // The model used by the Engine.
   std::shared_ptr<CacheManager> cache_manager_;          // The cache manager for handling cached data.
   std::unique_ptr<Scheduler> scheduler_;                 // The scheduler responsible for managing execution order.
   std::unique_ptr<ModelExecutor> model_executor_;        // The executor responsible for running the model.
   std::queue<std::shared_ptr<Request>> ready_requests_;  // The list of requests that are ready for the application to process.
+
+  // State shared with the background thread, guarded by mutex_.
+  mutable std::mutex mutex_;
+  std::condition_variable submitted_;
+  std::vector<std::pair<SubmissionType, std::shared_ptr<Request>>> submissions_;  // Multi-producer queue drained by the background thread.
+  bool stop_requested_{};
+  bool has_scheduled_requests_{};  // Whether the scheduler had pending requests after the last background step.
+  std::exception_ptr background_error_;
+
+  mutable std::mutex step_mutex_;  // Held by the background thread while it runs a step.
+  std::thread background_thread_;
+  std::atomic<bool> running_in_background_{};
 };
 
 }  // namespace Generators
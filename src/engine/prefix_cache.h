@@ -0,0 +1,208 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include "../span.h"
+#include "block_pool.h"
+
+/**
+ * @file prefix_cache.h
+ * @brief Defines the PrefixCache class, which shares the key-value cache blocks of
+ *        common prompt prefixes between requests.
+ */
+
+namespace Generators {
+
+/**
+ * @class PrefixCache
+ * @brief A radix tree over token ids whose nodes point at reference counted key-value cache blocks.
+ *
+ * Every edge of the tree is labeled with the tokens of one full block, so the path from the root
+ * to a node spells out the prefix whose keys and values are stored in that node's block. Only full
+ * blocks are ever cached, which keeps cached blocks immutable: a request that reuses a prefix only
+ * writes to blocks past the end of the prefix.
+ *
+ * The tree holds one reference on every cached block. Blocks that are not used by any request
+ * anymore are kept around until the pool runs low, at which point the least recently used leaves
+ * are evicted first.
+ */
+struct PrefixCache {
+  struct Stats {
+    size_t lookups{};         // Number of requests that looked up their prompt in the cache
+    size_t hits{};            // Number of requests that reused at least one cached block
+    size_t queried_tokens{};  // Number of prompt tokens that were looked up
+    size_t hit_tokens{};      // Number of prompt tokens whose key-value cache was reused
+
+    double HitRate() const { return queried_tokens ? static_cast<double>(hit_tokens) / queried_tokens : 0.0; }
+  };
+
+  explicit PrefixCache(BlockPool& block_pool) : block_pool_{block_pool} {}
+
+  PrefixCache(const PrefixCache&) = delete;
+  PrefixCache& operator=(const PrefixCache&) = delete;
+
+  /**
+   * @brief Finds the longest cached prefix of the given tokens made up of full blocks.
+   * @param tokens The tokens to look up.
+   * @param block_table The ids of the matching blocks are appended to this block table. A reference
+   *                    is added to each of them on behalf of the caller.
+   * @return The number of tokens covered by the matching blocks.
+   */
+  size_t Match(std::span<const int32_t> tokens, std::vector<int32_t>& block_table) {
+    const size_t block_size = block_pool_.BlockSize();
+    const uint64_t tick = ++clock_;
+
+    Node* node = &root_;
+    size_t num_matched_tokens = 0;
+    while (num_matched_tokens + block_size <= tokens.size()) {
+      auto child = node->children.find(BlockKey(tokens.subspan(num_matched_tokens, block_size)));
+      if (child == node->children.end()) {
+        break;
+      }
+      node = child->second.get();
+      node->last_access = tick;
+      block_pool_.AddRef(node->block);
+      block_table.push_back(node->block);
+      num_matched_tokens += block_size;
+    }
+
+    ++stats_.lookups;
+    stats_.hits += num_matched_tokens ? 1 : 0;
+    stats_.queried_tokens += tokens.size();
+    stats_.hit_tokens += num_matched_tokens;
+
+    return num_matched_tokens;
+  }
+
+  /**
+   * @brief Adds the full blocks of the given tokens to the cache.
+   * @param tokens The tokens whose keys and values have been written to the blocks.
+   * @param block_table The blocks holding the tokens, in order.
+   *
+   * Blocks whose prefix is already cached are left alone, the cache keeps its existing block.
+   */
+  void Insert(std::span<const int32_t> tokens, std::span<const int32_t> block_table) {
+    const size_t block_size = block_pool_.BlockSize();
+    const size_t num_full_blocks = std::min(tokens.size() / block_size, block_table.size());
+    const uint64_t tick = ++clock_;
+
+    Node* node = &root_;
+    for (size_t i = 0; i < num_full_blocks; ++i) {
+      auto& child = node->children[BlockKey(tokens.subspan(i * block_size, block_size))];
+      if (!child) {
+        child = std::make_unique<Node>();
+        child->parent = node;
+        child->block = block_table[i];
+        block_pool_.AddRef(child->block);
+        ++num_cached_blocks_;
+      }
+      node = child.get();
+      node->last_access = tick;
+    }
+  }
+
+  /**
+   * @brief Returns the number of cached blocks that are not used by any request.
+   */
+  size_t NumEvictableBlocks() const {
+    size_t num_evictable_blocks = 0;
+    for (const auto& [key, child] : root_.children) {
+      CountEvictableBlocks(*child, num_evictable_blocks);
+    }
+    return num_evictable_blocks;
+  }
+
+  /**
+   * @brief Evicts up to num_blocks least recently used blocks that are not used by any request.
+   * @return The number of blocks returned to the pool.
+   */
+  size_t Evict(size_t num_blocks) {
+    // Only leaves can be evicted since their descendants depend on them. Evicting a leaf
+    // may turn its parent into a leaf, which then becomes a candidate as well.
+    auto older = [](const Node* a, const Node* b) { return a->last_access > b->last_access; };
+    std::priority_queue<Node*, std::vector<Node*>, decltype(older)> candidates{older};
+    Visit(root_, [&](const Node& node) {
+      if (IsEvictableLeaf(node)) {
+        candidates.push(const_cast<Node*>(&node));
+      }
+    });
+
+    size_t num_evicted_blocks = 0;
+    while (num_evicted_blocks < num_blocks && !candidates.empty()) {
+      Node* node = candidates.top();
+      candidates.pop();
+
+      Node* parent = node->parent;
+      const int32_t block = node->block;
+      for (auto it = parent->children.begin(); it != parent->children.end(); ++it) {
+        if (it->second.get() == node) {
+          parent->children.erase(it);
+          break;
+        }
+      }
+      block_pool_.Free(std::span<const int32_t>(&block, 1));
+      --num_cached_blocks_;
+      ++num_evicted_blocks;
+
+      if (parent != &root_ && IsEvictableLeaf(*parent)) {
+        candidates.push(parent);
+      }
+    }
+
+    return num_evicted_blocks;
+  }
+
+  size_t NumCachedBlocks() const { return num_cached_blocks_; }
+
+  const Stats& GetStats() const { return stats_; }
+
+ private:
+  struct Node {
+    Node* parent{};
+    int32_t block{-1};
+    uint64_t last_access{};
+    std::map<std::vector<int32_t>, std::unique_ptr<Node>> children;
+  };
+
+  static std::vector<int32_t> BlockKey(std::span<const int32_t> tokens) {
+    return {tokens.begin(), tokens.end()};
+  }
+
+  bool IsEvictableLeaf(const Node& node) const {
+    return node.children.empty() && block_pool_.RefCount(node.block) == 1;
+  }
+
+  // Counts the evictable blocks of the subtree and returns true if the whole subtree can be evicted
+  bool CountEvictableBlocks(const Node& node, size_t& num_evictable_blocks) const {
+    bool evictable = block_pool_.RefCount(node.block) == 1;
+    for (const auto& [key, child] : node.children) {
+      evictable = CountEvictableBlocks(*child, num_evictable_blocks) && evictable;
+    }
+    num_evictable_blocks += evictable ? 1 : 0;
+    return evictable;
+  }
+
+  template <typename Fn>
+  static void Visit(const Node& node, Fn&& fn) {
+    for (const auto& [key, child] : node.children) {
+      fn(*child);
+      Visit(*child, fn);
+    }
+  }
+
+  BlockPool& block_pool_;
+  Node root_;
+  size_t num_cached_blocks_{};
+  uint64_t clock_{};
+  Stats stats_;
+};
+
+}  // namespace Generators
@@ -31,6 +31,12 @@ void Request::Assign(std::shared_ptr<Engine> engine) {
   engine_ = engine;
   status_ = RequestStatus::Assigned;
 
+  static std::atomic<uint64_t> next_arrival_index{};
+  arrival_index_ = next_arrival_index++;
+  if (latency_) {
+    deadline_ = std::chrono::steady_clock::now() + *latency_;
+  }
+
   auto device_tokens = AllocateOnDevice(*params_, prefill_input_ids_);
   processed_sequence_length_ = CurrentSequenceLength();
   search_->AppendTokens(device_tokens);
@@ -53,9 +59,12 @@ void Request::Schedule() {
 void Request::Remove() {
   auto engine = engine_.lock();
   if (engine) {
+    // The engine resets the status once the request has been removed, which happens
+    // asynchronously if the engine is running in the background.
     engine->RemoveRequest(shared_from_this());
+  } else {
+    status_ = RequestStatus::Unassigned;
   }
-  status_ = RequestStatus::Unassigned;
 }
 
 void Request::AddTokens(std::span<const int32_t> tokens) {
@@ -96,10 +105,57 @@ bool Request::HasUnseenTokens() const {
 
 DeviceSpan<int32_t> Request::UnprocessedTokens() {
   auto sequence = search_->GetSequence(0);
-  auto unprocessed_tokens = sequence.subspan(processed_sequence_length_, CurrentSequenceLength() - processed_sequence_length_);
+  size_t num_tokens = NumUnprocessedTokens();
+  if (scheduled_token_count_) {
+    num_tokens = std::min(num_tokens, scheduled_token_count_);
+  }
+  auto unprocessed_tokens = sequence.subspan(processed_sequence_length_, num_tokens);
   return unprocessed_tokens;
 }
 
+DeviceSpan<int32_t> Request::Sequence() {
+  return search_->GetSequence(0);
+}
+
+void Request::SetCachedPrefixLength(size_t num_tokens) {
+  if (status_ != RequestStatus::Assigned) {
+    throw std::runtime_error("The cached prefix can only be set before the request is scheduled.");
+  }
+  if (num_tokens >= static_cast<size_t>(CurrentSequenceLength())) {
+    throw std::runtime_error("The cached prefix must leave at least one token of the prompt to be processed.");
+  }
+  processed_sequence_length_ = static_cast<int64_t>(num_tokens);
+}
+
+void Request::Preempt(bool discard_cache) {
+  if (status_ != RequestStatus::InProgress) {
+    throw std::runtime_error("Only requests that are in progress can be preempted.");
+  }
+
+  status_ = RequestStatus::Assigned;
+  scheduled_token_count_ = 0;
+  if (discard_cache) {
+    processed_sequence_length_ = 0;
+    is_prefill_ = true;
+  }
+}
+
+void Request::SetScheduledTokenCount(size_t num_tokens) {
+  scheduled_token_count_ = num_tokens;
+}
+
+size_t Request::NumUnprocessedTokens() const {
+  return static_cast<size_t>(CurrentSequenceLength() - processed_sequence_length_);
+}
+
+int64_t Request::ProcessedSequenceLength() const {
+  return processed_sequence_length_;
+}
+
+const TokenLogprobs& Request::LastTokenLogprobs() const {
+  return search_->GetLogprobs();
+}
+
 bool Request::IsDone() const {
   return status_ == RequestStatus::Completed;
 }
@@ -109,13 +165,17 @@ bool Request::IsPrefill() const {
 }
 
 void Request::GenerateNextTokens(DeviceSpan<float> logits) {
-  processed_sequence_length_ = search_->GetSequence(0).size();
+  processed_sequence_length_ += UnprocessedTokens().size();
+  scheduled_token_count_ = 0;
+  if (processed_sequence_length_ < CurrentSequenceLength()) {
+    // Only a chunk of the prompt was processed in this step
+    return;
+  }
   is_prefill_ = false;
 
   search_->SetLogits(logits);
   auto& search_params = search_->params_->search;
-  search_->ApplyMinLength(search_params.min_length);
-  search_->ApplyRepetitionPenalty(search_params.repetition_penalty);
+  search_->ProcessLogits();
 
   if (!search_params.do_sample || search_params.top_k == 1 || search_params.temperature == 0) {
     search_->SelectTop();
@@ -149,6 +209,47 @@ std::shared_ptr<GeneratorParams> Request::Params() {
   return params_;
 }
 
+void Request::SetTokenCallback(TokenCallback callback) {
+  if (status_ != RequestStatus::Unassigned) {
+    throw std::runtime_error("The token callback must be set before the request is added to the engine.");
+  }
+  token_callback_ = std::move(callback);
+}
+
+bool Request::HasTokenCallback() const {
+  return static_cast<bool>(token_callback_);
+}
+
+void Request::InvokeTokenCallback() {
+  auto sequence = search_->GetSequence(0).CopyDeviceToCpu();
+  auto tokens = sequence.subspan(seen_sequence_length_, sequence.size() - seen_sequence_length_);
+  seen_sequence_length_ = static_cast<int64_t>(sequence.size());
+  token_callback_(tokens, IsDone());
+}
+
+void Request::SetPriority(int32_t priority) {
+  priority_ = priority;
+}
+
+int32_t Request::Priority() const {
+  return priority_;
+}
+
+void Request::SetDeadline(std::chrono::milliseconds latency) {
+  if (status_ != RequestStatus::Unassigned) {
+    throw std::runtime_error("The deadline must be set before the request is added to the engine.");
+  }
+  latency_ = latency;
+}
+
+std::chrono::steady_clock::time_point Request::Deadline() const {
+  return deadline_;
+}
+
+uint64_t Request::ArrivalIndex() const {
+  return arrival_index_;
+}
+
 void Request::SetOpaqueData(void* data) {
   opaque_data_ = data;
 }
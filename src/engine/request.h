@@ -3,6 +3,10 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+
 #include "../generators.h"
 
 /**
@@ -13,6 +17,8 @@
 
 namespace Generators {
 
+struct TokenLogprobs;
+
 enum class RequestStatus {
   Unassigned,  // A request has been created but has not been added to the engine yet.
                // This is the state of a request when it is first created.
@@ -83,6 +89,47 @@ struct Request : std::enable_shared_from_this<Request>,
    */
   DeviceSpan<int32_t> UnprocessedTokens();
 
+  /**
+   * @brief Returns all the tokens of the request, both the prompt and the generated tokens.
+   */
+  DeviceSpan<int32_t> Sequence();
+
+  /**
+   * @brief Marks the first tokens of the prompt as processed since their key-value cache is reused.
+   * @param num_tokens The number of prompt tokens found in the prefix cache.
+   *
+   * Must be called before the request is scheduled.
+   */
+  void SetCachedPrefixLength(size_t num_tokens);
+
+  /**
+   * @brief Moves the request from InProgress back to Assigned so that it is scheduled again later.
+   * @param discard_cache True if the key-value cache of the request was dropped, in which case
+   *                      all of its tokens are processed again once it is resumed.
+   */
+  void Preempt(bool discard_cache);
+
+  /**
+   * @brief Limits the number of unprocessed tokens handed to the model in the next step.
+   * @param num_tokens The maximum number of tokens to process. 0 processes all unprocessed tokens.
+   *
+   * This is used by the scheduler to split long prompts into chunks that are processed
+   * over several steps. The limit is reset once the step has been processed.
+   */
+  void SetScheduledTokenCount(size_t num_tokens);
+
+  /**
+   * @brief Gets the total number of tokens that have not been processed by the model yet.
+   * @return The number of unprocessed tokens, regardless of the scheduled token count.
+   */
+  size_t NumUnprocessedTokens() const;
+
+  /**
+   * @brief Gets the number of tokens that have already been processed by the model.
+   * @return The processed sequence length, which is the length of the sequence in the key-value cache.
+   */
+  int64_t ProcessedSequenceLength() const;
+
   /**
    * @brief Checks if there are any unseen tokens in the request.
    * @return True if there are unseen tokens, false otherwise.
@@ -92,9 +139,21 @@ struct Request : std::enable_shared_from_this<Request>,
   /**
    * @brief Generates the next set of tokens based on the provided logits.
    * @param logits DeviceSpan containing logits for token generation.
+   *
+   * If the step only processed a chunk of the prompt, the logits are discarded and
+   * no token is generated until the final chunk has been processed.
    */
   void GenerateNextTokens(DeviceSpan<float> logits);
 
+  /**
+   * @brief Gets the log probabilities of the last token generated for the request.
+   * @return The logprobs computed by the search when the logprobs or top_logprobs search options are set.
+   *
+   * They are overwritten by the next step that generates a token for the request, so applications read them
+   * from the token callback, or before the engine is stepped again.
+   */
+  const TokenLogprobs& LastTokenLogprobs() const;
+
   /**
    * @brief Checks if the termination condition for the request has been met.
    * @return True if the request is done, false otherwise.
@@ -118,7 +177,35 @@ struct Request : std::enable_shared_from_this<Request>,
    */
   int64_t CurrentSequenceLength() const;
 
-  RequestStatus status_{RequestStatus::Unassigned};
+  // Atomic since the application may query the status while the engine runs in the background.
+  std::atomic<RequestStatus> status_{RequestStatus::Unassigned};
+
+  /**
+   * @brief Callback invoked with the newly generated tokens of the request.
+   * @param tokens The tokens generated since the previous invocation.
+   * @param is_done True if the request has completed.
+   */
+  using TokenCallback = std::function<void(std::span<const int32_t> tokens, bool is_done)>;
+
+  /**
+   * @brief Sets a callback that receives the newly generated tokens after every engine step.
+   * @param callback The callback, or an empty function to stop receiving tokens through a callback.
+   *
+   * Tokens delivered through the callback are marked as seen. The callback is invoked
+   * on the thread running the engine step, which is the engine's background thread if the
+   * engine was started with Engine::Start(). Must be set before the request is added to the engine.
+   */
+  void SetTokenCallback(TokenCallback callback);
+
+  /**
+   * @brief Checks if a token callback has been set on the request.
+   */
+  bool HasTokenCallback() const;
+
+  /**
+   * @brief Delivers the unseen tokens of the request to the token callback.
+   */
+  void InvokeTokenCallback();
 
   /**
    * @brief Retrieves the generator parameters associated with this request.
@@ -126,6 +213,34 @@ struct Request : std::enable_shared_from_this<Request>,
    */
   std::shared_ptr<GeneratorParams> Params();
 
+  /**
+   * @brief Sets the priority of the request, used by the "priority" scheduling policy.
+   * @param priority Requests with a higher priority are served first. The default priority is 0.
+   */
+  void SetPriority(int32_t priority);
+
+  int32_t Priority() const;
+
+  /**
+   * @brief Sets the deadline of the request, used by the "deadline" scheduling policy.
+   * @param latency The time after being added to the engine within which the request should complete.
+   *
+   * Must be set before the request is added to the engine.
+   */
+  void SetDeadline(std::chrono::milliseconds latency);
+
+  /**
+   * @brief Gets the point in time by which the request should complete.
+   * @return The deadline, or the maximum time point if the request does not have a deadline.
+   */
+  std::chrono::steady_clock::time_point Deadline() const;
+
+  /**
+   * @brief Gets the order in which the request was added to an engine.
+   * @return A number that increases with every request added to an engine.
+   */
+  uint64_t ArrivalIndex() const;
+
   /**
    * @brief Sets the opaque data for user-defined purposes.
    * @param data Pointer to the opaque data.
@@ -150,11 +265,19 @@ struct Request : std::enable_shared_from_this<Request>,
   std::vector<int32_t> prefill_input_ids_;
   int64_t seen_sequence_length_{};
   int64_t processed_sequence_length_{};
+  size_t scheduled_token_count_{};
   std::shared_ptr<GeneratorParams> params_;
   std::unique_ptr<Search> search_;
   std::weak_ptr<Engine> engine_;
   bool is_prefill_{true};
 
+  TokenCallback token_callback_;
+
+  int32_t priority_{};
+  std::optional<std::chrono::milliseconds> latency_;
+  std::chrono::steady_clock::time_point deadline_{std::chrono::steady_clock::time_point::max()};
+  uint64_t arrival_index_{};
+
   void* opaque_data_{nullptr};  // Opaque data for user-defined purposes, can be set and retrieved by the application
 };
 
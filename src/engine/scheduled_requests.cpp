@@ -5,6 +5,7 @@
 
 #include "engine.h"
 #include "../search.h"
+#include "../thread_pool.h"
 
 namespace Generators {
 
@@ -38,10 +39,19 @@ void ScheduledRequests::GenerateNextTokens() {
     throw std::runtime_error("Logits size does not match the number of requests.");
   }
 
-  for (size_t request_idx = 0; request_idx < requests_.size(); ++request_idx) {
+  auto generate = [&](size_t request_idx) {
     if (requests_[request_idx]->status_ != RequestStatus::Completed) {
       requests_[request_idx]->GenerateNextTokens(logits[request_idx]);
     }
+  };
+
+  // Every request has its own search and random stream, so the requests can sample on any thread. The searches
+  // of other devices share a device stream and stay on this thread.
+  if (requests_.size() > 1 && model_->p_device_->GetType() == DeviceType::CPU) {
+    GetSamplingThreadPool().ParallelFor(requests_.size(), generate);
+  } else {
+    for (size_t request_idx = 0; request_idx < requests_.size(); ++request_idx)
+      generate(request_idx);
   }
 }
 
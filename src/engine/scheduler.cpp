@@ -6,13 +6,35 @@
 namespace Generators {
 
 Scheduler::Scheduler(std::shared_ptr<Model> model, std::shared_ptr<CacheManager> cache_manager)
-    : model_{model}, cache_manager_{cache_manager} {}
+    : model_{model},
+      cache_manager_{cache_manager},
+      policy_{CreateSchedulingPolicy(model->config_->engine.dynamic_batching.scheduling_policy)} {
+  const auto& options = model_->config_->engine.dynamic_batching;
+  if (options.max_batch_size <= 0 || options.max_num_tokens <= 0) {
+    throw std::runtime_error("engine.dynamic_batching.max_batch_size and engine.dynamic_batching.max_num_tokens must be greater than 0.");
+  }
+  // Every in progress request must be able to decode its next token in each step
+  if (cache_manager_->SupportsDynamicBatching() && options.max_num_tokens < options.max_batch_size) {
+    throw std::runtime_error("engine.dynamic_batching.max_num_tokens (" + std::to_string(options.max_num_tokens) +
+                             ") must not be smaller than engine.dynamic_batching.max_batch_size (" +
+                             std::to_string(options.max_batch_size) + ").");
+  }
+}
 
 void Scheduler::AddRequest(std::shared_ptr<Request> request) {
   requests_pool_.push_back(request);
 }
 
 void Scheduler::RemoveRequest(std::shared_ptr<Request> request) {
+  if (cache_manager_->SupportsDynamicBatching()) {
+    // Dynamically batched requests own their cache blocks individually, so they
+    // can be released right away.
+    std::vector<std::shared_ptr<Request>> requests{request};
+    cache_manager_->Deallocate(requests);
+    requests_pool_.erase(std::remove(requests_pool_.begin(), requests_pool_.end(), request), requests_pool_.end());
+    return;
+  }
+
   // For statically batched requests, memory is managed as a single block for the entire batch,
   // so individual requests cannot be deallocated until the whole batch is completed.
   // Therefore, deallocation is only performed for dynamically batched requests below.
@@ -22,12 +44,137 @@ void Scheduler::RemoveRequest(std::shared_ptr<Request> request) {
 }
 
 ScheduledRequests Scheduler::Schedule() {
+  if (cache_manager_->SupportsDynamicBatching()) {
+    return ScheduleDynamicBatch();
+  }
+  return ScheduleStaticBatch();
+}
+
+ScheduledRequests Scheduler::ScheduleDynamicBatch() {
+  // Release the cache held by requests that completed in the previous step so that
+  // the freed blocks can be handed to the waiting requests right away.
+  std::vector<std::shared_ptr<Request>> completed_requests;
+  for (auto& request : cache_manager_->AllocatedRequests()) {
+    if (request->status_ == RequestStatus::Completed) {
+      completed_requests.push_back(request);
+    }
+  }
+  cache_manager_->Deallocate(completed_requests);
+  for (auto& request : completed_requests) {
+    requests_pool_.erase(std::remove(requests_pool_.begin(), requests_pool_.end(), request), requests_pool_.end());
+  }
+
+  // Every step processes at most max_num_tokens tokens. Requests that are already decoding
+  // are served first since they only need a single token each, followed by the prompts of
+  // requests that are part way through a chunked prefill. The rest of the budget is spent
+  // on the prompts of waiting requests.
+  const auto& options = model_->config_->engine.dynamic_batching;
+  const bool chunked_prefill = options.prefill_chunk_size > 0;
+  size_t token_budget = static_cast<size_t>(options.max_num_tokens);
+
+  std::vector<std::shared_ptr<Request>> requests_to_run;
+  std::vector<size_t> charged_tokens;  // The budget charged for each of requests_to_run
+
+  // Returns the number of tokens of the request that this step can process, or 0 if it does not fit in the budget
+  auto tokens_within_budget = [&](const std::shared_ptr<Request>& request) -> size_t {
+    const size_t num_tokens = request->NumUnprocessedTokens();
+    if (chunked_prefill) {
+      // Long prompts are split into chunks that fill whatever is left of the budget
+      return std::min({num_tokens, static_cast<size_t>(options.prefill_chunk_size), token_budget});
+    }
+    // A prompt that is larger than the whole budget can only be processed in a step of its own
+    return num_tokens > token_budget && !requests_to_run.empty() ? 0 : num_tokens;
+  };
+
+  auto try_consume_budget = [&](const std::shared_ptr<Request>& request) {
+    const size_t num_tokens = tokens_within_budget(request);
+    if (num_tokens == 0) {
+      return false;
+    }
+    charged_tokens.push_back(std::min(num_tokens, token_budget));
+    token_budget -= charged_tokens.back();
+    request->SetScheduledTokenCount(num_tokens);
+    requests_to_run.push_back(request);
+    return true;
+  };
+
+  auto running_requests = cache_manager_->AllocatedRequests();
+  policy_->Sort(running_requests);
+
+  // Preempts the running request that comes last in the order of the scheduling policy.
+  // The request goes back to waiting and is resumed once there is room for it again.
+  auto preempt_last_running_request = [&]() {
+    auto victim = running_requests.back();
+    running_requests.pop_back();
+    if (auto it = std::find(requests_to_run.begin(), requests_to_run.end(), victim); it != requests_to_run.end()) {
+      auto charged = charged_tokens.begin() + (it - requests_to_run.begin());
+      token_budget += *charged;
+      charged_tokens.erase(charged);
+      requests_to_run.erase(it);
+    }
+    cache_manager_->Preempt(victim);
+  };
+
+  // The cache must be able to hold the tokens of every running request after this step.
+  while (!running_requests.empty() && !cache_manager_->CanAllocate({})) {
+    preempt_last_running_request();
+  }
+
+  for (bool prefill : {false, true}) {
+    for (auto& request : running_requests) {
+      if (request->status_ == RequestStatus::InProgress && request->IsPrefill() == prefill) {
+        try_consume_budget(request);
+      }
+    }
+  }
+
+  // Admit waiting requests in the order of the scheduling policy for as long as the budget
+  // and the cache can hold them.
+  std::vector<std::shared_ptr<Request>> waiting_requests;
+  std::copy_if(requests_pool_.begin(), requests_pool_.end(), std::back_inserter(waiting_requests),
+               [](const std::shared_ptr<Request>& request) { return request->status_ == RequestStatus::Assigned; });
+  policy_->Sort(waiting_requests);
+  for (auto& request : waiting_requests) {
+    if (token_budget == 0) {
+      break;
+    }
+    // Make room for a waiting request that the scheduling policy serves before running requests, but only
+    // if it fits in the budget. Its cached prefix can only lower its tokens once it is allocated.
+    const bool fits_budget = tokens_within_budget(request) != 0;
+    while (fits_budget && !cache_manager_->CanAllocate({request}) && !running_requests.empty() &&
+           policy_->Precedes(*request, *running_requests.back())) {
+      preempt_last_running_request();
+    }
+    if (!cache_manager_->CanAllocate({request})) {
+      break;
+    }
+    // Allocate before charging the budget since a cached prefix reduces the tokens to process
+    std::vector<std::shared_ptr<Request>> requests{request};
+    cache_manager_->Allocate(requests);
+    if (!try_consume_budget(request)) {
+      cache_manager_->Deallocate(requests);
+      break;
+    }
+    request->Schedule();
+  }
+
+  ScheduledRequests scheduled_requests(requests_to_run, model_);
+
+  if (!scheduled_requests) {
+    throw std::runtime_error("Unable to schedule requests: not enough key-value cache blocks available for any pending request.");
+  }
+
+  return scheduled_requests;
+}
+
+ScheduledRequests Scheduler::ScheduleStaticBatch() {
   std::vector<std::shared_ptr<Request>> requests_to_schedule;
   for (auto& request : requests_pool_) {
     if (request->status_ == RequestStatus::Assigned) {
       requests_to_schedule.push_back(request);
     }
   }
+  policy_->Sort(requests_to_schedule);
 
   constexpr size_t static_batch_size = 4;
   for (size_t batch_size = std::min(static_batch_size, requests_to_schedule.size());
@@ -72,4 +219,13 @@ bool Scheduler::HasPendingRequests() const {
   return false;
 }
 
+bool Scheduler::PendingRequestsHaveTokenCallbacks() const {
+  for (auto& request : requests_pool_) {
+    if (request->status_ != RequestStatus::Completed && !request->HasTokenCallback()) {
+      return false;
+    }
+  }
+  return true;
+}
+
 }  // namespace Generators
@@ -6,6 +6,7 @@
 #include "request.h"
 #include "scheduled_requests.h"
 #include "cache_manager.h"
+#include "scheduling_policy.h"
 
 /**
  * @file scheduler.h
@@ -58,9 +59,23 @@ struct Scheduler {
    */
   bool HasPendingRequests() const;
 
+  /**
+   * @brief Checks if every pending request delivers its tokens through a token callback.
+   * @return True if no pending request is without a token callback, false otherwise.
+   */
+  bool PendingRequestsHaveTokenCallbacks() const;
+
  private:
+  // Admits new requests and releases completed ones at every step. Used when the cache manager
+  // supports dynamic batching.
+  ScheduledRequests ScheduleDynamicBatch();
+
+  // Schedules a new batch only once every request of the previous batch has completed.
+  ScheduledRequests ScheduleStaticBatch();
+
   std::shared_ptr<Model> model_;
   std::shared_ptr<CacheManager> cache_manager_;
+  std::unique_ptr<SchedulingPolicy> policy_;
   std::vector<std::shared_ptr<Request>> requests_pool_;
   std::set<std::shared_ptr<Request>> to_be_removed_requests_;
 };
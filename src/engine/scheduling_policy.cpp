@@ -0,0 +1,54 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "scheduling_policy.h"
+
+namespace Generators {
+
+void SchedulingPolicy::Sort(std::vector<std::shared_ptr<Request>>& requests) const {
+  std::stable_sort(requests.begin(), requests.end(),
+                   [this](const std::shared_ptr<Request>& a, const std::shared_ptr<Request>& b) {
+                     return Precedes(*a, *b);
+                   });
+}
+
+bool FirstComeFirstServedPolicy::Precedes(const Request& a, const Request& b) const {
+  return a.ArrivalIndex() < b.ArrivalIndex();
+}
+
+bool PriorityPolicy::Precedes(const Request& a, const Request& b) const {
+  if (a.Priority() != b.Priority()) {
+    return a.Priority() > b.Priority();
+  }
+  return a.ArrivalIndex() < b.ArrivalIndex();
+}
+
+bool ShortestPromptFirstPolicy::Precedes(const Request& a, const Request& b) const {
+  if (a.CurrentSequenceLength() != b.CurrentSequenceLength()) {
+    return a.CurrentSequenceLength() < b.CurrentSequenceLength();
+  }
+  return a.ArrivalIndex() < b.ArrivalIndex();
+}
+
+bool DeadlinePolicy::Precedes(const Request& a, const Request& b) const {
+  if (a.Deadline() != b.Deadline()) {
+    return a.Deadline() < b.Deadline();
+  }
+  return a.ArrivalIndex() < b.ArrivalIndex();
+}
+
+std::unique_ptr<SchedulingPolicy> CreateSchedulingPolicy(std::string_view name) {
+  if (name == "fcfs") {
+    return std::make_unique<FirstComeFirstServedPolicy>();
+  } else if (name == "priority") {
+    return std::make_unique<PriorityPolicy>();
+  } else if (name == "shortest_prompt_first") {
+    return std::make_unique<ShortestPromptFirstPolicy>();
+  } else if (name == "deadline") {
+    return std::make_unique<DeadlinePolicy>();
+  }
+  throw std::runtime_error("Unknown scheduling policy: " + std::string(name) +
+                           ". Expected one of fcfs, priority, shortest_prompt_first or deadline.");
+}
+
+}  // namespace Generators
@@ -0,0 +1,64 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include "request.h"
+
+/**
+ * @file scheduling_policy.h
+ * @brief Defines the scheduling policies that decide the order in which the
+ *        Scheduler serves requests.
+ */
+
+namespace Generators {
+
+/**
+ * @brief Orders requests for the Scheduler.
+ *
+ * Waiting requests are admitted in the order defined by the policy, and running requests
+ * are served in that order when the token budget of a step is tight. When the key-value
+ * cache runs out, the running request that comes last in the order is preempted first.
+ */
+struct SchedulingPolicy {
+  /**
+   * @brief Returns true if request a should be served before request b.
+   */
+  virtual bool Precedes(const Request& a, const Request& b) const = 0;
+
+  /**
+   * @brief Sorts the given requests from the first to the last to be served.
+   */
+  void Sort(std::vector<std::shared_ptr<Request>>& requests) const;
+
+  virtual ~SchedulingPolicy() = default;
+};
+
+// Serves requests in the order they were added to the engine.
+struct FirstComeFirstServedPolicy : SchedulingPolicy {
+  bool Precedes(const Request& a, const Request& b) const override;
+};
+
+// Serves requests with a higher priority first, requests of the same priority in arrival order.
+struct PriorityPolicy : SchedulingPolicy {
+  bool Precedes(const Request& a, const Request& b) const override;
+};
+
+// Serves requests with fewer tokens first, which minimizes the average time to first token.
+struct ShortestPromptFirstPolicy : SchedulingPolicy {
+  bool Precedes(const Request& a, const Request& b) const override;
+};
+
+// Serves requests with the earliest deadline first. Requests without a deadline are served last.
+struct DeadlinePolicy : SchedulingPolicy {
+  bool Precedes(const Request& a, const Request& b) const override;
+};
+
+/**
+ * @brief Creates the scheduling policy with the given name.
+ * @param name One of "fcfs", "priority", "shortest_prompt_first" or "deadline".
+ * @throws std::runtime_error if the name does not match any policy.
+ */
+std::unique_ptr<SchedulingPolicy> CreateSchedulingPolicy(std::string_view name);
+
+}  // namespace Generators
@@ -7,8 +7,11 @@
 #include "models/model.h"
 #include "models/decoder_only.h"
 #include "constrained_logits_processor.h"
+#include "speculative_decoding.h"
 #include "search.h"
+#include "state_file.h"
 #include "tracing.h"
+#include "thread_pool.h"
 #include "cpu/interface.h"
 #include "cuda/interface.h"
 #include "dml/interface.h"
@@ -63,6 +66,8 @@ OrtGlobals::OrtGlobals()
   GetDeviceInterface(DeviceType::CPU)->InitOrt(*Ort::api, allocator_cpu);
 }
 
+OrtGlobals::~OrtGlobals() = default;
+
 // Ensure Shutdown() has been called before process exit
 struct EnsureShutdown {
   ~EnsureShutdown() {
@@ -98,6 +103,16 @@ OrtEnv& GetOrtEnv() {
   return *GetOrtGlobals()->env_;
 }
 
+ThreadPool& GetSamplingThreadPool() {
+  auto& globals = *GetOrtGlobals();
+  std::call_once(globals.sampling_thread_pool_once_, [&globals] {
+    // The calling thread takes part in every loop, so one thread less than the cores is enough
+    const unsigned num_cores = std::thread::hardware_concurrency();
+    globals.sampling_thread_pool_ = std::make_unique<ThreadPool>(num_cores > 1 ? num_cores - 1 : 0);
+  });
+  return *globals.sampling_thread_pool_;
+}
+
 // Fallback to copy between two separate device buffers by going through CPU memory (slow unless we're the CPU device)
 void CopyThroughCpu(DeviceBuffer& dest, size_t begin_dest, DeviceBuffer& source, size_t begin_source, size_t size_in_bytes) {
   source.CopyDeviceToCpu();
@@ -266,6 +281,13 @@ void GeneratorParams::SetGuidance(std::string_view type, std::string_view data)
   guidance_data = data;
 }
 
+void GeneratorParams::SetDraftModel(const Model& model, size_t num_draft_tokens) {
+  if (num_draft_tokens == 0)
+    throw std::runtime_error("num_draft_tokens must be 1 or greater");
+  draft_model = model.shared_from_this();
+  this->num_draft_tokens = num_draft_tokens;
+}
+
 std::unique_ptr<Generator> CreateGenerator(const Model& model, const GeneratorParams& params) {
   return std::make_unique<Generator>(model, params);
 }
@@ -289,8 +311,19 @@ Generator::Generator(const Model& model, const GeneratorParams& params) : model_
   search_ = CreateSearch(params);
   state_ = model.CreateState(search_->GetSequenceLengths(), params);    // Search sequence lengths set when creating state
   guidance_logits_processor_ = CreateGuidanceLogitsProcessor(*state_);  // Could be nullptr if use_guidance (constrained decoding) is not used
+  if (params.draft_model && params.search.prompt_lookup_num_tokens > 0)
+    throw std::runtime_error("A draft model and prompt lookup cannot be used together.");
+  if ((params.draft_model || params.search.prompt_lookup_num_tokens > 0) && (params.search.logprobs || params.search.top_logprobs > 0))
+    throw std::runtime_error("logprobs are not supported with speculative decoding.");
+  if (params.draft_model)
+    speculative_decoder_ = std::make_unique<SpeculativeDecoder>(*this, std::make_unique<DraftModelProposer>(*params.draft_model, params), params.num_draft_tokens);
+  else if (params.search.prompt_lookup_num_tokens > 0)
+    speculative_decoder_ = std::make_unique<SpeculativeDecoder>(*this, std::make_unique<PromptLookupProposer>(params.search.prompt_lookup_min_ngram_size),
+                                                                params.search.prompt_lookup_num_tokens);
 }
 
+Generator::~Generator() = default;
+
 DeviceSpan<int32_t> Generator::AllocateInputIdsOnDevice(cpu_span<const int32_t> input_ids) {
   size_t padded_input_ids_size = input_ids.size();
   if (model_->config_->model.decoder.sliding_window.has_value()) {
@@ -327,6 +360,8 @@ void Generator::AppendTokens(cpu_span<const int32_t> input_ids) {
     throw std::runtime_error("input_ids size (" + std::to_string(input_ids.size()) + ") + current sequence length (" + std::to_string(search_->GetSequenceLength()) + ") exceeds max length (" + std::to_string(state_->params_->search.max_length) + ")");
   if (search_->GetSequenceLength() != 0 && state_->params_->search.batch_size > 1)
     throw std::runtime_error("AppendTokens can only be called once for batch_size > 1. To call AppendTokens again, use RewindToLength(0)");
+  if (speculative_decoder_)
+    speculative_decoder_->DiscardPendingTokens();
 
   constexpr std::array<DeviceType, 4> devices_supporting_continuous_decoding{DeviceType::CPU, DeviceType::CUDA, DeviceType::WEBGPU, DeviceType::OpenVINO};
   if (search_->GetSequenceLength() != 0 &&
@@ -436,6 +471,8 @@ bool Generator::IsSessionTerminated() const {
 }
 
 void Generator::SetLogits(DeviceSpan<float> logits) {
+  if (speculative_decoder_)
+    speculative_decoder_->DiscardPendingTokens();
   search_->SetLogits(logits);
   computed_logits_ = true;
 }
@@ -460,10 +497,13 @@ void Generator::GenerateNextToken() {
     }
   }
 
+  if (speculative_decoder_ && speculative_decoder_->GenerateNextToken())
+    return;
+
   if (!computed_logits_) {
     auto next_tokens = search_->GetNextTokens();
     if (last_action_ == Action::rewound)
-      search_->AppendTokens(next_tokens);
+      search_->AppendRewoundTokens();
     ComputeLogits(next_tokens);
   }
   if (guidance_logits_processor_) {
@@ -472,8 +512,7 @@ void Generator::GenerateNextToken() {
   }
   computed_logits_ = false;
   auto& search = search_->params_->search;
-  search_->ApplyMinLength(search.min_length);
-  search_->ApplyRepetitionPenalty(search.repetition_penalty);
+  search_->ProcessLogits();
 
   if (g_log.enabled && g_log.generate_next_token) {
     auto& stream = Log("generate_next_token");
@@ -516,11 +555,12 @@ void Generator::RewindToLength(size_t new_length) {
     throw std::runtime_error("RewindTo is currently not supported for " + model_->config_->model.type + ".");
   if (new_length > search_->GetSequenceLength())
     throw std::runtime_error("Cannot rewind to a length greater than the current sequence length");
+  if (speculative_decoder_)
+    speculative_decoder_->DiscardPendingTokens();
   if (new_length == search_->GetSequenceLength())
     return;
-  size_t batch_size = search_->params_->search.batch_size;
-  if (batch_size > 1 && new_length != 0)
-    throw std::runtime_error("RewindToLength must be called with new_length=0 when batch_size > 1");
+  if (search_->params_->search.num_beams > 1 && new_length != 0)
+    throw std::runtime_error("RewindToLength must be called with new_length=0 for beam search");
   search_->RewindTo(new_length);
   state_->RewindTo(new_length);
   if (guidance_logits_processor_) {
@@ -530,7 +570,160 @@ void Generator::RewindToLength(size_t new_length) {
   last_action_ = Action::rewound;
 }
 
+std::unique_ptr<Generator> Generator::Fork() {
+  ThrowErrorIfSessionTerminated(state_->session_terminated_);
+  const auto& params = *state_->params_;
+  if (params.search.batch_size != 1 || params.search.num_beams != 1)
+    throw std::runtime_error("Fork only supports batch_size 1 and num_beams 1.");
+  if (params.use_graph_capture)
+    throw std::runtime_error("Fork is not supported with graph capture.");
+  if (guidance_logits_processor_)
+    throw std::runtime_error("Fork cannot be combined with guidance.");
+  if (search_->GetSequenceLength() == 0)
+    throw std::runtime_error("Fork called with no prior state. Please call AppendTokens before calling Fork.");
+  if (search_->IsDone())
+    throw std::runtime_error("Fork called on a generator that is done.");
+  if (speculative_decoder_)
+    speculative_decoder_->DiscardPendingTokens();
+
+  // Run the model on the tokens it has not seen yet, so that the fork starts from this generator's logits
+  if (!computed_logits_) {
+    auto next_tokens = search_->GetNextTokens();
+    if (last_action_ == Action::rewound)
+      search_->AppendRewoundTokens();
+    ComputeLogits(next_tokens);
+  }
+
+  auto fork = std::make_unique<Generator>(*model_, params);
+  fork->extra_inputs_ = extra_inputs_;
+  if (!set_extra_inputs_) {
+    fork->state_->SetExtraInputs(fork->extra_inputs_);
+    fork->set_extra_inputs_ = false;
+  }
+  fork->state_->ForkFrom(*state_);
+
+  auto sequence = GetSequence(0).CopyDeviceToCpu();
+  auto sequence_device = params.p_device->Allocate<int32_t>(sequence.size());
+  std::copy(sequence.begin(), sequence.end(), sequence_device.CpuSpan().begin());
+  sequence_device.CopyCpuToDevice();
+  fork->search_->AppendTokens(sequence_device);
+
+  if (!random_streams_)
+    random_streams_ = std::make_shared<std::atomic<uint64_t>>(0);
+  fork->random_streams_ = random_streams_;
+  fork->search_->SetRandomStream(++*random_streams_);
+
+  // The search reads the logits in place, so the fork gets its own copy
+  auto logits = search_->GetLogits();
+  fork->fork_logits_ = params.p_device->Allocate<float>(logits.size());
+  fork->fork_logits_.CopyFrom(logits);
+  fork->search_->SetLogits(fork->fork_logits_);
+  fork->computed_logits_ = true;
+  return fork;
+}
+
+void Generator::CheckStateSupported(const char* operation) const {
+  ThrowErrorIfSessionTerminated(state_->session_terminated_);
+  const auto& params = *state_->params_;
+  if (params.search.batch_size != 1 || params.search.num_beams != 1)
+    throw std::runtime_error(std::string(operation) + " only supports batch_size 1 and num_beams 1.");
+  if (params.use_graph_capture)
+    throw std::runtime_error(std::string(operation) + " is not supported with graph capture.");
+  if (guidance_logits_processor_)
+    throw std::runtime_error(std::string(operation) + " cannot be combined with guidance.");
+  if (speculative_decoder_)
+    throw std::runtime_error(std::string(operation) + " is not supported with speculative decoding.");
+}
+
+void Generator::SaveState(const fs::path& path) {
+  PrepareSaveState();
+  StateFileWriter file{path, *model_};
+  WriteState(file);
+}
+
+void Generator::SaveState(std::vector<uint8_t>& buffer) {
+  PrepareSaveState();
+  StateFileWriter file{buffer, *model_};
+  WriteState(file);
+}
+
+void Generator::LoadState(const fs::path& path) {
+  PrepareLoadState();
+  StateFileReader file{path, *model_};
+  ReadState(file);
+}
+
+void Generator::LoadState(std::span<const uint8_t> buffer) {
+  PrepareLoadState();
+  StateFileReader file{buffer, *model_};
+  ReadState(file);
+}
+
+void Generator::PrepareSaveState() {
+  CheckStateSupported("SaveState");
+  if (search_->GetSequenceLength() == 0)
+    throw std::runtime_error("SaveState called with no prior state. Please call AppendTokens before calling SaveState.");
+
+  // Run the model on the tokens it has not seen yet, so that the saved state includes the logits. A generator that is
+  // done has not run its last token either, which AppendTokens would otherwise do on the next turn.
+  if (!computed_logits_) {
+    auto next_tokens = search_->GetNextTokens();
+    if (last_action_ == Action::rewound)
+      search_->AppendRewoundTokens();
+    ComputeLogits(next_tokens);
+  }
+}
+
+void Generator::PrepareLoadState() {
+  CheckStateSupported("LoadState");
+  if (search_->GetSequenceLength() != 0)
+    throw std::runtime_error("LoadState must be called on a new generator, before AppendTokens.");
+}
+
+void Generator::WriteState(StateFileWriter& file) {
+  const int sequence_length = search_->GetSequenceLength();
+  file.WriteValue("generator.sequence_length", sequence_length);
+  file.WriteArray("generator.sequence", std::span<const int32_t>{GetSequence(0).CopyDeviceToCpu()});
+  file.WriteArray("generator.logits", std::span<const float>{search_->GetLogits().CopyDeviceToCpu()});
+  auto random_state = search_->GetRandomState();
+  file.Write("generator.random_state", random_state);
+  state_->SaveState(file, sequence_length);
+  file.Finish();
+}
+
+void Generator::ReadState(const StateFileReader& file) {
+  const auto& params = *state_->params_;
+  const int sequence_length = file.ReadValue<int>("generator.sequence_length");
+  auto sequence = file.ReadArray<int32_t>("generator.sequence");
+  auto logits = file.ReadArray<float>("generator.logits");
+  if (sequence_length <= 0 || sequence.size() != static_cast<size_t>(sequence_length) ||
+      logits.size() != static_cast<size_t>(params.BatchBeamSize() * model_->config_->model.vocab_size))
+    throw std::runtime_error("The generator state is corrupt.");
+  if (sequence_length > params.search.max_length)
+    throw std::runtime_error("The saved sequence length (" + std::to_string(sequence_length) + ") exceeds max_length (" + std::to_string(params.search.max_length) + ").");
+
+  if (set_extra_inputs_) {
+    state_->SetExtraInputs(extra_inputs_);
+    set_extra_inputs_ = false;
+  }
+  state_->LoadState(file, sequence_length);
+
+  auto sequence_device = params.p_device->Allocate<int32_t>(sequence.size());
+  std::copy(sequence.begin(), sequence.end(), sequence_device.CpuSpan().begin());
+  sequence_device.CopyCpuToDevice();
+  search_->AppendTokens(sequence_device);
+  search_->SetRandomState(file.Read("generator.random_state"));
+
+  fork_logits_ = params.p_device->Allocate<float>(logits.size());
+  std::copy(logits.begin(), logits.end(), fork_logits_.CpuSpan().begin());
+  fork_logits_.CopyCpuToDevice();
+  search_->SetLogits(fork_logits_);
+  computed_logits_ = true;
+}
+
 DeviceSpan<float> Generator::GetLogits() {
+  if (speculative_decoder_)
+    speculative_decoder_->DiscardPendingTokens();
   if (!computed_logits_) {
     ComputeLogits(search_->GetNextTokens());
   }
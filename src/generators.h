@@ -13,6 +13,7 @@
 #include <iostream>
 #include "span.h"
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <optional>
 #include <queue>
@@ -38,10 +39,14 @@ void ThrowErrorIfSessionTerminated(bool is_session_terminated);
 
 namespace Generators {
 struct Model;
+struct StateFileWriter;
+struct StateFileReader;
 struct State;
 struct Search;
 struct Tokenizer;
 struct ConstrainedLogitsProcessor;
+struct SpeculativeDecoder;
+class ThreadPool;
 struct ExtraInput {  // Extra inputs provided via SetInputs()
   std::string name;
   std::shared_ptr<Tensor> tensor;
@@ -84,10 +89,15 @@ struct GeneratorParams : std::enable_shared_from_this<GeneratorParams>, LeakChec
   std::string guidance_type;  // e.g. json_schema or regex
   std::string guidance_data;  // e.g. rules data in json_schema or regex
   void SetGuidance(std::string_view type, std::string_view data);
+
+  std::shared_ptr<const Model> draft_model;  // Set to decode speculatively with tokens proposed by this model
+  size_t num_draft_tokens{};                 // Number of tokens the draft model proposes per target model run
+  void SetDraftModel(const Model& model, size_t num_draft_tokens);
 };
 
 struct Generator : LeakChecked<Generator> {
   Generator(const Model& model, const GeneratorParams& params);
+  ~Generator();
 
   bool IsDone() const;
   void AppendTokens(cpu_span<const int32_t> input_ids);
@@ -98,6 +108,18 @@ struct Generator : LeakChecked<Generator> {
   void SetRuntimeOption(const char* key, const char* value);
   bool IsSessionTerminated() const;
 
+  // Creates a generator that continues from the current sequence without running the model on it again. The
+  // prompt's key-value cache is shared with the fork until either one writes to it.
+  std::unique_ptr<Generator> Fork();
+
+  // Saves the sequence, the logits, the random state and the key-value cache to a file, which LoadState restores into
+  // a new generator of the same model and config without running the model on the sequence again
+  void SaveState(const fs::path& path);
+  void LoadState(const fs::path& path);
+  // Saves to and loads from memory instead, in the same format
+  void SaveState(std::vector<uint8_t>& buffer);
+  void LoadState(std::span<const uint8_t> buffer);
+
   DeviceSpan<int32_t> GetSequence(size_t index) const;
 
   // A list of extra model inputs that will be matched at runtime based on name
@@ -108,12 +130,23 @@ struct Generator : LeakChecked<Generator> {
   std::unique_ptr<State> state_;
   std::unique_ptr<Search> search_;
   std::unique_ptr<ConstrainedLogitsProcessor> guidance_logits_processor_;
+  std::unique_ptr<SpeculativeDecoder> speculative_decoder_;  // Set if the params have a draft model or prompt_lookup_num_tokens
 
   bool computed_logits_{};       // Set to true in ComputeLogits() and false after appending a token to ensure a 1 to 1 call ratio
   bool set_extra_inputs_{true};  // Set to false once SetExtraInputs() is called once
 
+  DeviceSpan<float> fork_logits_;                            // Logits copied from the generator this one was forked from, or loaded by LoadState
+  std::shared_ptr<std::atomic<uint64_t>> random_streams_;  // Last random stream given to a fork, shared by every fork of a generator
+
  private:
+  friend struct SpeculativeDecoder;
+
   DeviceSpan<int32_t> AllocateInputIdsOnDevice(cpu_span<const int32_t> input_ids);
+  void CheckStateSupported(const char* operation) const;  // Throws if SaveState or LoadState can't be used
+  void PrepareSaveState();
+  void PrepareLoadState();
+  void WriteState(StateFileWriter& file);
+  void ReadState(const StateFileReader& file);
   void ComputeLogits(DeviceSpan<int32_t> next_tokens);
   enum Action { standard,   // Default, set in any other case
                 generated,  // Set after GenerateNextToken
@@ -123,6 +156,7 @@ struct Generator : LeakChecked<Generator> {
 
 struct OrtGlobals {
   OrtGlobals();
+  ~OrtGlobals();
 
   std::unique_ptr<OrtEnv> env_;
 
@@ -132,6 +166,9 @@ struct OrtGlobals {
   };
   Allocator device_allocators_[static_cast<int>(DeviceType::MAX)];
 
+  std::once_flag sampling_thread_pool_once_;
+  std::unique_ptr<ThreadPool> sampling_thread_pool_;  // Created on first use by GetSamplingThreadPool()
+
  private:
   OrtGlobals(const OrtGlobals&) = delete;
   void operator=(const OrtGlobals&) = delete;
@@ -140,6 +177,7 @@ struct OrtGlobals {
 std::unique_ptr<OrtGlobals>& GetOrtGlobals();
 void Shutdown();  // Do this once at exit, Ort code will fail after this call
 OrtEnv& GetOrtEnv();
+ThreadPool& GetSamplingThreadPool();  // Shared by the CPU searches to sample batch rows in parallel
 
 std::shared_ptr<Model> CreateModel(OrtEnv& ort_env, const char* config_path, const RuntimeSettings* settings = nullptr);
 std::shared_ptr<Model> CreateModel(OrtEnv& ort_env, std::unique_ptr<Config> config);
@@ -0,0 +1,264 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "generators.h"
+#include "sequences.h"
+#include "logits_processor.h"
+
+namespace Generators {
+
+TokenCounts::TokenCounts(size_t num_sequences, size_t vocab_size)
+    : vocab_size_{vocab_size},
+      counts_(num_sequences * vocab_size),
+      positions_(num_sequences * vocab_size),
+      tokens_(num_sequences) {}
+
+void TokenCounts::Add(size_t sequence_index, int32_t token) {
+  const size_t offset = sequence_index * vocab_size_ + token;
+  if (counts_[offset]++ == 0) {
+    auto& tokens = tokens_[sequence_index];
+    positions_[offset] = static_cast<int32_t>(tokens.size());
+    tokens.push_back(token);
+  }
+}
+
+void TokenCounts::Remove(size_t sequence_index, int32_t token) {
+  const size_t offset = sequence_index * vocab_size_ + token;
+  assert(counts_[offset] > 0);
+  if (--counts_[offset] == 0) {
+    // Move the last distinct token into the removed token's place
+    auto& tokens = tokens_[sequence_index];
+    const int32_t last = tokens.back();
+    tokens[positions_[offset]] = last;
+    positions_[sequence_index * vocab_size_ + last] = positions_[offset];
+    tokens.pop_back();
+  }
+}
+
+void TokenCounts::Assign(size_t sequence_index, std::span<const int32_t> sequence) {
+  auto& tokens = tokens_[sequence_index];
+  for (int32_t token : tokens)
+    counts_[sequence_index * vocab_size_ + token] = 0;
+  tokens.clear();
+  for (int32_t token : sequence)
+    Add(sequence_index, token);
+}
+
+namespace {
+
+constexpr uint64_t kModulus[2] = {2147483647, 2147483629};
+constexpr uint64_t kBase[2] = {1000003, 999983};
+
+uint64_t Part(uint64_t hash, int i) { return i == 0 ? hash >> 32 : hash & 0xFFFFFFFF; }
+uint64_t Pack(uint64_t high, uint64_t low) { return (high << 32) | low; }
+
+}  // namespace
+
+NgramIndex::NgramIndex(size_t num_sequences, size_t ngram_size)
+    : ngram_size_{ngram_size}, sequences_(num_sequences) {
+  uint64_t power[2] = {1, 1};
+  for (size_t i = 0; i + 1 < ngram_size; i++) {
+    for (int j = 0; j < 2; j++)
+      power[j] = power[j] * kBase[j] % kModulus[j];
+  }
+  prefix_power_ = Pack(power[0], power[1]);
+  for (auto& sequence : sequences_)
+    sequence.prefix_hashes.push_back(0);
+}
+
+NgramIndex::Hash NgramIndex::PrefixHash(size_t sequence_index, size_t end) const {
+  const auto& prefix_hashes = sequences_[sequence_index].prefix_hashes;
+  const size_t begin = end + 1 - ngram_size_;
+  uint64_t hash[2];
+  for (int j = 0; j < 2; j++) {
+    // hash(tokens[begin, end)) = P(end) - P(begin) * base^(end - begin)
+    const uint64_t subtrahend = Part(prefix_hashes[begin], j) * Part(prefix_power_, j) % kModulus[j];
+    hash[j] = (Part(prefix_hashes[end], j) + kModulus[j] - subtrahend) % kModulus[j];
+  }
+  return Pack(hash[0], hash[1]);
+}
+
+void NgramIndex::Add(size_t sequence_index, Hash prefix, int32_t token) {
+  auto& entries = sequences_[sequence_index].next_tokens[prefix];
+  for (auto& entry : entries) {
+    if (entry.token == token) {
+      entry.count++;
+      return;
+    }
+  }
+  entries.push_back({token, 1});
+}
+
+void NgramIndex::Remove(size_t sequence_index, Hash prefix, int32_t token) {
+  auto& next_tokens = sequences_[sequence_index].next_tokens;
+  auto it = next_tokens.find(prefix);
+  assert(it != next_tokens.end());
+  auto& entries = it->second;
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (entries[i].token == token && --entries[i].count == 0) {
+      entries[i] = entries.back();
+      entries.pop_back();
+      break;
+    }
+  }
+  if (entries.empty())
+    next_tokens.erase(it);
+}
+
+void NgramIndex::Append(size_t sequence_index, int32_t token) {
+  auto& prefix_hashes = sequences_[sequence_index].prefix_hashes;
+  const size_t length = prefix_hashes.size() - 1;
+  if (length + 1 >= ngram_size_)
+    Add(sequence_index, PrefixHash(sequence_index, length), token);
+
+  const uint64_t last = prefix_hashes.back();
+  uint64_t hash[2];
+  for (int j = 0; j < 2; j++)
+    hash[j] = (Part(last, j) * kBase[j] + static_cast<uint32_t>(token)) % kModulus[j];
+  prefix_hashes.push_back(Pack(hash[0], hash[1]));
+}
+
+void NgramIndex::Truncate(size_t sequence_index, std::span<const int32_t> sequence, size_t length) {
+  auto& prefix_hashes = sequences_[sequence_index].prefix_hashes;
+  // Remove the n-grams ending at or after length, latest first
+  for (size_t end = prefix_hashes.size() - 1; end > length; end--) {
+    if (end >= ngram_size_)
+      Remove(sequence_index, PrefixHash(sequence_index, end - 1), sequence[end - 1]);
+  }
+  prefix_hashes.resize(std::min(prefix_hashes.size(), length + 1));
+}
+
+void NgramIndex::Assign(size_t sequence_index, std::span<const int32_t> sequence) {
+  auto& state = sequences_[sequence_index];
+  state.next_tokens.clear();
+  state.prefix_hashes.resize(1);
+  for (int32_t token : sequence)
+    Append(sequence_index, token);
+}
+
+const std::vector<NgramIndex::Entry>* NgramIndex::NextTokens(size_t sequence_index) const {
+  const auto& state = sequences_[sequence_index];
+  const size_t length = state.prefix_hashes.size() - 1;
+  if (length + 1 < ngram_size_)
+    return nullptr;
+  auto it = state.next_tokens.find(PrefixHash(sequence_index, length));
+  return it != state.next_tokens.end() ? &it->second : nullptr;
+}
+
+void ApplyTokenPenalties(float& logit, int32_t count, float repetition_penalty, float presence_penalty, float frequency_penalty) {
+  // If the logit < 0, then repetition penalty > 1.0 has to multiplied to reduce the previous token probability,
+  // This assumes that scores are either positive (like ctrl) or negative (like GPT-2), but not a mixture.
+  logit = logit < 0 ? logit * repetition_penalty : logit / repetition_penalty;
+  logit -= presence_penalty + frequency_penalty * static_cast<float>(count);
+}
+
+namespace {
+
+// Keeps the EOS tokens from being chosen until the sequences reach min_length
+struct MinLengthProcessor : LogitsProcessor {
+  MinLengthProcessor(const GeneratorParams& params, const Sequences& sequences)
+      : sequences_{sequences}, min_length_{params.search.min_length}, eos_token_ids_{params.config.model.eos_token_id} {}
+
+  void Process(size_t /*sequence_index*/, std::span<float> logits) override {
+    if (sequences_.GetSequenceLength() >= min_length_)
+      return;
+    for (auto token_id : eos_token_ids_)
+      logits[token_id] = std::numeric_limits<float>::lowest();
+  }
+
+ private:
+  const Sequences& sequences_;
+  int min_length_;
+  const std::vector<int>& eos_token_ids_;
+};
+
+// Applies the repetition, presence and frequency penalties to the tokens already in the sequence
+struct TokenPenaltyProcessor : LogitsProcessor {
+  TokenPenaltyProcessor(const GeneratorParams& params, const TokenCounts& token_counts)
+      : token_counts_{token_counts},
+        repetition_penalty_{params.search.repetition_penalty},
+        presence_penalty_{params.search.presence_penalty},
+        frequency_penalty_{params.search.frequency_penalty} {}
+
+  void Process(size_t sequence_index, std::span<float> logits) override {
+    for (int32_t token : token_counts_.Tokens(sequence_index))
+      ApplyTokenPenalties(logits[token], token_counts_.Count(sequence_index, token), repetition_penalty_, presence_penalty_, frequency_penalty_);
+  }
+
+ private:
+  const TokenCounts& token_counts_;
+  float repetition_penalty_;
+  float presence_penalty_;
+  float frequency_penalty_;
+};
+
+// Keeps the tokens that would repeat an n-gram of no_repeat_ngram_size tokens from being chosen
+struct NoRepeatNgramProcessor : LogitsProcessor {
+  NoRepeatNgramProcessor(const NgramIndex& ngram_index) : ngram_index_{ngram_index} {}
+
+  void Process(size_t sequence_index, std::span<float> logits) override {
+    if (auto* next_tokens = ngram_index_.NextTokens(sequence_index)) {
+      for (auto& entry : *next_tokens)
+        logits[entry.token] = std::numeric_limits<float>::lowest();
+    }
+  }
+
+ private:
+  const NgramIndex& ngram_index_;
+};
+
+}  // namespace
+
+LogitsPipeline::LogitsPipeline(const GeneratorParams& params, const Sequences& sequences)
+    : vocab_size_{static_cast<size_t>(params.config.model.vocab_size)} {
+  const auto& search = params.search;
+
+  if (search.min_length > 0)
+    processors_.push_back(std::make_unique<MinLengthProcessor>(params, sequences));
+
+  if (search.repetition_penalty != 1.0f || search.presence_penalty != 0.0f || search.frequency_penalty != 0.0f) {
+    token_counts_ = std::make_unique<TokenCounts>(params.BatchBeamSize(), vocab_size_);
+    processors_.push_back(std::make_unique<TokenPenaltyProcessor>(params, *token_counts_));
+  }
+
+  if (search.no_repeat_ngram_size > 0) {
+    ngram_index_ = std::make_unique<NgramIndex>(params.BatchBeamSize(), search.no_repeat_ngram_size);
+    processors_.push_back(std::make_unique<NoRepeatNgramProcessor>(*ngram_index_));
+  }
+}
+
+LogitsPipeline::~LogitsPipeline() = default;
+
+void LogitsPipeline::Append(size_t sequence_index, int32_t token) {
+  if (token_counts_)
+    token_counts_->Add(sequence_index, token);
+  if (ngram_index_)
+    ngram_index_->Append(sequence_index, token);
+}
+
+void LogitsPipeline::Rewind(size_t sequence_index, std::span<const int32_t> sequence, size_t length) {
+  if (token_counts_) {
+    for (int32_t token : sequence.subspan(length, sequence.size() - length))
+      token_counts_->Remove(sequence_index, token);
+  }
+  if (ngram_index_)
+    ngram_index_->Truncate(sequence_index, sequence, length);
+}
+
+void LogitsPipeline::Assign(size_t sequence_index, std::span<const int32_t> sequence) {
+  if (token_counts_)
+    token_counts_->Assign(sequence_index, sequence);
+  if (ngram_index_)
+    ngram_index_->Assign(sequence_index, sequence);
+}
+
+void LogitsPipeline::Process(std::span<float> logits) {
+  const size_t num_sequences = logits.size() / vocab_size_;
+  for (size_t sequence_index = 0; sequence_index < num_sequences; sequence_index++) {
+    auto sequence_logits = logits.subspan(sequence_index * vocab_size_, vocab_size_);
+    for (auto& processor : processors_)
+      processor->Process(sequence_index, sequence_logits);
+  }
+}
+
+}  // namespace Generators
@@ -0,0 +1,115 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "span.h"
+
+namespace Generators {
+
+struct GeneratorParams;
+struct Sequences;
+
+// How often each token occurs in each sequence of a search. It is updated as tokens are appended or rewound,
+// so the penalties read it instead of rescanning the whole sequence every step.
+struct TokenCounts {
+  TokenCounts(size_t num_sequences, size_t vocab_size);
+
+  void Add(size_t sequence_index, int32_t token);
+  void Remove(size_t sequence_index, int32_t token);
+
+  // Recounts a sequence from scratch, for sequences replaced by another one (like beams being reordered)
+  void Assign(size_t sequence_index, std::span<const int32_t> sequence);
+
+  int32_t Count(size_t sequence_index, int32_t token) const { return counts_[sequence_index * vocab_size_ + token]; }
+
+  // The distinct tokens of a sequence, in no particular order
+  std::span<const int32_t> Tokens(size_t sequence_index) const { return tokens_[sequence_index]; }
+
+ private:
+  size_t vocab_size_;
+  std::vector<int32_t> counts_;     // shape (num_sequences, vocab_size)
+  std::vector<int32_t> positions_;  // shape (num_sequences, vocab_size), index of each counted token in tokens_
+  std::vector<std::vector<int32_t>> tokens_;
+};
+
+// The n-grams of each sequence of a search, keyed by a rolling hash of their first n - 1 tokens. Appending a token
+// adds the n-gram it completes, so the tokens that would repeat an n-gram are a single lookup instead of a rescan.
+struct NgramIndex {
+  NgramIndex(size_t num_sequences, size_t ngram_size);
+
+  void Append(size_t sequence_index, int32_t token);
+
+  // Drops the n-grams past length. sequence holds the tokens the index was built from.
+  void Truncate(size_t sequence_index, std::span<const int32_t> sequence, size_t length);
+
+  // Rebuilds the index of a sequence from scratch, for sequences replaced by another one
+  void Assign(size_t sequence_index, std::span<const int32_t> sequence);
+
+  struct Entry {
+    int32_t token;
+    int32_t count;  // Number of times the n-gram occurs, so rewinding can tell when it is gone
+  };
+
+  // The last tokens of the n-grams that start with the sequence's last n - 1 tokens, or null if there are none
+  const std::vector<Entry>* NextTokens(size_t sequence_index) const;
+
+ private:
+  using Hash = uint64_t;  // Two hashes modulo different 31 bit primes, packed together to make collisions unlikely
+
+  // Hash of the ngram_size_ - 1 tokens of the sequence ending before position end
+  Hash PrefixHash(size_t sequence_index, size_t end) const;
+  void Add(size_t sequence_index, Hash prefix, int32_t token);
+  void Remove(size_t sequence_index, Hash prefix, int32_t token);
+
+  struct Sequence {
+    std::vector<Hash> prefix_hashes;  // Polynomial hash of the first i tokens, shape (length + 1)
+    std::unordered_map<Hash, std::vector<Entry>> next_tokens;
+  };
+
+  size_t ngram_size_;
+  Hash prefix_power_;  // The bases raised to ngram_size_ - 1
+  std::vector<Sequence> sequences_;
+};
+
+// Adjusts the logits of one token that occurs count times in the sequence, by the repetition, presence and
+// frequency penalties of the search options
+void ApplyTokenPenalties(float& logit, int32_t count, float repetition_penalty, float presence_penalty, float frequency_penalty);
+
+// A stage of the logits processing, applied to the logits of a single sequence
+struct LogitsProcessor {
+  virtual ~LogitsProcessor() = default;
+  virtual void Process(size_t sequence_index, std::span<float> logits) = 0;
+};
+
+// The logits processors enabled by the search options, chosen once when the search is created. All stages run on
+// a sequence's logits before moving to the next sequence, so the logits are still in cache for the next stage.
+// Stages only touch the tokens they change, so disabled options cost nothing.
+struct LogitsPipeline {
+  LogitsPipeline(const GeneratorParams& params, const Sequences& sequences);
+  ~LogitsPipeline();
+
+  bool empty() const { return processors_.empty(); }
+
+  // Keep the state of the stages in line with the sequences of the search. sequence is the full sequence before
+  // a rewind, and the new sequence when it was replaced by another one.
+  void Append(size_t sequence_index, int32_t token);
+  void Rewind(size_t sequence_index, std::span<const int32_t> sequence, size_t length);
+  void Assign(size_t sequence_index, std::span<const int32_t> sequence);
+
+  // logits has shape (num_sequences, vocab_size)
+  void Process(std::span<float> logits);
+
+ private:
+  size_t vocab_size_;
+  std::unique_ptr<TokenCounts> token_counts_;  // Only if a penalty needs it
+  std::unique_ptr<NgramIndex> ngram_index_;    // Only if no_repeat_ngram_size is set
+  std::vector<std::unique_ptr<LogitsProcessor>> processors_;
+};
+
+}  // namespace Generators
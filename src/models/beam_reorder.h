@@ -0,0 +1,70 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "../span.h"
+
+namespace Generators {
+
+// The two ways beam search keeps the key-value cache of each beam on CPU. Other devices copy the beams into a new
+// tensor every step instead, which these have to stay equivalent to.
+
+// Reorders the beams of a CPU key-value tensor in place, so beam j takes the data of beam beam_indices[j] in each of
+// the group_count groups (key and value for the combined cache). Beams that continue themselves are left alone, and
+// only the source beams that get overwritten are staged in scratch, so no new tensor is needed.
+inline void ReorderBeamsInPlace(std::span<uint8_t> data, size_t group_count, std::span<const int32_t> beam_indices, std::vector<uint8_t>& scratch) {
+  const size_t beam_count = beam_indices.size();
+  const size_t block_size = data.size() / (group_count * beam_count);
+
+  std::vector<int32_t> staged_slots(beam_count, -1);
+  int32_t staged_count = 0;
+  for (size_t j = 0; j < beam_count; j++) {
+    const int32_t source = beam_indices[j];
+    if (static_cast<size_t>(source) != j && beam_indices[source] != source && staged_slots[source] < 0)
+      staged_slots[source] = staged_count++;
+  }
+  scratch.resize(static_cast<size_t>(staged_count) * block_size);
+
+  for (size_t group = 0; group < group_count; group++) {
+    auto group_data = data.subspan(group * beam_count * block_size, beam_count * block_size);
+    for (size_t source = 0; source < beam_count; source++) {
+      if (staged_slots[source] >= 0)
+        std::copy_n(group_data.data() + source * block_size, block_size, scratch.data() + staged_slots[source] * block_size);
+    }
+    for (size_t j = 0; j < beam_count; j++) {
+      const int32_t source = beam_indices[j];
+      if (static_cast<size_t>(source) == j)
+        continue;
+      const uint8_t* source_data = staged_slots[source] >= 0 ? scratch.data() + staged_slots[source] * block_size
+                                                             : group_data.data() + source * block_size;
+      std::copy_n(source_data, block_size, group_data.data() + j * block_size);
+    }
+  }
+}
+
+// Writes the cache indirection table for the step that processes position current_length - 1 into target, from the
+// table of the previous step in source. Same semantics as the CUDA kernel.
+inline void UpdateCacheIndirectionTable(int32_t* target_table, const int32_t* source_table, const int32_t* beam_ids, int batch_size, int beam_width, int input_seq_length, int max_seq_length, int current_length) {
+  for (int batch_id = 0; batch_id < batch_size; batch_id++) {
+    for (int beam_id = 0; beam_id < beam_width; beam_id++) {
+      const int src_beam = beam_ids[batch_id * beam_width + beam_id] % beam_width;
+      int32_t* target = target_table + (batch_id * beam_width + beam_id) * max_seq_length;
+      const int32_t* source = source_table + (batch_id * beam_width + src_beam) * max_seq_length;
+
+      // The input sequence always comes from beam 0, the newly generated step from the beam itself, and every
+      // other step from wherever the source beam took it from
+      std::fill_n(target, std::min(input_seq_length, current_length), 0);
+      if (input_seq_length < current_length - 1)
+        std::copy(source + input_seq_length, source + current_length - 1, target + input_seq_length);
+      if (current_length > input_seq_length)
+        target[current_length - 1] = beam_id;
+    }
+  }
+}
+
+}  // namespace Generators
@@ -1,4 +1,5 @@
 #include "../generators.h"
+#include "../state_file.h"
 #include "decoder_only.h"
 
 namespace Generators {
@@ -21,6 +22,21 @@ DecoderOnly_State::DecoderOnly_State(const DecoderOnly_Model& model, DeviceSpan<
   position_inputs_.Add();
   logits_.Add();
   kv_cache_->Add();
+
+  const auto& cache_indirection_name = model_.config_->model.decoder.inputs.cache_indirection;
+  if (model_.session_info_.HasInput(cache_indirection_name)) {
+    auto cache_indirection_type = model_.session_info_.GetInputDataType(cache_indirection_name);
+    auto cache_indirection_shape = std::array<int64_t, 3>{params_->search.batch_size, params_->search.num_beams, params_->search.max_length};
+    cache_indirection_ = OrtValue::CreateTensor(model_.p_device_inputs_->GetAllocator(), cache_indirection_shape, cache_indirection_type);
+    ByteWrapTensor(*model_.p_device_inputs_, *cache_indirection_).Zero();
+    // Caches that reorder the beams themselves leave the table zeroed, so that every beam reads its own past
+    if (params_->search.num_beams > 1 && kv_cache_ && kv_cache_->KeepsBeamsInPlace())
+      next_cache_indirection_ = OrtValue::CreateTensor(model_.p_device_inputs_->GetAllocator(), cache_indirection_shape, cache_indirection_type);
+
+    cache_indirection_index_ = inputs_.size();
+    input_names_.push_back(cache_indirection_name.c_str());
+    inputs_.push_back(cache_indirection_.get());
+  }
 }
 
 void DecoderOnly_State::SetExtraInputs(const std::vector<ExtraInput>& extra_inputs) {
@@ -42,12 +58,67 @@ void DecoderOnly_State::RewindTo(size_t index) {
   kv_cache_->RewindTo(index);
 }
 
+void DecoderOnly_State::ForkFrom(State& other_state) {
+  auto& other = dynamic_cast<DecoderOnly_State&>(other_state);
+  if (other.cache_indirection_ && other.params_->search.num_beams > 1)
+    throw std::runtime_error("Fork is not supported with beam search.");
+
+  ForkAdaptersFrom(other);
+  input_ids_.ForkFrom(other.input_ids_);
+  position_inputs_.ForkFrom(other.position_inputs_);
+  if (kv_cache_)
+    kv_cache_->ForkFrom(*other.kv_cache_);
+}
+
+void DecoderOnly_State::SaveState(StateFileWriter& file, int total_length) {
+  if (cache_indirection_ && params_->search.num_beams > 1)
+    throw std::runtime_error("SaveState is not supported with beam search.");
+
+  SaveAdapters(file);
+  input_ids_.SaveState(file);
+  position_inputs_.SaveState(file);
+  if (kv_cache_)
+    kv_cache_->SaveState(file, total_length);
+}
+
+void DecoderOnly_State::LoadState(const StateFileReader& file, int total_length) {
+  if (cache_indirection_ && params_->search.num_beams > 1)
+    throw std::runtime_error("LoadState is not supported with beam search.");
+
+  CheckAdapters(file);
+  input_ids_.LoadState(file);
+  position_inputs_.LoadState(file);
+  if (kv_cache_)
+    kv_cache_->LoadState(file, total_length);
+}
+
 void DecoderOnly_State::UpdateInputsOutputs(DeviceSpan<int32_t>& next_tokens, DeviceSpan<int32_t> beam_indices, int total_length) {
   input_ids_.Update(next_tokens);
   size_t new_length = static_cast<size_t>(input_ids_.GetShape()[1]);
   position_inputs_.Update(next_tokens, total_length, static_cast<int>(new_length));
   kv_cache_->Update(beam_indices, total_length);
   logits_.Update(next_tokens, new_length);
+  if (next_cache_indirection_)
+    UpdateCacheIndirection(beam_indices, total_length);
+}
+
+void DecoderOnly_State::UpdateCacheIndirection(DeviceSpan<int32_t> beam_indices, int total_length) {
+  // The first run processes the prompt, which every beam shares
+  if (beam_indices.empty()) {
+    prompt_length_ = total_length;
+    return;
+  }
+
+  model_.p_device_inputs_->UpdateCacheIndirection(next_cache_indirection_->GetTensorMutableData<int32_t>(),
+                                                  cache_indirection_->GetTensorData<int32_t>(),
+                                                  beam_indices.Span().data(),
+                                                  params_->search.batch_size,
+                                                  params_->search.num_beams,
+                                                  prompt_length_,
+                                                  params_->search.max_length,
+                                                  total_length);
+  std::swap(cache_indirection_, next_cache_indirection_);
+  inputs_[cache_indirection_index_] = cache_indirection_.get();
 }
 
 }  // namespace Generators
@@ -25,8 +25,14 @@ struct DecoderOnly_State : State {
 
   void RewindTo(size_t index) override;
 
+  void ForkFrom(State& other) override;
+
+  void SaveState(StateFileWriter& file, int total_length) override;
+  void LoadState(const StateFileReader& file, int total_length) override;
+
  private:
   void UpdateInputsOutputs(DeviceSpan<int32_t>& next_tokens, DeviceSpan<int32_t> beam_indices, int total_length);
+  void UpdateCacheIndirection(DeviceSpan<int32_t> beam_indices, int total_length);
 
   const DecoderOnly_Model& model_;
 
@@ -35,6 +41,13 @@ struct DecoderOnly_State : State {
   std::unique_ptr<KeyValueCache> kv_cache_;
   DefaultPositionInputs position_inputs_;
   ExtraInputs extra_inputs_{*this};
+
+  // For models that read the past key-values through a cache indirection, beam search only updates which beam each
+  // past position comes from, instead of reordering the key-value cache
+  std::unique_ptr<OrtValue> cache_indirection_;       // Model input { batch_size, num_beams, max_sequence_length }
+  std::unique_ptr<OrtValue> next_cache_indirection_;  // Written from cache_indirection_ every step, then swapped. Only set if the cache keeps the beams in place
+  size_t cache_indirection_index_{~0U};
+  int prompt_length_{};  // Positions that are the same in every beam
 };
 
 }  // namespace Generators
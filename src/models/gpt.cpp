@@ -1,4 +1,5 @@
 #include "../generators.h"
+#include "../state_file.h"
 #include "gpt.h"
 
 namespace Generators {
@@ -40,6 +41,28 @@ void Gpt_State::RewindTo(size_t index) {
   kv_cache_.RewindTo(index);
 }
 
+void Gpt_State::ForkFrom(State& other_state) {
+  auto& other = dynamic_cast<Gpt_State&>(other_state);
+  ForkAdaptersFrom(other);
+  input_ids_.ForkFrom(other.input_ids_);
+  position_inputs_.ForkFrom(other.position_inputs_);
+  kv_cache_.ForkFrom(other.kv_cache_);
+}
+
+void Gpt_State::SaveState(StateFileWriter& file, int total_length) {
+  SaveAdapters(file);
+  input_ids_.SaveState(file);
+  position_inputs_.SaveState(file);
+  kv_cache_.SaveState(file, total_length);
+}
+
+void Gpt_State::LoadState(const StateFileReader& file, int total_length) {
+  CheckAdapters(file);
+  input_ids_.LoadState(file);
+  position_inputs_.LoadState(file);
+  kv_cache_.LoadState(file, total_length);
+}
+
 void Gpt_State::UpdateInputsOutputs(DeviceSpan<int32_t>& next_tokens, DeviceSpan<int32_t> beam_indices, int total_length) {
   input_ids_.Update(next_tokens);
   size_t new_length = static_cast<size_t>(input_ids_.GetShape()[1]);
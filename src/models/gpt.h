@@ -25,6 +25,11 @@ struct Gpt_State : State {
 
   void RewindTo(size_t index) override;
 
+  void ForkFrom(State& other) override;
+
+  void SaveState(StateFileWriter& file, int total_length) override;
+  void LoadState(const StateFileReader& file, int total_length) override;
+
  private:
   void UpdateInputsOutputs(DeviceSpan<int32_t>& next_tokens, DeviceSpan<int32_t> beam_indices, int current_length);
 
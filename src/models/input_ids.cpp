@@ -1,6 +1,7 @@
 #include "../generators.h"
 #include "model.h"
 #include "input_ids.h"
+#include "../state_file.h"
 
 namespace Generators {
 
@@ -103,6 +104,31 @@ void DefaultInputIDs::Update(DeviceSpan<int32_t> new_tokens) {
   is_prompt_ = false;
 }
 
+void DefaultInputIDs::ForkFrom(const DefaultInputIDs& other) {
+  is_prompt_ = other.is_prompt_;
+  if (current_sequence_length_ && past_sequence_length_) {
+    *current_sequence_length_->GetTensorMutableData<int32_t>() = *other.current_sequence_length_->GetTensorData<int32_t>();
+    *past_sequence_length_->GetTensorMutableData<int32_t>() = *other.past_sequence_length_->GetTensorData<int32_t>();
+  }
+}
+
+void DefaultInputIDs::SaveState(StateFileWriter& file) const {
+  file.WriteValue("input_ids.is_prompt", is_prompt_);
+  if (current_sequence_length_ && past_sequence_length_) {
+    file.WriteValue("input_ids.sequence_lengths", std::array<int32_t, 2>{*current_sequence_length_->GetTensorData<int32_t>(),
+                                                                         *past_sequence_length_->GetTensorData<int32_t>()});
+  }
+}
+
+void DefaultInputIDs::LoadState(const StateFileReader& file) {
+  is_prompt_ = file.ReadValue<bool>("input_ids.is_prompt");
+  if (current_sequence_length_ && past_sequence_length_) {
+    auto sequence_lengths = file.ReadValue<std::array<int32_t, 2>>("input_ids.sequence_lengths");
+    *current_sequence_length_->GetTensorMutableData<int32_t>() = sequence_lengths[0];
+    *past_sequence_length_->GetTensorMutableData<int32_t>() = sequence_lengths[1];
+  }
+}
+
 WindowedInputIDs::WindowedInputIDs(State& state) : state_{state} {
   if (model_.p_device_inputs_->GetType() != DeviceType::QNN &&
       model_.p_device_inputs_->GetType() != DeviceType::CPU) {
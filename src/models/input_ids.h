@@ -27,6 +27,12 @@ struct DefaultInputIDs : InputIDs {
 
   OrtValue* Get() override { return value_->GetOrtTensor(); }
 
+  // Continues from other, the input_ids of a state this one is forked from. The next update sets the value.
+  void ForkFrom(const DefaultInputIDs& other);
+
+  void SaveState(StateFileWriter& file) const;
+  void LoadState(const StateFileReader& file);
+
  private:
   State& state_;
   const Model& model_{state_.model_};
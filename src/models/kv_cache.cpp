@@ -4,6 +4,8 @@
 #include "../generators.h"
 #include "model.h"
 #include "kv_cache.h"
+#include "beam_reorder.h"
+#include "../state_file.h"
 #include "windowed_kv_cache.h"
 #include "../openvino/interface.h"
 
@@ -47,10 +49,21 @@ void CombinedKeyValueCache::Add() {
 void CombinedKeyValueCache::Update(DeviceSpan<int32_t> beam_indices, int total_length) {
   assert(state_.params_->search.num_beams == 1 || !beam_indices.empty());  // We require beam_indices if we're a beam search
 
+  if (rewind_length_ > 0) {
+    if (type_ == Ort::TypeToTensorType<float>)
+      RewindPastTensorsTo<float>(rewind_length_);
+    else
+      RewindPastTensorsTo<Ort::Float16_t>(rewind_length_);
+    rewind_length_ = 0;
+  }
+
   if (!is_first_update_) {
     for (int i = 0; i < layer_count_; i++) {
       if (beam_indices.empty()) {
         pasts_[i] = std::move(presents_[i]);
+      } else if (Device().GetType() == DeviceType::CPU) {
+        ReorderBeamsInPlace(ByteWrapTensor(Device(), *presents_[i]).CpuSpan(), 2, beam_indices.CopyDeviceToCpu(), reorder_scratch_);
+        pasts_[i] = std::move(presents_[i]);
       } else {
         PickPastState(beam_indices, i);
       }
@@ -68,36 +81,85 @@ void CombinedKeyValueCache::Update(DeviceSpan<int32_t> beam_indices, int total_l
 }
 
 void CombinedKeyValueCache::RewindTo(size_t index) {
-  if (shape_[3] <= static_cast<int>(index)) {
+  if (shape_[3] < static_cast<int>(index)) {
     throw std::runtime_error("Requested length of rewind is greater than the current length.");
   }
 
   is_first_update_ = true;
+  shape_[3] = static_cast<int>(index);
+  // The pasts are only cut from the presents by the next update, so rewinding again before that is free
+  rewind_length_ = index;
   if (index == 0) {
     for (int i = 0; i < layer_count_; i++) {
       pasts_[i] = nullptr;
       state_.inputs_[input_index_ + i] = empty_past_.get();
     }
-  } else if (type_ == Ort::TypeToTensorType<float>) {
-    RewindPastTensorsTo<float>(index);
-  } else {
-    RewindPastTensorsTo<Ort::Float16_t>(index);
   }
 }
 
+void CombinedKeyValueCache::ForkFrom(KeyValueCache& other_cache) {
+  auto& other = dynamic_cast<CombinedKeyValueCache&>(other_cache);
+  is_first_update_ = other.is_first_update_;
+  rewind_length_ = other.rewind_length_;
+  shape_ = other.shape_;
+  for (int i = 0; i < layer_count_; i++) {
+    pasts_[i] = other.pasts_[i];
+    presents_[i] = other.presents_[i];
+    state_.inputs_[input_index_ + i] = pasts_[i] ? pasts_[i].get() : empty_past_.get();
+    state_.outputs_[output_index_ + i] = presents_[i].get();
+  }
+}
+
+void CombinedKeyValueCache::SaveState(StateFileWriter& file, int total_length) {
+  // The presents always hold exactly the sequence, so they are saved whole
+  assert(shape_[3] == total_length);
+  file.WriteValue("kv_cache.shape", shape_);
+  file.WriteValue("kv_cache.type", type_);
+  for (int i = 0; i < layer_count_; i++)
+    file.Write("kv_cache." + std::to_string(i), ByteWrapTensor(Device(), *presents_[i]).CopyDeviceToCpu());
+}
+
+void CombinedKeyValueCache::LoadState(const StateFileReader& file, int total_length) {
+  auto shape = shape_;
+  shape[3] = total_length;
+  if (file.ReadValue<std::array<int64_t, 5>>("kv_cache.shape") != shape || file.ReadValue<ONNXTensorElementDataType>("kv_cache.type") != type_)
+    throw std::runtime_error("The generator state has a different key-value cache layout.");
+
+  // The loaded tensors become the presents, which the next update moves to the pasts
+  shape_ = shape;
+  for (int i = 0; i < layer_count_; i++) {
+    presents_[i] = OrtValue::CreateTensor(Allocator(), shape_, type_);
+    auto saved_data = file.Read("kv_cache." + std::to_string(i));
+    auto present = ByteWrapTensor(Device(), *presents_[i]);
+    if (saved_data.size() != present.size())
+      throw std::runtime_error("The generator state has a different key-value cache layout.");
+    std::copy(saved_data.begin(), saved_data.end(), present.CpuSpan().begin());
+    present.CopyCpuToDevice();
+    state_.outputs_[output_index_ + i] = presents_[i].get();
+  }
+  is_first_update_ = false;
+}
+
 template <typename T>
 void CombinedKeyValueCache::RewindPastTensorsTo(size_t index) {
-  assert(index > 0 && shape_[3] >= static_cast<int64_t>(index));
+  const int64_t present_length = presents_[0]->GetTensorTypeAndShapeInfo()->GetShape()[3];
+  assert(index > 0 && present_length >= static_cast<int64_t>(index));
   std::array<int64_t, 5> new_shape = shape_;
   new_shape[3] = static_cast<int>(index);
   auto batch_x_num_heads = new_shape[1] * new_shape[2];
   auto new_length_x_head_size = new_shape[3] * new_shape[4];
-  auto old_length_x_head_size = shape_[3] * new_shape[4];
-  shape_[3] = new_shape[3];
+  auto old_length_x_head_size = present_length * new_shape[4];
 
   for (int i = 0; i < layer_count_; i++) {
+    // Only the last sampled token was dropped, which the presents don't hold yet
+    if (present_length == new_shape[3]) {
+      pasts_[i] = presents_[i];
+      state_.inputs_[input_index_ + i] = pasts_[i].get();
+      continue;
+    }
+
     OrtValue& present = *presents_[i];
-    std::unique_ptr<OrtValue> past = OrtValue::CreateTensor(Allocator(), shape_, type_);
+    std::unique_ptr<OrtValue> past = OrtValue::CreateTensor(Allocator(), new_shape, type_);
     auto present_span = WrapTensor<T>(Device(), present);
     auto past_span = WrapTensor<T>(Device(), *past);
 
@@ -149,13 +211,18 @@ void CombinedKeyValueCache::PickPastState(DeviceSpan<int32_t> beam_indices, int
 DefaultKeyValueCache::DefaultKeyValueCache(State& state)
     : state_{state},
       layer_count_{model_.config_->model.decoder.num_hidden_layers},
-      past_present_share_buffer_{state_.params_->search.past_present_share_buffer && (state_.params_->search.num_beams == 1 || model_.config_->model.type == "whisper")},
+      quantized_{model_.config_->model.decoder.kv_cache_quantization.has_value()},
+      growable_{state_.params_->search.growable_kv_cache && Device().GetType() == DeviceType::CPU && model_.config_->model.type != "whisper" && !quantized_},
+      reorders_beams_{growable_ && state_.params_->search.num_beams > 1 && !model_.session_info_.HasInput(model_.config_->model.decoder.inputs.cache_indirection)},
+      past_present_share_buffer_{growable_ || (state_.params_->search.past_present_share_buffer && !quantized_ && (state_.params_->search.num_beams == 1 || model_.config_->model.type == "whisper" || model_.session_info_.HasInput(model_.config_->model.decoder.inputs.cache_indirection)))},
       shape_{state_.params_->BatchBeamSize(), model_.config_->model.decoder.num_key_value_heads, 0, model_.config_->model.decoder.head_size} {
-  if (g_log.enabled && g_log.warning && past_present_share_buffer_ != state_.params_->search.past_present_share_buffer)
+  if (g_log.enabled && g_log.warning && state_.params_->search.past_present_share_buffer && !past_present_share_buffer_)
     Log("warning", "past_present_share_buffer search option set to true, but has been disabled due to the current configuration. See https://aka.ms/generate_config for details");
+  if (g_log.enabled && g_log.warning && state_.params_->search.growable_kv_cache && !growable_)
+    Log("warning", "growable_kv_cache search option set to true, but is only supported on CPU for decoder models without kv_cache_quantization");
 
-  pasts_.resize(layer_count_ * 2);
-  presents_.reserve(layer_count_ * 2);
+  pasts_.resize(TensorCount());
+  presents_.reserve(TensorCount());
 
   for (int i = 0; i < layer_count_; ++i) {
     input_name_strings_.emplace_back(ComposeKeyValueName(model_.config_->model.decoder.inputs.past_key_names, i));
@@ -169,6 +236,37 @@ DefaultKeyValueCache::DefaultKeyValueCache(State& state)
   type_ = model_.session_info_.GetInputDataType(input_name_strings_[0]);
   empty_past_ = OrtValue::CreateTensor(Allocator(), shape_, type_);
 
+  if (quantized_) {
+    // The model quantizes the keys and values it writes, with one scale per group of group_size elements of a head
+    // and token, and dequantizes the pasts it reads. The cache only has to carry the scales along with them.
+    const auto& quantization = *model_.config_->model.decoder.kv_cache_quantization;
+    ONNXTensorElementDataType expected_type;
+    if (quantization.type == "int8")
+      expected_type = Ort::TypeToTensorType<int8_t>;
+    else if (quantization.type == "fp8")
+      expected_type = ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT8E4M3FN;
+    else
+      throw std::runtime_error("Unknown kv_cache_quantization type: " + quantization.type + ". Expected int8 or fp8.");
+    if (type_ != expected_type)
+      throw std::runtime_error("kv_cache_quantization type is " + quantization.type + ", but the model's key-value cache inputs have a different type.");
+
+    const int head_size = model_.config_->model.decoder.head_size;
+    const int group_size = quantization.group_size != 0 ? quantization.group_size : head_size;
+    if (group_size <= 0 || head_size % group_size != 0)
+      throw std::runtime_error("kv_cache_quantization group_size must divide head_size (" + std::to_string(head_size) + "), but is " + std::to_string(group_size));
+    scale_group_count_ = head_size / group_size;
+
+    for (int i = 0; i < layer_count_; ++i) {
+      input_name_strings_.emplace_back(ComposeKeyValueName(model_.config_->model.decoder.inputs.past_key_scale_names, i));
+      input_name_strings_.emplace_back(ComposeKeyValueName(model_.config_->model.decoder.inputs.past_value_scale_names, i));
+
+      output_name_strings_.emplace_back(ComposeKeyValueName(model_.config_->model.decoder.outputs.present_key_scale_names, i));
+      output_name_strings_.emplace_back(ComposeKeyValueName(model_.config_->model.decoder.outputs.present_value_scale_names, i));
+    }
+    scale_type_ = model_.session_info_.GetInputDataType(input_name_strings_[layer_count_ * 2]);
+    empty_past_scale_ = CreateTensor(layer_count_ * 2, shape_);
+  }
+
   if (state_.params_->use_graph_capture && !past_present_share_buffer_) {
     // share buffer is a precondition for graph capture
     throw std::runtime_error("Graph capture is not supported with past_present_share_buffer set to false.");
@@ -180,13 +278,16 @@ DefaultKeyValueCache::DefaultKeyValueCache(State& state)
       model_.config_->model.decoder.sliding_window->window_size > 0) {
     shape_[2] = std::min(state_.params_->search.max_length,
                          model_.config_->model.decoder.sliding_window->window_size);
+  } else if (growable_) {
+    constexpr int initial_length = 256;  // Grown on the first update if the prompt is longer
+    shape_[2] = std::min(state_.params_->search.max_length, initial_length);
   } else if (past_present_share_buffer_) {
     shape_[2] = state_.params_->search.max_length;
   }
 
   try {
-    for (int i = 0; i < layer_count_ * 2; ++i) {
-      presents_.push_back(OrtValue::CreateTensor(Allocator(), shape_, type_));
+    for (int i = 0; i < TensorCount(); ++i) {
+      presents_.push_back(CreateTensor(i, shape_));
 
       // Zero the memory so we don't leak any data from the previous run
       // WebGPU device has no Zero() implementation yet. Since this zeroing is optional we disable it for WebGPU for now
@@ -209,30 +310,55 @@ void DefaultKeyValueCache::Add() {
   input_index_ = state_.inputs_.size();
   output_index_ = state_.outputs_.size();
 
-  for (int i = 0; i < layer_count_ * 2; ++i) {
-    state_.inputs_.push_back(empty_past_.get());  // Set empty past here, Update() takes care of the rest
+  for (int i = 0; i < TensorCount(); ++i) {
+    state_.inputs_.push_back(EmptyPast(i));  // Set empty past here, Update() takes care of the rest
     state_.input_names_.push_back(input_name_strings_[i].c_str());
     state_.outputs_.push_back(presents_[i].get());
     state_.output_names_.push_back(output_name_strings_[i].c_str());
   }
 
   // For shared_past_present, the past & presents never change, so set the inputs to the present values (outputs are already set above)
-  if (past_present_share_buffer_) {
-    for (int i = 0; i < layer_count_ * 2; ++i) {
-      state_.inputs_[input_index_ + i] = presents_[i].get();
-    }
+  if (past_present_share_buffer_)
+    SetSharedBuffers();
+}
+
+void DefaultKeyValueCache::SetSharedBuffers() {
+  for (int i = 0; i < TensorCount(); ++i) {
+    state_.inputs_[input_index_ + i] = presents_[i].get();
+    state_.outputs_[output_index_ + i] = presents_[i].get();
   }
 }
 
 void DefaultKeyValueCache::Update(DeviceSpan<int32_t> beam_indices, int total_length) {
+  if (growable_) {
+    if (total_length > shape_[2])
+      Grow(total_length);
+    // The model wrote the new tokens of every beam in place, so the beams are reordered in the same buffers
+    if (reorders_beams_ && !is_first_update_) {
+      auto beam_indices_cpu = beam_indices.CopyDeviceToCpu();
+      for (int i = 0; i < TensorCount(); i++)
+        ReorderBeamsInPlace(ByteWrapTensor(Device(), *presents_[i]).CpuSpan(), 1, beam_indices_cpu, reorder_scratch_);
+    }
+    is_first_update_ = false;
+    return;
+  }
+
   // If we're sharing past & present buffers there is nothing to do here, so early exit
   if (past_present_share_buffer_)
     return;
 
+  if (rewind_length_ > 0) {
+    RewindPastTensorsTo(rewind_length_);
+    rewind_length_ = 0;
+  }
+
   if (!is_first_update_) {
-    for (int i = 0; i < layer_count_ * 2; i++) {
+    for (int i = 0; i < TensorCount(); i++) {
       if (beam_indices.empty()) {
         pasts_[i] = std::move(presents_[i]);
+      } else if (Device().GetType() == DeviceType::CPU) {
+        ReorderBeamsInPlace(ByteWrapTensor(Device(), *presents_[i]).CpuSpan(), 1, beam_indices.CopyDeviceToCpu(), reorder_scratch_);
+        pasts_[i] = std::move(presents_[i]);
       } else {
         PickPastState(beam_indices, i);
       }
@@ -241,8 +367,8 @@ void DefaultKeyValueCache::Update(DeviceSpan<int32_t> beam_indices, int total_le
   }
 
   shape_[2] = total_length;
-  for (int i = 0; i < layer_count_ * 2; i++) {
-    presents_[i] = OrtValue::CreateTensor(Allocator(), shape_, type_);
+  for (int i = 0; i < TensorCount(); i++) {
+    presents_[i] = CreateTensor(i, shape_);
     state_.outputs_[output_index_ + i] = presents_[i].get();
   }
 
@@ -250,63 +376,178 @@ void DefaultKeyValueCache::Update(DeviceSpan<int32_t> beam_indices, int total_le
 }
 
 void DefaultKeyValueCache::RewindTo(size_t index) {
+  // The model only reads the shared buffers up to the length of the attention mask, so they are left as they are
   if (past_present_share_buffer_) {
     return;
-  } else if (shape_[2] <= static_cast<int>(index)) {
+  } else if (shape_[2] < static_cast<int>(index)) {
     throw std::runtime_error("Requested length of rewind is greater than the current length.");
   }
 
   is_first_update_ = true;
+  shape_[2] = static_cast<int>(index);
+  // The pasts are only cut from the presents by the next update, so rewinding again before that is free
+  rewind_length_ = index;
   if (index == 0) {
-    for (int i = 0; i < layer_count_ * 2; i++) {
+    for (int i = 0; i < TensorCount(); i++) {
       pasts_[i] = nullptr;
-      state_.inputs_[input_index_ + i] = empty_past_.get();
+      state_.inputs_[input_index_ + i] = EmptyPast(i);
+    }
+  }
+}
+
+void DefaultKeyValueCache::ForkFrom(KeyValueCache& other_cache) {
+  auto& other = dynamic_cast<DefaultKeyValueCache&>(other_cache);
+  is_first_update_ = other.is_first_update_;
+  rewind_length_ = other.rewind_length_;
+
+  // The model writes the new tokens into a shared past/present buffer in place, so the fork needs its own copy
+  if (past_present_share_buffer_) {
+    if (growable_ && shape_[2] != other.shape_[2]) {
+      shape_ = other.shape_;
+      for (int i = 0; i < TensorCount(); i++)
+        presents_[i] = CreateTensor(i, shape_);
+      SetSharedBuffers();
+    }
+    for (int i = 0; i < TensorCount(); i++)
+      ByteWrapTensor(Device(), *presents_[i]).CopyFrom(ByteWrapTensor(Device(), *other.presents_[i]));
+    return;
+  }
+
+  // Otherwise the tensors are only read, and each state allocates its own presents on its next update
+  shape_ = other.shape_;
+  for (int i = 0; i < TensorCount(); i++) {
+    pasts_[i] = other.pasts_[i];
+    presents_[i] = other.presents_[i];
+    state_.inputs_[input_index_ + i] = pasts_[i] ? pasts_[i].get() : EmptyPast(i);
+    state_.outputs_[output_index_ + i] = presents_[i].get();
+  }
+}
+
+void DefaultKeyValueCache::SaveState(StateFileWriter& file, int total_length) {
+  std::array<int64_t, 4> shape = shape_;
+  shape[2] = total_length;
+  file.WriteValue("kv_cache.shape", shape);
+  file.WriteValue("kv_cache.type", type_);
+
+  // Shared buffers are longer than the sequence, so only the first total_length positions of every row are saved
+  const size_t row_count = static_cast<size_t>(shape_[0] * shape_[1]);
+  for (int i = 0; i < TensorCount(); i++) {
+    const int64_t present_length = presents_[i]->GetTensorTypeAndShapeInfo()->GetShape()[2];
+    assert(present_length >= total_length);
+    auto present_data = ByteWrapTensor(Device(), *presents_[i]).CopyDeviceToCpu();
+    const size_t present_row_size = present_data.size() / row_count;
+    const size_t saved_row_size = present_row_size / present_length * total_length;
+
+    const std::string name = "kv_cache." + std::to_string(i);
+    file.Write(name, present_data.subspan(0, saved_row_size));
+    for (size_t row = 1; row < row_count; row++)
+      file.Append(present_data.subspan(row * present_row_size, saved_row_size));
+  }
+}
+
+void DefaultKeyValueCache::LoadState(const StateFileReader& file, int total_length) {
+  auto shape = file.ReadValue<std::array<int64_t, 4>>("kv_cache.shape");
+  if (file.ReadValue<ONNXTensorElementDataType>("kv_cache.type") != type_ || shape[0] != shape_[0] ||
+      shape[1] != shape_[1] || shape[2] != total_length || shape[3] != shape_[3])
+    throw std::runtime_error("The generator state has a different key-value cache layout.");
+
+  if (past_present_share_buffer_) {
+    if (total_length > shape_[2]) {
+      if (!growable_)
+        throw std::runtime_error("The saved sequence is longer than the key-value cache.");
+      Grow(total_length);
     }
-  } else if (type_ == Ort::TypeToTensorType<float>) {
-    RewindPastTensorsTo<float>(index);
   } else {
-    RewindPastTensorsTo<Ort::Float16_t>(index);
+    // The loaded tensors become the presents, which the next update moves to the pasts
+    shape_[2] = total_length;
+    for (int i = 0; i < TensorCount(); i++) {
+      presents_[i] = CreateTensor(i, shape_);
+      state_.outputs_[output_index_ + i] = presents_[i].get();
+    }
   }
+
+  const size_t row_count = static_cast<size_t>(shape_[0] * shape_[1]);
+  for (int i = 0; i < TensorCount(); i++) {
+    auto saved_data = file.Read("kv_cache." + std::to_string(i));
+    auto present = ByteWrapTensor(Device(), *presents_[i]);
+    auto present_data = present.CpuSpan();
+    const size_t present_row_size = present_data.size() / row_count;
+    const size_t saved_row_size = saved_data.size() / row_count;
+    if (saved_data.size() != saved_row_size * row_count || saved_row_size > present_row_size)
+      throw std::runtime_error("The generator state has a different key-value cache layout.");
+
+    for (size_t row = 0; row < row_count; row++) {
+      uint8_t* present_row = present_data.data() + row * present_row_size;
+      std::copy_n(saved_data.data() + row * saved_row_size, saved_row_size, present_row);
+      std::fill(present_row + saved_row_size, present_row + present_row_size, uint8_t{});
+    }
+    present.CopyCpuToDevice();
+  }
+  is_first_update_ = false;
 }
 
-template <typename T>
 void DefaultKeyValueCache::RewindPastTensorsTo(size_t index) {
-  assert(index > 0 && shape_[2] >= static_cast<int64_t>(index) && !past_present_share_buffer_);
+  const int64_t present_length = presents_[0]->GetTensorTypeAndShapeInfo()->GetShape()[2];
+  assert(index > 0 && present_length >= static_cast<int64_t>(index) && !past_present_share_buffer_);
   std::array<int64_t, 4> new_shape = shape_;
   new_shape[2] = static_cast<int>(index);
-  auto batch_x_num_heads = new_shape[0] * new_shape[1];
-  auto new_length_x_head_size = new_shape[2] * new_shape[3];
-  auto old_length_x_head_size = shape_[2] * new_shape[3];
-  shape_[2] = new_shape[2];
+  const size_t row_count = static_cast<size_t>(new_shape[0] * new_shape[1]);
 
-  for (int i = 0; i < layer_count_ * 2; i++) {
-    OrtValue& present = *presents_[i];
-    std::unique_ptr<OrtValue> past = OrtValue::CreateTensor(Allocator(), shape_, type_);
+  for (int i = 0; i < TensorCount(); i++) {
+    // Only the last sampled token was dropped, which the presents don't hold yet
+    if (present_length == new_shape[2]) {
+      pasts_[i] = presents_[i];
+      state_.inputs_[input_index_ + i] = pasts_[i].get();
+      continue;
+    }
 
-    auto past_span = WrapTensor<T>(Device(), *past);
-    auto present_span = WrapTensor<T>(Device(), present);
+    std::unique_ptr<OrtValue> past = CreateTensor(i, new_shape);
+    auto past_data = ByteWrapTensor(Device(), *past);
+    auto present_data = ByteWrapTensor(Device(), *presents_[i]);
 
-    for (int j = 0; j < batch_x_num_heads; j++) {
-      auto present_data = present_span.subspan(j * old_length_x_head_size, new_length_x_head_size);
-      auto past_data = past_span.subspan(j * new_length_x_head_size, new_length_x_head_size);
-      past_data.CopyFrom(present_data);
-    }
+    // Every head of every sequence is a row, of which the first index tokens are kept
+    const size_t past_row_size = past_data.size() / row_count;
+    const size_t present_row_size = present_data.size() / row_count;
+    for (size_t row = 0; row < row_count; row++)
+      past_data.subspan(row * past_row_size, past_row_size).CopyFrom(present_data.subspan(row * present_row_size, past_row_size));
     pasts_[i] = std::move(past);
     state_.inputs_[input_index_ + i] = pasts_[i].get();
   }
 }
 
+void DefaultKeyValueCache::Grow(int64_t length) {
+  assert(growable_ && length > shape_[2]);
+  // Doubling the length keeps the copies to a constant amount per token on average
+  std::array<int64_t, 4> new_shape = shape_;
+  new_shape[2] = std::min<int64_t>(std::max(length, shape_[2] * 2), state_.params_->search.max_length);
+  const size_t row_count = static_cast<size_t>(shape_[0] * shape_[1]);
+
+  for (int i = 0; i < TensorCount(); i++) {
+    std::unique_ptr<OrtValue> present = OrtValue::CreateTensor(Allocator(), new_shape, type_);
+    auto old_data = ByteWrapTensor(Device(), *presents_[i]).CpuSpan();
+    auto new_data = ByteWrapTensor(Device(), *present).CpuSpan();
+    // Every head of every sequence is a row of length * head_size elements
+    const size_t old_row_size = old_data.size() / row_count;
+    const size_t new_row_size = new_data.size() / row_count;
+    for (size_t row = 0; row < row_count; row++) {
+      uint8_t* new_row = new_data.data() + row * new_row_size;
+      std::copy_n(old_data.data() + row * old_row_size, old_row_size, new_row);
+      std::fill(new_row + old_row_size, new_row + new_row_size, uint8_t{});
+    }
+    presents_[i] = std::move(present);
+  }
+  shape_ = new_shape;
+  SetSharedBuffers();
+}
+
 // Copy present state to past state reordered by the beam_indices
-template <typename ScoreType>
 void DefaultKeyValueCache::PickPastState(DeviceSpan<int32_t> beam_indices_device, int index) {
   std::span<int32_t> beam_indices = beam_indices_device.CopyDeviceToCpu();
-  auto block_size_per_beam = shape_[1] * shape_[2] * shape_[3];
-
-  OrtValue& present_value = *presents_[index];
-  std::unique_ptr<OrtValue> past_value = OrtValue::CreateTensor<ScoreType>(Allocator(), shape_);
 
-  auto past_span = WrapTensor<ScoreType>(Device(), *past_value);
-  auto present_span = WrapTensor<ScoreType>(Device(), present_value);
+  std::unique_ptr<OrtValue> past_value = CreateTensor(index, shape_);
+  auto past_span = ByteWrapTensor(Device(), *past_value);
+  auto present_span = ByteWrapTensor(Device(), *presents_[index]);
+  const size_t block_size_per_beam = past_span.size() / beam_indices.size();
 
   for (size_t j = 0; j < beam_indices.size(); j++) {
     int32_t beam_index = beam_indices[j];
@@ -318,12 +559,11 @@ void DefaultKeyValueCache::PickPastState(DeviceSpan<int32_t> beam_indices_device
   pasts_[index] = std::move(past_value);
 }
 
-void DefaultKeyValueCache::PickPastState(DeviceSpan<int32_t> beam_indices, int index) {
-  if (type_ == Ort::TypeToTensorType<float>) {
-    PickPastState<float>(beam_indices, index);
-  } else {
-    PickPastState<Ort::Float16_t>(beam_indices, index);
-  }
+std::unique_ptr<OrtValue> DefaultKeyValueCache::CreateTensor(int index, std::array<int64_t, 4> shape) {
+  if (index < layer_count_ * 2)
+    return OrtValue::CreateTensor(Allocator(), shape, type_);
+  shape[3] = scale_group_count_;
+  return OrtValue::CreateTensor(Allocator(), shape, scale_type_);
 }
 
 CrossCache::CrossCache(State& state, int sequence_length) {
@@ -421,6 +661,8 @@ std::unique_ptr<KeyValueCache> CreateKeyValueCache(State& state) {
   if (state.model_.p_device_->GetType() != DeviceType::NvTensorRtRtx &&
       state.model_.config_->model.decoder.sliding_window &&
       state.model_.config_->model.decoder.sliding_window->slide_key_value_cache) {
+    if (state.model_.config_->model.decoder.kv_cache_quantization)
+      throw std::runtime_error("kv_cache_quantization is not supported with a sliding window key-value cache.");
     return std::make_unique<WindowedKeyValueCache>(state);
   }
 
@@ -16,6 +16,23 @@ struct KeyValueCache {
 
   virtual void RewindTo(size_t index) = 0;
 
+  // True if Update leaves the past key-values of every beam where the model wrote them during beam search, so a model
+  // with a cache_indirection input has to be told which beam each position comes from. Otherwise Update reorders them.
+  virtual bool KeepsBeamsInPlace() const { return false; }
+
+  // Takes over the contents of other, the cache of a state this one is forked from
+  virtual void ForkFrom(KeyValueCache& other) {
+    throw std::runtime_error("Fork is not supported by this key-value cache.");
+  }
+
+  // Writes the first total_length positions of the cache to a state file, and reads them back into a newly created cache
+  virtual void SaveState(StateFileWriter& file, int total_length) {
+    throw std::runtime_error("SaveState is not supported by this key-value cache.");
+  }
+  virtual void LoadState(const StateFileReader& file, int total_length) {
+    throw std::runtime_error("LoadState is not supported by this key-value cache.");
+  }
+
   // Note: PartialUpdate() is mainly for supporting DecoderOnlyPipelineState usage where we update
   // part of the KV cache after running part of the pipeline.
   // An alternative may be to have a dedicated KV cache per IntermediatePipelineState.
@@ -34,6 +51,9 @@ struct CombinedKeyValueCache : KeyValueCache {
   void Add() override;  // Add to state inputs/outputs
   void Update(DeviceSpan<int32_t> beam_indices, int total_length) override;
   void RewindTo(size_t index) override;
+  void ForkFrom(KeyValueCache& other) override;
+  void SaveState(StateFileWriter& file, int total_length) override;
+  void LoadState(const StateFileReader& file, int total_length) override;
 
  private:
   template <typename ScoreType>
@@ -52,13 +72,17 @@ struct CombinedKeyValueCache : KeyValueCache {
   size_t input_index_{~0U}, output_index_{~0U};
 
   bool is_first_update_{true};
+  size_t rewind_length_{};  // Length the pasts are cut to from the presents on the next update, 0 if there is no pending rewind
 
   std::array<int64_t, 5> shape_;
   ONNXTensorElementDataType type_;
 
   std::unique_ptr<OrtValue> empty_past_;
-  std::vector<std::unique_ptr<OrtValue>> pasts_, presents_;
+  // Shared with the caches of forked states. That only happens when the model reads the past and writes a new
+  // present, so shared tensors are never written to.
+  std::vector<std::shared_ptr<OrtValue>> pasts_, presents_;
   std::vector<std::string> input_name_strings_, output_name_strings_;
+  std::vector<uint8_t> reorder_scratch_;  // Beams staged while reordering the presents in place on CPU
 };
 
 struct DefaultKeyValueCache : KeyValueCache {
@@ -74,15 +98,24 @@ struct DefaultKeyValueCache : KeyValueCache {
   // Move present to past. Prepare present output for next generation iteration.
   void Update(DeviceSpan<int32_t> beam_indices, int total_length) override;
   void RewindTo(size_t index) override;
+  bool KeepsBeamsInPlace() const override { return past_present_share_buffer_ && !reorders_beams_; }
+  void ForkFrom(KeyValueCache& other) override;
+  void SaveState(StateFileWriter& file, int total_length) override;
+  void LoadState(const StateFileReader& file, int total_length) override;
 
  private:
-  template <typename ScoreType>
   void PickPastState(DeviceSpan<int32_t> beam_indices, int index);
-  void PickPastState(DeviceSpan<int32_t> beam_indices, int index);
-
-  template <typename T>
   void RewindPastTensorsTo(size_t index);
 
+  // Moves the shared past/present tensors to buffers of a larger length, keeping their contents
+  void Grow(int64_t length);
+  void SetSharedBuffers();
+
+  // The keys and values of every layer come first in pasts_/presents_, followed by their scales if quantized_
+  int TensorCount() const { return layer_count_ * (quantized_ ? 4 : 2); }
+  std::unique_ptr<OrtValue> CreateTensor(int index, std::array<int64_t, 4> shape);
+  OrtValue* EmptyPast(int index) { return index < layer_count_ * 2 ? empty_past_.get() : empty_past_scale_.get(); }
+
   DeviceInterface& Device() { return *model_.p_device_kvcache_; }
   Ort::Allocator& Allocator() { return model_.p_device_kvcache_->GetAllocator(); }
 
@@ -90,16 +123,25 @@ struct DefaultKeyValueCache : KeyValueCache {
   const Model& model_{state_.model_};
   int layer_count_;
   size_t input_index_{~0U}, output_index_{~0U};
-  bool past_present_share_buffer_;  // True if model.decoder.past_present_share_buffer is set to true, and we're using cuda, and not beam search
+  bool quantized_;                  // True if model.decoder.kv_cache_quantization is set. The model then reads and writes a scale tensor for every key and value tensor
+  bool growable_;                   // True if search.growable_kv_cache is set on CPU. The shared buffers then double in length as needed, instead of being allocated to max_length
+  bool reorders_beams_;             // True if growable_ with beam search, and the model doesn't read the cache through a cache_indirection
+  bool past_present_share_buffer_;  // True if model.decoder.past_present_share_buffer is set to true, either not beam search or the model reads the cache through a cache_indirection, and not quantized_. Always true if growable_
 
   bool is_first_update_{true};
+  size_t rewind_length_{};  // Length the pasts are cut to from the presents on the next update, 0 if there is no pending rewind
 
   std::array<int64_t, 4> shape_;
   ONNXTensorElementDataType type_;
+  int64_t scale_group_count_{};  // Scales per head and token if quantized_, the last dimension of the scale tensors
+  ONNXTensorElementDataType scale_type_{};
 
-  std::unique_ptr<OrtValue> empty_past_;
-  std::vector<std::unique_ptr<OrtValue>> pasts_, presents_;
+  std::unique_ptr<OrtValue> empty_past_, empty_past_scale_;
+  // Shared with the caches of forked states. That only happens when the model reads the past and writes a new
+  // present, so shared tensors are never written to.
+  std::vector<std::shared_ptr<OrtValue>> pasts_, presents_;
   std::vector<std::string> input_name_strings_, output_name_strings_;
+  std::vector<uint8_t> reorder_scratch_;  // Beams staged while reordering the presents in place on CPU
 };
 
 // Very similar to the DefaultKeyValueCache, but is only created once at the encoder step, then used without modification for every decoder step
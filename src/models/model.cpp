@@ -11,6 +11,7 @@
 
 #include "../generators.h"
 #include "../search.h"
+#include "../state_file.h"
 #include "../tracing.h"
 #include "model.h"
 #include "gpt.h"
@@ -201,6 +202,39 @@ void State::SetActiveAdapter(Adapters* adapters, const std::string& adapter_name
   adapter_names_.push_back(adapter_name);
 }
 
+void State::ForkFrom(State& /*other*/) {
+  throw std::runtime_error("Fork is not supported for " + model_.config_->model.type + ".");
+}
+
+void State::ForkAdaptersFrom(const State& other) {
+  for (const auto& adapter_name : other.adapter_names_)
+    SetActiveAdapter(other.adapters_.get(), adapter_name);
+}
+
+void State::SaveState(StateFileWriter& /*file*/, int /*total_length*/) {
+  throw std::runtime_error("SaveState is not supported for " + model_.config_->model.type + ".");
+}
+
+void State::LoadState(const StateFileReader& /*file*/, int /*total_length*/) {
+  throw std::runtime_error("LoadState is not supported for " + model_.config_->model.type + ".");
+}
+
+void State::SaveAdapters(StateFileWriter& file) const {
+  std::string names;
+  for (const auto& adapter_name : adapter_names_)
+    names += adapter_name + '\n';
+  file.Write("adapters", {reinterpret_cast<const uint8_t*>(names.data()), names.size()});
+}
+
+void State::CheckAdapters(const StateFileReader& file) const {
+  auto saved = file.Read("adapters");
+  std::string names;
+  for (const auto& adapter_name : adapter_names_)
+    names += adapter_name + '\n';
+  if (!std::equal(saved.begin(), saved.end(), names.begin(), names.end()))
+    throw std::runtime_error("The generator state was saved with different active adapters. Set the same adapters active before calling LoadState.");
+}
+
 State::~State() {
   if (adapters_) {
     for (const auto& adapter_name : adapter_names_) {
@@ -15,6 +15,8 @@
 namespace Generators {
 
 struct Tokenizer;
+struct StateFileWriter;
+struct StateFileReader;
 
 void Cast(OrtValue& input, std::unique_ptr<OrtValue>& output, DeviceInterface& device, ONNXTensorElementDataType type);
 void CheckResult(extError_t error);
@@ -40,6 +42,15 @@ struct State {
 
   virtual void SetExtraInputs(const std::vector<ExtraInput>& extra_inputs) {}
 
+  // Brings this newly created state to the point of other, a state of the same model that already ran. The
+  // key-value cache is shared with other where the model only reads it, instead of being copied.
+  virtual void ForkFrom(State& other);
+
+  // Writes a state that already ran, up to total_length, to a state file, and reads it back into a newly created state
+  // of the same model
+  virtual void SaveState(StateFileWriter& file, int total_length);
+  virtual void LoadState(const StateFileReader& file, int total_length);
+
   void DumpInputs();
   void DumpOutputs();
 
@@ -55,6 +66,9 @@ struct State {
 
  protected:
   void Run(OrtSession& session, bool graph_capture_this_run = false);
+  void ForkAdaptersFrom(const State& other);  // Activates the adapters that are active in other
+  void SaveAdapters(StateFileWriter& file) const;
+  void CheckAdapters(const StateFileReader& file) const;  // Throws unless the adapters saved in file are active
   bool first_run_{true};
 
   std::unique_ptr<OrtRunOptions> run_options_;
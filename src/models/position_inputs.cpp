@@ -1,6 +1,7 @@
 #include "../generators.h"
 #include "model.h"
 #include "position_inputs.h"
+#include "../state_file.h"
 
 namespace Generators {
 
@@ -91,10 +92,56 @@ void DefaultPositionInputs::RewindTo(size_t index) {
       position_ids_next_ = std::make_unique<Tensor>(model_.p_device_inputs_, type_);
     // Rewind the mask input to a previous state
   } else if (has_mask_input_) {
-    if (attention_mask_shape_[0] == 1) {
-      RewindMask(index);
-    } else
-      throw std::runtime_error("DefaultPositionInputs::RewindTo - Unsupported batch size");
+    RewindMask(index);
+    if (has_posid_input_ && position_ids_shape_[0] > 1) {
+      if (type_ == Ort::TypeToTensorType<int32_t>)
+        RewindPositionIDs<int32_t>(index);
+      else
+        RewindPositionIDs<int64_t>(index);
+    }
+  } else if (has_posid_input_ && position_ids_shape_[0] > 1)
+    throw std::runtime_error("DefaultPositionInputs::RewindTo - Rewinding a batch requires an attention mask input");
+}
+
+void DefaultPositionInputs::ForkFrom(DefaultPositionInputs& other) {
+  is_first_update_ = other.is_first_update_;
+  position_ids_shape_ = other.position_ids_shape_;
+  attention_mask_shape_ = other.attention_mask_shape_;
+
+  if (has_posid_input_ && other.position_ids_->ort_tensor_) {
+    position_ids_->CreateTensor(other.position_ids_->GetShape());
+    position_ids_->GetByteSpan().CopyFrom(other.position_ids_->GetByteSpan());
+    state_.inputs_[posid_input_index_] = position_ids_->GetOrtTensor();
+  }
+  if (has_mask_input_ && other.attention_mask_->ort_tensor_) {
+    attention_mask_->CreateTensor(other.attention_mask_->GetShape());
+    attention_mask_->GetByteSpan().CopyFrom(other.attention_mask_->GetByteSpan());
+    state_.inputs_[mask_input_index_] = attention_mask_->GetOrtTensor();
+  }
+}
+
+void DefaultPositionInputs::SaveState(StateFileWriter& file) {
+  file.WriteValue("position_inputs.is_first_update", is_first_update_);
+  file.WriteValue("position_inputs.shapes", std::array{position_ids_shape_, attention_mask_shape_});
+  if (has_posid_input_)
+    WriteTensor(file, "position_ids", *position_ids_);
+  if (has_mask_input_)
+    WriteTensor(file, "attention_mask", *attention_mask_);
+}
+
+void DefaultPositionInputs::LoadState(const StateFileReader& file) {
+  is_first_update_ = file.ReadValue<bool>("position_inputs.is_first_update");
+  auto shapes = file.ReadValue<std::array<std::array<int64_t, 2>, 2>>("position_inputs.shapes");
+  position_ids_shape_ = shapes[0];
+  attention_mask_shape_ = shapes[1];
+
+  if (has_posid_input_) {
+    ReadTensor(file, "position_ids", *position_ids_);
+    state_.inputs_[posid_input_index_] = position_ids_->GetOrtTensor();
+  }
+  if (has_mask_input_) {
+    ReadTensor(file, "attention_mask", *attention_mask_);
+    state_.inputs_[mask_input_index_] = attention_mask_->GetOrtTensor();
   }
 }
 
@@ -276,7 +323,44 @@ void DefaultPositionInputs::InitializeSequenceLengths(std::array<int64_t, 2> sha
   }
 }
 
+template <typename T>
+void DefaultPositionInputs::RewindPositionIDs(size_t index) {
+  // Each row continues from the number of its tokens before index that aren't padding. Read from the rewound mask,
+  // as the prompt of every row is padded differently.
+  auto mask = attention_mask_->GetDeviceSpan<T>().CopyDeviceToCpu();
+  auto& last_position_ids = position_ids_next_ ? *position_ids_next_ : *position_ids_;
+  auto last_positions_device = last_position_ids.GetDeviceSpan<T>();
+  auto last_positions = last_positions_device.CopyDeviceToCpu();
+  for (size_t row = 0; row < last_positions.size(); row++) {
+    auto row_mask = mask.subspan(row * index, index);
+    last_positions[row] = std::accumulate(row_mask.begin(), row_mask.end(), T{}) - 1;
+  }
+  last_positions_device.CopyCpuToDevice();
+}
+
+template <typename T>
+void DefaultPositionInputs::RewindBatchedMask(size_t index) {
+  // Keep the first index entries of every row, packed at the new row length, which is what the next update expects
+  auto mask_device = attention_mask_->GetDeviceSpan<T>();
+  auto mask = mask_device.CopyDeviceToCpu();
+  const size_t length = static_cast<size_t>(attention_mask_shape_[1]);
+  for (size_t row = 1; row < static_cast<size_t>(attention_mask_shape_[0]); row++)
+    std::copy_n(mask.begin() + row * length, index, mask.begin() + row * index);
+  mask_device.CopyCpuToDevice();
+  attention_mask_shape_[1] = static_cast<int64_t>(index);
+}
+
 void DefaultPositionInputs::RewindMask(size_t index) {
+  if (attention_mask_shape_[0] > 1) {
+    if (ShouldUseStaticMaskHandling())
+      throw std::runtime_error("DefaultPositionInputs::RewindTo - Rewinding a batch is not supported with a static attention mask");
+    if (type_ == Ort::TypeToTensorType<int32_t>)
+      RewindBatchedMask<int32_t>(index);
+    else
+      RewindBatchedMask<int64_t>(index);
+    return;
+  }
+
   if (state_.params_->use_graph_capture) {
     throw std::runtime_error("PositionInputs::RewindMask - Static buffer is not supported for continuous decoding.");
 #if 0  // TODO: Fix implementation, cudaMemsetAsync of 1 is setting bytes of 1 vs int32's of 1
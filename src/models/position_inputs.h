@@ -17,6 +17,12 @@ struct DefaultPositionInputs : PositionInputs {
 
   void RewindTo(size_t index) override;
 
+  // Copies the inputs of other, the position inputs of a state this one is forked from
+  void ForkFrom(DefaultPositionInputs& other);
+
+  void SaveState(StateFileWriter& file);
+  void LoadState(const StateFileReader& file);
+
  private:
   void AddAttentionMask();
   void AddPositionIDs();
@@ -37,6 +43,10 @@ struct DefaultPositionInputs : PositionInputs {
   void InitializeStaticMask(OrtValue& cpu_attention_mask);
 
   void RewindMask(size_t index);
+  template <typename T>
+  void RewindBatchedMask(size_t index);
+  template <typename T>
+  void RewindPositionIDs(size_t index);
 
   // This returns true when either:
   // 1. Graph capture is enabled, OR
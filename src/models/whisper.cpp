@@ -209,7 +209,8 @@ void WhisperState::SetExtraInputs(const std::vector<ExtraInput>& extra_inputs) {
   }
 }
 
-void WhisperState::TransposeKCaches(std::vector<std::unique_ptr<OrtValue>>& kv_caches) {
+template <typename OrtValuePtr>
+void WhisperState::TransposeKCaches(std::vector<OrtValuePtr>& kv_caches) {
   // Transpose attention K caches for `DecoderMaskedMultiHeadAttention` kernel (done on CUDA only)
   auto kv_cache_info = kv_caches[0]->GetTensorTypeAndShapeInfo();
   auto kv_cache_type = kv_cache_info->GetElementType();
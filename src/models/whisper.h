@@ -96,7 +96,8 @@ struct WhisperState : State {
 
  private:
   // clang-format off
-  void TransposeKCaches(std::vector<std::unique_ptr<OrtValue>>& kv_caches);
+  template <typename OrtValuePtr>
+  void TransposeKCaches(std::vector<OrtValuePtr>& kv_caches);
   template <typename T> void UpdateCrossQKSearchBuffer(int current_length);
   template <typename T> void FinalizeCrossQK(int current_length);
   void UpdateInputsOutputs(DeviceSpan<int32_t>& next_tokens, DeviceSpan<int32_t> next_indices, int current_length);
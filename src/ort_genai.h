@@ -376,6 +376,10 @@ struct OgaGeneratorParams : OgaAbstract {
     OgaCheckResult(OgaGeneratorParamsSetGuidance(this, type, data));
   }
 
+  void SetDraftModel(const OgaModel& draft_model, size_t num_draft_tokens) {
+    OgaCheckResult(OgaGeneratorParamsSetDraftModel(this, &draft_model, num_draft_tokens));
+  }
+
   static void operator delete(void* p) { OgaDestroyGeneratorParams(reinterpret_cast<OgaGeneratorParams*>(p)); }
 };
 
@@ -427,6 +431,22 @@ struct OgaGenerator : OgaAbstract {
     OgaCheckResult(OgaGenerator_GetNextTokens(this, &out, &out_count));
     return {out, out_count};
   }
+
+  std::span<const float> GetNextTokenLogprobs() const {
+    const float* out;
+    size_t out_count;
+    OgaCheckResult(OgaGenerator_GetNextTokenLogprobs(this, &out, &out_count));
+    return {out, out_count};
+  }
+
+  void GetNextTokenTopLogprobs(std::span<const int32_t>& tokens, std::span<const float>& logprobs) const {
+    const int32_t* out_tokens;
+    const float* out_logprobs;
+    size_t out_count;
+    OgaCheckResult(OgaGenerator_GetNextTokenTopLogprobs(this, &out_tokens, &out_logprobs, &out_count));
+    tokens = {out_tokens, out_count};
+    logprobs = {out_logprobs, out_count};
+  }
 #endif
 
   void RewindTo(size_t new_length) {
@@ -437,6 +457,26 @@ struct OgaGenerator : OgaAbstract {
     OgaCheckResult(OgaGenerator_SetRuntimeOption(this, key, value));
   }
 
+  std::unique_ptr<OgaGenerator> Fork() {
+    OgaGenerator* p;
+    OgaCheckResult(OgaGenerator_Fork(this, &p));
+    return std::unique_ptr<OgaGenerator>(p);
+  }
+
+  void SaveState(const char* path) {
+    OgaCheckResult(OgaGenerator_SaveState(this, path));
+  }
+
+  void LoadState(const char* path) {
+    OgaCheckResult(OgaGenerator_LoadState(this, path));
+  }
+
+  double GetSpeculativeDecodingStatistic(const char* name) const {
+    double value;
+    OgaCheckResult(OgaGenerator_GetSpeculativeDecodingStatistic(this, name, &value));
+    return value;
+  }
+
   size_t GetSequenceCount(size_t index) const {
     return OgaGenerator_GetSequenceCount(this, index);
   }
@@ -735,6 +775,20 @@ struct OgaRequest : OgaAbstract {
     return token;
   }
 
+#if OGA_USE_SPAN
+  // Returns the log probability of the last generated token, and the most likely tokens of that step through top_tokens
+  float GetLastTokenLogprobs(std::span<const int32_t>& top_tokens, std::span<const float>& top_logprobs) const {
+    float logprob;
+    const int32_t* out_tokens;
+    const float* out_logprobs;
+    size_t top_count;
+    OgaCheckResult(OgaRequestGetLastTokenLogprobs(this, &logprob, &out_tokens, &out_logprobs, &top_count));
+    top_tokens = {out_tokens, top_count};
+    top_logprobs = {out_logprobs, top_count};
+    return logprob;
+  }
+#endif
+
   void SetOpaqueData(void* data) {
     OgaCheckResult(OgaRequestSetOpaqueData(this, data));
   }
@@ -745,6 +799,18 @@ struct OgaRequest : OgaAbstract {
     return data;
   }
 
+  void SetPriority(int32_t priority) {
+    OgaCheckResult(OgaRequestSetPriority(this, priority));
+  }
+
+  void SetDeadline(int64_t milliseconds) {
+    OgaCheckResult(OgaRequestSetDeadline(this, milliseconds));
+  }
+
+  void SetTokenCallback(OgaRequestTokenCallback callback, void* user_data) {
+    OgaCheckResult(OgaRequestSetTokenCallback(this, callback, user_data));
+  }
+
   static void operator delete(void* p) { OgaDestroyRequest(reinterpret_cast<OgaRequest*>(p)); }
 };
 
@@ -761,6 +827,12 @@ struct OgaEngine : OgaAbstract {
     return f;
   }
 
+  double GetStatistic(const char* name) const {
+    double value;
+    OgaCheckResult(OgaEngineGetStatistic(this, name, &value));
+    return value;
+  }
+
   void Add(OgaRequest& request) {
     OgaCheckResult(OgaEngineAddRequest(this, &request));
   }
@@ -769,6 +841,14 @@ struct OgaEngine : OgaAbstract {
     OgaCheckResult(OgaEngineRemoveRequest(this, &request));
   }
 
+  void Start() {
+    OgaCheckResult(OgaEngineStart(this));
+  }
+
+  void Stop() {
+    OgaCheckResult(OgaEngineStop(this));
+  }
+
   std::unique_ptr<OgaRequest> Step() {
     OgaRequest* request;
     OgaCheckResult(OgaEngineStep(this, &request));
@@ -778,6 +858,38 @@ struct OgaEngine : OgaAbstract {
   static void operator delete(void* p) { OgaDestroyEngine(reinterpret_cast<OgaEngine*>(p)); }
 };
 
+struct OgaSessionPool : OgaAbstract {
+  static std::unique_ptr<OgaSessionPool> Create(const OgaModel& model, const OgaGeneratorParams& params,
+                                                size_t max_active_sessions, size_t max_bytes,
+                                                const char* spill_directory = nullptr) {
+    OgaSessionPool* p;
+    OgaCheckResult(OgaCreateSessionPool(&model, &params, max_active_sessions, max_bytes, spill_directory, &p));
+    return std::unique_ptr<OgaSessionPool>(p);
+  }
+
+  std::unique_ptr<OgaGenerator> Acquire(const char* conversation_id, const int32_t* tokens, size_t token_count) {
+    OgaGenerator* p;
+    OgaCheckResult(OgaSessionPool_Acquire(this, conversation_id, tokens, token_count, &p));
+    return std::unique_ptr<OgaGenerator>(p);
+  }
+
+  void Release(const char* conversation_id, std::unique_ptr<OgaGenerator> generator) {
+    OgaCheckResult(OgaSessionPool_Release(this, conversation_id, generator.release()));
+  }
+
+  void Remove(const char* conversation_id) {
+    OgaCheckResult(OgaSessionPool_Remove(this, conversation_id));
+  }
+
+  double GetStatistic(const char* name) const {
+    double value;
+    OgaCheckResult(OgaSessionPool_GetStatistic(this, name, &value));
+    return value;
+  }
+
+  static void operator delete(void* p) { OgaDestroySessionPool(reinterpret_cast<OgaSessionPool*>(p)); }
+};
+
 struct OgaHandle {
   OgaHandle() = default;
   ~OgaHandle() noexcept {
@@ -9,8 +9,10 @@
 #include "generators.h"
 #include "models/model.h"
 #include "constrained_logits_processor.h"
+#include "speculative_decoding.h"
 #include "runtime_settings.h"
 #include "search.h"
+#include "session_pool.h"
 #include "smartptrs.h"
 #include "engine/engine.h"
 
@@ -60,6 +62,7 @@ struct OgaTokenizer : Generators::Tokenizer, OgaAbstract {};
 struct OgaTokenizerStream : Generators::TokenizerStream, OgaAbstract {};
 struct OgaEngine : Generators::Engine, OgaAbstract {};
 struct OgaRequest : Generators::Request, OgaAbstract {};
+struct OgaSessionPool : Generators::SessionPool, OgaAbstract {};
 
 // Helper function to return a shared pointer as a raw pointer. It won't compile if the types are wrong.
 // Exposed types that are internally owned by shared_ptrs inherit from ExternalRefCounted. Then we
@@ -360,6 +363,13 @@ OgaResult* OGA_API_CALL OgaGeneratorParamsSetGuidance(OgaGeneratorParams* params
   OGA_CATCH
 }
 
+OgaResult* OGA_API_CALL OgaGeneratorParamsSetDraftModel(OgaGeneratorParams* params, const OgaModel* draft_model, size_t num_draft_tokens) {
+  OGA_TRY
+  params->SetDraftModel(*draft_model, num_draft_tokens);
+  return nullptr;
+  OGA_CATCH
+}
+
 OgaResult* OgaCreateGenerator(const OgaModel* model, const OgaGeneratorParams* params, OgaGenerator** out) {
   OGA_TRY
   *out = ReturnUnique<OgaGenerator>(CreateGenerator(*model, *params));
@@ -431,6 +441,62 @@ OgaResult* OGA_API_CALL OgaGenerator_GetNextTokens(const OgaGenerator* generator
   OGA_CATCH
 }
 
+OgaResult* OGA_API_CALL OgaGenerator_GetNextTokenLogprobs(const OgaGenerator* generator, const float** out, size_t* out_count) {
+  OGA_TRY
+  const auto& logprobs = generator->search_->GetLogprobs();
+  if (logprobs.chosen.empty())
+    throw std::runtime_error("The logprobs search option is not set.");
+  *out = logprobs.chosen.data();
+  *out_count = logprobs.chosen.size();
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGenerator_GetNextTokenTopLogprobs(const OgaGenerator* generator, const int32_t** tokens, const float** logprobs, size_t* out_count) {
+  OGA_TRY
+  const auto& token_logprobs = generator->search_->GetLogprobs();
+  if (token_logprobs.top.empty())
+    throw std::runtime_error("The top_logprobs search option is not set.");
+  *tokens = token_logprobs.top_tokens.data();
+  *logprobs = token_logprobs.top.data();
+  *out_count = token_logprobs.top.size();
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGenerator_Fork(OgaGenerator* generator, OgaGenerator** out) {
+  OGA_TRY
+  *out = ReturnUnique<OgaGenerator>(generator->Fork());
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGenerator_SaveState(OgaGenerator* generator, const char* path) {
+  OGA_TRY
+  generator->SaveState(fs::path(path));
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGenerator_LoadState(OgaGenerator* generator, const char* path) {
+  OGA_TRY
+  generator->LoadState(fs::path(path));
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGenerator_GetSpeculativeDecodingStatistic(const OgaGenerator* generator, const char* name, double* out) {
+  OGA_TRY
+  if (!generator->speculative_decoder_)
+    throw std::runtime_error("Speculative decoding is not enabled for this generator.");
+  auto value = generator->speculative_decoder_->GetStats().Get(name);
+  if (!value)
+    throw std::runtime_error(std::string("Unknown speculative decoding statistic: ") + name);
+  *out = *value;
+  return nullptr;
+  OGA_CATCH
+}
+
 OgaResult* OGA_API_CALL OgaGenerator_RewindTo(OgaGenerator* generator, size_t new_length) {
   OGA_TRY
   generator->RewindToLength(new_length);
@@ -896,6 +962,73 @@ OgaResult* OgaEngineHasPendingRequests(OgaEngine* engine, bool* out) {
   OGA_CATCH
 }
 
+OgaResult* OgaEngineStart(OgaEngine* engine) {
+  OGA_TRY
+  engine->Start();
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OgaEngineStop(OgaEngine* engine) {
+  OGA_TRY
+  engine->Stop();
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OgaEngineGetStatistic(const OgaEngine* engine, const char* name, double* out) {
+  OGA_TRY
+  *out = engine->GetStatistic(name);
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaCreateSessionPool(const OgaModel* model, const OgaGeneratorParams* params,
+                                             size_t max_active_sessions, size_t max_bytes,
+                                             const char* spill_directory, OgaSessionPool** out) {
+  OGA_TRY
+  Generators::SessionPool::Options options;
+  options.max_active_sessions = max_active_sessions;
+  options.max_bytes = max_bytes;
+  if (spill_directory)
+    options.spill_directory = fs::path(spill_directory);
+  *out = ReturnUnique<OgaSessionPool>(std::make_unique<Generators::SessionPool>(*model, *params, options));
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaSessionPool_Acquire(OgaSessionPool* pool, const char* conversation_id,
+                                               const int32_t* tokens, size_t token_count, OgaGenerator** out) {
+  OGA_TRY
+  *out = ReturnUnique<OgaGenerator>(pool->Acquire(conversation_id, Generators::cpu_span<const int32_t>(tokens, token_count)));
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaSessionPool_Release(OgaSessionPool* pool, const char* conversation_id, OgaGenerator* generator) {
+  OGA_TRY
+  pool->Release(conversation_id, std::unique_ptr<Generators::Generator>(generator));
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaSessionPool_Remove(OgaSessionPool* pool, const char* conversation_id) {
+  OGA_TRY
+  pool->Remove(conversation_id);
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaSessionPool_GetStatistic(const OgaSessionPool* pool, const char* name, double* out) {
+  OGA_TRY
+  auto value = pool->GetStats().Get(name);
+  if (!value)
+    throw std::runtime_error(std::string("Unknown session pool statistic: ") + name);
+  *out = *value;
+  return nullptr;
+  OGA_CATCH
+}
+
 OgaResult* OgaEngineAddRequest(OgaEngine* engine, OgaRequest* request) {
   OGA_TRY
   engine->AddRequest(request->shared_from_this());
@@ -949,6 +1082,20 @@ OgaResult* OgaRequestIsDone(const OgaRequest* request, bool* out) {
   OGA_CATCH
 }
 
+OgaResult* OgaRequestGetLastTokenLogprobs(const OgaRequest* request, float* logprob, const int32_t** top_tokens,
+                                          const float** top_logprobs, size_t* top_count) {
+  OGA_TRY
+  const auto& logprobs = request->LastTokenLogprobs();
+  if (logprobs.chosen.empty())
+    throw std::runtime_error("The logprobs search option is not set.");
+  *logprob = logprobs.chosen[0];
+  *top_tokens = logprobs.top_tokens.data();
+  *top_logprobs = logprobs.top.data();
+  *top_count = logprobs.top.size();
+  return nullptr;
+  OGA_CATCH
+}
+
 OgaResult* OgaRequestSetOpaqueData(OgaRequest* request, void* data) {
   OGA_TRY
   request->SetOpaqueData(data);
@@ -956,6 +1103,33 @@ OgaResult* OgaRequestSetOpaqueData(OgaRequest* request, void* data) {
   OGA_CATCH
 }
 
+OgaResult* OGA_API_CALL OgaRequestSetPriority(OgaRequest* request, int32_t priority) {
+  OGA_TRY
+  request->SetPriority(priority);
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaRequestSetDeadline(OgaRequest* request, int64_t milliseconds) {
+  OGA_TRY
+  request->SetDeadline(std::chrono::milliseconds(milliseconds));
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaRequestSetTokenCallback(OgaRequest* request, OgaRequestTokenCallback callback, void* user_data) {
+  OGA_TRY
+  if (!callback) {
+    request->SetTokenCallback({});
+    return nullptr;
+  }
+  request->SetTokenCallback([request, callback, user_data](std::span<const int32_t> tokens, bool is_done) {
+    callback(request, tokens.data(), tokens.size(), is_done, user_data);
+  });
+  return nullptr;
+  OGA_CATCH
+}
+
 OgaResult* OGA_API_CALL OgaRequestGetOpaqueData(OgaRequest* request, void** data) {
   OGA_TRY
   *data = request->GetOpaqueData();
@@ -982,6 +1156,7 @@ void OGA_API_CALL OgaDestroyAdapters(OgaAdapters* p) { p->ExternalRelease(); }
 void OGA_API_CALL OgaDestroyRuntimeSettings(OgaRuntimeSettings* p) { delete p; }
 void OGA_API_CALL OgaDestroyEngine(OgaEngine* p) { p->ExternalRelease(); }
 void OGA_API_CALL OgaDestroyRequest(OgaRequest* p) { p->ExternalRelease(); }
+void OGA_API_CALL OgaDestroySessionPool(OgaSessionPool* p) { delete p; }
 
 void OGA_API_CALL OgaRegisterExecutionProviderLibrary(const char* registration_name, const char* library_path) {
   Ort::RegisterExecutionProviderLibrary(&(Generators::GetOrtEnv()), registration_name, fs::path(library_path).c_str());
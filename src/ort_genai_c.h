@@ -78,8 +78,20 @@ typedef struct OgaAudios OgaAudios;
 typedef struct OgaStringArray OgaStringArray;
 typedef struct OgaAdapters OgaAdapters;
 typedef struct OgaEngine OgaEngine;
+typedef struct OgaSessionPool OgaSessionPool;
 typedef struct OgaRequest OgqRequest;
 
+/**
+ * \brief Callback that receives the newly generated tokens of a request.
+ * \param[in] request The request that generated the tokens.
+ * \param[in] tokens The tokens generated since the previous invocation. Only valid for the duration of the call.
+ * \param[in] token_count The number of tokens.
+ * \param[in] is_done True if the request has completed.
+ * \param[in] user_data The user data passed to OgaRequestSetTokenCallback.
+ */
+typedef void(OGA_API_CALL* OgaRequestTokenCallback)(OgaRequest* request, const int32_t* tokens, size_t token_count,
+                                                   bool is_done, void* user_data);
+
 //! @}
 
 /** \addtogroup Global
@@ -376,6 +388,19 @@ OGA_EXPORT OgaResult* OGA_API_CALL OgaGeneratorParamsTryGraphCaptureWithMaxBatch
  */
 OGA_EXPORT OgaResult* OGA_API_CALL OgaGeneratorParamsSetGuidance(OgaGeneratorParams* params, const char* type, const char* data);
 
+/**
+ * \brief Enables speculative decoding with a draft model for generators created from the params.
+ *        The draft model proposes num_draft_tokens tokens, which the target model verifies in a single run.
+ *        Greedy search only keeps tokens the target model would have picked, so the output is unchanged.
+ *        Sampling uses rejection sampling, which keeps the target model's distribution.
+ *        Only batch_size 1 and num_beams 1 are supported. The draft model must share the target model's vocabulary.
+ * \param[in] params The generator params to enable speculative decoding on.
+ * \param[in] draft_model The model that proposes tokens. It is kept alive by the params.
+ * \param[in] num_draft_tokens The number of tokens proposed per target model run.
+ * \return OgaResult containing the error message if the setting of the draft model failed.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGeneratorParamsSetDraftModel(OgaGeneratorParams* params, const OgaModel* draft_model, size_t num_draft_tokens);
+
 /**
  * \brief Creates a generator from the given model and generator params.
  * \param[in] model The model to use for generation.
@@ -448,11 +473,34 @@ OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_GenerateNextToken(OgaGenerator*
  */
 OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_GetNextTokens(const OgaGenerator* generator, const int32_t** out, size_t* out_count);
 
+/**
+ * \brief Returns the log probabilities of the next tokens generated by the model. They are the log-softmax of the logits
+ *        after the penalties, before temperature, top-k and top-p are applied. Sequences that are already done report 0.
+ *        Requires the logprobs or top_logprobs search option.
+ * \param[in] generator The generator to get the log probabilities from.
+ * \param[out] out The pointer to the log probabilities, one per sequence. The pointer is valid until the next OgaGenerator call
+ * \param[out] out_count The number of log probabilities in the out array, which is the batch size.
+ * \return OgaResult containing the error message if the search does not compute log probabilities.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_GetNextTokenLogprobs(const OgaGenerator* generator, const float** out, size_t* out_count);
+
+/**
+ * \brief Returns the most likely tokens of the last step and their log probabilities, top_logprobs of them per sequence
+ *        with the most likely first. Requires the top_logprobs search option.
+ * \param[in] generator The generator to get the top log probabilities from.
+ * \param[out] tokens The pointer to the tokens, shape (batch_size, top_logprobs). Valid until the next OgaGenerator call
+ * \param[out] logprobs The pointer to the log probabilities of the tokens, with the same shape.
+ * \param[out] out_count The number of entries in the tokens and logprobs arrays.
+ * \return OgaResult containing the error message if the search does not compute log probabilities.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_GetNextTokenTopLogprobs(const OgaGenerator* generator, const int32_t** tokens, const float** logprobs, size_t* out_count);
+
 OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_SetRuntimeOption(OgaGenerator* generator, const char* key, const char* value);
 
 /**
  * \brief Rewinds the generator to the given length. This is useful when the user wants to rewind the generator to a specific length
- *        and continue generating from that point.
+ *        and continue generating from that point. Every sequence of a batch is rewound to the same length, and beam search can only
+ *        be rewound to 0. With the past_present_share_buffer or growable_kv_cache search options the key-value cache is not copied.
  * \param[in] generator The generator to rewind to the given length.
  * \param[in] new_length The desired length in tokens after rewinding.
  * \return OgaResult containing the error message if the rewinding failed.
@@ -517,6 +565,52 @@ OGA_EXPORT size_t OGA_API_CALL OgaGenerator_GetSequenceCount(const OgaGenerator*
  */
 OGA_EXPORT const int32_t* OGA_API_CALL OgaGenerator_GetSequenceData(const OgaGenerator* generator, size_t index);
 
+/**
+ * \brief Creates a generator that continues from the current sequence of the given generator, for sampling several
+ *        continuations of one prompt. The prompt is not run through the model again, and its key-value cache is
+ *        shared with the new generator until either one writes to it. The new generator samples from its own
+ *        random stream. Only batch_size 1 and num_beams 1 decoder-only models are supported.
+ * \param[in] generator The generator to fork. It must have processed tokens through AppendTokens.
+ * \param[out] out The created generator. It is independent of the given generator and is destroyed with OgaDestroyGenerator.
+ * \return OgaResult containing the error message if the generator could not be forked.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_Fork(OgaGenerator* generator, OgaGenerator** out);
+
+/**
+ * \brief Saves the state of the generator to a file: its sequence, the logits of the last step, the random state used
+ *        for sampling and the key-value cache. A generator created later from the same model and config continues
+ *        from the file with OgaGenerator_LoadState, without running the sequence through the model again.
+ *        Only batch_size 1 and num_beams 1 decoder-only models are supported.
+ * \param[in] generator The generator to save. It must have processed tokens through AppendTokens.
+ * \param[in] path The file to write. An existing file is replaced.
+ * \return OgaResult containing the error message if the state could not be saved.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_SaveState(OgaGenerator* generator, const char* path);
+
+/**
+ * \brief Restores a state saved with OgaGenerator_SaveState. The file is mapped into memory and copied directly into
+ *        the generator's buffers. Adapters that were active when the state was saved must be set active first.
+ * \param[in] generator A new generator, created with the same model and config as the saved one, before any
+ *            tokens are appended.
+ * \param[in] path The file written by OgaGenerator_SaveState.
+ * \return OgaResult containing the error message if the file was saved with a different model or config, or the
+ *         state could not be loaded.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_LoadState(OgaGenerator* generator, const char* path);
+
+/**
+ * \brief Returns a speculative decoding statistic of the generator. The available statistics are:
+ * - "draft_tokens": The number of tokens proposed by the draft model or by prompt lookup.
+ * - "accepted_tokens": The number of proposed tokens accepted by the target model.
+ * - "verification_steps": The number of target model runs that verified proposed tokens.
+ * - "acceptance_rate": accepted_tokens / draft_tokens.
+ * \param[in] generator The generator, created from params with a draft model or the prompt_lookup_num_tokens search option.
+ * \param[in] name The name of the statistic.
+ * \param[out] out The value of the statistic.
+ * \return OgaResult containing the error message if speculative decoding is not enabled or the name is unknown.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_GetSpeculativeDecodingStatistic(const OgaGenerator* generator, const char* name, double* out);
+
 OGA_EXPORT OgaResult* OGA_API_CALL OgaCreateTokenizer(const OgaModel* model, OgaTokenizer** out);
 OGA_EXPORT void OGA_API_CALL OgaDestroyTokenizer(OgaTokenizer*);
 
@@ -845,6 +939,53 @@ OGA_EXPORT OgaResult* OGA_API_CALL OgaEngineStep(OgaEngine* engine, OgaRequest**
  */
 OGA_EXPORT OgaResult* OGA_API_CALL OgaEngineHasPendingRequests(OgaEngine* engine, bool* out);
 
+/**
+ * \brief Starts running the step loop of the engine on a background thread.
+ *
+ * While the engine runs in the background, requests can be added and removed from any thread and
+ * OgaEngineStep must not be called. New tokens are delivered through the callbacks set with
+ * OgaRequestSetTokenCallback, on the background thread. Every request needs a callback, since the
+ * application can't read the tokens of a request while the background thread writes them.
+ *
+ * \param[in] engine The engine to start.
+ * \return OgaResult containing the error message if the engine is already running or a pending request has no
+ *         token callback, or nullptr on success.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaEngineStart(OgaEngine* engine);
+
+/**
+ * \brief Stops the background thread of the engine once its current step has finished.
+ *
+ * Requests that are still pending remain in the engine and can be processed by calling OgaEngineStep or
+ * OgaEngineStart again. Does nothing if the engine is not running in the background.
+ *
+ * \param[in] engine The engine to stop.
+ * \return OgaResult containing the error that stopped the background thread, or nullptr on success.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaEngineStop(OgaEngine* engine);
+
+/**
+ * \brief Gets the value of a statistic tracked by the engine.
+ *
+ * The following statistics are available:
+ * - "free_blocks": The number of free key-value cache blocks (paged key-value cache only).
+ * - "preemptions": The number of times a running request was preempted because the key-value cache ran out.
+ * - "swapped_requests": The number of preempted requests whose key-value cache is currently held in host memory.
+ * - "swap_bytes": The host memory used by the key-value cache of swapped out requests.
+ * - "prefix_cache_lookups": The number of requests that looked up their prompt in the prefix cache.
+ * - "prefix_cache_hits": The number of requests that reused at least one cached block.
+ * - "prefix_cache_queried_tokens": The number of prompt tokens that were looked up in the prefix cache.
+ * - "prefix_cache_hit_tokens": The number of prompt tokens whose key-value cache was reused.
+ * - "prefix_cache_hit_rate": prefix_cache_hit_tokens / prefix_cache_queried_tokens.
+ * - "prefix_cache_blocks": The number of key-value cache blocks held by the prefix cache.
+ *
+ * \param[in] engine The engine instance to query.
+ * \param[in] name The name of the statistic.
+ * \param[out] out The value of the statistic.
+ * \return OgaResult containing the error message if the statistic is unknown, or nullptr on success.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaEngineGetStatistic(const OgaEngine* engine, const char* name, double* out);
+
 /**
  * \brief Adds a request to the OgaEngine for processing.
  *
@@ -853,6 +994,7 @@ OGA_EXPORT OgaResult* OGA_API_CALL OgaEngineHasPendingRequests(OgaEngine* engine
  *
  * \param[in] engine The engine instance to which the request is being added.
  * \param[in] request The request to add to the engine. The request must remain valid until it is removed or processed.
+ *                    While the engine runs in the background, the request must have a token callback.
  * \return OgaResult containing the error message if the operation failed, or nullptr on success.
  */
 OGA_EXPORT OgaResult* OGA_API_CALL OgaEngineAddRequest(OgaEngine* engine, OgaRequest* request);
@@ -968,6 +1110,147 @@ OGA_EXPORT OgaResult* OGA_API_CALL OgaRequestGetUnseenToken(OgaRequest* request,
  */
 OGA_EXPORT OgaResult* OGA_API_CALL OgaRequestIsDone(const OgaRequest* request, bool* out);
 
+/**
+ * \brief Gets the log probabilities of the last token generated for the request.
+ *
+ * Requires the logprobs or top_logprobs search option. The values are overwritten by the next engine step that
+ * generates a token for the request, so read them from the token callback, or before stepping the engine again.
+ *
+ * \param[in] request The request to get the log probabilities from.
+ * \param[out] logprob The log probability of the last generated token.
+ * \param[out] top_tokens The pointer to the top_logprobs most likely tokens of the step, most likely first.
+ * \param[out] top_logprobs The pointer to the log probabilities of top_tokens.
+ * \param[out] top_count The number of entries in top_tokens and top_logprobs.
+ * \return OgaResult containing the error message if the search does not compute log probabilities, or nullptr on success.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaRequestGetLastTokenLogprobs(const OgaRequest* request, float* logprob, const int32_t** top_tokens,
+                                                                  const float** top_logprobs, size_t* top_count);
+
+/**
+ * \brief Sets the priority of the request.
+ *
+ * Used when the engine is configured with the "priority" scheduling policy. Requests with a higher
+ * priority are admitted first and preempted last. The default priority is 0.
+ *
+ * \param[in] request The request to set the priority on.
+ * \param[in] priority The priority of the request.
+ * \return OgaResult containing the error message if the operation failed, or nullptr on success.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaRequestSetPriority(OgaRequest* request, int32_t priority);
+
+/**
+ * \brief Sets the deadline of the request.
+ *
+ * Used when the engine is configured with the "deadline" scheduling policy. Requests with the earliest
+ * deadline are admitted first and preempted last. Requests without a deadline are served after all
+ * requests with a deadline. Must be called before the request is added to the engine.
+ *
+ * \param[in] request The request to set the deadline on.
+ * \param[in] milliseconds The time after being added to the engine within which the request should complete.
+ * \return OgaResult containing the error message if the request was already added to an engine, or nullptr on success.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaRequestSetDeadline(OgaRequest* request, int64_t milliseconds);
+
+/**
+ * \brief Sets a callback that receives the newly generated tokens of the request after every engine step.
+ *
+ * Tokens delivered through the callback are marked as seen. The callback is invoked on the thread running
+ * the engine step, which is the background thread of the engine if it was started with OgaEngineStart.
+ * Must be called before the request is added to the engine.
+ *
+ * \param[in] request The request to set the callback on.
+ * \param[in] callback The callback, or nullptr to remove a previously set callback.
+ * \param[in] user_data User data passed to the callback.
+ * \return OgaResult containing the error message if the request was already added to an engine, or nullptr on success.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaRequestSetTokenCallback(OgaRequest* request, OgaRequestTokenCallback callback,
+                                                             void* user_data);
+
+/**
+ * \brief Creates a pool that keeps the conversations of a chat service between turns, so that a turn only runs the
+ *        model on the tokens added since the previous one.
+ *
+ * The most recently used conversations keep their generator. The least recently used ones beyond
+ * max_active_sessions are saved into host memory with OgaGenerator_SaveState, and the ones beyond max_bytes of saved
+ * states are written to spill_directory, or dropped if it is not set. A dropped conversation starts again from its
+ * whole transcript. Only batch_size 1 and num_beams 1 decoder-only models are supported.
+ *
+ * \param[in] model The model of the conversations.
+ * \param[in] params The parameters of every generator the pool creates.
+ * \param[in] max_active_sessions The number of conversations that keep their generator, at least 1.
+ * \param[in] max_bytes The host memory for the saved states of the other conversations.
+ * \param[in] spill_directory A directory for the saved states beyond max_bytes, or nullptr to drop them instead.
+ * \param[out] out The created pool, destroyed with OgaDestroySessionPool.
+ * \return OgaResult containing the error message if the pool could not be created.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaCreateSessionPool(const OgaModel* model, const OgaGeneratorParams* params,
+                                                        size_t max_active_sessions, size_t max_bytes,
+                                                        const char* spill_directory, OgaSessionPool** out);
+
+/**
+ * \brief Destroys the given session pool and deletes its spilled states.
+ * \param[in] pool The session pool to be destroyed.
+ */
+OGA_EXPORT void OGA_API_CALL OgaDestroySessionPool(OgaSessionPool* pool);
+
+/**
+ * \brief Checks out the generator of a conversation for its next turn.
+ *
+ * If the pool holds the conversation, only the tokens after the longest common prefix with its sequence are run
+ * through the model. Otherwise a new generator runs all of them.
+ *
+ * \param[in] pool The session pool.
+ * \param[in] conversation_id The id of the conversation.
+ * \param[in] tokens The whole transcript of the conversation so far: the tokens of its previous turns, including the
+ *            generated ones, followed by the new ones.
+ * \param[in] token_count The number of tokens.
+ * \param[out] out The generator, ready to generate the reply. It must be given back with OgaSessionPool_Release.
+ * \return OgaResult containing the error message if the conversation is already checked out or the tokens could not
+ *         be appended.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaSessionPool_Acquire(OgaSessionPool* pool, const char* conversation_id,
+                                                          const int32_t* tokens, size_t token_count, OgaGenerator** out);
+
+/**
+ * \brief Gives the generator of a conversation back to the pool after its turn, and evicts the least recently used
+ *        conversations if the pool is over its limits.
+ * \param[in] pool The session pool.
+ * \param[in] conversation_id The id of the conversation.
+ * \param[in] generator The generator returned by OgaSessionPool_Acquire. The pool takes ownership of it, so it must not
+ *            be used or destroyed afterwards. nullptr forgets the conversation.
+ * \return OgaResult containing the error message if the conversation was not checked out.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaSessionPool_Release(OgaSessionPool* pool, const char* conversation_id,
+                                                          OgaGenerator* generator);
+
+/**
+ * \brief Forgets a conversation. If it is checked out, its generator is destroyed when it is released.
+ * \param[in] pool The session pool.
+ * \param[in] conversation_id The id of the conversation.
+ * \return OgaResult containing the error message if the conversation could not be removed.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaSessionPool_Remove(OgaSessionPool* pool, const char* conversation_id);
+
+/**
+ * \brief Returns a statistic of the session pool. The available statistics are:
+ * - "turns": The number of calls to OgaSessionPool_Acquire.
+ * - "hits": The number of turns that continued a conversation held by the pool.
+ * - "hit_rate": hits / turns.
+ * - "loads": The number of hits that restored a saved state.
+ * - "reused_tokens": The number of transcript tokens that were not run through the model again.
+ * - "evictions": The number of generators saved and destroyed to stay within max_active_sessions.
+ * - "drops": The number of conversations forgotten to stay within the limits.
+ * - "active_sessions": The number of conversations with a generator, including the checked out ones.
+ * - "stored_sessions": The number of conversations saved in host memory.
+ * - "spilled_sessions": The number of conversations saved in the spill directory.
+ * - "stored_bytes": The host memory used by the saved states.
+ * \param[in] pool The session pool.
+ * \param[in] name The name of the statistic.
+ * \param[out] out The value of the statistic.
+ * \return OgaResult containing the error message if the statistic is unknown.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaSessionPool_GetStatistic(const OgaSessionPool* pool, const char* name, double* out);
+
 /**
  * \brief Registers an execution provider library with ONNXRuntime API.
  * \param registration_name name for registration.
@@ -0,0 +1,64 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace Generators {
+
+// Philox4x32-10 counter-based random number generator (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3").
+// Each output block is a pure function of the key and a counter, so every (seed, stream) pair is its own independent
+// sequence. Giving each batch row its own stream keeps sampling deterministic no matter which thread runs the row.
+// Meets the UniformRandomBitGenerator requirements, so it works with the std:: distributions.
+struct Philox4x32 {
+  using result_type = uint32_t;
+
+  Philox4x32(uint64_t seed, uint64_t stream)
+      : key_{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)},
+        counter_{0, 0, static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32)} {}
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+  result_type operator()() {
+    if (output_index_ == output_.size()) {
+      Generate();
+      output_index_ = 0;
+    }
+    return output_[output_index_++];
+  }
+
+ private:
+  static constexpr uint32_t kMultiplier0 = 0xD2511F53;
+  static constexpr uint32_t kMultiplier1 = 0xCD9E8D57;
+  static constexpr uint32_t kWeyl0 = 0x9E3779B9;
+  static constexpr uint32_t kWeyl1 = 0xBB67AE85;
+
+  void Generate() {
+    auto block = counter_;
+    auto key = key_;
+    for (int round = 0; round < 10; round++) {
+      const uint64_t product0 = static_cast<uint64_t>(kMultiplier0) * block[0];
+      const uint64_t product1 = static_cast<uint64_t>(kMultiplier1) * block[2];
+      block = {static_cast<uint32_t>(product1 >> 32) ^ block[1] ^ key[0], static_cast<uint32_t>(product1),
+               static_cast<uint32_t>(product0 >> 32) ^ block[3] ^ key[1], static_cast<uint32_t>(product0)};
+      key[0] += kWeyl0;
+      key[1] += kWeyl1;
+    }
+    output_ = block;
+
+    // The low half of the counter is the position in the stream, the high half selects the stream
+    if (++counter_[0] == 0)
+      ++counter_[1];
+  }
+
+  std::array<uint32_t, 2> key_;
+  std::array<uint32_t, 4> counter_;
+  std::array<uint32_t, 4> output_{};
+  size_t output_index_{output_.size()};
+};
+
+}  // namespace Generators
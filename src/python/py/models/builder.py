@@ -308,6 +308,14 @@ class Model:
             self.quant_attrs["config"] = config.quantization_config
             self.quant_attrs["use_g_idx"] = config.quantization_config["desc_act"] if "desc_act" in config.quantization_config else False
 
+        # KV cache quantization-specific variables (INT8, FP8)
+        self.kv_cache_quant_attrs = {
+            "type": extra_options.get("kv_cache_quant_type", None),                                  # Storage type of the KV cache ("int8" or "fp8"), or None to store it in io_dtype
+            "group_size": int(extra_options.get("kv_cache_quant_group_size", self.head_size)),        # Elements of a head that share a scale, per token
+        }
+        if self.kv_cache_quant_attrs["type"] is not None:
+            self.make_kv_cache_quant_init()
+
         # States for building the model
         graph = ir.Graph(
             inputs=(),
@@ -368,6 +376,30 @@ class Model:
 
         self.past_present_share_buffer = self.attention_attrs["op_type"] == "GroupQueryAttention"
 
+    def make_kv_cache_quant_init(self):
+        kv_cache_quant_type, group_size = self.kv_cache_quant_attrs["type"], self.kv_cache_quant_attrs["group_size"]
+        kv_cache_dtypes = {"int8": ir.DataType.INT8, "fp8": ir.DataType.FLOAT8E4M3FN}
+        if kv_cache_quant_type not in kv_cache_dtypes:
+            raise ValueError(f"kv_cache_quant_type must be int8 or fp8, but is {kv_cache_quant_type}.")
+        if group_size <= 0 or self.head_size % group_size != 0:
+            raise ValueError(f"kv_cache_quant_group_size must divide the head size ({self.head_size}), but is {group_size}.")
+        if self.attention_attrs["op_type"] not in {"MultiHeadAttention", "GroupQueryAttention"} or (self.attention_attrs["op_type"] == "MultiHeadAttention" and self.num_attn_heads != self.num_kv_heads):
+            raise NotImplementedError("A quantized KV cache is only supported with GroupQueryAttention, or MultiHeadAttention without repeated KV heads.")
+
+        # The model dequantizes the past KV cache before attention and quantizes the present KV cache after it,
+        # so attention writes a new present instead of appending to the past in place
+        self.past_present_share_buffer = False
+
+        kv_cache_dtype = kv_cache_dtypes[kv_cache_quant_type]
+        num_groups = self.head_size // group_size
+        for kv in ["key", "value"]:
+            self.input_types[f"past_key_values.{kv}"] = kv_cache_dtype
+            self.input_types[f"past_key_values.{kv}_scale"] = ir.DataType.FLOAT
+            self.input_shapes[f"past_key_values.{kv}_scale"] = ["batch_size", self.num_kv_heads, "past_sequence_length", num_groups]
+            self.output_types[f"present.{kv}"] = kv_cache_dtype
+            self.output_types[f"present.{kv}_scale"] = ir.DataType.FLOAT
+            self.output_shapes[f"present.{kv}_scale"] = ["batch_size", self.num_kv_heads, "total_sequence_length", num_groups]
+
     def make_genai_config(self, model_name_or_path, extra_kwargs, out_dir):
         try:
             config = GenerationConfig.from_pretrained(model_name_or_path, token=self.hf_token, trust_remote_code=True, **extra_kwargs)
@@ -384,6 +416,15 @@ class Model:
             "present_key_names": "present.%d.key",
             "present_value_names": "present.%d.value",
         })
+        if self.kv_cache_quant_attrs["type"] is not None:
+            inputs.update({
+                "past_key_scale_names": "past_key_values.%d.key_scale",
+                "past_value_scale_names": "past_key_values.%d.value_scale",
+            })
+            outputs.update({
+                "present_key_scale_names": "present.%d.key_scale",
+                "present_value_scale_names": "present.%d.value_scale",
+            })
         if "hidden_states" in outputs:
             # Remove 'hidden_states' from 'outputs' entry in config since ORT GenAI doesn't use it
             del outputs["hidden_states"]
@@ -432,6 +473,9 @@ class Model:
         if self.window_size is not None and self.window_size > 0:
             genai_config["model"]["decoder"]["sliding_window"] = {"window_size": self.window_size, "slide_key_value_cache": False, "slide_inputs": False}
 
+        if self.kv_cache_quant_attrs["type"] is not None:
+            genai_config["model"]["decoder"]["kv_cache_quantization"] = {"type": self.kv_cache_quant_attrs["type"], "group_size": self.kv_cache_quant_attrs["group_size"]}
+
         if self.ep != "cpu":
             ep_options = { self.ep : self.ep_attrs[self.ep] }
             genai_config["model"]["decoder"]["session_options"]["provider_options"].append(ep_options)
@@ -628,6 +672,14 @@ class Model:
             value_name = f"present.{i}.value"
             outputs.append(self.make_value(value_name, dtype=self.output_types["present.value"], shape=self.output_shapes["present.value"]))
 
+            if self.kv_cache_quant_attrs["type"] is not None:
+                # Add KV cache scales to inputs and outputs
+                for kv in ["key", "value"]:
+                    scale_name = f"past_key_values.{i}.{kv}_scale"
+                    inputs.append(self.make_value(scale_name, dtype=self.input_types[f"past_key_values.{kv}_scale"], shape=self.input_shapes[f"past_key_values.{kv}_scale"]))
+                    scale_name = f"present.{i}.{kv}_scale"
+                    outputs.append(self.make_value(scale_name, dtype=self.output_types[f"present.{kv}_scale"], shape=self.output_shapes[f"present.{kv}_scale"]))
+
     def make_constant(self, name):
         # Make constant ops for 0, 1, 2, 3, etc.
         # Format of name is "/model/constants/{dtype}/{num}"
@@ -1860,6 +1912,105 @@ class Model:
             do_rotary=self.attention_attrs["use_rope_in_attn"], rotary_interleaved=self.rotemb_attrs["interleaved"],
         )
 
+    def make_kv_cache_dequantize(self, basename, root_input, scale):
+        # Make nodes for the KV cache dequantization subgraph
+        #
+        #   root_input (B, N, S, H)   scale (B, N, S, H/G)
+        #              |                      |
+        #   Reshape (B, N, S, H/G, G)     Unsqueeze
+        #              |                      |
+        #            Cast                     |
+        #               \                    /
+        #                 +-------Mul-------+
+        #                          |
+        #                 Reshape (B, N, S, H)
+        #                          |
+        #                        Cast (if io_dtype is not FP32)
+        num_groups, group_size = self.head_size // self.kv_cache_quant_attrs["group_size"], self.kv_cache_quant_attrs["group_size"]
+        shape = ["batch_size", self.num_kv_heads, "past_sequence_length", self.head_size]
+        grouped_shape = shape[:-1] + [num_groups, group_size]
+
+        reshape_1_name = f"{basename}/Reshape_1"
+        reshape_1_inputs = [root_input, f"/model/constants/INT64/[0, 0, 0, {num_groups}, {group_size}]"]
+        self.make_reshape(reshape_1_name, reshape_1_inputs, dtype=self.input_types["past_key_values.key"], shape=grouped_shape)
+        cast_1_name = f"{basename}/Cast_1"
+        self.make_cast(cast_1_name, f"{reshape_1_name}/output_0", dtype=ir.DataType.FLOAT, shape=grouped_shape)
+        unsqueeze_name = f"{basename}/Unsqueeze"
+        self.make_unsqueeze(unsqueeze_name, [scale, "/model/constants/INT64/[-1]"], dtype=ir.DataType.FLOAT, shape=grouped_shape[:-1] + [1])
+        mul_name = f"{basename}/Mul"
+        self.make_mul(mul_name, [f"{cast_1_name}/output_0", f"{unsqueeze_name}/output_0"], dtype=ir.DataType.FLOAT, shape=grouped_shape)
+        reshape_2_name = f"{basename}/Reshape_2"
+        reshape_2_inputs = [f"{mul_name}/output_0", f"/model/constants/INT64/[0, 0, 0, {self.head_size}]"]
+        self.make_reshape(reshape_2_name, reshape_2_inputs, dtype=ir.DataType.FLOAT, shape=shape)
+
+        output = f"{reshape_2_name}/output_0"
+        if self.io_dtype != ir.DataType.FLOAT:
+            cast_2_name = f"{basename}/Cast_2"
+            self.make_cast(cast_2_name, output, dtype=self.io_dtype, shape=shape)
+            output = f"{cast_2_name}/output_0"
+        return output
+
+    def make_kv_cache_quantize(self, basename, root_input, output, scale):
+        # Make nodes for the KV cache quantization subgraph. Each group of G elements of a head and token
+        # gets its own scale, so that its largest magnitude maps to the largest value of the quantized type.
+        #
+        #   root_input (B, N, S, H)
+        #              |
+        #            Cast (if io_dtype is not FP32)
+        #              |
+        #   Reshape (B, N, S, H/G, G)
+        #         /          |
+        #       Abs          |
+        #        |           |
+        #    ReduceMax       |
+        #        |           |
+        #       Div          |
+        #        |           |
+        #       Max ---------+---------> scale (B, N, S, H/G)
+        #        |           |
+        #    Unsqueeze       |
+        #         \          |
+        #          +---Div---+
+        #               |
+        #        QuantizeLinear
+        #               |
+        #      Reshape (B, N, S, H) ---> output
+        num_groups, group_size = self.head_size // self.kv_cache_quant_attrs["group_size"], self.kv_cache_quant_attrs["group_size"]
+        shape = ["batch_size", self.num_kv_heads, "total_sequence_length", self.head_size]
+        grouped_shape = shape[:-1] + [num_groups, group_size]
+        kv_cache_dtype = self.output_types["present.key"]
+        max_value, zero_point = (127.0, "/model/constants/INT8/0") if kv_cache_dtype == ir.DataType.INT8 else (448.0, "/model/constants/FLOAT8E4M3FN/0")
+
+        if self.io_dtype != ir.DataType.FLOAT:
+            cast_name = f"{basename}/Cast"
+            self.make_cast(cast_name, root_input, dtype=ir.DataType.FLOAT, shape=shape)
+            root_input = f"{cast_name}/output_0"
+        reshape_1_name = f"{basename}/Reshape_1"
+        reshape_1_inputs = [root_input, f"/model/constants/INT64/[0, 0, 0, {num_groups}, {group_size}]"]
+        self.make_reshape(reshape_1_name, reshape_1_inputs, dtype=ir.DataType.FLOAT, shape=grouped_shape)
+
+        abs_name = f"{basename}/Abs"
+        abs_output = f"{abs_name}/output_0"
+        self.make_node("Abs", inputs=[f"{reshape_1_name}/output_0"], outputs=[abs_output], name=abs_name)
+        self.make_value(abs_output, ir.DataType.FLOAT, shape=grouped_shape)
+        reduce_max_name = f"{basename}/ReduceMax"
+        self.make_reduce_max(reduce_max_name, [abs_output, "/model/constants/INT64/[-1]"], dtype=ir.DataType.FLOAT, shape=grouped_shape[:-1])
+        div_1_name = f"{basename}/Div_1"
+        self.make_div(div_1_name, [f"{reduce_max_name}/output_0", f"/model/constants/FLOAT/{max_value}"], dtype=ir.DataType.FLOAT, shape=grouped_shape[:-1])
+        max_name = f"{basename}/Max"  # Keeps the scales of all-zero groups from dividing by zero
+        self.make_node("Max", inputs=[f"{div_1_name}/output_0", "/model/constants/FLOAT/1e-08"], outputs=[scale], name=max_name)
+
+        unsqueeze_name = f"{basename}/Unsqueeze"
+        self.make_unsqueeze(unsqueeze_name, [scale, "/model/constants/INT64/[-1]"], dtype=ir.DataType.FLOAT, shape=grouped_shape[:-1] + [1])
+        div_2_name = f"{basename}/Div_2"
+        self.make_div(div_2_name, [f"{reshape_1_name}/output_0", f"{unsqueeze_name}/output_0"], dtype=ir.DataType.FLOAT, shape=grouped_shape)
+        quantize_name = f"{basename}/QuantizeLinear"
+        quantize_output = f"{quantize_name}/output_0"
+        self.make_node("QuantizeLinear", inputs=[f"{div_2_name}/output_0", "/model/constants/FLOAT/1.0", zero_point], outputs=[quantize_output], name=quantize_name)
+        self.make_value(quantize_output, kv_cache_dtype, shape=grouped_shape)
+        reshape_2_name = f"{basename}/Reshape_2"
+        self.make_node("Reshape", inputs=[quantize_output, f"/model/constants/INT64/[0, 0, 0, {self.head_size}]"], outputs=[output], name=reshape_2_name)
+
     def make_attention(self, layer_id, attention, root_input, **kwargs):
         # Make nodes for the Attention subgraph
         #
@@ -1966,6 +2117,15 @@ class Model:
             self.attention_attrs["v_path"] = self.make_repeat_kv(layer_id, root_input=self.attention_attrs["v_path"], past_kv=past_v, present_kv=present_v)
             past_k, past_v, present_k, present_v = "", "", "", ""
 
+        # Make KV cache dequantization nodes (if the KV cache is quantized)
+        if self.kv_cache_quant_attrs["type"] is not None:
+            past_k = self.make_kv_cache_dequantize(f"/model/layers.{layer_id}/attn/k_cache/dequantize", past_k, f"past_key_values.{layer_id}.key_scale")
+            past_v = self.make_kv_cache_dequantize(f"/model/layers.{layer_id}/attn/v_cache/dequantize", past_v, f"past_key_values.{layer_id}.value_scale")
+            quantized_present_k, quantized_present_v = present_k, present_v
+            present_k, present_v = f"/model/layers.{layer_id}/attn/present_k", f"/model/layers.{layer_id}/attn/present_v"
+            for present in [present_k, present_v]:
+                self.make_value(present, self.io_dtype, shape=["batch_size", self.num_kv_heads, "total_sequence_length", self.head_size])
+
         # Make attention node (e.g. MultiHeadAttention, GroupQueryAttention, etc.)
         attn_name = f"/model/layers.{layer_id}/attn/{self.attention_attrs['op_type']}"
         self.make_attention_op(
@@ -1974,6 +2134,11 @@ class Model:
             cos_cache=cos_cache_name, sin_cache=sin_cache_name, **kwargs,
         )
 
+        # Make KV cache quantization nodes (if the KV cache is quantized)
+        if self.kv_cache_quant_attrs["type"] is not None:
+            self.make_kv_cache_quantize(f"/model/layers.{layer_id}/attn/k_cache/quantize", present_k, quantized_present_k, f"present.{layer_id}.key_scale")
+            self.make_kv_cache_quantize(f"/model/layers.{layer_id}/attn/v_cache/quantize", present_v, quantized_present_v, f"present.{layer_id}.value_scale")
+
         # Make MatMul node (output projection weight node)
         o_proj = 'o_proj' if hasattr(attention, 'o_proj') else 'dense'
         o_matmul_basename = f"/model/layers.{layer_id}/attn/o_proj/MatMul"
@@ -3960,6 +4125,10 @@ def get_args():
                     Use this option to create quantized ONNX models that use BF16 precision.
                 adapter_path = Path to folder on disk containing the adapter files (adapter_config.json and adapter model weights).
                     Use this option for LoRA models.
+                kv_cache_quant_type = int8/fp8: Store the KV cache quantized, with a float32 scale per group of elements of each head and token.
+                    The model dequantizes the past KV cache before attention and quantizes the present KV cache after it.
+                    Use this option to roughly halve the KV cache memory of FP16 models (quarter it for FP32 models).
+                kv_cache_quant_group_size = Specify the number of elements of a head that share a scale when the KV cache is quantized. Default is the head size.
             """),
     )
 
@@ -200,6 +200,10 @@ struct PyGeneratorParams {
     params_->SetGuidance(type.c_str(), data.c_str());
   }
 
+  void SetDraftModel(const OgaModel& draft_model, size_t num_draft_tokens) {
+    params_->SetDraftModel(draft_model, num_draft_tokens);
+  }
+
   std::vector<pybind11::object> refs_;  // References to data we want to ensure doesn't get garbage collected
 };
 
@@ -208,10 +212,24 @@ struct PyGenerator {
     generator_ = OgaGenerator::Create(model, *params.params_);
   }
 
+  PyGenerator(std::unique_ptr<OgaGenerator> generator) : generator_{std::move(generator)} {}
+
   pybind11::array_t<int32_t> GetNextTokens() {
     return ToPython(generator_->GetNextTokens());
   }
 
+  pybind11::array_t<float> GetNextTokenLogprobs() {
+    return ToPython(generator_->GetNextTokenLogprobs());
+  }
+
+  // The top tokens and their logprobs, each of shape (batch_size * top_logprobs)
+  pybind11::tuple GetNextTokenTopLogprobs() {
+    std::span<const int32_t> tokens;
+    std::span<const float> logprobs;
+    generator_->GetNextTokenTopLogprobs(tokens, logprobs);
+    return pybind11::make_tuple(ToPython(tokens), ToPython(logprobs));
+  }
+
   pybind11::array_t<int32_t> GetSequence(int index) {
     return ToPython(generator_->GetSequence(index));
   }
@@ -256,6 +274,22 @@ struct PyGenerator {
     generator_->RewindTo(new_length);
   }
 
+  PyGenerator Fork() {
+    return PyGenerator{generator_->Fork()};
+  }
+
+  void SaveState(const std::string& path) {
+    generator_->SaveState(path.c_str());
+  }
+
+  void LoadState(const std::string& path) {
+    generator_->LoadState(path.c_str());
+  }
+
+  double GetSpeculativeDecodingStatistic(const std::string& name) const {
+    return generator_->GetSpeculativeDecodingStatistic(name.c_str());
+  }
+
   bool IsDone() const {
     return generator_->IsDone();
   }
@@ -318,7 +352,8 @@ PYBIND11_MODULE(onnxruntime_genai, m) {
       .def(pybind11::init<const OgaModel&>())
       .def("try_graph_capture_with_max_batch_size", &PyGeneratorParams::TryGraphCaptureWithMaxBatchSize)
       .def("set_search_options", &PyGeneratorParams::SetSearchOptions)  // See config.h 'struct Search' for the options
-      .def("set_guidance", &PyGeneratorParams::SetGuidance);
+      .def("set_guidance", &PyGeneratorParams::SetGuidance)
+      .def("set_draft_model", &PyGeneratorParams::SetDraftModel);
 
   pybind11::class_<OgaTokenizerStream>(m, "TokenizerStream")
       .def("decode", [](OgaTokenizerStream& t, int32_t token) { return t.Decode(token); });
@@ -434,7 +469,13 @@ PYBIND11_MODULE(onnxruntime_genai, m) {
       .def("set_logits", &PyGenerator::SetLogits)
       .def("generate_next_token", &PyGenerator::GenerateNextToken)
       .def("rewind_to", &PyGenerator::RewindTo)
+      .def("fork", &PyGenerator::Fork)
+      .def("save_state", &PyGenerator::SaveState)
+      .def("load_state", &PyGenerator::LoadState)
+      .def("get_speculative_decoding_statistic", &PyGenerator::GetSpeculativeDecodingStatistic)
       .def("get_next_tokens", &PyGenerator::GetNextTokens)
+      .def("get_next_token_logprobs", &PyGenerator::GetNextTokenLogprobs)
+      .def("get_next_token_top_logprobs", &PyGenerator::GetNextTokenTopLogprobs)
       .def("get_sequence", &PyGenerator::GetSequence)
       .def("set_active_adapter", &PyGenerator::SetActiveAdapter);
 
@@ -555,6 +596,14 @@ PYBIND11_MODULE(onnxruntime_genai, m) {
       .def("has_unseen_tokens", &OgaRequest::HasUnseenTokens)
       .def("is_done", &OgaRequest::IsDone)
       .def("get_unseen_token", &OgaRequest::GetUnseenToken)
+      .def("get_last_token_logprobs", [](const OgaRequest& request) {
+        std::span<const int32_t> top_tokens;
+        std::span<const float> top_logprobs;
+        float logprob = request.GetLastTokenLogprobs(top_tokens, top_logprobs);
+        return pybind11::make_tuple(logprob, ToPython(top_tokens), ToPython(top_logprobs));
+      })
+      .def("set_priority", &OgaRequest::SetPriority)
+      .def("set_deadline", &OgaRequest::SetDeadline)
       .def("set_opaque_data", [](OgaRequest& request, pybind11::object opaque_data) {
         request.SetOpaqueData(opaque_data.ptr());
       })
@@ -570,7 +619,8 @@ PYBIND11_MODULE(onnxruntime_genai, m) {
       .def("add_request", &OgaEngine::Add)
       .def("step", &OgaEngine::Step)
       .def("remove_request", &OgaEngine::Remove)
-      .def("has_pending_requests", &OgaEngine::HasPendingRequests);
+      .def("has_pending_requests", &OgaEngine::HasPendingRequests)
+      .def("get_statistic", &OgaEngine::GetStatistic);
 
   m.def("set_log_options", &SetLogOptions);
   m.def("set_log_callback", &SetLogCallback);
@@ -3,7 +3,7 @@
 #include "search.h"
 #include "beam_search_scorer.h"
 #include "cpu/interface.h"
-#include <queue>
+#include "thread_pool.h"
 #include <algorithm>
 #include <limits>
 
@@ -19,15 +19,14 @@ Search_Cpu::Search_Cpu(const GeneratorParams& params)
 
 GreedySearch_Cpu::GreedySearch_Cpu(const GeneratorParams& params)
     : Search_Cpu(params) {
-  if (params_->search.random_seed != -1)
-    gen_.seed(params_->search.random_seed);
-  else {
+  seed_ = static_cast<uint64_t>(params_->search.random_seed);
+  if (params_->search.random_seed == -1) {
     std::random_device rd;
-    std::array<uint32_t, decltype(gen_)::state_size> data;
-    std::generate(std::begin(data), std::end(data), std::ref(rd));
-    std::seed_seq seq(data.begin(), data.end());
-    gen_.seed(seq);
+    seed_ = (static_cast<uint64_t>(rd()) << 32) | rd();
   }
+  rows_.reserve(params.search.batch_size);
+  for (size_t row = 0; row < static_cast<size_t>(params.search.batch_size); row++)
+    rows_.emplace_back(seed_, row);
 
   next_tokens_ptr_ = cpu_device_.Allocate<int32_t>(params.search.batch_size);
   next_tokens_ptr_.Zero();
@@ -35,15 +34,31 @@ GreedySearch_Cpu::GreedySearch_Cpu(const GeneratorParams& params)
 
   eos_seen_buffer_ = AllocateArray<bool>(params.search.batch_size, &eos_seen_);
   memset(eos_seen_.data(), 0, eos_seen_.size_bytes());
+  eos_lengths_.resize(params.search.batch_size);
+
+  if (params_->search.top_logprobs < 0)
+    throw std::runtime_error("top_logprobs must be 0 or greater");
+  if (params_->search.top_logprobs > params_->config.model.vocab_size)
+    throw std::runtime_error("top_logprobs cannot be greater than vocab_size (" + std::to_string(params_->config.model.vocab_size) + ")");
+  if (compute_logprobs_) {
+    const size_t top_count = static_cast<size_t>(params.search.batch_size) * params_->search.top_logprobs;
+    logprobs_.chosen.resize(params.search.batch_size);
+    logprobs_.top_tokens.resize(top_count);
+    logprobs_.top.resize(top_count);
+  }
 }
 
 BeamSearch_Cpu::BeamSearch_Cpu(const GeneratorParams& params)
     : Search_Cpu(params) {
   assert(params_->search.num_beams > 1);  // If 1, use GreedySearch
+  if (params_->search.logprobs || params_->search.top_logprobs > 0)
+    throw std::runtime_error("logprobs are not supported with beam search");
   beam_scorer_ = std::make_unique<BeamSearchScorer>(*params_);
 
   next_tokens_buffer_ = AllocateArray<int32_t>(params.BatchBeamSize(), &next_tokens_);
   memset(next_tokens_buffer_.get(), 0, next_tokens_.size_bytes());
+
+  beam_top_indices_.resize(params.BatchBeamSize());
 }
 
 BeamSearch_Cpu::~BeamSearch_Cpu() = default;
@@ -70,186 +85,217 @@ DeviceSpan<int32_t> BeamSearch_Cpu::GetNextIndices() {
 }
 
 void BeamSearch_Cpu::SelectTop() {
+  const size_t batch_size = params_->search.batch_size;
+  const size_t num_beams = params_->search.num_beams;
+  const size_t vocab_size = params_->config.model.vocab_size;
+  const size_t top_k = 2 * num_beams;
   auto next_token_scores = next_token_scores_.CpuSpan();
-
-  // Normalize next token scores
-  for (size_t i = 0; i < params_->BatchBeamSize(); i++) {
-    std::span<float> const scores = next_token_scores.subspan(i * static_cast<size_t>(params_->config.model.vocab_size), params_->config.model.vocab_size);
-    LogSoftMax(scores, 1.0);
-  }
-
   auto beam_scores = beam_scorer_->GetNextScores().Span();
 
-  // Add beam score to next token scores. Corresponding python code is like:
-  //    next_token_scores = next_token_scores + beam_scores[:, None].expand_as(next_token_scores)
-  // TODO(aciddelgado): use thread pool to parallel
-  int offset = 0;
-  int batch_beam_index = 0;
-  for (int i = 0; i < params_->search.batch_size; i++) {
-    for (int j = 0; j < params_->search.num_beams; j++, batch_beam_index++) {
-      for (int k = 0; k < params_->config.model.vocab_size; k++, offset++) {
-        next_token_scores[offset] += beam_scores[batch_beam_index];
-      }
+  // The beam score and the log-softmax shift every token of a beam equally, so the best top_k candidates of a batch
+  // entry are among the top_k tokens of each of its beams. Only those get their score, corresponding python code:
+  //    next_token_scores = log_softmax(logits) + beam_scores[:, None].expand_as(next_token_scores)
+  candidate_scores_.resize(params_->BatchBeamSize() * top_k);
+  candidate_tokens_.resize(params_->BatchBeamSize() * top_k);
+  auto select_beam_candidates = [&](size_t batch_beam_index) {
+    std::span<const float> const scores = next_token_scores.subspan(batch_beam_index * vocab_size, vocab_size);
+    auto& top_indices = beam_top_indices_[batch_beam_index];
+    TopKIndices(scores, top_k, top_indices);
+
+    const float max_score = scores[top_indices[0]];
+    const float offset = beam_scores[batch_beam_index] - max_score - LogSumExp(scores, max_score);
+    for (size_t i = 0; i < top_k; i++) {
+      // A vocabulary smaller than top_k leaves candidates that are never picked
+      const bool valid = i < top_indices.size();
+      candidate_tokens_[batch_beam_index * top_k + i] = valid ? top_indices[i] : 0;
+      candidate_scores_[batch_beam_index * top_k + i] = valid ? scores[top_indices[i]] + offset : std::numeric_limits<float>::lowest();
     }
-  }
-
-  const size_t top_k = 2 * params_->search.num_beams;
-
-  struct ScoreIndex {
-    float score;
-    int32_t index;
-
-    bool operator<(const ScoreIndex& s) const { return score < s.score; }
   };
 
-  auto scores = std::make_unique<float[]>(top_k * params_->search.batch_size);     // Score of top_k tokens
-  auto indices = std::make_unique<int32_t[]>(top_k * params_->search.batch_size);  // beam index of top_k tokens
-  auto tokens = std::make_unique<int32_t[]>(top_k * params_->search.batch_size);   // token id of top_k tokens
-
-  auto next_scores = std::span<float>(scores.get(), top_k * params_->search.batch_size);
-  auto next_indices = std::span<int32_t>(indices.get(), top_k * params_->search.batch_size);
-  auto next_tokens = std::span<int32_t>(tokens.get(), top_k * params_->search.batch_size);
-
-  // TODO(aciddelgado): Optimize this top k with partial sort
-  for (size_t batch_index = 0; batch_index < static_cast<size_t>(params_->search.batch_size); batch_index++) {
-    std::priority_queue<ScoreIndex, std::vector<ScoreIndex>> queue;
-    auto token_scores_sub = next_token_scores.subspan(batch_index * params_->search.num_beams * params_->config.model.vocab_size, static_cast<size_t>(params_->search.num_beams) * params_->config.model.vocab_size);
-    for (int i = 0; i < token_scores_sub.size(); i++) {
-      queue.push({token_scores_sub[i], i});
-    }
+  constexpr size_t min_parallel_scores = 1 << 16;
+  if (params_->BatchBeamSize() * vocab_size >= min_parallel_scores)
+    GetSamplingThreadPool().ParallelFor(params_->BatchBeamSize(), select_beam_candidates);
+  else {
+    for (size_t batch_beam_index = 0; batch_beam_index < static_cast<size_t>(params_->BatchBeamSize()); batch_beam_index++)
+      select_beam_candidates(batch_beam_index);
+  }
 
-    auto next_indices_sub = next_indices.subspan(top_k * batch_index, top_k);
-    auto next_tokens_sub = next_tokens.subspan(top_k * batch_index, top_k);
-    auto next_scores_sub = next_scores.subspan(top_k * batch_index, top_k);
-    for (unsigned i = 0; i < top_k; i++) {
-      auto v = queue.top();
-      next_indices_sub[i] = v.index / params_->config.model.vocab_size;
-      next_tokens_sub[i] = v.index % params_->config.model.vocab_size;
-      next_scores_sub[i] = v.score;
-      queue.pop();
+  top_k_scores_.resize(top_k * batch_size);
+  top_k_indices_.resize(top_k * batch_size);
+  top_k_tokens_.resize(top_k * batch_size);
+  std::span<float> next_scores = top_k_scores_;
+  std::span<int32_t> next_indices = top_k_indices_;
+  std::span<int32_t> next_tokens = top_k_tokens_;
+
+  // Merge the candidates of each batch entry's beams into its top_k
+  for (size_t batch_index = 0; batch_index < batch_size; batch_index++) {
+    const size_t first_candidate = batch_index * num_beams * top_k;
+    candidate_order_.resize(num_beams * top_k);
+    std::iota(candidate_order_.begin(), candidate_order_.end(), static_cast<int32_t>(first_candidate));
+    std::partial_sort(candidate_order_.begin(), candidate_order_.begin() + top_k, candidate_order_.end(),
+                      [this](int32_t a, int32_t b) { return candidate_scores_[a] > candidate_scores_[b]; });
+
+    for (size_t i = 0; i < top_k; i++) {
+      const int32_t candidate = candidate_order_[i];
+      // Beam index within the batch entry, like the index / vocab_size of the flattened [num_beams, vocab_size] scores
+      next_indices[batch_index * top_k + i] = static_cast<int32_t>((candidate - first_candidate) / top_k);
+      next_tokens[batch_index * top_k + i] = candidate_tokens_[candidate];
+      next_scores[batch_index * top_k + i] = candidate_scores_[candidate];
     }
   }
 
-#if 0  // TODO(ryanhill): Use logging option
-  DumpSpan(std::cout, next_tokens);
-  DumpSpan(std::cout, next_indices_);
-  DumpSpan(std::cout, next_scores_);
-#endif
-
   beam_scorer_->Process(sequences_, next_scores, next_tokens, next_indices);
   next_tokens_ = cpu_span<int32_t>(beam_scorer_->GetNextTokens().Span());
 
   AppendNextTokensToSequences();
 }
 
-void GreedySearch_Cpu::SelectTop() {
-  // next_tokens = torch.argmax(scores, dim=-1)
-  for (size_t batch_id = 0; batch_id < params_->search.batch_size; batch_id++) {
+void GreedySearch_Cpu::SampleRows(const std::function<int32_t(std::span<float> scores, RowState& row)>& sample_row) {
+  const size_t batch_size = params_->search.batch_size;
+  const size_t vocab_size = params_->config.model.vocab_size;
+  auto const all_scores = next_token_scores_.CpuSpan();
+
+  // Each row only writes its own token and state, the EOS bookkeeping happens afterwards in row order
+  auto sample = [&](size_t batch_id) {
+    if (eos_seen_[batch_id])
+      return;
+    auto scores = all_scores.subspan(batch_id * vocab_size, vocab_size);
+    auto& row = rows_[batch_id];
+    if (!compute_logprobs_) {
+      next_tokens_[batch_id] = sample_row(scores, row);
+      return;
+    }
+    // Normalize while the row is still in cache. The samplers leave the scores intact for the chosen token afterwards
+    const float log_normalizer = ComputeTopLogprobs(batch_id, scores, row);
+    const int32_t token = sample_row(scores, row);
+    next_tokens_[batch_id] = token;
+    logprobs_.chosen[batch_id] = scores[token] - log_normalizer;
+  };
+
+  // Waking up the pool costs more than sampling a few small rows
+  constexpr size_t min_parallel_scores = 1 << 16;
+  if (batch_size > 1 && batch_size * vocab_size >= min_parallel_scores)
+    GetSamplingThreadPool().ParallelFor(batch_size, sample);
+  else {
+    for (size_t batch_id = 0; batch_id < batch_size; batch_id++)
+      sample(batch_id);
+  }
+
+  for (size_t batch_id = 0; batch_id < batch_size; batch_id++) {
     if (PadIfAlreadyEOS(batch_id)) {
+      if (compute_logprobs_)
+        PadLogprobs(batch_id);
       continue;
     }
+    SetNextToken(batch_id, next_tokens_[batch_id]);
+  }
+  AppendNextTokensToSequences();
+}
+
+float GreedySearch_Cpu::ComputeTopLogprobs(size_t batch_id, std::span<const float> scores, RowState& row) {
+  const size_t top_logprobs = params_->search.top_logprobs;
+  float max_score;
+  if (top_logprobs > 0) {
+    TopKIndices(scores, top_logprobs, row.top_logprob_indices);
+    max_score = scores[row.top_logprob_indices[0]];
+  } else
+    max_score = MaxElement(scores);
+  const float log_normalizer = max_score + LogSumExp(scores, max_score);
 
-    std::span<float> const scores = next_token_scores_.CpuSpan().subspan(batch_id * params_->config.model.vocab_size, params_->config.model.vocab_size);
-    auto const token = static_cast<int32_t>(std::distance(scores.begin(), std::max_element(scores.begin(), scores.end())));
-    SetNextToken(batch_id, token);
+  for (size_t i = 0; i < top_logprobs; i++) {
+    const int32_t token = row.top_logprob_indices[i];
+    logprobs_.top_tokens[batch_id * top_logprobs + i] = token;
+    logprobs_.top[batch_id * top_logprobs + i] = scores[token] - log_normalizer;
   }
+  return log_normalizer;
+}
 
-  AppendNextTokensToSequences();
+void GreedySearch_Cpu::PadLogprobs(size_t batch_id) {
+  // Finished rows only get the pad token, which makes it certain
+  const size_t top_logprobs = params_->search.top_logprobs;
+  logprobs_.chosen[batch_id] = 0.0f;
+  std::fill_n(logprobs_.top_tokens.begin() + batch_id * top_logprobs, top_logprobs, params_->config.model.pad_token_id);
+  std::fill_n(logprobs_.top.begin() + batch_id * top_logprobs, top_logprobs, 0.0f);
+}
+
+void GreedySearch_Cpu::SelectTop() {
+  // next_tokens = torch.argmax(scores, dim=-1)
+  SampleRows([](std::span<float> scores, RowState&) {
+    return static_cast<int32_t>(Argmax(scores));
+  });
 }
 
 void GreedySearch_Cpu::SampleTopK(int k, float temperature) {
-  for (size_t batch_id = 0; batch_id < params_->search.batch_size; batch_id++) {
-    std::span<float> const scores = next_token_scores_.CpuSpan().subspan(batch_id * params_->config.model.vocab_size, params_->config.model.vocab_size);
+  SampleRows([k, temperature](std::span<float> scores, RowState& row) {
     // Find the top K scores
-    std::vector<int> indices(scores.size());
-    std::iota(indices.begin(), indices.end(), 0);
-    std::partial_sort(indices.begin(), indices.begin() + k, indices.end(), [scores = scores.data()](int i, int j) { return scores[i] > scores[j]; });
-    std::vector<float> top_k_scores(k);
-    for (int i = 0; i < k; i++)
-      top_k_scores[i] = scores[indices[i]];
+    TopKIndices(scores, k, row.top_indices);
+    row.top_scores.resize(row.top_indices.size());
+    for (size_t i = 0; i < row.top_indices.size(); i++)
+      row.top_scores[i] = scores[row.top_indices[i]];
     // Sample a token from the top K
-    Softmax(top_k_scores, temperature);
-    std::discrete_distribution<> dis(top_k_scores.begin(), top_k_scores.end());
-    SetNextToken(batch_id, indices[dis(gen_)]);
-  }
-  AppendNextTokensToSequences();
+    Softmax(row.top_scores, temperature);
+    std::discrete_distribution<> dis(row.top_scores.begin(), row.top_scores.end());
+    return row.top_indices[dis(row.gen)];
+  });
 }
 
 void GreedySearch_Cpu::SampleTopP(float p, float temperature) {
-  std::uniform_real_distribution<float> dis(0, p);
-  for (size_t batch_id = 0; batch_id < params_->search.batch_size; batch_id++) {
-    if (PadIfAlreadyEOS(batch_id)) {
-      continue;
+  SampleRows([this, p, temperature](std::span<float> scores, RowState& row) {
+    std::span<float> probabilities = scores;
+    if (compute_logprobs_) {
+      // The logprob of the chosen token is read from the scores afterwards
+      row.probabilities.assign(scores.begin(), scores.end());
+      probabilities = row.probabilities;
     }
-    std::span<float> const scores = next_token_scores_.CpuSpan().subspan(batch_id * params_->config.model.vocab_size, params_->config.model.vocab_size);
-    Softmax(scores, temperature);
-    // Sort an array of indices into the scores
-    std::vector<int32_t> indices(scores.size());
-    std::iota(indices.begin(), indices.end(), 0);
-    std::sort(indices.begin(), indices.end(), [scores = scores.data()](int32_t i, int32_t j) { return scores[i] > scores[j]; });
+    Softmax(probabilities, temperature);
+    // Sorted indices of the most probable tokens, which add up to at least p
+    TopPIndices(probabilities, p, row.top_indices);
     // Sample a probability threshold
-    float threshold = dis(gen_);
-    int32_t token = 0;
+    std::uniform_real_distribution<float> dis(0, p);
+    float threshold = dis(row.gen);
     // Find the first token where the cumulative probability exceeds the threshold
-    for (int i = 0; i < scores.size(); i++) {
-      threshold -= scores[indices[i]];
-      if (threshold > 0) {
-        continue;
-      }
-      token = indices[i];
-      break;
+    for (int32_t index : row.top_indices) {
+      threshold -= probabilities[index];
+      if (threshold <= 0)
+        return index;
     }
-    SetNextToken(batch_id, token);
-  }
-  AppendNextTokensToSequences();
+    return row.top_indices.back();
+  });
 }
 
 void GreedySearch_Cpu::SampleTopKTopP(int k, float p, float temperature) {
-  // For numerical stability, we use 0.9999999f not 1.0f to avoid zero probabilities.
-  std::uniform_real_distribution<float> dis(0, 0.999999f);
-  for (size_t batch_id = 0; batch_id < params_->search.batch_size; batch_id++) {
-    if (PadIfAlreadyEOS(batch_id))
-      continue;
-    std::span<float> const scores = next_token_scores_.CpuSpan().subspan(batch_id * params_->config.model.vocab_size, params_->config.model.vocab_size);
+  SampleRows([k, p, temperature](std::span<float> scores, RowState& row) {
     // Find the top K scores
-    std::vector<int> indices(scores.size());
-    std::iota(indices.begin(), indices.end(), 0);
-    std::partial_sort(indices.begin(), indices.begin() + k, indices.end(), [scores = scores.data()](int i, int j) { return scores[i] > scores[j]; });
-    std::vector<float> scores_top_k(k, 0.0f);
-    std::vector<float> scores_top_k_old(k, 0.0f);
-    for (int i = 0; i < k; i++) {
-      scores_top_k[i] = scores[indices[i]];
-      scores_top_k_old[i] = scores[indices[i]];
-    }
-    SoftmaxWithMax(scores_top_k, temperature, scores_top_k[0]);
+    TopKIndices(scores, k, row.top_indices);
+    const size_t top_k = row.top_indices.size();
+    row.top_scores.resize(top_k);
+    for (size_t i = 0; i < top_k; i++)
+      row.top_scores[i] = scores[row.top_indices[i]];
+    SoftmaxWithMax(row.top_scores, temperature, row.top_scores[0]);
     float saferNegative = std::numeric_limits<float>::lowest() / 1000.0f;
-    std::vector<float> scores_top_k_filtering(k, saferNegative);
-    scores_top_k_filtering[0] = scores_top_k_old[0];
+    row.top_scores_filtered.assign(top_k, saferNegative);
+    row.top_scores_filtered[0] = scores[row.top_indices[0]];
     float threshold = p;
-    for (int i = 1; i < k; i++) {
-      threshold -= scores_top_k[i - 1];
+    for (size_t i = 1; i < top_k; i++) {
+      threshold -= row.top_scores[i - 1];
       if (threshold > 0) {
-        scores_top_k_filtering[i] = scores_top_k_old[i];
+        row.top_scores_filtered[i] = scores[row.top_indices[i]];
       } else {
         break;
       }
     }
-    SoftmaxWithMax(scores_top_k_filtering, temperature, scores_top_k_filtering[0]);
-    // Sample a probability threshold
-    threshold = dis(gen_);
-    int32_t token = indices[k - 1];
+    SoftmaxWithMax(row.top_scores_filtered, temperature, row.top_scores_filtered[0]);
+    // Sample a probability threshold. For numerical stability, we use 0.9999999f not 1.0f to avoid zero probabilities.
+    std::uniform_real_distribution<float> dis(0, 0.999999f);
+    threshold = dis(row.gen);
     // Find the first token where the cumulative probability exceeds the threshold
-    for (int i = 0; i < k - 1; i++) {
-      threshold -= scores_top_k_filtering[i];
-      if (threshold > 0) {
-        continue;
-      }
-      token = indices[i];
-      break;
+    for (size_t i = 0; i + 1 < top_k; i++) {
+      threshold -= row.top_scores_filtered[i];
+      if (threshold <= 0)
+        return row.top_indices[i];
     }
-    SetNextToken(batch_id, token);
-  }
-  AppendNextTokensToSequences();
+    return row.top_indices[top_k - 1];
+  });
 }
 
 bool GreedySearch_Cpu::PadIfAlreadyEOS(size_t batch_id) {
@@ -266,6 +312,7 @@ void GreedySearch_Cpu::SetNextToken(size_t batch_id, int32_t token) {
   next_tokens_[batch_id] = token;
   if (contains(params_->config.model.eos_token_id, token)) {
     eos_seen_[batch_id] = true;
+    eos_lengths_[batch_id] = sequences_.GetSequenceLength() + 1;
     if (g_log.enabled && g_log.hit_eos)
       Log("hit_eos", "EOS seen on batch " + std::to_string(batch_id));
     if (--not_done_count_ == 0) {
@@ -285,6 +332,9 @@ void GreedySearch_Cpu::AppendNextTokensToSequences() {
   }
   sequences_.GetSequences().CopyCpuToDevice();
 
+  for (int i = 0; i < batch_beam_size; i++)
+    logits_pipeline_.Append(i, next_tokens[i]);
+
   sequences_.AfterAppendNextTokens(next_tokens_ptr_, batch_beam_size);
 
   if (sequences_.GetSequenceLength() == params_->search.max_length) {
@@ -309,12 +359,39 @@ void GreedySearch_Cpu::AppendTokens(DeviceSpan<int32_t>& next_tokens) {
   done_ = false;
   not_done_count_ = params_->search.batch_size;
   memset(eos_seen_.data(), 0, eos_seen_.size_bytes());
+  std::fill(eos_lengths_.begin(), eos_lengths_.end(), 0);
+}
+
+void GreedySearch_Cpu::SetRandomStream(uint64_t stream) {
+  for (size_t row = 0; row < rows_.size(); row++)
+    rows_[row].gen = Philox4x32{seed_, stream * rows_.size() + row};
+}
+
+std::vector<uint8_t> GreedySearch_Cpu::GetRandomState() const {
+  static_assert(std::is_trivially_copyable_v<Philox4x32>);
+  std::vector<uint8_t> state(rows_.size() * sizeof(Philox4x32));
+  for (size_t row = 0; row < rows_.size(); row++)
+    std::memcpy(state.data() + row * sizeof(Philox4x32), &rows_[row].gen, sizeof(Philox4x32));
+  return state;
+}
+
+void GreedySearch_Cpu::SetRandomState(std::span<const uint8_t> state) {
+  if (state.size() != rows_.size() * sizeof(Philox4x32))
+    throw std::runtime_error("The saved random state doesn't match the search.");
+  for (size_t row = 0; row < rows_.size(); row++)
+    std::memcpy(&rows_[row].gen, state.data() + row * sizeof(Philox4x32), sizeof(Philox4x32));
 }
 
 void GreedySearch_Cpu::RewindTo(size_t index) {
-  done_ = false;
-  not_done_count_ = params_->search.batch_size;
-  memset(eos_seen_.data(), 0, eos_seen_.size_bytes());
+  // Rows that sampled EOS within the kept tokens stay done, the others continue
+  not_done_count_ = 0;
+  for (size_t i = 0; i < eos_lengths_.size(); i++) {
+    if (eos_lengths_[i] > index)
+      eos_lengths_[i] = 0;
+    eos_seen_[i] = eos_lengths_[i] != 0;
+    not_done_count_ += !eos_seen_[i];
+  }
+  done_ = not_done_count_ == 0;
   // Set next tokens to the last tokens in the sequence
   if (index > 0) {
     for (int i = 0; i < params_->BatchBeamSize(); i++) {
@@ -322,9 +399,20 @@ void GreedySearch_Cpu::RewindTo(size_t index) {
     }
   } else
     memset(next_tokens_.data(), 0, next_tokens_.size_bytes());
+  for (int i = 0; i < params_->BatchBeamSize(); i++)
+    logits_pipeline_.Rewind(i, sequences_.GetSequence(i).CpuSpan(), index);
   sequences_.RewindTo(index);
 }
 
+void GreedySearch_Cpu::AppendRewoundTokens() {
+  // The rewound token of a done row is already its padding
+  for (size_t i = 0; i < eos_lengths_.size(); i++) {
+    if (!eos_seen_[i])
+      SetNextToken(i, next_tokens_[i]);
+  }
+  AppendNextTokensToSequences();
+}
+
 void BeamSearch_Cpu::AppendTokens(DeviceSpan<int32_t>& next_tokens) {
   // Set user-defined next tokens
   auto next_tokens_cpu = next_tokens.CpuSpan();
@@ -340,6 +428,7 @@ void BeamSearch_Cpu::AppendTokens(DeviceSpan<int32_t>& next_tokens) {
     std::span<int32_t> target = next_sequences_span.subspan(i * sequences_.max_length_, tokens_count_per_batch);
     std::span<const int32_t> source = next_tokens_cpu.subspan((i / params_->search.num_beams) * tokens_count_per_batch, tokens_count_per_batch);
     copy(source, target);
+    logits_pipeline_.Assign(i, target);
   }
   sequences_.AfterAppendNextTokens(next_tokens, params_->search.batch_size);  // next_tokens is not expanded
 }
@@ -370,6 +459,12 @@ void BeamSearch_Cpu::AppendNextTokensToSequences() {
 
     // Append next token to each beam.
     sequences_next_span[i * max_length + current_length] = batch_beam_next_tokens[i];
+
+    // Beams that continue themselves only gain the new token, the others take over another beam's sequence
+    if (batch_beam_index == i)
+      logits_pipeline_.Append(i, batch_beam_next_tokens[i]);
+    else
+      logits_pipeline_.Assign(i, sequences_next_span.subspan(i * max_length, current_length + 1));
   }
   auto next_tokens_device = beam_scorer_->GetNextTokens();
   sequences_.GetNextSequences().CopyCpuToDevice();
@@ -406,6 +501,19 @@ std::span<float> Search_Cpu::GetScores(int batch_beam_index) {
   return next_token_scores_.CpuSpan().subspan(static_cast<size_t>(batch_beam_index) * params_->config.model.vocab_size, params_->config.model.vocab_size);
 }
 
+void Search::ProcessLogits() {
+  auto& search = params_->search;
+  if (search.presence_penalty != 0.0f || search.frequency_penalty != 0.0f || search.no_repeat_ngram_size > 0)
+    throw std::runtime_error("presence_penalty, frequency_penalty and no_repeat_ngram_size are only supported when the search runs on the CPU");
+  ApplyMinLength(search.min_length);
+  ApplyRepetitionPenalty(search.repetition_penalty);
+}
+
+void Search_Cpu::ProcessLogits() {
+  if (!logits_pipeline_.empty())
+    logits_pipeline_.Process(next_token_scores_.CpuSpan());
+}
+
 void Search_Cpu::ApplyMinLength(int min_length) {
   if (sequences_.GetSequenceLength() >= min_length) {
     return;
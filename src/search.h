@@ -1,10 +1,20 @@
 #include "sequences.h"
 #include <random>
+#include "philox.h"
+#include "logits_processor.h"
 #include "beam_search_scorer.h"
 #pragma once
 
 namespace Generators {
 
+// Log probabilities of the tokens picked by the last step of a search, computed when the logprobs or top_logprobs
+// search options are set. They are the log-softmax of the processed logits, before temperature and top-k/top-p.
+struct TokenLogprobs {
+  std::vector<float> chosen;        // shape (batch_size)
+  std::vector<int32_t> top_tokens;  // shape (batch_size, top_logprobs), most likely first
+  std::vector<float> top;           // shape (batch_size, top_logprobs)
+};
+
 struct Search : LeakChecked<Search> {
   Search(const GeneratorParams& params) : params_{params.shared_from_this()}, sequences_{*params_} {}
   virtual ~Search() = default;
@@ -28,11 +38,27 @@ struct Search : LeakChecked<Search> {
   // Scoring features
   virtual void ApplyMinLength(int min_length) = 0;
   virtual void ApplyRepetitionPenalty(float penalty) = 0;
+  // Applies every scoring feature enabled in the search options
+  virtual void ProcessLogits();
 
   // Set user input tokens
   virtual void AppendTokens(DeviceSpan<int32_t>& next_tokens) { assert(false); };
   // To be used for rewind
   virtual void RewindTo(size_t index) { assert(false); };
+  // Puts back the next tokens that RewindTo took from the sequences, so that generation continues after a rewind. Unlike
+  // AppendTokens, rows that kept their EOS stay done.
+  virtual void AppendRewoundTokens() {
+    auto next_tokens = GetNextTokens();
+    AppendTokens(next_tokens);
+  }
+  // Samples from another random stream of the same seed, so that forks of a generator sample independently
+  virtual void SetRandomStream(uint64_t /*stream*/) {}
+  // The position of the random streams, saved with the generator state so that sampling continues the same way.
+  // Empty for searches that don't keep their random state on the CPU.
+  virtual std::vector<uint8_t> GetRandomState() const { return {}; }
+  virtual void SetRandomState(std::span<const uint8_t> /*state*/) {}
+
+  virtual const TokenLogprobs& GetLogprobs() const { throw std::runtime_error("Logprobs are not supported by this search."); }
 
   std::shared_ptr<const GeneratorParams> params_;
   Sequences sequences_;
@@ -49,6 +75,7 @@ struct Search_Cpu : Search {
 
   void ApplyMinLength(int min_length) override;
   void ApplyRepetitionPenalty(float penalty) override;
+  void ProcessLogits() override;
 
   std::span<float> GetScores(int batch_beam_index);
 
@@ -60,6 +87,8 @@ struct Search_Cpu : Search {
 
   DeviceSpan<float> next_token_scores_;  // shape (beam_size*batch_size, vocab_size)
 
+  LogitsPipeline logits_pipeline_{*params_, sequences_};
+
   bool done_{};
 };
 
@@ -77,6 +106,12 @@ struct GreedySearch_Cpu : Search_Cpu {
   // Used by continuous decoding search.
   void AppendTokens(DeviceSpan<int32_t>& next_tokens) override;
   void RewindTo(size_t index) override;
+  void AppendRewoundTokens() override;
+  void SetRandomStream(uint64_t stream) override;
+  std::vector<uint8_t> GetRandomState() const override;
+  void SetRandomState(std::span<const uint8_t> state) override;
+
+  const TokenLogprobs& GetLogprobs() const override { return logprobs_; }
 
  protected:
   void SetNextToken(size_t batch_id, int32_t token);
@@ -84,14 +119,40 @@ struct GreedySearch_Cpu : Search_Cpu {
 
   bool PadIfAlreadyEOS(size_t batch_id);
 
+  // State of a batch row's sampling. Every row has its own random stream and scratch buffers, so that rows can be
+  // sampled on any thread and still give the same tokens.
+  struct RowState {
+    RowState(uint64_t seed, size_t row) : gen{seed, row} {}
+
+    Philox4x32 gen;
+    std::vector<int32_t> top_indices;
+    std::vector<float> top_scores;
+    std::vector<float> top_scores_filtered;
+    std::vector<float> probabilities;  // For top-p sampling to keep the scores intact while logprobs are computed
+    std::vector<int32_t> top_logprob_indices;
+  };
+
+  // Picks the next token of every row that hasn't seen EOS yet with sample_row, then appends the tokens to the
+  // sequences. Large batches are spread over the sampling thread pool.
+  void SampleRows(const std::function<int32_t(std::span<float> scores, RowState& row)>& sample_row);
+
+  // Normalizes the scores of a row and fills its most likely tokens, returns the log of the softmax denominator
+  float ComputeTopLogprobs(size_t batch_id, std::span<const float> scores, RowState& row);
+  void PadLogprobs(size_t batch_id);
+
   DeviceSpan<int32_t> next_tokens_ptr_;
   std::unique_ptr<int32_t[]> temp_topk_buffer_;
 
   std::span<bool> eos_seen_;  // shape (batch_size)
   std::unique_ptr<bool[]> eos_seen_buffer_;
   int not_done_count_{params_->search.batch_size};  // When zero, every batch entry is done (starts at batch_size_)
+  std::vector<size_t> eos_lengths_;                 // shape (batch_size), sequence length once the row sampled EOS, or 0
 
-  std::mt19937 gen_;
+  uint64_t seed_;
+  std::vector<RowState> rows_;  // shape (batch_size)
+
+  bool compute_logprobs_{params_->search.logprobs || params_->search.top_logprobs > 0};
+  TokenLogprobs logprobs_;
 };
 
 struct BeamSearch_Cpu : Search_Cpu {
@@ -118,6 +179,15 @@ struct BeamSearch_Cpu : Search_Cpu {
 
   std::unique_ptr<int32_t[]> next_tokens_buffer_;  // prevents freeing of next_tokens buffer for setting user tokens
 
+  // Scratch buffers for SelectTop, reused across steps
+  std::vector<std::vector<int32_t>> beam_top_indices_;  // shape (batch_size*num_beams, 2*num_beams)
+  std::vector<float> candidate_scores_;                 // shape (batch_size*num_beams, 2*num_beams)
+  std::vector<int32_t> candidate_tokens_;               // shape (batch_size*num_beams, 2*num_beams)
+  std::vector<int32_t> candidate_order_;
+  std::vector<float> top_k_scores_;                     // shape (batch_size, 2*num_beams)
+  std::vector<int32_t> top_k_indices_;                  // shape (batch_size, 2*num_beams), beam of each candidate
+  std::vector<int32_t> top_k_tokens_;                   // shape (batch_size, 2*num_beams)
+
   std::unique_ptr<BeamSearchScorer> beam_scorer_;
 };
 
@@ -0,0 +1,236 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "generators.h"
+#include "models/model.h"
+#include "session_pool.h"
+
+namespace Generators {
+
+namespace {
+
+void RemoveFile(const fs::path& path) {
+#ifdef _WIN32
+  _wremove(path.c_str());
+#else
+  std::remove(path.c_str());
+#endif
+}
+
+}  // namespace
+
+std::optional<double> SessionPool::Stats::Get(std::string_view name) const {
+  const std::pair<std::string_view, size_t> counts[] = {
+      {"turns", turns},
+      {"hits", hits},
+      {"loads", loads},
+      {"reused_tokens", reused_tokens},
+      {"evictions", evictions},
+      {"drops", drops},
+      {"active_sessions", active_sessions},
+      {"stored_sessions", stored_sessions},
+      {"spilled_sessions", spilled_sessions},
+      {"stored_bytes", stored_bytes},
+  };
+  for (const auto& [count_name, count] : counts) {
+    if (name == count_name)
+      return static_cast<double>(count);
+  }
+  if (name == "hit_rate")
+    return HitRate();
+  return std::nullopt;
+}
+
+SessionPool::SessionPool(const Model& model, const GeneratorParams& params, const Options& options)
+    : model_{model.shared_from_this()},
+      params_{params.shared_from_this()},
+      options_{options} {
+  if (params.search.batch_size != 1 || params.search.num_beams != 1)
+    throw std::runtime_error("SessionPool only supports batch_size 1 and num_beams 1.");
+  if (options_.max_active_sessions == 0)
+    throw std::runtime_error("SessionPool needs max_active_sessions of at least 1.");
+}
+
+SessionPool::~SessionPool() {
+  for (auto& [id, session] : sessions_)
+    Forget(session);
+}
+
+std::unique_ptr<Generator> SessionPool::Acquire(const std::string& id, cpu_span<const int32_t> tokens) {
+  if (tokens.empty())
+    throw std::runtime_error("SessionPool::Acquire called with no tokens.");
+
+  // Take what the pool holds of the conversation, then run the model outside the lock
+  std::unique_ptr<Generator> generator;
+  std::vector<uint8_t> state;
+  fs::path spill_path;
+  {
+    std::lock_guard lock{mutex_};
+    auto& session = sessions_[id];
+    if (session.checked_out)
+      throw std::runtime_error("Conversation " + id + " is already checked out of the session pool.");
+    session.checked_out = true;
+    session.last_use = ++clock_;
+    generator = std::move(session.generator);
+    stored_bytes_ -= session.state.size();
+    state = std::move(session.state);
+    spill_path = std::move(session.spill_path);
+    session.spill_path = {};
+    stats_.turns++;
+  }
+
+  bool loaded = false;
+  size_t reused_tokens = 0;
+  try {
+    if (!generator && (!state.empty() || !spill_path.string().empty())) {
+      // A state that fails to load only costs the prefill of the whole transcript
+      try {
+        generator = CreateGenerator(*model_, *params_);
+        if (!state.empty())
+          generator->LoadState(state);
+        else
+          generator->LoadState(spill_path);
+        loaded = true;
+      } catch (const std::exception&) {
+        generator.reset();
+      }
+      state = {};
+      if (!spill_path.string().empty())
+        RemoveFile(spill_path);
+    }
+
+    if (generator) {
+      auto sequence = generator->GetSequence(0).CopyDeviceToCpu();
+      reused_tokens = std::mismatch(sequence.begin(), sequence.end(), tokens.begin(), tokens.end()).first - sequence.begin();
+      if (reused_tokens == 0)
+        generator.reset();
+      else if (reused_tokens < sequence.size())
+        generator->RewindToLength(reused_tokens);
+    }
+
+    if (!generator)
+      generator = CreateGenerator(*model_, *params_);
+    if (reused_tokens < tokens.size())
+      generator->AppendTokens(cpu_span<const int32_t>{tokens.subspan(reused_tokens, tokens.size() - reused_tokens)});
+  } catch (...) {
+    // The conversation's state was taken out of the pool, so it is forgotten
+    std::lock_guard lock{mutex_};
+    sessions_.erase(id);
+    throw;
+  }
+
+  std::lock_guard lock{mutex_};
+  if (reused_tokens > 0) {
+    stats_.hits++;
+    stats_.loads += loaded;
+    stats_.reused_tokens += reused_tokens;
+  }
+  return generator;
+}
+
+void SessionPool::Release(const std::string& id, std::unique_ptr<Generator> generator) {
+  std::lock_guard lock{mutex_};
+  auto session = sessions_.find(id);
+  // The conversation was removed while it was checked out
+  if (session == sessions_.end())
+    return;
+  if (!session->second.checked_out)
+    throw std::runtime_error("Conversation " + id + " was not checked out of the session pool.");
+
+  if (!generator) {
+    sessions_.erase(session);
+    return;
+  }
+  session->second.checked_out = false;
+  session->second.generator = std::move(generator);
+  session->second.last_use = ++clock_;
+  Evict();
+}
+
+void SessionPool::Remove(const std::string& id) {
+  std::lock_guard lock{mutex_};
+  auto session = sessions_.find(id);
+  if (session == sessions_.end())
+    return;
+  Forget(session->second);
+  sessions_.erase(session);
+}
+
+void SessionPool::Evict() {
+  // Generators beyond max_active_sessions are saved to host memory, least recently used first
+  while (true) {
+    size_t active_sessions = 0;
+    Session* oldest = nullptr;
+    for (auto& [id, session] : sessions_) {
+      active_sessions += session.generator || session.checked_out;
+      if (session.generator && (!oldest || session.last_use < oldest->last_use))
+        oldest = &session;
+    }
+    if (active_sessions <= options_.max_active_sessions || !oldest)
+      break;
+
+    try {
+      oldest->generator->SaveState(oldest->state);
+      stored_bytes_ += oldest->state.size();
+    } catch (const std::exception&) {
+      oldest->state = {};
+      stats_.drops++;
+    }
+    oldest->generator.reset();
+    stats_.evictions++;
+  }
+
+  // Saved states beyond max_bytes are spilled or dropped, least recently used first
+  while (stored_bytes_ > options_.max_bytes) {
+    Session* oldest = nullptr;
+    for (auto& [id, session] : sessions_) {
+      if (!session.state.empty() && (!oldest || session.last_use < oldest->last_use))
+        oldest = &session;
+    }
+    assert(oldest);
+
+    if (!options_.spill_directory.string().empty()) {
+      auto spill_path = options_.spill_directory / fs::path("session_pool_" + std::to_string(reinterpret_cast<uintptr_t>(this)) + "_" + std::to_string(++spill_count_) + ".bin");
+      auto file = spill_path.open_for_write(std::ios::binary | std::ios::trunc);
+      file.write(reinterpret_cast<const char*>(oldest->state.data()), oldest->state.size());
+      file.close();
+      if (file)
+        oldest->spill_path = spill_path;
+      else
+        RemoveFile(spill_path);
+    }
+    if (oldest->spill_path.string().empty())
+      stats_.drops++;
+    stored_bytes_ -= oldest->state.size();
+    oldest->state = {};
+  }
+
+  for (auto session = sessions_.begin(); session != sessions_.end();) {
+    const bool dropped = !session->second.checked_out && !session->second.generator && session->second.state.empty() &&
+                         session->second.spill_path.string().empty();
+    session = dropped ? sessions_.erase(session) : std::next(session);
+  }
+}
+
+void SessionPool::Forget(Session& session) {
+  session.generator.reset();
+  stored_bytes_ -= session.state.size();
+  session.state = {};
+  if (!session.spill_path.string().empty())
+    RemoveFile(session.spill_path);
+  session.spill_path = {};
+}
+
+SessionPool::Stats SessionPool::GetStats() const {
+  std::lock_guard lock{mutex_};
+  Stats stats = stats_;
+  for (const auto& [id, session] : sessions_) {
+    stats.active_sessions += session.generator || session.checked_out;
+    stats.stored_sessions += !session.state.empty();
+    stats.spilled_sessions += !session.spill_path.string().empty();
+  }
+  stats.stored_bytes = stored_bytes_;
+  return stats;
+}
+
+}  // namespace Generators
@@ -0,0 +1,82 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+#pragma once
+
+namespace Generators {
+
+// Keeps the conversations of a chat service between turns, so that a turn only runs the model on the tokens added
+// since the previous one instead of on the whole transcript again.
+//
+// The most recently used conversations keep their generator. Beyond max_active_sessions, the least recently used
+// generators are saved with Generator::SaveState into host memory and destroyed, which frees their device buffers and
+// keeps only the used positions of their key-value cache. Beyond max_bytes of saved states, the least recently used
+// ones are written to spill_directory, or dropped if it is not set. A dropped conversation starts again from its whole
+// transcript on its next turn.
+struct SessionPool {
+  struct Options {
+    size_t max_active_sessions{4};      // Conversations that keep their generator, including the checked out ones
+    size_t max_bytes{size_t{1} << 30};  // Host memory for the saved states of the other conversations
+    fs::path spill_directory;           // Where saved states go beyond max_bytes. They are dropped if this is empty.
+  };
+
+  struct Stats {
+    size_t turns{};          // Number of calls to Acquire
+    size_t hits{};           // Number of turns that continued a conversation held by the pool
+    size_t loads{};          // Number of hits that restored a saved state
+    size_t reused_tokens{};  // Number of transcript tokens that were not run through the model again
+    size_t evictions{};      // Number of generators saved and destroyed to stay within max_active_sessions
+    size_t drops{};          // Number of conversations forgotten to stay within the limits
+
+    size_t active_sessions{};   // Conversations with a generator
+    size_t stored_sessions{};   // Conversations saved in host memory
+    size_t spilled_sessions{};  // Conversations saved in spill_directory
+    size_t stored_bytes{};      // Host memory held by the saved states
+
+    double HitRate() const { return turns ? static_cast<double>(hits) / turns : 0.0; }
+    std::optional<double> Get(std::string_view name) const;
+  };
+
+  SessionPool(const Model& model, const GeneratorParams& params, const Options& options);
+  ~SessionPool();  // Deletes the spilled states
+
+  SessionPool(const SessionPool&) = delete;
+  SessionPool& operator=(const SessionPool&) = delete;
+
+  // Returns a generator that has appended tokens, the whole transcript of the conversation so far: the tokens of its
+  // previous turns, including the generated ones, followed by the new ones. If the pool holds the conversation, only
+  // the tokens after the longest common prefix with its sequence are run through the model. The conversation is
+  // checked out until its generator is given back with Release, and the generator can be used on any thread meanwhile.
+  std::unique_ptr<Generator> Acquire(const std::string& id, cpu_span<const int32_t> tokens);
+  // Takes back the generator of a conversation after its turn, and evicts the least recently used conversations if
+  // the pool is over its limits. A null generator forgets the conversation.
+  void Release(const std::string& id, std::unique_ptr<Generator> generator);
+  // Forgets a conversation. If it is checked out, its generator is destroyed when it is released.
+  void Remove(const std::string& id);
+
+  Stats GetStats() const;
+
+ private:
+  struct Session {
+    std::unique_ptr<Generator> generator;  // Set while active and not checked out
+    std::vector<uint8_t> state;            // Set while stored in host memory
+    fs::path spill_path;                   // Set while spilled
+    bool checked_out{};
+    uint64_t last_use{};
+  };
+
+  void Evict();
+  void Forget(Session& session);  // Releases what the session holds, except a checked out generator
+
+  std::shared_ptr<const Model> model_;
+  std::shared_ptr<const GeneratorParams> params_;
+  Options options_;
+
+  mutable std::mutex mutex_;  // Guards everything below. The model only runs under it to evict.
+  std::unordered_map<std::string, Session> sessions_;
+  uint64_t clock_{};
+  uint64_t spill_count_{};
+  size_t stored_bytes_{};
+  Stats stats_;
+};
+
+}  // namespace Generators
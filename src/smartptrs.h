@@ -25,6 +25,8 @@ struct DeviceBuffer : std::enable_shared_from_this<DeviceBuffer> {
   virtual void AllocateCpu() = 0;      // Allocates p_cpu_ if necessary (using appropriate memory type for interop)
   virtual void CopyDeviceToCpu() = 0;  // Allocates p_cpu_ if necessary and copies p_device_ memory into it
   virtual void CopyCpuToDevice() = 0;
+  // Copies only part of p_cpu_ to p_device_. Devices without a ranged copy copy the whole buffer.
+  virtual void CopyRangeCpuToDevice(size_t /*begin*/, size_t /*size_in_bytes*/) { CopyCpuToDevice(); }
   virtual void CopyFrom(size_t begin_dest, DeviceBuffer& source, size_t begin_source, size_t size_in_bytes) = 0;
   virtual void Zero() = 0;  // Zero out the device memory
 
@@ -66,6 +68,9 @@ struct DeviceSpan {
   // Copy CPU memory to device memory, typically used after calling CpuSpan or CopyDeviceToCpu to update the device memory with the modifications made
   void CopyCpuToDevice() { p_device_memory_->CopyCpuToDevice(); }
 
+  // Copy only the CPU memory of this span to device memory, when the rest of the buffer is known to be unchanged or unused
+  void CopyRangeCpuToDevice() { p_device_memory_->CopyRangeCpuToDevice(begin_ * sizeof(T), length_ * sizeof(T)); }
+
   // Zero out the device memory
   void Zero() { p_device_memory_->Zero(); }
 
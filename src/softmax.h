@@ -1,35 +1,48 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "span.h"
+
 namespace Generators {
 
-void SoftmaxWithMax(std::span<float> scores, float temperature, float max_score) {
-  // Subtract max score and scale by temperature
-  std::transform(scores.begin(), scores.end(), scores.begin(), [max_score, temperature](float score) { return std::exp((score - max_score) / temperature); });
+// Vectorized CPU kernels for the search. The widest instruction set the CPU supports (AVX-512, AVX2 or plain C++)
+// is chosen once at runtime, so a single binary runs everywhere and still uses the wide registers where available.
+
+// Returns the name of the instruction set the kernels run with: "avx512", "avx2" or "scalar"
+std::string_view CpuKernelInstructionSet();
+
+// Makes the kernels run with the named instruction set instead of the widest one, so that tests can compare every
+// flavor. Returns false if the CPU doesn't support it. An empty name goes back to the widest one.
+bool SetCpuKernelInstructionSet(std::string_view name);
+
+float MaxElement(std::span<const float> values);
 
-  // Compute sum of exponentials
-  float const exp_sum = std::accumulate(scores.begin(), scores.end(), 0.0f);
+// Returns the index of the first largest value, like std::max_element
+size_t Argmax(std::span<const float> values);
 
-  // Divide each score by the sum of exponentials
-  std::transform(scores.begin(), scores.end(), scores.begin(), [exp_sum](float score) { return score / exp_sum; });
-}
+// Divides every score by the temperature
+void ApplyTemperature(std::span<float> scores, float temperature);
 
-void Softmax(std::span<float> scores, float temperature) {
-  const float max_score = *std::max_element(scores.begin(), scores.end());
+// Fused exp((score - max_score) / temperature) and sum, followed by the normalization
+void SoftmaxWithMax(std::span<float> scores, float temperature, float max_score);
 
-  SoftmaxWithMax(scores, temperature, max_score);
-}
+void Softmax(std::span<float> scores, float temperature);
 
-void LogSoftMax(std::span<float> scores, float temperature) {
-  float const max_score = *std::max_element(scores.begin(), scores.end());
+void LogSoftMax(std::span<float> scores, float temperature);
 
-  // Subtract max score and scale by temperature
-  std::transform(scores.begin(), scores.end(), scores.begin(), [max_score, temperature](float score) { return (score - max_score) / temperature; });
+// log(sum(exp(score - max_score))), so single log-probabilities can be found without writing every score
+float LogSumExp(std::span<const float> scores, float max_score);
 
-  // Compute sum of exponentials
-  float const exp_sum = std::accumulate(scores.begin(), scores.end(), 0.0f, [](float a, float b) { return a + std::exp(b); });
+// Fills indices with the positions of the k largest scores, largest first. Uses a bounded min-heap, so a score
+// that doesn't beat the current k-th largest costs a single compare. The vector is reused as scratch space.
+void TopKIndices(std::span<const float> scores, size_t k, std::vector<int32_t>& indices);
 
-  // Subtract log of sum of exponentials from each score
-  std::transform(scores.begin(), scores.end(), scores.begin(), [exp_sum](float score) { return score - std::log(exp_sum); });
-}
+// Fills indices with the most probable tokens, most probable first, such that their probabilities add up to at
+// least p. Only the tokens above a probability cutoff get sorted, instead of the whole vocabulary.
+void TopPIndices(std::span<const float> probabilities, float p, std::vector<int32_t>& indices);
 
 }  // namespace Generators
@@ -1,22 +1,490 @@
-#include "generators.h"
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "softmax.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define USE_X86_KERNELS 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define X86_TARGET(isa)
+#else
+#define X86_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
 
 namespace Generators {
 
-void softmax(std::span<float> values) {
-  float max = *std::max_element(values.data(), values.data() + values.size());
-  std::transform(values.begin(), values.end(), values.begin(), [max](float v) { return std::exp(v - max); });
-  float sum = std::accumulate(values.begin(), values.end(), 0.0f);
-  std::transform(values.begin(), values.end(), values.begin(), [sum](float v) { return v / sum; });
+namespace {
+
+// Every kernel comes in a scalar, an AVX2 and an AVX-512 flavor with the same signatures
+struct Kernels {
+  const char* name;
+  float (*max)(const float* values, size_t count);
+  size_t (*argmax)(const float* values, size_t count);
+  // values[i] = exp((values[i] - max) * scale), returns the sum of the results
+  float (*exp_sum)(float* values, size_t count, float max, float scale);
+  // Returns the sum of exp((values[i] - max) * scale) without writing anything back
+  float (*exp_sum_reduce)(const float* values, size_t count, float max, float scale);
+  // values[i] = values[i] * scale + bias
+  void (*affine)(float* values, size_t count, float scale, float bias);
+};
+
+float MaxScalar(const float* values, size_t count) {
+  return *std::max_element(values, values + count);
+}
+
+size_t ArgmaxScalar(const float* values, size_t count) {
+  return std::distance(values, std::max_element(values, values + count));
+}
+
+float ExpSumScalar(float* values, size_t count, float max, float scale) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < count; i++) {
+    values[i] = std::exp((values[i] - max) * scale);
+    sum += values[i];
+  }
+  return sum;
+}
+
+float ExpSumReduceScalar(const float* values, size_t count, float max, float scale) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < count; i++)
+    sum += std::exp((values[i] - max) * scale);
+  return sum;
+}
+
+void AffineScalar(float* values, size_t count, float scale, float bias) {
+  for (size_t i = 0; i < count; i++)
+    values[i] = values[i] * scale + bias;
 }
 
-void log_softmax(std::span<float> values) {
-  float max = *std::max_element(values.data(), values.data() + values.size());
-  std::vector<float> scaled(values.begin(), values.end());
-  std::transform(values.begin(), values.end(), scaled.begin(), [max](float v) { return std::exp(v - max); });
+constexpr Kernels scalar_kernels{"scalar", MaxScalar, ArgmaxScalar, ExpSumScalar, ExpSumReduceScalar, AffineScalar};
+
+#if USE_X86_KERNELS
+
+// exp(x) = 2^n * exp(r) with n = round(x / ln(2)) and |r| <= ln(2) / 2, where exp(r) is a degree 6 polynomial
+// (Cephes expf). Inputs below the smallest normal result flush to 0, so masked out scores stay at 0.
+constexpr float kExpMax = 88.3762626647949f;
+constexpr float kExpMin = -87.3365447505531f;
+constexpr float kLog2e = 1.44269504088896341f;
+constexpr float kLn2Hi = 0.693359375f;
+constexpr float kLn2Lo = -2.12194440e-4f;
+constexpr float kExpP0 = 1.9875691500e-4f;
+constexpr float kExpP1 = 1.3981999507e-3f;
+constexpr float kExpP2 = 8.3334519073e-3f;
+constexpr float kExpP3 = 4.1665795894e-2f;
+constexpr float kExpP4 = 1.6666665459e-1f;
+constexpr float kExpP5 = 5.0000001201e-1f;
+
+X86_TARGET("avx2,fma")
+inline __m256 Exp(__m256 x) {
+  const __m256 underflow = _mm256_cmp_ps(x, _mm256_set1_ps(kExpMin), _CMP_LT_OQ);
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(kExpMin)), _mm256_set1_ps(kExpMax));
+
+  const __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(kLog2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(kLn2Hi), x);
+  r = _mm256_fnmadd_ps(n, _mm256_set1_ps(kLn2Lo), r);
+
+  __m256 p = _mm256_set1_ps(kExpP0);
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP1));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP2));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP3));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP4));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP5));
+  p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+  const __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_andnot_ps(underflow, _mm256_mul_ps(p, _mm256_castsi256_ps(exponent)));
+}
+
+X86_TARGET("avx2,fma")
+inline float HorizontalSum(__m256 v) {
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+  return _mm_cvtss_f32(sum);
+}
+
+X86_TARGET("avx2,fma")
+inline float HorizontalMax(__m256 v) {
+  __m128 max = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  max = _mm_max_ps(max, _mm_movehl_ps(max, max));
+  max = _mm_max_ss(max, _mm_movehdup_ps(max));
+  return _mm_cvtss_f32(max);
+}
+
+X86_TARGET("avx2,fma")
+float MaxAvx2(const float* values, size_t count) {
+  if (count < 8)
+    return MaxScalar(values, count);
+
+  __m256 max = _mm256_loadu_ps(values);
+  size_t i = 8;
+  for (; i + 8 <= count; i += 8)
+    max = _mm256_max_ps(max, _mm256_loadu_ps(values + i));
+
+  float result = HorizontalMax(max);
+  for (; i < count; i++)
+    result = std::max(result, values[i]);
+  return result;
+}
+
+X86_TARGET("avx2,fma")
+size_t ArgmaxAvx2(const float* values, size_t count) {
+  if (count < 8)
+    return ArgmaxScalar(values, count);
+
+  // Each lane keeps its first largest value, ties between lanes go to the lowest index below
+  __m256 best_values = _mm256_loadu_ps(values);
+  __m256i best_indices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i indices = best_indices;
+  const __m256i step = _mm256_set1_epi32(8);
+  size_t i = 8;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 v = _mm256_loadu_ps(values + i);
+    indices = _mm256_add_epi32(indices, step);
+    const __m256 greater = _mm256_cmp_ps(v, best_values, _CMP_GT_OQ);
+    best_values = _mm256_blendv_ps(best_values, v, greater);
+    best_indices = _mm256_blendv_epi8(best_indices, indices, _mm256_castps_si256(greater));
+  }
+
+  alignas(32) float lane_values[8];
+  alignas(32) int32_t lane_indices[8];
+  _mm256_store_ps(lane_values, best_values);
+  _mm256_store_si256(reinterpret_cast<__m256i*>(lane_indices), best_indices);
+
+  float best_value = lane_values[0];
+  size_t best_index = static_cast<size_t>(lane_indices[0]);
+  for (int lane = 1; lane < 8; lane++) {
+    if (lane_values[lane] > best_value || (lane_values[lane] == best_value && static_cast<size_t>(lane_indices[lane]) < best_index)) {
+      best_value = lane_values[lane];
+      best_index = static_cast<size_t>(lane_indices[lane]);
+    }
+  }
+
+  for (; i < count; i++) {
+    if (values[i] > best_value) {
+      best_value = values[i];
+      best_index = i;
+    }
+  }
+  return best_index;
+}
+
+X86_TARGET("avx2,fma")
+float ExpSumAvx2(float* values, size_t count, float max, float scale) {
+  const __m256 max_v = _mm256_set1_ps(max);
+  const __m256 scale_v = _mm256_set1_ps(scale);
+  __m256 sum = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 e = Exp(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(values + i), max_v), scale_v));
+    _mm256_storeu_ps(values + i, e);
+    sum = _mm256_add_ps(sum, e);
+  }
+  return HorizontalSum(sum) + ExpSumScalar(values + i, count - i, max, scale);
+}
+
+X86_TARGET("avx2,fma")
+float ExpSumReduceAvx2(const float* values, size_t count, float max, float scale) {
+  const __m256 max_v = _mm256_set1_ps(max);
+  const __m256 scale_v = _mm256_set1_ps(scale);
+  __m256 sum = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+    sum = _mm256_add_ps(sum, Exp(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(values + i), max_v), scale_v)));
+  return HorizontalSum(sum) + ExpSumReduceScalar(values + i, count - i, max, scale);
+}
+
+X86_TARGET("avx2,fma")
+void AffineAvx2(float* values, size_t count, float scale, float bias) {
+  const __m256 scale_v = _mm256_set1_ps(scale);
+  const __m256 bias_v = _mm256_set1_ps(bias);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+    _mm256_storeu_ps(values + i, _mm256_fmadd_ps(_mm256_loadu_ps(values + i), scale_v, bias_v));
+  AffineScalar(values + i, count - i, scale, bias);
+}
+
+constexpr Kernels avx2_kernels{"avx2", MaxAvx2, ArgmaxAvx2, ExpSumAvx2, ExpSumReduceAvx2, AffineAvx2};
+
+X86_TARGET("avx512f")
+inline __m512 Exp(__m512 x) {
+  const __mmask16 underflow = _mm512_cmp_ps_mask(x, _mm512_set1_ps(kExpMin), _CMP_LT_OQ);
+  x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(kExpMin)), _mm512_set1_ps(kExpMax));
+
+  const __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(kLog2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(kLn2Hi), x);
+  r = _mm512_fnmadd_ps(n, _mm512_set1_ps(kLn2Lo), r);
+
+  __m512 p = _mm512_set1_ps(kExpP0);
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP1));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP2));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP3));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP4));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP5));
+  p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+
+  return _mm512_maskz_mov_ps(static_cast<__mmask16>(~underflow), _mm512_scalef_ps(p, n));
+}
+
+X86_TARGET("avx512f")
+float MaxAvx512(const float* values, size_t count) {
+  if (count < 16)
+    return MaxScalar(values, count);
+
+  __m512 max = _mm512_loadu_ps(values);
+  size_t i = 16;
+  for (; i + 16 <= count; i += 16)
+    max = _mm512_max_ps(max, _mm512_loadu_ps(values + i));
+  if (i < count)
+    max = _mm512_mask_max_ps(max, static_cast<__mmask16>((1u << (count - i)) - 1), max, _mm512_maskz_loadu_ps(static_cast<__mmask16>((1u << (count - i)) - 1), values + i));
+  return _mm512_reduce_max_ps(max);
+}
+
+X86_TARGET("avx512f")
+size_t ArgmaxAvx512(const float* values, size_t count) {
+  if (count < 16)
+    return ArgmaxScalar(values, count);
+
+  __m512 best_values = _mm512_loadu_ps(values);
+  __m512i best_indices = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  __m512i indices = best_indices;
+  const __m512i step = _mm512_set1_epi32(16);
+  size_t i = 16;
+  for (; i + 16 <= count; i += 16) {
+    const __m512 v = _mm512_loadu_ps(values + i);
+    indices = _mm512_add_epi32(indices, step);
+    const __mmask16 greater = _mm512_cmp_ps_mask(v, best_values, _CMP_GT_OQ);
+    best_values = _mm512_mask_blend_ps(greater, best_values, v);
+    best_indices = _mm512_mask_blend_epi32(greater, best_indices, indices);
+  }
+
+  // Of the lanes holding the largest value, pick the lowest index
+  const float best_value = _mm512_reduce_max_ps(best_values);
+  const __mmask16 is_best = _mm512_cmp_ps_mask(best_values, _mm512_set1_ps(best_value), _CMP_EQ_OQ);
+  size_t best_index = static_cast<size_t>(_mm512_mask_reduce_min_epi32(is_best, best_indices));
+
+  float tail_best_value = best_value;
+  for (; i < count; i++) {
+    if (values[i] > tail_best_value) {
+      tail_best_value = values[i];
+      best_index = i;
+    }
+  }
+  return best_index;
+}
+
+X86_TARGET("avx512f")
+float ExpSumAvx512(float* values, size_t count, float max, float scale) {
+  const __m512 max_v = _mm512_set1_ps(max);
+  const __m512 scale_v = _mm512_set1_ps(scale);
+  __m512 sum = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m512 e = Exp(_mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(values + i), max_v), scale_v));
+    _mm512_storeu_ps(values + i, e);
+    sum = _mm512_add_ps(sum, e);
+  }
+  if (i < count) {
+    const __mmask16 tail = static_cast<__mmask16>((1u << (count - i)) - 1);
+    const __m512 e = _mm512_maskz_mov_ps(tail, Exp(_mm512_mul_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(tail, values + i), max_v), scale_v)));
+    _mm512_mask_storeu_ps(values + i, tail, e);
+    sum = _mm512_add_ps(sum, e);
+  }
+  return _mm512_reduce_add_ps(sum);
+}
+
+X86_TARGET("avx512f")
+float ExpSumReduceAvx512(const float* values, size_t count, float max, float scale) {
+  const __m512 max_v = _mm512_set1_ps(max);
+  const __m512 scale_v = _mm512_set1_ps(scale);
+  __m512 sum = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16)
+    sum = _mm512_add_ps(sum, Exp(_mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(values + i), max_v), scale_v)));
+  if (i < count) {
+    const __mmask16 tail = static_cast<__mmask16>((1u << (count - i)) - 1);
+    sum = _mm512_add_ps(sum, _mm512_maskz_mov_ps(tail, Exp(_mm512_mul_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(tail, values + i), max_v), scale_v))));
+  }
+  return _mm512_reduce_add_ps(sum);
+}
+
+X86_TARGET("avx512f")
+void AffineAvx512(float* values, size_t count, float scale, float bias) {
+  const __m512 scale_v = _mm512_set1_ps(scale);
+  const __m512 bias_v = _mm512_set1_ps(bias);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16)
+    _mm512_storeu_ps(values + i, _mm512_fmadd_ps(_mm512_loadu_ps(values + i), scale_v, bias_v));
+  if (i < count) {
+    const __mmask16 tail = static_cast<__mmask16>((1u << (count - i)) - 1);
+    _mm512_mask_storeu_ps(values + i, tail, _mm512_fmadd_ps(_mm512_maskz_loadu_ps(tail, values + i), scale_v, bias_v));
+  }
+}
+
+constexpr Kernels avx512_kernels{"avx512", MaxAvx512, ArgmaxAvx512, ExpSumAvx512, ExpSumReduceAvx512, AffineAvx512};
+
+#if defined(_MSC_VER) && !defined(__clang__)
+bool CpuSupports(int leaf, int subleaf, int register_index, int bit) {
+  int registers[4];
+  __cpuidex(registers, leaf, subleaf);
+  return (registers[register_index] >> bit) & 1;
+}
+
+bool SupportsAvx2() {
+  // AVX2 and FMA, plus the OS saving the YMM registers (OSXSAVE and XCR0 bits 1 and 2)
+  return CpuSupports(1, 0, 2, 27) && (_xgetbv(0) & 0x6) == 0x6 && CpuSupports(7, 0, 1, 5) && CpuSupports(1, 0, 2, 12);
+}
+
+bool SupportsAvx512() {
+  // AVX512F, plus the OS saving the opmask and ZMM registers (XCR0 bits 5 to 7)
+  return SupportsAvx2() && (_xgetbv(0) & 0xe0) == 0xe0 && CpuSupports(7, 0, 1, 16);
+}
+#else
+bool SupportsAvx2() { return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"); }
+bool SupportsAvx512() { return __builtin_cpu_supports("avx512f"); }
+#endif
+
+#endif  // USE_X86_KERNELS
+
+const Kernels& SelectKernels() {
+#if USE_X86_KERNELS
+  if (SupportsAvx512())
+    return avx512_kernels;
+  if (SupportsAvx2())
+    return avx2_kernels;
+#endif
+  return scalar_kernels;
+}
+
+std::atomic<const Kernels*>& ActiveKernels() {
+  static std::atomic<const Kernels*> kernels{&SelectKernels()};
+  return kernels;
+}
+
+const Kernels& GetKernels() {
+  return *ActiveKernels().load(std::memory_order_relaxed);
+}
+
+}  // namespace
+
+std::string_view CpuKernelInstructionSet() {
+  return GetKernels().name;
+}
+
+bool SetCpuKernelInstructionSet(std::string_view name) {
+  const Kernels* kernels = nullptr;
+  if (name.empty())
+    kernels = &SelectKernels();
+  else if (name == scalar_kernels.name)
+    kernels = &scalar_kernels;
+#if USE_X86_KERNELS
+  else if (name == avx2_kernels.name && SupportsAvx2())
+    kernels = &avx2_kernels;
+  else if (name == avx512_kernels.name && SupportsAvx512())
+    kernels = &avx512_kernels;
+#endif
+  if (!kernels)
+    return false;
+  ActiveKernels().store(kernels, std::memory_order_relaxed);
+  return true;
+}
+
+float MaxElement(std::span<const float> values) {
+  return GetKernels().max(values.data(), values.size());
+}
+
+size_t Argmax(std::span<const float> values) {
+  return GetKernels().argmax(values.data(), values.size());
+}
+
+void ApplyTemperature(std::span<float> scores, float temperature) {
+  if (temperature != 1.0f)
+    GetKernels().affine(scores.data(), scores.size(), 1.0f / temperature, 0.0f);
+}
+
+void SoftmaxWithMax(std::span<float> scores, float temperature, float max_score) {
+  const auto& kernels = GetKernels();
+  const float exp_sum = kernels.exp_sum(scores.data(), scores.size(), max_score, 1.0f / temperature);
+  kernels.affine(scores.data(), scores.size(), 1.0f / exp_sum, 0.0f);
+}
+
+void Softmax(std::span<float> scores, float temperature) {
+  SoftmaxWithMax(scores, temperature, MaxElement(scores));
+}
+
+void LogSoftMax(std::span<float> scores, float temperature) {
+  const auto& kernels = GetKernels();
+  const float max_score = kernels.max(scores.data(), scores.size());
+  const float scale = 1.0f / temperature;
+  const float exp_sum = kernels.exp_sum_reduce(scores.data(), scores.size(), max_score, scale);
+
+  // (score - max_score) / temperature - log(exp_sum) as a single multiply-add
+  kernels.affine(scores.data(), scores.size(), scale, -max_score * scale - std::log(exp_sum));
+}
+
+float LogSumExp(std::span<const float> scores, float max_score) {
+  return std::log(GetKernels().exp_sum_reduce(scores.data(), scores.size(), max_score, 1.0f));
+}
+
+void TopKIndices(std::span<const float> scores, size_t k, std::vector<int32_t>& indices) {
+  k = std::min(k, scores.size());
+  indices.clear();
+  if (k == 0)
+    return;
+
+  // Min-heap on score, so the front is the smallest of the k largest seen so far
+  auto greater = [scores = scores.data()](int32_t a, int32_t b) { return scores[a] > scores[b]; };
+  for (size_t i = 0; i < k; i++)
+    indices.push_back(static_cast<int32_t>(i));
+  std::make_heap(indices.begin(), indices.end(), greater);
+
+  float kth_largest = scores[indices.front()];
+  for (size_t i = k; i < scores.size(); i++) {
+    if (scores[i] <= kth_largest)
+      continue;
+    std::pop_heap(indices.begin(), indices.end(), greater);
+    indices.back() = static_cast<int32_t>(i);
+    std::push_heap(indices.begin(), indices.end(), greater);
+    kth_largest = scores[indices.front()];
+  }
+  std::sort_heap(indices.begin(), indices.end(), greater);
+}
+
+void TopPIndices(std::span<const float> probabilities, float p, std::vector<int32_t>& indices) {
+  const size_t count = probabilities.size();
+  // The tokens below a cutoff add up to at most count * cutoff, so this cutoff always keeps at least p
+  const float guaranteed_cutoff = std::max(1.0f - p, 0.0f) / static_cast<float>(count);
+
+  // Start from a cutoff that keeps few tokens on peaked distributions and lower it until the tokens kept reach p.
+  // Each try is a single pass over the probabilities, and the last one is guaranteed to succeed.
+  for (float cutoff = 1.0f / 64.0f;; cutoff /= 64.0f) {
+    const bool last_try = cutoff <= guaranteed_cutoff || cutoff < 1e-6f;
+    if (last_try)
+      cutoff = guaranteed_cutoff;
+
+    indices.clear();
+    float kept = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+      if (probabilities[i] >= cutoff) {
+        indices.push_back(static_cast<int32_t>(i));
+        kept += probabilities[i];
+      }
+    }
+    if (kept >= p || last_try)
+      break;
+  }
 
-  float sum = std::accumulate(scaled.begin(), scaled.end(), 0.0f);
-  float log_max = std::log(sum);
-  std::transform(values.begin(), values.end(), values.begin(), [max, log_max](float v) { return v - max - log_max; });
+  std::sort(indices.begin(), indices.end(), [probabilities = probabilities.data()](int32_t a, int32_t b) { return probabilities[a] > probabilities[b]; });
 }
 
 }  // namespace Generators
@@ -0,0 +1,465 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "generators.h"
+#include "search.h"
+#include "logits_processor.h"
+#include "models/model.h"
+#include "models/utils.h"
+#include "softmax.h"
+#include "speculative_decoding.h"
+
+namespace Generators {
+
+namespace {
+
+// Copies the logits of every position of the raw [batch_size, sequence_length, vocab_size] logits output to fp32
+void CopyLogitsToCpu(DeviceInterface& device, OrtValue& logits, std::vector<float>& logits_cpu) {
+  auto type = logits.GetTensorTypeAndShapeInfo()->GetElementType();
+  auto bytes = ByteWrapTensor(device, logits).CopyDeviceToCpu();
+  const size_t element_count = bytes.size() / Ort::SizeOf(type);
+  logits_cpu.resize(element_count);
+
+  if (type == Ort::TypeToTensorType<float>) {
+    std::copy_n(reinterpret_cast<const float*>(bytes.data()), element_count, logits_cpu.begin());
+  } else if (type == Ort::TypeToTensorType<Ort::Float16_t>) {
+    auto data = reinterpret_cast<const Ort::Float16_t*>(bytes.data());
+    std::transform(data, data + element_count, logits_cpu.begin(), [](Ort::Float16_t v) { return ToFloat32(v); });
+  } else if (type == Ort::TypeToTensorType<Ort::BFloat16_t>) {
+    auto data = reinterpret_cast<const Ort::BFloat16_t*>(bytes.data());
+    std::transform(data, data + element_count, logits_cpu.begin(), [](Ort::BFloat16_t v) { return ToFloat32(v); });
+  } else {
+    throw std::runtime_error("Speculative decoding does not support the data type of the logits output.");
+  }
+}
+
+}  // namespace
+
+SpeculativeSampler::SpeculativeSampler(const GeneratorParams& params) : params_{params} {
+  if (params_.search.random_seed != -1)
+    gen_.seed(params_.search.random_seed);
+  else {
+    std::random_device rd;
+    std::array<uint32_t, decltype(gen_)::state_size> data;
+    std::generate(std::begin(data), std::end(data), std::ref(rd));
+    std::seed_seq seq(data.begin(), data.end());
+    gen_.seed(seq);
+  }
+
+  const auto& search = params_.search;
+  if (search.repetition_penalty != 1.0f || search.presence_penalty != 0.0f || search.frequency_penalty != 0.0f)
+    token_counts_ = std::make_unique<TokenCounts>(1, static_cast<size_t>(params_.config.model.vocab_size));
+  if (search.no_repeat_ngram_size > 0)
+    ngram_index_ = std::make_unique<NgramIndex>(1, static_cast<size_t>(search.no_repeat_ngram_size));
+}
+
+SpeculativeSampler::~SpeculativeSampler() = default;
+
+bool SpeculativeSampler::IsGreedy() const {
+  const auto& search = params_.search;
+  return !search.do_sample || search.top_k == 1 || search.temperature == 0;
+}
+
+void SpeculativeSampler::SetContext(std::span<const int32_t> sequence) {
+  const size_t common_length = std::mismatch(context_.begin(), context_.end(), sequence.begin(), sequence.end()).first - context_.begin();
+  Truncate(common_length);
+  for (size_t i = common_length; i < sequence.size(); i++)
+    Append(sequence[i]);
+}
+
+void SpeculativeSampler::Append(int32_t token) {
+  context_.push_back(token);
+  if (token_counts_)
+    token_counts_->Add(0, token);
+  if (ngram_index_)
+    ngram_index_->Append(0, token);
+}
+
+void SpeculativeSampler::Truncate(size_t length) {
+  if (length >= context_.size())
+    return;
+  if (token_counts_) {
+    for (size_t i = length; i < context_.size(); i++)
+      token_counts_->Remove(0, context_[i]);
+  }
+  if (ngram_index_)
+    ngram_index_->Truncate(0, context_, length);
+  context_.resize(length);
+}
+
+void SpeculativeSampler::ApplyPenalties(std::span<float> logits) const {
+  const auto& search = params_.search;
+  if (static_cast<int>(context_.size()) < search.min_length) {
+    for (auto token_id : params_.config.model.eos_token_id)
+      logits[token_id] = std::numeric_limits<float>::lowest();
+  }
+
+  if (token_counts_) {
+    for (int32_t token : token_counts_->Tokens(0))
+      ApplyTokenPenalties(logits[token], token_counts_->Count(0, token), search.repetition_penalty, search.presence_penalty, search.frequency_penalty);
+  }
+
+  // Ban the tokens that would repeat an n-gram of no_repeat_ngram_size tokens
+  if (ngram_index_) {
+    if (auto* next_tokens = ngram_index_->NextTokens(0)) {
+      for (auto& entry : *next_tokens)
+        logits[entry.token] = std::numeric_limits<float>::lowest();
+    }
+  }
+}
+
+void SpeculativeSampler::ToDistribution(std::span<float> logits) {
+  const auto& search = params_.search;
+  const size_t vocab_size = logits.size();
+
+  if (search.top_k > 1 && static_cast<size_t>(search.top_k) < vocab_size) {
+    TopKIndices(logits, search.top_k, indices_);
+    const float threshold = logits[indices_.back()];
+    for (auto& logit : logits) {
+      if (logit < threshold)
+        logit = std::numeric_limits<float>::lowest();
+    }
+  }
+
+  // Scores masked out above underflow to a probability of 0
+  Softmax(logits, search.temperature);
+
+  if (search.top_p > 0.0f && search.top_p < 1.0f) {
+    TopPIndices(logits, search.top_p, indices_);
+
+    float cumulative = 0.0f;
+    size_t kept = 0;
+    while (kept < indices_.size() && cumulative < search.top_p)
+      cumulative += logits[indices_[kept++]];
+    kept_probabilities_.resize(kept);
+    for (size_t i = 0; i < kept; i++)
+      kept_probabilities_[i] = logits[indices_[i]] / cumulative;
+    std::fill(logits.begin(), logits.end(), 0.0f);
+    for (size_t i = 0; i < kept; i++)
+      logits[indices_[i]] = kept_probabilities_[i];
+  }
+}
+
+int32_t SpeculativeSampler::Argmax(std::span<const float> logits) {
+  return static_cast<int32_t>(Generators::Argmax(logits));
+}
+
+int32_t SpeculativeSampler::Sample(std::span<const float> distribution) {
+  const float sum = std::accumulate(distribution.begin(), distribution.end(), 0.0f);
+  float threshold = Uniform() * sum;
+  for (size_t i = 0; i < distribution.size(); i++) {
+    threshold -= distribution[i];
+    if (threshold < 0.0f && distribution[i] > 0.0f)
+      return static_cast<int32_t>(i);
+  }
+  // Rounding can leave a tiny remainder, fall back to the last token that has any probability
+  for (size_t i = distribution.size(); i-- > 0;) {
+    if (distribution[i] > 0.0f)
+      return static_cast<int32_t>(i);
+  }
+  return 0;
+}
+
+DraftModelProposer::DraftModelProposer(const Model& draft_model, const GeneratorParams& params)
+    : params_{CreateGeneratorParams(draft_model)} {
+  if (draft_model.config_->model.vocab_size != params.config.model.vocab_size)
+    throw std::runtime_error("The draft model's vocab_size (" + std::to_string(draft_model.config_->model.vocab_size) +
+                             ") must match the target model's vocab_size (" + std::to_string(params.config.model.vocab_size) + ")");
+  if (!ModelType::IsLLM(draft_model.config_->model.type))
+    throw std::runtime_error("The draft model must be a decoder-only language model, " + draft_model.config_->model.type + " is not supported.");
+
+  params_->search.batch_size = 1;
+  params_->search.num_beams = 1;
+  params_->search.max_length = std::min(params.search.max_length, draft_model.config_->model.context_length);
+  generator_ = CreateGenerator(draft_model, *params_);
+}
+
+DraftModelProposer::~DraftModelProposer() = default;
+
+void DraftModelProposer::Propose(std::span<const int32_t> sequence, size_t max_tokens, SpeculativeSampler& sampler,
+                                 std::vector<int32_t>& tokens, std::vector<std::vector<float>>& distributions) {
+  if (sequence.size() + max_tokens > static_cast<size_t>(params_->search.max_length))
+    return;
+
+  // Only rewind the draft model to where its sequence and the target model's sequence differ. At least the
+  // last token is appended again so that there are fresh logits to propose from.
+  auto draft_sequence = generator_->GetSequence(0).CopyDeviceToCpu();
+  const size_t common_length = std::mismatch(draft_sequence.begin(), draft_sequence.end(), sequence.begin(), sequence.end()).first - draft_sequence.begin();
+  const size_t keep_length = std::min(common_length, sequence.size() - 1);
+  generator_->RewindToLength(keep_length);
+  generator_->AppendTokens(cpu_span<const int32_t>(sequence.subspan(keep_length, sequence.size() - keep_length)));
+
+  sampler.SetContext(sequence);
+  const auto& eos_token_ids = params_->config.model.eos_token_id;
+  for (size_t i = 0; i < max_tokens; i++) {
+    auto logits_span = generator_->GetLogits().CopyDeviceToCpu();
+    std::vector<float> logits(logits_span.begin(), logits_span.end());
+    sampler.ApplyPenalties(logits);
+
+    int32_t token;
+    if (sampler.IsGreedy()) {
+      token = SpeculativeSampler::Argmax(logits);
+    } else {
+      sampler.ToDistribution(logits);
+      token = sampler.Sample(logits);
+      distributions.push_back(std::move(logits));
+    }
+
+    tokens.push_back(token);
+    sampler.Append(token);
+    if (contains(eos_token_ids, token) || i + 1 == max_tokens)
+      break;
+    generator_->AppendTokens(cpu_span<const int32_t>(&token, 1));
+  }
+}
+
+SuffixIndex::SuffixIndex() {
+  Clear();
+}
+
+void SuffixIndex::Clear() {
+  states_.clear();
+  states_.push_back({0, -1, -1, {}});
+  last_ = 0;
+}
+
+void SuffixIndex::Append(int32_t token) {
+  const int32_t current = static_cast<int32_t>(states_.size());
+  const int32_t end = states_[last_].length;
+  states_.push_back({end + 1, 0, end, {}});
+
+  int32_t state = last_;
+  for (; state != -1 && !states_[state].next.count(token); state = states_[state].link)
+    states_[state].next[token] = current;
+
+  if (state != -1) {
+    const int32_t target = states_[state].next[token];
+    if (states_[state].length + 1 == states_[target].length) {
+      states_[current].link = target;
+    } else {
+      // Split the target, so the shorter substrings that now also end at the new position get their own state
+      const int32_t clone = static_cast<int32_t>(states_.size());
+      states_.push_back({states_[state].length + 1, states_[target].link, states_[target].first_end, states_[target].next});
+      for (; state != -1; state = states_[state].link) {
+        auto it = states_[state].next.find(token);
+        if (it == states_[state].next.end() || it->second != target)
+          break;
+        it->second = clone;
+      }
+      states_[target].link = clone;
+      states_[current].link = clone;
+    }
+  }
+  last_ = current;
+}
+
+SuffixIndex::Match SuffixIndex::LongestEarlierMatch() const {
+  // The suffix link of the whole sequence is its longest suffix that ends at more than the last position
+  const int32_t link = states_[last_].link;
+  if (link <= 0)
+    return {0, 0};
+  return {static_cast<size_t>(states_[link].length), static_cast<size_t>(states_[link].first_end)};
+}
+
+PromptLookupProposer::PromptLookupProposer(int min_ngram_size) : min_ngram_size_{static_cast<size_t>(min_ngram_size)} {
+  if (min_ngram_size < 1)
+    throw std::runtime_error("prompt_lookup_min_ngram_size must be 1 or greater");
+}
+
+void PromptLookupProposer::Propose(std::span<const int32_t> sequence, size_t max_tokens, SpeculativeSampler& /*sampler*/,
+                                   std::vector<int32_t>& tokens, std::vector<std::vector<float>>& /*distributions*/) {
+  // The sequence only grows between calls unless the generator was rewound, which rebuilds the index
+  if (indexed_tokens_.size() > sequence.size() || !std::equal(indexed_tokens_.begin(), indexed_tokens_.end(), sequence.begin())) {
+    index_.Clear();
+    indexed_tokens_.clear();
+  }
+  for (size_t i = indexed_tokens_.size(); i < sequence.size(); i++) {
+    index_.Append(sequence[i]);
+    indexed_tokens_.push_back(sequence[i]);
+  }
+
+  auto match = index_.LongestEarlierMatch();
+  if (match.length < min_ngram_size_)
+    return;
+
+  // The match ends before the last token, so at least one token follows it
+  auto continuation = sequence.subspan(match.end + 1, sequence.size() - match.end - 1);
+  tokens.insert(tokens.end(), continuation.begin(), continuation.begin() + std::min(max_tokens, continuation.size()));
+}
+
+std::optional<double> SpeculativeDecodingStats::Get(std::string_view name) const {
+  if (name == "draft_tokens")
+    return static_cast<double>(draft_tokens);
+  if (name == "accepted_tokens")
+    return static_cast<double>(accepted_tokens);
+  if (name == "verification_steps")
+    return static_cast<double>(verification_steps);
+  if (name == "acceptance_rate")
+    return AcceptanceRate();
+  return std::nullopt;
+}
+
+SpeculativeDecoder::SpeculativeDecoder(Generator& generator, std::unique_ptr<DraftProposer> proposer, size_t num_draft_tokens)
+    : generator_{generator},
+      proposer_{std::move(proposer)},
+      num_draft_tokens_{num_draft_tokens},
+      sampler_{*generator.search_->params_} {
+  const auto& params = *generator_.search_->params_;
+  if (num_draft_tokens_ == 0)
+    throw std::runtime_error("Speculative decoding requires at least one draft token.");
+  if (params.search.batch_size != 1 || params.search.num_beams != 1)
+    throw std::runtime_error("Speculative decoding only supports batch_size 1 and num_beams 1.");
+  if (generator_.guidance_logits_processor_)
+    throw std::runtime_error("Speculative decoding cannot be combined with guidance.");
+  if (!ModelType::IsLLM(generator_.model_->config_->model.type))
+    throw std::runtime_error("Speculative decoding is not supported for " + generator_.model_->config_->model.type + ".");
+
+  selected_token_scores_ = params.p_device->Allocate<float>(params.config.model.vocab_size);
+}
+
+bool SpeculativeDecoder::GenerateNextToken() {
+  if (next_pending_token_ < pending_tokens_.size()) {
+    ReleaseToken();
+    return true;
+  }
+
+  // Verification needs the target model's state to either hold logits for the next position, or to be one
+  // generated token behind the search. Anything else, like a rewind, goes through a regular step first.
+  const bool has_logits = generator_.computed_logits_;
+  const bool has_generated_token = !has_logits && generator_.last_action_ == Generator::Action::generated;
+  const size_t sequence_length = static_cast<size_t>(generator_.search_->GetSequenceLength());
+  const size_t max_length = static_cast<size_t>(generator_.search_->params_->search.max_length);
+  if ((!has_logits && !has_generated_token) || sequence_length == 0 || sequence_length + 1 >= max_length)
+    return false;
+
+  auto sequence = generator_.search_->GetSequence(0).CopyDeviceToCpu();
+  sequence_.assign(sequence.begin(), sequence.end());
+
+  // Leave room for the token the target model adds after the accepted ones
+  const size_t max_draft_tokens = std::min(num_draft_tokens_, max_length - sequence_length - 1);
+  draft_tokens_.clear();
+  draft_distributions_.clear();
+  proposer_->Propose(sequence_, max_draft_tokens, sampler_, draft_tokens_, draft_distributions_);
+  if (draft_tokens_.empty())
+    return false;
+
+  Verify(sequence_);
+  ReleaseToken();
+  return true;
+}
+
+void SpeculativeDecoder::Verify(std::span<const int32_t> sequence) {
+  auto& state = *generator_.state_;
+  auto& search = *generator_.search_;
+  const auto& params = *search.params_;
+  const size_t vocab_size = static_cast<size_t>(params.config.model.vocab_size);
+  const size_t sequence_length = sequence.size();
+  const size_t num_draft_tokens = draft_tokens_.size();
+
+  // Logits for the position after the sequence are either already computed, or come out of the same run that
+  // processes the last generated token together with the draft tokens
+  std::vector<int32_t> input_ids;
+  std::vector<float> first_logits;
+  if (generator_.computed_logits_) {
+    // The search logits point into the model's output buffer, so copy them out before the next run
+    auto logits = search.GetLogits().CopyDeviceToCpu();
+    first_logits.assign(logits.begin(), logits.end());
+  } else {
+    input_ids.push_back(sequence.back());
+  }
+  input_ids.insert(input_ids.end(), draft_tokens_.begin(), draft_tokens_.end());
+
+  auto input_ids_device = params.p_device->Allocate<int32_t>(input_ids.size());
+  std::copy(input_ids.begin(), input_ids.end(), input_ids_device.CpuSpan().begin());
+  input_ids_device.CopyCpuToDevice();
+  state.Run(static_cast<int>(sequence_length + num_draft_tokens), input_ids_device, search.GetNextIndices());
+
+  auto* logits_output = state.GetOutput(generator_.model_->config_->model.decoder.outputs.logits.c_str());
+  CopyLogitsToCpu(*generator_.model_->p_device_inputs_, *logits_output, target_logits_);
+  if (!first_logits.empty())
+    target_logits_.insert(target_logits_.begin(), first_logits.begin(), first_logits.end());
+  if (target_logits_.size() != (num_draft_tokens + 1) * vocab_size)
+    throw std::runtime_error("Speculative decoding expects the model to output logits for every input token.");
+
+  // Accept draft tokens while the target model agrees with them, then let the target model pick the next token. The
+  // proposer may have moved the sampler's context past the sequence, which rolls the draft tokens back.
+  sampler_.SetContext(sequence);
+  const auto& eos_token_ids = params.config.model.eos_token_id;
+  const bool greedy = sampler_.IsGreedy();
+  pending_tokens_.clear();
+  next_pending_token_ = 0;
+
+  size_t num_accepted = 0;
+  for (size_t i = 0; i <= num_draft_tokens; i++) {
+    std::span<float> target(target_logits_.data() + i * vocab_size, vocab_size);
+    sampler_.ApplyPenalties(target);
+
+    if (greedy) {
+      const int32_t token = SpeculativeSampler::Argmax(target);
+      pending_tokens_.push_back(token);
+      if (i == num_draft_tokens || token != draft_tokens_[i])
+        break;
+    } else {
+      sampler_.ToDistribution(target);
+      if (i == num_draft_tokens) {
+        pending_tokens_.push_back(sampler_.Sample(target));
+        break;
+      }
+
+      // Accept the draft token with probability min(1, p(token) / q(token)), otherwise sample from max(0, p - q)
+      const int32_t token = draft_tokens_[i];
+      const float draft_probability = draft_distributions_.empty() ? 1.0f : draft_distributions_[i][token];
+      if (sampler_.Uniform() * draft_probability < target[token]) {
+        pending_tokens_.push_back(token);
+      } else {
+        if (draft_distributions_.empty()) {
+          target[token] = 0.0f;
+        } else {
+          for (size_t j = 0; j < vocab_size; j++)
+            target[j] = std::max(0.0f, target[j] - draft_distributions_[i][j]);
+        }
+        pending_tokens_.push_back(sampler_.Sample(target));
+        break;
+      }
+    }
+
+    num_accepted++;
+    sampler_.Append(pending_tokens_.back());
+    if (contains(eos_token_ids, pending_tokens_.back()))
+      break;
+  }
+
+  // The accepted tokens stay in the key-value cache, the last pending token is processed by the next run
+  const size_t num_processed = pending_tokens_.size() - 1;
+  if (num_processed < num_draft_tokens)
+    state.RewindTo(sequence_length + num_processed);
+
+  stats_.draft_tokens += num_draft_tokens;
+  stats_.accepted_tokens += num_accepted;
+  stats_.verification_steps++;
+}
+
+void SpeculativeDecoder::ReleaseToken() {
+  // Let the search append the token as if it had selected it, which keeps its EOS and max_length handling
+  auto scores = selected_token_scores_.CpuSpan();
+  std::fill(scores.begin(), scores.end(), std::numeric_limits<float>::lowest());
+  scores[pending_tokens_[next_pending_token_++]] = 0.0f;
+  selected_token_scores_.CopyCpuToDevice();
+
+  generator_.search_->SetLogits(selected_token_scores_);
+  generator_.search_->SelectTop();
+  generator_.computed_logits_ = false;
+  generator_.last_action_ = Generator::Action::generated;
+}
+
+void SpeculativeDecoder::DiscardPendingTokens() {
+  if (next_pending_token_ == pending_tokens_.size())
+    return;
+
+  // The key-value cache already holds the verified tokens, drop the ones the search has not seen yet
+  generator_.state_->RewindTo(generator_.search_->GetSequenceLength() - 1);
+  pending_tokens_.clear();
+  next_pending_token_ = 0;
+}
+
+}  // namespace Generators
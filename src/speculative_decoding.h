@@ -0,0 +1,172 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Generators {
+
+struct Generator;
+struct TokenCounts;
+struct NgramIndex;
+
+// Applies the search options of the generator params to logits on the CPU, so that proposed tokens can
+// be verified against the target model with the same scoring the search would use
+struct SpeculativeSampler {
+  SpeculativeSampler(const GeneratorParams& params);
+  ~SpeculativeSampler();
+
+  // True if the search would pick the most likely token instead of sampling
+  bool IsGreedy() const;
+
+  // Moves the context the penalties are applied for to sequence. Only the tokens after the common prefix with the
+  // previous context are rolled back and added, so following a sequence that grows by a few tokens is cheap.
+  void SetContext(std::span<const int32_t> sequence);
+  // Adds a proposed or accepted token to the context
+  void Append(int32_t token);
+
+  // Applies min_length, no_repeat_ngram_size and the repetition, presence and frequency penalties for the token that follows the context
+  void ApplyPenalties(std::span<float> logits) const;
+
+  // Turns penalized logits into the distribution tokens are sampled from (temperature, top_k and top_p)
+  void ToDistribution(std::span<float> logits);
+
+  static int32_t Argmax(std::span<const float> logits);
+  int32_t Sample(std::span<const float> distribution);
+  float Uniform() { return std::uniform_real_distribution<float>{}(gen_); }
+
+ private:
+  void Truncate(size_t length);
+
+  const GeneratorParams& params_;
+  std::vector<int32_t> context_;
+  std::unique_ptr<TokenCounts> token_counts_;  // Only if a penalty needs it
+  std::unique_ptr<NgramIndex> ngram_index_;    // Only if no_repeat_ngram_size is set
+  std::vector<int32_t> indices_;               // Scratch buffers for top_k and top_p
+  std::vector<float> kept_probabilities_;
+  std::mt19937 gen_;
+};
+
+// Proposes tokens continuing a sequence, which the target model then verifies in a single run
+struct DraftProposer {
+  virtual ~DraftProposer() = default;
+
+  // Appends up to max_tokens proposed tokens to tokens. When the sampler is not greedy and the tokens are
+  // sampled, the distribution each one was drawn from is appended to distributions. Proposers that leave
+  // distributions empty are treated as always proposing their token with probability 1.
+  virtual void Propose(std::span<const int32_t> sequence, size_t max_tokens, SpeculativeSampler& sampler,
+                       std::vector<int32_t>& tokens, std::vector<std::vector<float>>& distributions) = 0;
+};
+
+// Proposes tokens by running a smaller draft model that shares the target model's vocabulary
+struct DraftModelProposer : DraftProposer {
+  DraftModelProposer(const Model& draft_model, const GeneratorParams& params);
+  ~DraftModelProposer();
+
+  void Propose(std::span<const int32_t> sequence, size_t max_tokens, SpeculativeSampler& sampler,
+               std::vector<int32_t>& tokens, std::vector<std::vector<float>>& distributions) override;
+
+ private:
+  std::shared_ptr<GeneratorParams> params_;
+  std::unique_ptr<Generator> generator_;
+};
+
+// Suffix automaton of a token sequence. Appending a token takes amortized constant time, and the longest suffix
+// of the sequence that also occurs earlier in it is read off the automaton instead of searched for.
+struct SuffixIndex {
+  SuffixIndex();
+
+  void Append(int32_t token);
+  void Clear();
+
+  struct Match {
+    size_t length;  // 0 if the last token does not occur earlier
+    size_t end;     // Position of the last token of the first occurrence
+  };
+
+  // The longest suffix of the sequence that also ends at an earlier position
+  Match LongestEarlierMatch() const;
+
+ private:
+  struct State {
+    int32_t length;     // Longest substring that ends in this state
+    int32_t link;       // State of the longest suffix that ends at more positions, -1 for the root
+    int32_t first_end;  // Earliest position the substrings of this state end at
+    std::unordered_map<int32_t, int32_t> next;
+  };
+
+  std::vector<State> states_;
+  int32_t last_{};  // State of the whole sequence
+};
+
+// Proposes the tokens that followed the longest earlier match of the end of the sequence, so text that repeats
+// spans of the prompt or of earlier output is proposed without a draft model
+struct PromptLookupProposer : DraftProposer {
+  PromptLookupProposer(int min_ngram_size);
+
+  void Propose(std::span<const int32_t> sequence, size_t max_tokens, SpeculativeSampler& sampler,
+               std::vector<int32_t>& tokens, std::vector<std::vector<float>>& distributions) override;
+
+ private:
+  size_t min_ngram_size_;
+  SuffixIndex index_;
+  std::vector<int32_t> indexed_tokens_;  // Tokens in index_, to tell when the sequence was rewound
+};
+
+struct SpeculativeDecodingStats {
+  size_t draft_tokens{};        // Tokens proposed for verification
+  size_t accepted_tokens{};     // Proposed tokens the target model accepted
+  size_t verification_steps{};  // Target model runs that verified proposed tokens
+
+  double AcceptanceRate() const { return draft_tokens ? static_cast<double>(accepted_tokens) / draft_tokens : 0.0; }
+  std::optional<double> Get(std::string_view name) const;
+};
+
+// Drives speculative decoding for a Generator. A proposer suggests several tokens, the target model scores all
+// of them in one run, and the longest accepted prefix plus one token chosen by the target model is kept. Tokens
+// past the first rejected one are rolled back through the regular rewind paths.
+//
+// Greedy search accepts a proposed token only if it is the one the target model would pick, so the output
+// matches regular decoding. Sampling uses rejection sampling, which keeps the target model's distribution.
+//
+// The verified tokens are handed out one per GenerateNextToken call, so callers keep seeing one new token per call.
+struct SpeculativeDecoder {
+  SpeculativeDecoder(Generator& generator, std::unique_ptr<DraftProposer> proposer, size_t num_draft_tokens);
+
+  // Generates the next token speculatively. Returns false if the generator has to take a regular step instead.
+  bool GenerateNextToken();
+
+  // Drops verified tokens that were not handed out yet, which brings the target model's state back in line with
+  // the search. Called before anything else touches the generator state.
+  void DiscardPendingTokens();
+
+  const SpeculativeDecodingStats& GetStats() const { return stats_; }
+
+ private:
+  void Verify(std::span<const int32_t> sequence);
+  void ReleaseToken();
+
+  Generator& generator_;
+  std::unique_ptr<DraftProposer> proposer_;
+  size_t num_draft_tokens_;
+  SpeculativeSampler sampler_;
+  SpeculativeDecodingStats stats_;
+
+  std::vector<int32_t> pending_tokens_;  // Verified tokens that were not handed out yet
+  size_t next_pending_token_{};
+
+  std::vector<int32_t> sequence_;
+  std::vector<int32_t> draft_tokens_;
+  std::vector<std::vector<float>> draft_distributions_;
+  std::vector<float> target_logits_;  // [num_positions, vocab_size]
+  DeviceSpan<float> selected_token_scores_;
+};
+
+}  // namespace Generators
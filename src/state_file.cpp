@@ -0,0 +1,245 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "generators.h"
+#include "models/model.h"
+#include "state_file.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace Generators {
+
+namespace {
+
+// 64-bit FNV-1a
+struct Hasher {
+  void Add(std::span<const uint8_t> data) {
+    for (uint8_t byte : data) {
+      hash_ ^= byte;
+      hash_ *= 0x100000001B3;
+    }
+  }
+
+  void Add(std::string_view text) { Add({reinterpret_cast<const uint8_t*>(text.data()), text.size()}); }
+
+  template <typename T>
+  void AddValue(const T& value) { Add({reinterpret_cast<const uint8_t*>(&value), sizeof(T)}); }
+
+  uint64_t hash_{0xCBF29CE484222325};
+};
+
+}  // namespace
+
+uint64_t HashModel(const Model& model) {
+  const auto& decoder = model.config_->model.decoder;
+  Hasher hasher;
+  hasher.Add(model.config_->model.type);
+  hasher.Add(decoder.filename);
+  auto file = (model.config_->config_path / fs::path(decoder.filename)).open(std::ios::binary | std::ios::ate);
+  hasher.AddValue(static_cast<int64_t>(file ? static_cast<std::streamoff>(file.tellg()) : -1));
+  hasher.AddValue(decoder.num_hidden_layers);
+  hasher.AddValue(decoder.num_key_value_heads);
+  hasher.AddValue(decoder.head_size);
+  hasher.AddValue(model.config_->model.vocab_size);
+  return hasher.hash_;
+}
+
+uint64_t HashConfig(const Config& config) {
+  Hasher hasher;
+  auto file = (config.config_path / "genai_config.json").open(std::ios::binary);
+  std::string contents{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+  hasher.Add(contents);
+  return hasher.hash_;
+}
+
+void WriteTensor(StateFileWriter& file, std::string_view name, Tensor& tensor) {
+  auto shape = tensor.GetShape();
+  file.WriteArray(std::string(name) + ".shape", std::span<const int64_t>{shape});
+  file.Write(name, tensor.GetByteSpan().CopyDeviceToCpu());
+}
+
+void ReadTensor(const StateFileReader& file, std::string_view name, Tensor& tensor) {
+  auto shape = file.ReadArray<int64_t>(std::string(name) + ".shape");
+  tensor.CreateTensor(std::vector<int64_t>(shape.begin(), shape.end()));
+  auto data = file.Read(name);
+  auto bytes = tensor.GetByteSpan();
+  if (data.size() != bytes.size())
+    throw std::runtime_error("State file section " + std::string(name) + " has an unexpected size.");
+  std::copy(data.begin(), data.end(), bytes.CpuSpan().begin());
+  bytes.CopyCpuToDevice();
+}
+
+StateFileWriter::StateFileWriter(const fs::path& path, const Model& model)
+    : file_{path.open_for_write(std::ios::binary | std::ios::trunc)} {
+  if (!file_)
+    throw std::runtime_error("Could not open " + path.string() + " to save the generator state.");
+  Begin(model, StateFile::kAlignment);
+}
+
+StateFileWriter::StateFileWriter(std::vector<uint8_t>& buffer, const Model& model) : buffer_{&buffer} {
+  buffer_->clear();
+  Begin(model, StateFile::kMemoryAlignment);
+}
+
+void StateFileWriter::Begin(const Model& model, uint32_t alignment) {
+  std::copy(std::begin(StateFile::kMagic), std::end(StateFile::kMagic), header_.magic);
+  header_.version = StateFile::kVersion;
+  header_.alignment = alignment;
+  header_.model_hash = HashModel(model);
+  header_.config_hash = HashConfig(*model.config_);
+
+  // The header is written last, its space is left empty until then
+  const StateFile::Header empty_header{};
+  Put(&empty_header, sizeof(empty_header));
+}
+
+void StateFileWriter::Put(const void* data, size_t size) {
+  if (buffer_)
+    buffer_->insert(buffer_->end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+  else
+    file_.write(static_cast<const char*>(data), size);
+  offset_ += size;
+}
+
+void StateFileWriter::Pad() {
+  const uint64_t padding = (header_.alignment - offset_ % header_.alignment) % header_.alignment;
+  static constexpr uint8_t zeros[StateFile::kAlignment]{};
+  Put(zeros, padding);
+}
+
+void StateFileWriter::Write(std::string_view name, std::span<const uint8_t> data) {
+  StateFile::Section section{};
+  if (name.size() >= sizeof(section.name))
+    throw std::runtime_error("State file section name is too long: " + std::string(name));
+  std::copy(name.begin(), name.end(), section.name);
+
+  Pad();
+  section.offset = offset_;
+  section.size = data.size();
+  Put(data.data(), data.size());
+  sections_.push_back(section);
+}
+
+void StateFileWriter::Append(std::span<const uint8_t> data) {
+  if (sections_.empty())
+    throw std::runtime_error("StateFileWriter::Append called before any section was written.");
+  Put(data.data(), data.size());
+  sections_.back().size += data.size();
+}
+
+void StateFileWriter::Finish() {
+  Pad();
+  header_.section_table_offset = offset_;
+  header_.section_count = sections_.size();
+  Put(sections_.data(), sections_.size() * sizeof(StateFile::Section));
+
+  if (buffer_) {
+    std::memcpy(buffer_->data(), &header_, sizeof(header_));
+    return;
+  }
+  file_.seekp(0);
+  file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+  file_.close();
+  if (!file_)
+    throw std::runtime_error("Failed to write the generator state file.");
+}
+
+StateFileReader::StateFileReader(const fs::path& path, const Model& model) {
+  const uint8_t*& data = mapping_.data;
+  size_t& size = mapping_.size;
+#ifdef _WIN32
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    throw std::runtime_error("Could not open the generator state file " + path.string());
+  LARGE_INTEGER file_size{};
+  GetFileSizeEx(file, &file_size);
+  size = static_cast<size_t>(file_size.QuadPart);
+  if (size != 0) {
+    mapping_.handle = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_.handle)
+      data = static_cast<const uint8_t*>(MapViewOfFile(mapping_.handle, FILE_MAP_READ, 0, 0, 0));
+  }
+  CloseHandle(file);
+#else
+  int file = open(path.c_str(), O_RDONLY);
+  if (file < 0)
+    throw std::runtime_error("Could not open the generator state file " + path.string());
+  struct stat info {};
+  fstat(file, &info);
+  size = static_cast<size_t>(info.st_size);
+  if (size != 0) {
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+    data = mapped != MAP_FAILED ? static_cast<const uint8_t*>(mapped) : nullptr;
+  }
+  close(file);
+#endif
+  if (size != 0 && !data)
+    throw std::runtime_error("Could not map the generator state file " + path.string());
+
+  data_ = {data, size};
+  Open(model, path.string());
+}
+
+StateFileReader::StateFileReader(std::span<const uint8_t> data, const Model& model) : data_{data} {
+  // A mapping is page aligned, but a caller's buffer may not be aligned for the section table and ReadArray
+  if (reinterpret_cast<uintptr_t>(data.data()) % alignof(uint64_t) != 0) {
+    aligned_copy_.resize((data.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    std::memcpy(aligned_copy_.data(), data.data(), data.size());
+    data_ = {reinterpret_cast<const uint8_t*>(aligned_copy_.data()), data.size()};
+  }
+  Open(model, "The saved state");
+}
+
+void StateFileReader::Open(const Model& model, const std::string& source) {
+  StateFile::Header header;
+  if (data_.size() < sizeof(header))
+    throw std::runtime_error(source + " is not a generator state.");
+  std::memcpy(&header, data_.data(), sizeof(header));
+  if (!std::equal(std::begin(header.magic), std::end(header.magic), std::begin(StateFile::kMagic)))
+    throw std::runtime_error(source + " is not a generator state, or was not completely written.");
+  if (header.version != StateFile::kVersion)
+    throw std::runtime_error("Generator state version " + std::to_string(header.version) + " is not supported, expected version " + std::to_string(StateFile::kVersion) + ".");
+  if (header.model_hash != HashModel(model))
+    throw std::runtime_error(source + " was saved with a different model.");
+  if (header.config_hash != HashConfig(*model.config_))
+    throw std::runtime_error(source + " was saved with a different genai_config.json.");
+
+  const uint64_t size = data_.size();
+  const uint64_t table_offset = header.section_table_offset;
+  if (header.alignment == 0 || header.alignment % alignof(uint64_t) != 0 ||
+      table_offset % alignof(StateFile::Section) != 0 || table_offset > size ||
+      header.section_count > (size - table_offset) / sizeof(StateFile::Section))
+    throw std::runtime_error(source + " is corrupt.");
+  sections_ = {reinterpret_cast<const StateFile::Section*>(data_.data() + table_offset), static_cast<size_t>(header.section_count)};
+  for (const auto& section : sections_) {
+    if (section.offset % header.alignment != 0 || section.offset > size || section.size > size - section.offset ||
+        section.name[sizeof(section.name) - 1] != '\0')
+      throw std::runtime_error(source + " is corrupt.");
+  }
+}
+
+StateFileReader::Mapping::~Mapping() {
+#ifdef _WIN32
+  if (data)
+    UnmapViewOfFile(data);
+  if (handle)
+    CloseHandle(handle);
+#else
+  if (data)
+    munmap(const_cast<uint8_t*>(data), size);
+#endif
+}
+
+std::span<const uint8_t> StateFileReader::Read(std::string_view name) const {
+  for (const auto& section : sections_) {
+    if (name == section.name)
+      return data_.subspan(section.offset, section.size);
+  }
+  throw std::runtime_error("The generator state file has no " + std::string(name) + " section.");
+}
+
+}  // namespace Generators
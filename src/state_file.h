@@ -0,0 +1,135 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+#pragma once
+
+namespace Generators {
+
+struct Model;
+struct StateFileWriter;
+struct StateFileReader;
+struct Tensor;
+
+// A generator's state saved to disk or to memory. It is a header followed by named sections, each starting on an
+// aligned boundary (a page in files), and a table locating the sections. Loading maps the file and copies each section
+// straight out of the mapping, so there is nothing to parse and nothing is staged in between.
+struct StateFile {
+  static constexpr char kMagic[8] = {'O', 'G', 'A', 'S', 'T', 'A', 'T', 'E'};
+  static constexpr uint32_t kVersion = 1;
+  static constexpr uint32_t kAlignment = 4096;
+  static constexpr uint32_t kMemoryAlignment = 64;
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t alignment;    // Every section starts at a multiple of this
+    uint64_t model_hash;   // HashModel of the model the state was saved with
+    uint64_t config_hash;  // HashConfig of the config the state was saved with
+    uint64_t section_table_offset;
+    uint64_t section_count;
+  };
+
+  struct Section {
+    char name[48];  // Null terminated
+    uint64_t offset;
+    uint64_t size;
+  };
+};
+
+// Identify the model and the config a state was saved with, so that it is never loaded into a different one. The
+// model is identified by its file and key-value cache layout, instead of a hash of its weights that would take as
+// long to compute as the prefill that loading saves.
+uint64_t HashModel(const Model& model);
+uint64_t HashConfig(const Config& config);
+
+// Saves the shape and contents of a tensor as the sections <name>.shape and <name>, and restores them into a tensor
+// of the same type, recreating it with the saved shape
+void WriteTensor(StateFileWriter& file, std::string_view name, Tensor& tensor);
+void ReadTensor(const StateFileReader& file, std::string_view name, Tensor& tensor);
+
+struct StateFileWriter {
+  StateFileWriter(const fs::path& path, const Model& model);
+  // Writes the same format to memory, with sections aligned to kMemoryAlignment instead so that small states stay small
+  StateFileWriter(std::vector<uint8_t>& buffer, const Model& model);
+
+  void Write(std::string_view name, std::span<const uint8_t> data);
+  // Adds data to the end of the last section written, for sections that are gathered from several places
+  void Append(std::span<const uint8_t> data);
+
+  template <typename T>
+  void WriteValue(std::string_view name, const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    Write(name, {reinterpret_cast<const uint8_t*>(&value), sizeof(T)});
+  }
+
+  template <typename T>
+  void WriteArray(std::string_view name, std::span<const T> values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    Write(name, {reinterpret_cast<const uint8_t*>(values.data()), values.size_bytes()});
+  }
+
+  // Writes the section table and then the header, so a file that was not finished never loads
+  void Finish();
+
+ private:
+  void Begin(const Model& model, uint32_t alignment);
+  void Put(const void* data, size_t size);
+  void Pad();
+
+  std::ofstream file_;
+  std::vector<uint8_t>* buffer_{};  // Written to instead of file_ if set
+  uint64_t offset_{};
+  StateFile::Header header_{};
+  std::vector<StateFile::Section> sections_;
+};
+
+struct StateFileReader {
+  StateFileReader(const fs::path& path, const Model& model);
+  // Reads a state written to memory, which must outlive the reader. Memory that is not aligned for the sections to be
+  // read in place is copied first.
+  StateFileReader(std::span<const uint8_t> data, const Model& model);
+
+  StateFileReader(const StateFileReader&) = delete;
+  StateFileReader& operator=(const StateFileReader&) = delete;
+
+  // The contents of a section, valid as long as the reader. Throws if the file has no section of that name.
+  std::span<const uint8_t> Read(std::string_view name) const;
+
+  template <typename T>
+  T ReadValue(std::string_view name) const {
+    static_assert(std::is_trivially_copyable_v<T>);
+    auto data = Read(name);
+    if (data.size() != sizeof(T))
+      throw std::runtime_error("State file section " + std::string(name) + " has an unexpected size.");
+    T value;
+    std::memcpy(&value, data.data(), sizeof(T));
+    return value;
+  }
+
+  // Sections start on an aligned boundary, so their contents can be used in place as an array of any type
+  template <typename T>
+  std::span<const T> ReadArray(std::string_view name) const {
+    static_assert(std::is_trivially_copyable_v<T>);
+    auto data = Read(name);
+    if (data.size() % sizeof(T) != 0)
+      throw std::runtime_error("State file section " + std::string(name) + " has an unexpected size.");
+    return {reinterpret_cast<const T*>(data.data()), data.size() / sizeof(T)};
+  }
+
+ private:
+  void Open(const Model& model, const std::string& source);
+
+  // Unmaps the file when destroyed, which also happens when the constructor throws
+  struct Mapping {
+    ~Mapping();
+    const uint8_t* data{};
+    size_t size{};
+#ifdef _WIN32
+    HANDLE handle{};
+#endif
+  } mapping_;
+  std::vector<uint64_t> aligned_copy_;  // The state, if the memory it was read from is not aligned
+  std::span<const uint8_t> data_;       // The mapping, the memory the state was read from, or aligned_copy_
+  std::span<const StateFile::Section> sections_;
+};
+
+}  // namespace Generators
@@ -0,0 +1,82 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "worker_thread.h"
+
+namespace Generators {
+
+// A fixed set of worker threads that loops are split across. The threads live as long as the pool, so a
+// parallel loop costs a wake up instead of creating threads.
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t num_worker_threads) {
+    for (size_t i = 0; i < num_worker_threads; i++)
+      workers_.push_back(std::make_unique<WorkerThread>());
+  }
+
+  // Number of threads a loop can run on, including the calling thread
+  size_t ThreadCount() const { return workers_.size() + 1; }
+
+  // Calls fn(i) for every i in [0, count) and returns once all calls have finished. The calling thread takes part
+  // in the loop. The first exception thrown by fn is rethrown here once the other threads have stopped.
+  // Loops started from inside a loop of the pool run inline on the calling thread.
+  void ParallelFor(size_t count, const std::function<void(size_t)>& fn) {
+    const size_t num_helpers = in_loop_ ? 0 : std::min(workers_.size(), count > 0 ? count - 1 : 0);
+    if (num_helpers == 0) {
+      for (size_t i = 0; i < count; i++)
+        fn(i);
+      return;
+    }
+
+    std::atomic<size_t> next{0};
+    auto run = [&] {
+      in_loop_ = true;
+      try {
+        for (size_t i; (i = next.fetch_add(1)) < count;)
+          fn(i);
+      } catch (...) {
+        next = count;  // Stop handing out work to the other threads
+        in_loop_ = false;
+        throw;
+      }
+      in_loop_ = false;
+    };
+
+    std::vector<std::future<void>> futures;
+    futures.reserve(num_helpers);
+    for (size_t i = 0; i < num_helpers; i++)
+      futures.push_back(workers_[i]->Enqueue(run));
+
+    std::exception_ptr error;
+    try {
+      run();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    for (auto& future : futures) {
+      try {
+        future.get();
+      } catch (...) {
+        if (!error)
+          error = std::current_exception();
+      }
+    }
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+ private:
+  std::vector<std::unique_ptr<WorkerThread>> workers_;
+  static inline thread_local bool in_loop_{};
+};
+
+}  // namespace Generators
@@ -0,0 +1,130 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "models/beam_reorder.h"
+
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace Generators::test {
+
+namespace {
+
+// Beam j takes the block of beam beam_indices[j] from a copy of the data, like PickPastState does on other devices
+std::vector<uint8_t> ReorderBeamsByCopy(const std::vector<uint8_t>& data, size_t group_count, const std::vector<int32_t>& beam_indices) {
+  const size_t beam_count = beam_indices.size();
+  const size_t block_size = data.size() / (group_count * beam_count);
+  std::vector<uint8_t> reordered(data.size());
+  for (size_t group = 0; group < group_count; group++) {
+    for (size_t j = 0; j < beam_count; j++) {
+      std::memcpy(reordered.data() + (group * beam_count + j) * block_size,
+                  data.data() + (group * beam_count + beam_indices[j]) * block_size, block_size);
+    }
+  }
+  return reordered;
+}
+
+}  // namespace
+
+TEST(BeamReorderTest, InPlaceMatchesCopy) {
+  constexpr size_t beam_count = 6;
+  constexpr size_t block_size = 12;
+  std::mt19937 engine{1234};
+
+  std::vector<std::vector<int32_t>> beam_indices_cases{
+      {0, 1, 2, 3, 4, 5},  // Every beam continues itself
+      {1, 0, 3, 2, 5, 4},  // Swaps
+      {1, 2, 3, 4, 5, 0},  // A single cycle through every beam
+      {0, 0, 0, 0, 0, 0},  // Every beam continues the first one
+      {5, 5, 1, 1, 3, 3},
+      {0, 2, 2, 1, 4, 1},
+  };
+  std::uniform_int_distribution<int32_t> beam_distribution{0, beam_count - 1};
+  for (int i = 0; i < 32; i++) {
+    auto& beam_indices = beam_indices_cases.emplace_back(beam_count);
+    for (auto& index : beam_indices)
+      index = beam_distribution(engine);
+  }
+
+  // The scratch buffer is reused across steps like the key-value cache does
+  std::vector<uint8_t> scratch;
+  std::uniform_int_distribution<int> byte_distribution{0, 255};
+  for (size_t group_count : {1, 2}) {
+    for (const auto& beam_indices : beam_indices_cases) {
+      std::vector<uint8_t> data(group_count * beam_count * block_size);
+      for (auto& byte : data)
+        byte = static_cast<uint8_t>(byte_distribution(engine));
+
+      auto expected = ReorderBeamsByCopy(data, group_count, beam_indices);
+      ReorderBeamsInPlace(data, group_count, beam_indices, scratch);
+      EXPECT_EQ(data, expected) << "group_count " << group_count;
+    }
+  }
+}
+
+// Runs beam search steps with random beam choices on three caches of one value per position: one reordered by copy,
+// one reordered in place, and one left as the model wrote it and read through the cache indirection table. Every beam
+// must see the same past in all three.
+TEST(BeamReorderTest, CacheIndirectionMatchesReorderedCache) {
+  constexpr int batch_size = 2;
+  constexpr int beam_width = 4;
+  constexpr int prompt_length = 3;
+  constexpr int max_length = 16;
+  constexpr size_t batch_beam_size = batch_size * beam_width;
+  std::mt19937 engine{5678};
+  std::uniform_int_distribution<int32_t> beam_distribution{0, beam_width - 1};
+
+  std::vector<int32_t> copied(batch_beam_size * max_length);
+  for (size_t beam = 0; beam < batch_beam_size; beam++) {
+    for (int position = 0; position < prompt_length; position++)
+      copied[beam * max_length + position] = static_cast<int32_t>(beam / beam_width * 1000 + position);
+  }
+  auto in_place = copied;
+  auto shared = copied;
+  std::vector<int32_t> table(batch_beam_size * max_length), next_table(batch_beam_size * max_length);
+
+  auto as_bytes = [](std::vector<int32_t>& values) {
+    return std::span<uint8_t>{reinterpret_cast<uint8_t*>(values.data()), values.size() * sizeof(int32_t)};
+  };
+
+  std::vector<uint8_t> scratch;
+  for (int current_length = prompt_length + 1; current_length <= max_length; current_length++) {
+    // Beam search picks each beam's source among the beams of the same batch entry
+    std::vector<int32_t> beam_indices(batch_beam_size);
+    for (size_t beam = 0; beam < batch_beam_size; beam++)
+      beam_indices[beam] = static_cast<int32_t>(beam / beam_width * beam_width) + beam_distribution(engine);
+
+    auto copied_bytes = as_bytes(copied);
+    auto reordered = ReorderBeamsByCopy(std::vector<uint8_t>(copied_bytes.begin(), copied_bytes.end()), 1, beam_indices);
+    std::memcpy(copied.data(), reordered.data(), reordered.size());
+    ReorderBeamsInPlace(as_bytes(in_place), 1, beam_indices, scratch);
+    UpdateCacheIndirectionTable(next_table.data(), table.data(), beam_indices.data(), batch_size, beam_width,
+                                prompt_length, max_length, current_length);
+    std::swap(table, next_table);
+
+    // The model writes the new position of every beam into the beam's own slot
+    const int position = current_length - 1;
+    for (size_t beam = 0; beam < batch_beam_size; beam++) {
+      const int32_t value = static_cast<int32_t>(current_length * 100 + beam);
+      copied[beam * max_length + position] = value;
+      in_place[beam * max_length + position] = value;
+      shared[beam * max_length + position] = value;
+    }
+
+    for (size_t beam = 0; beam < batch_beam_size; beam++) {
+      const size_t batch_first_beam = beam / beam_width * beam_width;
+      for (int position = 0; position < current_length; position++) {
+        const int32_t expected = copied[beam * max_length + position];
+        EXPECT_EQ(in_place[beam * max_length + position], expected) << "beam " << beam << " position " << position;
+        const size_t source_beam = batch_first_beam + table[beam * max_length + position];
+        EXPECT_EQ(shared[source_beam * max_length + position], expected) << "beam " << beam << " position " << position;
+      }
+    }
+  }
+}
+
+}  // namespace Generators::test
@@ -0,0 +1,71 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "engine/block_pool.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace Generators::test {
+
+TEST(BlockPoolTest, BlocksNeeded) {
+  BlockPool pool{8, 16};
+
+  EXPECT_EQ(pool.BlocksNeeded(0), 0);
+  EXPECT_EQ(pool.BlocksNeeded(1), 1);
+  EXPECT_EQ(pool.BlocksNeeded(16), 1);
+  EXPECT_EQ(pool.BlocksNeeded(17), 2);
+}
+
+TEST(BlockPoolTest, AllocateAndFree) {
+  BlockPool pool{4, 16};
+
+  std::vector<int32_t> first, second;
+  pool.Allocate(3, first);
+  EXPECT_EQ(first, (std::vector<int32_t>{0, 1, 2}));
+  EXPECT_EQ(pool.NumFreeBlocks(), 1);
+
+  EXPECT_FALSE(pool.CanAllocate(2));
+  EXPECT_THROW(pool.Allocate(2, second), std::runtime_error);
+  EXPECT_TRUE(second.empty());
+
+  pool.Free(first);
+  EXPECT_EQ(pool.NumFreeBlocks(), 4);
+
+  pool.Allocate(4, second);
+  std::sort(second.begin(), second.end());
+  EXPECT_EQ(second, (std::vector<int32_t>{0, 1, 2, 3}));
+}
+
+TEST(BlockPoolTest, FreeInvalidBlocks) {
+  BlockPool pool{2, 16};
+
+  std::vector<int32_t> blocks{5};
+  EXPECT_THROW(pool.Free(blocks), std::runtime_error);
+  EXPECT_THROW(pool.AddRef(0), std::runtime_error);
+
+  blocks.clear();
+  pool.Allocate(1, blocks);
+  pool.Free(blocks);
+  EXPECT_THROW(pool.Free(blocks), std::runtime_error);
+}
+
+TEST(BlockPoolTest, SharedBlocks) {
+  BlockPool pool{2, 16};
+
+  std::vector<int32_t> blocks;
+  pool.Allocate(1, blocks);
+  pool.AddRef(blocks[0]);
+  EXPECT_EQ(pool.RefCount(blocks[0]), 2);
+
+  pool.Free(blocks);
+  EXPECT_EQ(pool.NumFreeBlocks(), 1);
+
+  pool.Free(blocks);
+  EXPECT_EQ(pool.NumFreeBlocks(), 2);
+  EXPECT_EQ(pool.RefCount(blocks[0]), 0);
+}
+
+}  // namespace Generators::test
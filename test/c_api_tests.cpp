@@ -3,6 +3,7 @@
 
 #include <cstring>  // for memcmp
 #include <fstream>
+#include <functional>
 #include <numeric>
 #include <iostream>
 #include <thread>
@@ -422,6 +423,294 @@ TEST(CAPIEngineTests, EndToEndPhiStaggeredBatch) {
 }
 #endif
 
+#if ENABLE_ENGINE_TESTS
+TEST(CAPIEngineTests, EndToEndPhiBackgroundThread) {
+  auto model = OgaModel::Create(PHI2_PATH);
+  auto engine = OgaEngine::Create(*model);
+  auto tokenizer = OgaTokenizer::Create(*model);
+
+  constexpr size_t batch_size = 3;
+  const char* input_strings[] = {
+      "This is a test.",
+      "Rats are awesome pets!",
+      "The quick brown fox jumps over the lazy dog.",
+  };
+
+  struct RequestState {
+    const OgaEngine* engine{};
+    std::vector<int32_t> tokens;
+    bool done{};
+    size_t statistic_queries{};
+  };
+
+  std::array<RequestState, batch_size> states;
+  auto on_tokens = [](OgaRequest* request, const int32_t* tokens, size_t token_count, bool is_done, void* user_data) {
+    auto* state = reinterpret_cast<RequestState*>(user_data);
+    state->tokens.insert(state->tokens.end(), tokens, tokens + token_count);
+    state->done = is_done;
+
+    // The callbacks run on the background thread, which must not hold the engine locked while it calls them.
+    // Models without a paged cache have no free_blocks statistic, which is fine as long as the call returns.
+    try {
+      state->engine->GetStatistic("free_blocks");
+    } catch (const std::exception&) {
+    }
+    state->statistic_queries++;
+  };
+
+  engine->Start();
+
+  // A request without a token callback can't deliver its tokens while the engine runs in the background
+  auto callbackless_params = OgaGeneratorParams::Create(*model);
+  auto callbackless_request = OgaRequest::Create(*callbackless_params);
+  EXPECT_THROW(engine->Add(*callbackless_request), std::runtime_error);
+
+  std::vector<std::unique_ptr<OgaRequest>> requests;
+  std::vector<std::unique_ptr<OgaGeneratorParams>> params;
+  std::vector<std::thread> submitters;
+  for (size_t i = 0; i < batch_size; i++) {
+    auto input_sequences = OgaSequences::Create();
+    tokenizer->Encode(input_strings[i], *input_sequences);
+    states[i].engine = engine.get();
+    states[i].tokens = std::vector<int32_t>(input_sequences->SequenceData(0),
+                                            input_sequences->SequenceData(0) + input_sequences->SequenceCount(0));
+    params.emplace_back(OgaGeneratorParams::Create(*model));
+    params.back()->SetSearchOption("max_length", 40);
+    requests.push_back(OgaRequest::Create(*params.back()));
+    requests.back()->AddTokens(*input_sequences);
+    requests.back()->SetTokenCallback(on_tokens, &states[i]);
+
+    // Submit the requests from different threads
+    submitters.emplace_back([&engine, &request = *requests.back()] { engine->Add(request); });
+  }
+  for (auto& submitter : submitters) {
+    submitter.join();
+  }
+
+  while (engine->HasPendingRequests()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  engine->Stop();
+
+  // Verify outputs match expected outputs
+  std::vector<std::vector<int32_t>> expected_output{
+      {1212, 318, 257, 1332, 13, 198, 50280, 2, 16926, 1330,
+       1635, 10412, 6617, 278, 6335, 32994, 21857, 13849, 38665, 82,
+       21815, 1108, 9557, 40755, 27446, 2417, 6381, 6, 7131, 6,
+       14870, 31314, 21411, 46009, 3974, 82, 1039, 889, 263, 3684},
+      {49, 1381, 389, 7427, 17252, 0, 198, 50284, 37811, 628, 50256},
+      {464, 2068, 7586, 21831, 18045, 625, 262, 16931, 3290, 13,
+       198, 50284, 37811, 628, 50256}};
+
+  for (size_t i = 0; i < batch_size; i++) {
+    EXPECT_TRUE(states[i].done);
+    EXPECT_TRUE(requests[i]->IsDone());
+    EXPECT_EQ(expected_output[i], states[i].tokens);
+    EXPECT_GT(states[i].statistic_queries, 0);
+  }
+}
+#endif
+
+#if ENABLE_ENGINE_TESTS
+// Runs prompts of the engine tests through an engine on phi-2 whose engine.dynamic_batching options are overlaid
+// with dynamic_batching_json, and collects the tokens of every request.
+struct PhiEngineTest {
+  // Request i uses input_strings_[prompts[i]], so that a prompt can be used by several requests
+  PhiEngineTest(const char* dynamic_batching_json = nullptr, std::vector<size_t> prompts = {0, 1, 2})
+      : prompts_{std::move(prompts)} {
+    auto config = OgaConfig::Create(PHI2_PATH);
+    if (dynamic_batching_json)
+      config->Overlay((std::string(R"({ "engine": { "dynamic_batching": )") + dynamic_batching_json + " } }").c_str());
+    model_ = OgaModel::Create(*config);
+    engine_ = OgaEngine::Create(*model_);
+    auto tokenizer = OgaTokenizer::Create(*model_);
+
+    generated_tokens_.resize(prompts_.size());
+    for (size_t i = 0; i < prompts_.size(); i++) {
+      auto input_sequence = OgaSequences::Create();
+      tokenizer->Encode(input_strings_[prompts_[i]], *input_sequence);
+      generated_tokens_[i] = std::vector<int32_t>(input_sequence->SequenceData(0),
+                                                  input_sequence->SequenceData(0) + input_sequence->SequenceCount(0));
+      params_.emplace_back(OgaGeneratorParams::Create(*model_));
+      params_.back()->SetSearchOption("max_length", 40);
+      requests_.emplace_back(OgaRequest::Create(*params_.back()));
+      requests_.back()->AddTokens(*input_sequence);
+      requests_.back()->SetOpaqueData(&generated_tokens_[i]);
+    }
+  }
+
+  // Adds the requests in add_order, the i-th one once Step has returned add_after_steps[i] requests, then steps the
+  // engine until no request is pending. on_step is called after every step.
+  void Run(std::vector<size_t> add_order = {}, std::vector<size_t> add_after_steps = {},
+           const std::function<void()>& on_step = {}) {
+    if (add_order.empty()) {
+      add_order.resize(requests_.size());
+      std::iota(add_order.begin(), add_order.end(), size_t{0});
+    }
+    add_after_steps.resize(add_order.size());
+
+    size_t num_steps = 0;
+    size_t num_added = 0;
+    auto add_due_requests = [&] {
+      while (num_added < add_order.size() && add_after_steps[num_added] <= num_steps)
+        engine_->Add(*requests_[add_order[num_added++]]);
+    };
+
+    add_due_requests();
+    while (auto request = engine_->Step()) {
+      auto* tokens = reinterpret_cast<std::vector<int32_t>*>(request->GetOpaqueData());
+      while (request->HasUnseenTokens()) {
+        tokens->push_back(request->GetUnseenToken());
+      }
+      const size_t index = tokens - generated_tokens_.data();
+      if (request->IsDone() && std::find(completion_order_.begin(), completion_order_.end(), index) == completion_order_.end())
+        completion_order_.push_back(index);
+
+      num_steps++;
+      if (on_step)
+        on_step();
+      add_due_requests();
+    }
+    EXPECT_EQ(num_added, add_order.size());
+  }
+
+  // Checks that every request is done with the tokens that phi-2 generates for its prompt
+  void CheckOutputs() const {
+    for (size_t i = 0; i < requests_.size(); i++) {
+      EXPECT_TRUE(requests_[i]->IsDone());
+      EXPECT_EQ(expected_outputs_[prompts_[i]], generated_tokens_[i]);
+    }
+  }
+
+  // Only models exported with paged attention batch dynamically, the others ignore most engine options
+  bool UsesPagedCache() const {
+    try {
+      engine_->GetStatistic("free_blocks");
+      return true;
+    } catch (const std::exception&) {
+      return false;
+    }
+  }
+
+  static constexpr const char* input_strings_[] = {
+      "This is a test.",
+      "Rats are awesome pets!",
+      "The quick brown fox jumps over the lazy dog.",
+  };
+  inline static const std::vector<std::vector<int32_t>> expected_outputs_{
+      {1212, 318, 257, 1332, 13, 198, 50280, 2, 16926, 1330,
+       1635, 10412, 6617, 278, 6335, 32994, 21857, 13849, 38665, 82,
+       21815, 1108, 9557, 40755, 27446, 2417, 6381, 6, 7131, 6,
+       14870, 31314, 21411, 46009, 3974, 82, 1039, 889, 263, 3684},
+      {49, 1381, 389, 7427, 17252, 0, 198, 50284, 37811, 628, 50256},
+      {464, 2068, 7586, 21831, 18045, 625, 262, 16931, 3290, 13,
+       198, 50284, 37811, 628, 50256}};
+
+  std::vector<size_t> prompts_;
+  std::unique_ptr<OgaModel> model_;
+  std::unique_ptr<OgaEngine> engine_;
+  std::vector<std::unique_ptr<OgaGeneratorParams>> params_;
+  std::vector<std::unique_ptr<OgaRequest>> requests_;
+  std::vector<std::vector<int32_t>> generated_tokens_;
+  std::vector<size_t> completion_order_;  // Indices of the requests in the order they were done
+};
+
+TEST(CAPIEngineTests, EndToEndPhiPackedPrefillAndDecode) {
+  // The later requests are added while the earlier ones decode, so that steps pack the prompt of one request with
+  // the single tokens of the others
+  PhiEngineTest test;
+  test.Run({0, 1, 2}, {0, 2, 4});
+  test.CheckOutputs();
+}
+
+TEST(CAPIEngineTests, EndToEndPhiTokenBudget) {
+  // A budget of 8 tokens per step runs the 10 token prompt in a step of its own and delays the others
+  PhiEngineTest test{R"({ "max_batch_size": 3, "max_num_tokens": 8 })"};
+  test.Run();
+  test.CheckOutputs();
+}
+
+TEST(CAPIEngineTests, EndToEndPhiChunkedPrefill) {
+  // Chunks of 4 tokens split every prompt over several steps, and the 10 token prompt over three
+  PhiEngineTest test{R"({ "max_batch_size": 3, "max_num_tokens": 8, "prefill_chunk_size": 4 })"};
+  test.Run();
+  test.CheckOutputs();
+}
+
+TEST(CAPIEngineTests, EndToEndPhiSchedulingPolicies) {
+  // With one request at a time, the requests complete in the order the scheduling policy serves them. Models without
+  // a paged cache run static batches that ignore max_batch_size, so the order is only checked with a paged cache.
+  {
+    PhiEngineTest test{R"({ "max_batch_size": 1, "scheduling_policy": "fcfs" })"};
+    test.Run({2, 0, 1});
+    test.CheckOutputs();
+    if (test.UsesPagedCache())
+      EXPECT_EQ(test.completion_order_, (std::vector<size_t>{2, 0, 1}));
+  }
+  {
+    PhiEngineTest test{R"({ "max_batch_size": 1, "scheduling_policy": "priority" })"};
+    test.requests_[0]->SetPriority(1);
+    test.requests_[1]->SetPriority(2);
+    test.Run();
+    test.CheckOutputs();
+    if (test.UsesPagedCache())
+      EXPECT_EQ(test.completion_order_, (std::vector<size_t>{1, 0, 2}));
+  }
+  {
+    PhiEngineTest test{R"({ "max_batch_size": 1, "scheduling_policy": "shortest_prompt_first" })"};
+    test.Run({2, 1, 0});
+    test.CheckOutputs();
+    if (test.UsesPagedCache())
+      EXPECT_EQ(test.completion_order_, (std::vector<size_t>{0, 1, 2}));
+  }
+  {
+    PhiEngineTest test{R"({ "max_batch_size": 1, "scheduling_policy": "deadline" })"};
+    test.requests_[0]->SetDeadline(3'000'000);
+    test.requests_[1]->SetDeadline(1'000'000);
+    test.requests_[2]->SetDeadline(2'000'000);
+    test.Run();
+    test.CheckOutputs();
+    if (test.UsesPagedCache())
+      EXPECT_EQ(test.completion_order_, (std::vector<size_t>{1, 2, 0}));
+  }
+
+  EXPECT_THROW(PhiEngineTest{R"({ "scheduling_policy": "lifo" })"}, std::runtime_error);
+}
+
+TEST(CAPIEngineTests, EndToEndPhiPreemption) {
+  // Two requests that run to max_length need 3 blocks of 16 tokens each, so with 4 blocks the later one is preempted
+  // once both pass 32 tokens, and resumes after the other one completes
+  const std::vector<size_t> prompts{0, 0, 1};
+  PhiEngineTest unpreempted{nullptr, prompts};
+  if (!unpreempted.UsesPagedCache())
+    GTEST_SKIP() << "Preemption needs a model exported with paged attention";
+  unpreempted.Run();
+  unpreempted.CheckOutputs();
+  EXPECT_EQ(unpreempted.engine_->GetStatistic("preemptions"), 0);
+
+  for (const char* preemption_mode : {"recompute", "swap"}) {
+    const bool swap = std::string_view{preemption_mode} == "swap";
+    PhiEngineTest test{(std::string(R"({ "block_size": 16, "num_blocks": 4, "preemption_mode": ")") + preemption_mode + "\" }").c_str(),
+                       prompts};
+    double max_swapped_requests = 0;
+    double max_swap_bytes = 0;
+    test.Run({}, {}, [&] {
+      max_swapped_requests = std::max(max_swapped_requests, test.engine_->GetStatistic("swapped_requests"));
+      max_swap_bytes = std::max(max_swap_bytes, test.engine_->GetStatistic("swap_bytes"));
+    });
+
+    test.CheckOutputs();
+    EXPECT_EQ(test.generated_tokens_, unpreempted.generated_tokens_) << preemption_mode;
+    EXPECT_GE(test.engine_->GetStatistic("preemptions"), 1) << preemption_mode;
+    // Recomputed requests are never swapped, and swapped ones are swapped back in when they resume
+    EXPECT_EQ(max_swapped_requests > 0, swap) << preemption_mode;
+    EXPECT_EQ(max_swap_bytes > 0, swap) << preemption_mode;
+    EXPECT_EQ(test.engine_->GetStatistic("swapped_requests"), 0) << preemption_mode;
+    EXPECT_EQ(test.engine_->GetStatistic("swap_bytes"), 0) << preemption_mode;
+  }
+}
+#endif
+
 TEST(CAPITests, EndToEndPhi) {
 #if TEST_PHI2
   auto model = OgaModel::Create(PHI2_PATH);
@@ -1141,6 +1430,56 @@ TEST(CAPITests, BatchedRewindGptFp32CAPI) {
     const auto* expected_output_start = &expected_output[i * max_length];
     EXPECT_TRUE(0 == std::memcmp(expected_output_start, sequence_data, sequence_length * sizeof(int32_t)));
   }
+
+  // Rewind both sequences into the generated tokens and verify same output, which needs the positions of each
+  // differently padded sequence to be restored
+  generator->RewindTo(6);
+  while (!generator->IsDone()) {
+    generator->GenerateNextToken();
+  }
+
+  for (int i = 0; i < batch_size; i++) {
+    const auto sequence_length = generator->GetSequenceCount(i);
+    const auto* sequence_data = generator->GetSequenceData(i);
+
+    ASSERT_EQ(sequence_length, max_length);
+
+    const auto* expected_output_start = &expected_output[i * max_length];
+    EXPECT_TRUE(0 == std::memcmp(expected_output_start, sequence_data, sequence_length * sizeof(int32_t)));
+  }
+
+  // With 114 as EOS the second row is done after its first 114 and pads the rest. A rewind past its EOS must keep it
+  // padding instead of sampling again, and a rewind before its EOS must make it sample the EOS again.
+  auto config = OgaConfig::Create(MODEL_PATH "hf-internal-testing/tiny-random-gpt2-fp32");
+  config->Overlay(R"({ "model": { "eos_token_id" : 114 } })");
+  auto eos_model = OgaModel::Create(*config);
+  auto eos_params = OgaGeneratorParams::Create(*eos_model);
+  eos_params->SetSearchOption("max_length", max_length);
+  eos_params->SetSearchOption("batch_size", batch_size);
+
+  std::vector<int32_t> expected_eos_output{
+      0, 0, 0, 52, 204, 204, 204, 204, 204, 204,
+      0, 0, 195, 731, 731, 114, 98, 98, 98, 98};
+
+  auto eos_generator = OgaGenerator::Create(*eos_model, *eos_params);
+  eos_generator->AppendTokens(input_ids.data(), input_ids.size());
+  for (size_t rewind_length : {size_t{0}, size_t{8}, size_t{5}}) {
+    if (rewind_length != 0)
+      eos_generator->RewindTo(rewind_length);
+    while (!eos_generator->IsDone()) {
+      eos_generator->GenerateNextToken();
+    }
+
+    for (int i = 0; i < batch_size; i++) {
+      const auto sequence_length = eos_generator->GetSequenceCount(i);
+      const auto* sequence_data = eos_generator->GetSequenceData(i);
+
+      ASSERT_EQ(sequence_length, max_length);
+
+      const auto* expected_output_start = &expected_eos_output[i * max_length];
+      EXPECT_TRUE(0 == std::memcmp(expected_output_start, sequence_data, sequence_length * sizeof(int32_t)));
+    }
+  }
 }
 
 TEST(CAPITests, RewindGptFp32CAPI) {
@@ -1204,6 +1543,224 @@ TEST(CAPITests, RewindGptFp32CAPI) {
   expected_output_start = &expected_output[0];
   EXPECT_TRUE(0 == std::memcmp(expected_output_start, sequence_data, sequence_length * sizeof(int32_t)));
 }
+
+TEST(CAPITests, SpeculativeDecodingGptFp32CAPI) {
+  std::vector<int32_t> input_ids{0, 0, 195, 731};
+
+  std::vector<int32_t> expected_output{
+      0, 0, 195, 731, 731, 114, 114, 114, 114, 114};
+
+  int max_length = 10;
+
+  // Using the same model as the draft model means every proposed token matches what greedy search picks
+  auto model = OgaModel::Create(MODEL_PATH "hf-internal-testing/tiny-random-gpt2-fp32");
+  auto draft_model = OgaModel::Create(MODEL_PATH "hf-internal-testing/tiny-random-gpt2-fp32");
+  auto params = OgaGeneratorParams::Create(*model);
+  params->SetSearchOption("max_length", max_length);
+  params->SetDraftModel(*draft_model, 3);
+
+  auto generator = OgaGenerator::Create(*model, *params);
+  generator->AppendTokens(input_ids.data(), input_ids.size());
+  while (!generator->IsDone()) {
+    generator->GenerateNextToken();
+  }
+
+  auto sequence_length = generator->GetSequenceCount(0);
+  auto* sequence_data = generator->GetSequenceData(0);
+  ASSERT_EQ(sequence_length, max_length);
+  EXPECT_TRUE(0 == std::memcmp(expected_output.data(), sequence_data, sequence_length * sizeof(int32_t)));
+
+  EXPECT_GT(generator->GetSpeculativeDecodingStatistic("verification_steps"), 0);
+  EXPECT_GT(generator->GetSpeculativeDecodingStatistic("acceptance_rate"), 0);
+  EXPECT_LT(generator->GetSpeculativeDecodingStatistic("verification_steps"), max_length - input_ids.size());
+
+  // Rewinding drops the proposed tokens and decoding picks up again with the same output
+  generator->RewindTo(6);
+  while (!generator->IsDone()) {
+    generator->GenerateNextToken();
+  }
+
+  sequence_length = generator->GetSequenceCount(0);
+  sequence_data = generator->GetSequenceData(0);
+  ASSERT_EQ(sequence_length, max_length);
+  EXPECT_TRUE(0 == std::memcmp(expected_output.data(), sequence_data, sequence_length * sizeof(int32_t)));
+}
+
+TEST(CAPITests, SpeculativeDecodingPenaltiesGptFp32CAPI) {
+  std::vector<int32_t> input_ids{0, 0, 195, 731};
+
+  int max_length = 16;
+
+  auto model = OgaModel::Create(MODEL_PATH "hf-internal-testing/tiny-random-gpt2-fp32");
+  auto draft_model = OgaModel::Create(MODEL_PATH "hf-internal-testing/tiny-random-gpt2-fp32");
+
+  auto generate = [&](bool speculative) {
+    auto params = OgaGeneratorParams::Create(*model);
+    params->SetSearchOption("max_length", max_length);
+    params->SetSearchOption("repetition_penalty", 1.5);
+    params->SetSearchOption("no_repeat_ngram_size", 2);
+    if (speculative)
+      params->SetDraftModel(*draft_model, 3);
+
+    auto generator = OgaGenerator::Create(*model, *params);
+    generator->AppendTokens(input_ids.data(), input_ids.size());
+    while (!generator->IsDone()) {
+      generator->GenerateNextToken();
+    }
+
+    auto* sequence_data = generator->GetSequenceData(0);
+    return std::vector<int32_t>(sequence_data, sequence_data + generator->GetSequenceCount(0));
+  };
+
+  // The penalties follow the accepted and rolled back tokens, so the output stays the same as greedy search
+  EXPECT_EQ(generate(true), generate(false));
+}
+
+TEST(CAPITests, PromptLookupDecodingGptFp32CAPI) {
+  std::vector<int32_t> input_ids{0, 0, 195, 731};
+
+  std::vector<int32_t> expected_output{
+      0, 0, 195, 731, 731, 114, 114, 114, 114, 114};
+
+  int max_length = 10;
+
+  // The repeated tokens are proposed from earlier in the sequence, and the output stays the same as greedy search
+  auto model = OgaModel::Create(MODEL_PATH "hf-internal-testing/tiny-random-gpt2-fp32");
+  auto params = OgaGeneratorParams::Create(*model);
+  params->SetSearchOption("max_length", max_length);
+  params->SetSearchOption("prompt_lookup_num_tokens", 3);
+  params->SetSearchOption("prompt_lookup_min_ngram_size", 1);
+
+  auto generator = OgaGenerator::Create(*model, *params);
+  generator->AppendTokens(input_ids.data(), input_ids.size());
+  while (!generator->IsDone()) {
+    generator->GenerateNextToken();
+  }
+
+  auto sequence_length = generator->GetSequenceCount(0);
+  auto* sequence_data = generator->GetSequenceData(0);
+  ASSERT_EQ(sequence_length, max_length);
+  EXPECT_TRUE(0 == std::memcmp(expected_output.data(), sequence_data, sequence_length * sizeof(int32_t)));
+
+  EXPECT_GT(generator->GetSpeculativeDecodingStatistic("verification_steps"), 0);
+  EXPECT_GT(generator->GetSpeculativeDecodingStatistic("acceptance_rate"), 0);
+}
+
+TEST(CAPITests, ForkGptFp32CAPI) {
+  std::vector<int32_t> input_ids{0, 0, 195, 731};
+
+  std::vector<int32_t> expected_output{
+      0, 0, 195, 731, 731, 114, 114, 114, 114, 114};
+
+  int max_length = 10;
+
+  auto model = OgaModel::Create(MODEL_PATH "hf-internal-testing/tiny-random-gpt2-fp32");
+  auto params = OgaGeneratorParams::Create(*model);
+  params->SetSearchOption("max_length", max_length);
+
+  auto generator = OgaGenerator::Create(*model, *params);
+  generator->AppendTokens(input_ids.data(), input_ids.size());
+
+  // Forks taken after the prompt and after a generated token both continue with the same greedy output
+  auto fork_after_prompt = generator->Fork();
+  generator->GenerateNextToken();
+  auto fork_after_token = generator->Fork();
+
+  for (auto* g : {generator.get(), fork_after_prompt.get(), fork_after_token.get()}) {
+    while (!g->IsDone()) {
+      g->GenerateNextToken();
+    }
+
+    auto sequence_length = g->GetSequenceCount(0);
+    auto* sequence_data = g->GetSequenceData(0);
+    ASSERT_EQ(sequence_length, max_length);
+    EXPECT_TRUE(0 == std::memcmp(expected_output.data(), sequence_data, sequence_length * sizeof(int32_t)));
+  }
+}
+
+TEST(CAPITests, SaveStateGptFp32CAPI) {
+  std::vector<int32_t> input_ids{0, 0, 195, 731};
+
+  std::vector<int32_t> expected_output{
+      0, 0, 195, 731, 731, 114, 114, 114, 114, 114};
+
+  int max_length = 10;
+  const char* state_path = "gpt2_generator_state.bin";
+
+  auto model = OgaModel::Create(MODEL_PATH "hf-internal-testing/tiny-random-gpt2-fp32");
+  auto params = OgaGeneratorParams::Create(*model);
+  params->SetSearchOption("max_length", max_length);
+
+  auto generator = OgaGenerator::Create(*model, *params);
+  generator->AppendTokens(input_ids.data(), input_ids.size());
+  generator->GenerateNextToken();
+  generator->SaveState(state_path);
+
+  // A new generator continues from the saved state with the same greedy output
+  auto loaded = OgaGenerator::Create(*model, *params);
+  loaded->LoadState(state_path);
+  std::remove(state_path);
+
+  ASSERT_EQ(loaded->GetSequenceCount(0), input_ids.size() + 1);
+  for (auto* g : {generator.get(), loaded.get()}) {
+    while (!g->IsDone()) {
+      g->GenerateNextToken();
+    }
+
+    auto sequence_length = g->GetSequenceCount(0);
+    auto* sequence_data = g->GetSequenceData(0);
+    ASSERT_EQ(sequence_length, max_length);
+    EXPECT_TRUE(0 == std::memcmp(expected_output.data(), sequence_data, sequence_length * sizeof(int32_t)));
+  }
+
+  // A generator that already has a sequence can't load a state
+  EXPECT_THROW(generator->LoadState(state_path), std::runtime_error);
+}
+
+TEST(CAPITests, SessionPoolGptFp32CAPI) {
+  std::vector<int32_t> first_turn{0, 0, 195, 731};
+  std::vector<int32_t> second_turn{114, 195, 731};
+
+  int max_length = 16;
+
+  auto model = OgaModel::Create(MODEL_PATH "hf-internal-testing/tiny-random-gpt2-fp32");
+  auto params = OgaGeneratorParams::Create(*model);
+  params->SetSearchOption("max_length", max_length);
+
+  // Only one conversation keeps its generator, so the first one is saved to host memory by the second
+  auto pool = OgaSessionPool::Create(*model, *params, 1, size_t{1} << 30);
+
+  auto generator = pool->Acquire("a", first_turn.data(), first_turn.size());
+  generator->GenerateNextToken();
+  generator->GenerateNextToken();
+  std::vector<int32_t> transcript(generator->GetSequenceData(0), generator->GetSequenceData(0) + generator->GetSequenceCount(0));
+  pool->Release("a", std::move(generator));
+
+  pool->Release("b", pool->Acquire("b", first_turn.data(), first_turn.size()));
+  EXPECT_EQ(pool->GetStatistic("active_sessions"), 1);
+  EXPECT_EQ(pool->GetStatistic("stored_sessions"), 1);
+  EXPECT_GT(pool->GetStatistic("stored_bytes"), 0);
+
+  // The next turn of the first conversation restores it and only runs the new tokens
+  transcript.insert(transcript.end(), second_turn.begin(), second_turn.end());
+  generator = pool->Acquire("a", transcript.data(), transcript.size());
+  EXPECT_EQ(pool->GetStatistic("hits"), 1);
+  EXPECT_EQ(pool->GetStatistic("loads"), 1);
+  EXPECT_EQ(pool->GetStatistic("reused_tokens"), first_turn.size() + 2);
+  EXPECT_EQ(pool->GetStatistic("hit_rate"), 1.0 / 3);
+
+  // It generates the same tokens as a generator that runs the whole transcript
+  auto expected = OgaGenerator::Create(*model, *params);
+  expected->AppendTokens(transcript.data(), transcript.size());
+  for (auto* g : {generator.get(), expected.get()}) {
+    while (!g->IsDone()) {
+      g->GenerateNextToken();
+    }
+  }
+  ASSERT_EQ(generator->GetSequenceCount(0), expected->GetSequenceCount(0));
+  EXPECT_TRUE(0 == std::memcmp(expected->GetSequenceData(0), generator->GetSequenceData(0), expected->GetSequenceCount(0) * sizeof(int32_t)));
+  pool->Release("a", std::move(generator));
+}
 #endif
 
 #if USE_GUIDANCE
@@ -0,0 +1,64 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "engine/prefix_cache.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace Generators::test {
+
+TEST(PrefixCacheTest, MatchesFullBlocksOnly) {
+  BlockPool pool{8, 2};
+  PrefixCache cache{pool};
+
+  const std::vector<int32_t> tokens{1, 2, 3, 4, 5};
+  std::vector<int32_t> block_table;
+  pool.Allocate(3, block_table);
+  cache.Insert(tokens, block_table);
+  EXPECT_EQ(cache.NumCachedBlocks(), 2);
+
+  std::vector<int32_t> matched;
+  EXPECT_EQ(cache.Match(std::vector<int32_t>{1, 2, 3, 4, 9}, matched), 4);
+  EXPECT_EQ(matched, (std::vector<int32_t>{block_table[0], block_table[1]}));
+  EXPECT_EQ(pool.RefCount(block_table[0]), 3);
+
+  matched.clear();
+  EXPECT_EQ(cache.Match(std::vector<int32_t>{1, 2, 9, 9}, matched), 2);
+  EXPECT_EQ(cache.Match(std::vector<int32_t>{9, 2, 3, 4}, matched), 0);
+
+  const auto& stats = cache.GetStats();
+  EXPECT_EQ(stats.lookups, 3);
+  EXPECT_EQ(stats.hits, 2);
+  EXPECT_EQ(stats.queried_tokens, 13);
+  EXPECT_EQ(stats.hit_tokens, 6);
+}
+
+TEST(PrefixCacheTest, EvictsLeastRecentlyUsedUnusedBlocks) {
+  BlockPool pool{4, 2};
+  PrefixCache cache{pool};
+
+  std::vector<int32_t> first, second;
+  pool.Allocate(2, first);
+  cache.Insert(std::vector<int32_t>{1, 2, 3, 4}, first);
+  pool.Allocate(1, second);
+  cache.Insert(std::vector<int32_t>{5, 6}, second);
+
+  // The second request is still running, so only the blocks of the first one can be evicted
+  pool.Free(first);
+  EXPECT_EQ(cache.NumEvictableBlocks(), 2);
+  EXPECT_EQ(pool.NumFreeBlocks(), 1);
+
+  // The leaf is evicted before its parent
+  EXPECT_EQ(cache.Evict(1), 1);
+  std::vector<int32_t> matched;
+  EXPECT_EQ(cache.Match(std::vector<int32_t>{1, 2, 3, 4}, matched), 2);
+  pool.Free(matched);
+
+  EXPECT_EQ(cache.Evict(4), 1);
+  EXPECT_EQ(cache.NumCachedBlocks(), 1);
+  EXPECT_EQ(pool.NumFreeBlocks(), 3);
+}
+
+}  // namespace Generators::test
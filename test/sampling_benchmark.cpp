@@ -1,12 +1,15 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // Licensed under the MIT License.
 
+#include <algorithm>
 #include <array>
 #include <chrono>
+#include <cmath>
 #include <iostream>
 #include <numeric>
 #include <random>
 #include "span.h"
+#include "softmax.h"
 #define OGA_USE_SPAN 1
 #include <ort_genai.h>
 #include <gtest/gtest.h>
@@ -135,7 +138,9 @@ TEST_P(SamplingBenchmarkTest, RunBenchmark) {
 auto benchmark_values = ::testing::Values(
     BenchmarkParams{"cpu", 1, BenchmarkFunction::TopP},
     BenchmarkParams{"cpu", 1, BenchmarkFunction::TopK},
-    BenchmarkParams{"cpu", 1, BenchmarkFunction::TopKTopP}
+    BenchmarkParams{"cpu", 1, BenchmarkFunction::TopKTopP},
+    BenchmarkParams{"cpu", 1, BenchmarkFunction::SelectTop},
+    BenchmarkParams{"cpu", 6, BenchmarkFunction::SelectTop}
 #if USE_CUDA
     ,
     BenchmarkParams{"cuda", 1, BenchmarkFunction::TopP},
@@ -149,3 +154,45 @@ auto benchmark_values = ::testing::Values(
 
 INSTANTIATE_TEST_SUITE_P(Benchmarks, SamplingBenchmarkTest, benchmark_values,
                          [](const ::testing::TestParamInfo<BenchmarkParams>& info) { return info.param.Name(); });
+
+// Times the vectorized CPU search kernels against the plain scalar loops they replaced, on vocabulary sizes of
+// current models
+TEST(SamplingBenchmarks, CpuKernels) {
+  std::mt19937 engine(0);
+  std::normal_distribution<float> distribution(0.0f, 5.0f);
+  const int num_iter = 100;
+
+  auto time = [&](auto&& fn) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_iter; i++)
+      fn();
+    auto stop = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / double(num_iter);
+  };
+
+  std::cout << "Instruction set: " << Generators::CpuKernelInstructionSet() << std::endl;
+  for (size_t vocab_size : {32000, 128256, 256000}) {
+    std::vector<float> logits(vocab_size);
+    for (auto& logit : logits)
+      logit = distribution(engine);
+    std::vector<float> scores(vocab_size);
+
+    auto scalar_softmax = time([&] {
+      scores = logits;
+      const float max = *std::max_element(scores.begin(), scores.end());
+      std::transform(scores.begin(), scores.end(), scores.begin(), [max](float score) { return std::exp(score - max); });
+      const float sum = std::accumulate(scores.begin(), scores.end(), 0.0f);
+      std::transform(scores.begin(), scores.end(), scores.begin(), [sum](float score) { return score / sum; });
+    });
+    auto softmax = time([&] {
+      scores = logits;
+      Generators::Softmax(scores, 1.0f);
+    });
+    auto scalar_argmax = time([&] { scores[0] = static_cast<float>(std::distance(logits.begin(), std::max_element(logits.begin(), logits.end()))); });
+    auto argmax = time([&] { scores[0] = static_cast<float>(Generators::Argmax(logits)); });
+
+    std::cout << "Vocab size " << vocab_size
+              << " softmax: " << scalar_softmax << " -> " << softmax << " microseconds,"
+              << " argmax: " << scalar_argmax << " -> " << argmax << " microseconds" << std::endl;
+  }
+}
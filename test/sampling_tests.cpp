@@ -3,11 +3,13 @@
 
 #include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstring>  // for memcmp
 #include <numeric>
 #include <random>
 #include <limits>
 #include "span.h"
+#include "softmax.h"
 #define OGA_USE_SPAN 1
 #include <ort_genai.h>
 #include <gtest/gtest.h>
@@ -285,6 +287,273 @@ TEST(SamplingTests, RandomizedSamplingTopPAndKCpu) {
   }
 }
 
+TEST(SamplingTests, PresenceAndFrequencyPenaltiesCpu) {
+  auto config = OgaConfig::Create(MODEL_PATH "hf-internal-testing/tiny-random-gpt2-fp32");
+  config->Overlay(R"({ "model": { "vocab_size" : 5 } })");
+
+  auto model = OgaModel::Create(*config);
+  auto params = OgaGeneratorParams::Create(*model);
+  params->SetSearchOption("max_length", 10);
+  params->SetSearchOption("presence_penalty", 0.4f);
+  params->SetSearchOption("frequency_penalty", 0.5f);
+
+  auto generator = OgaGenerator::Create(*model, *params);
+  auto generate = [&](std::vector<float> logits) {
+    generator->SetLogits(*OgaTensor::Create(logits.data(), std::array<int64_t, 2>{1LL, 5LL}));
+    generator->GenerateNextToken();
+    return generator->GetNextTokens()[0];
+  };
+
+  // Build the sequence 1, 1, 2
+  EXPECT_EQ(generate({0.0f, 10.0f, 0.0f, 0.0f, 0.0f}), 1);
+  EXPECT_EQ(generate({0.0f, 10.0f, 0.0f, 0.0f, 0.0f}), 1);
+  EXPECT_EQ(generate({0.0f, 0.0f, 10.0f, 0.0f, 0.0f}), 2);
+
+  // Token 1 drops to 3.0 - 0.4 - 2 * 0.5 = 1.6 and token 2 to 2.0 - 0.4 - 0.5 = 1.1, so the unseen token 3 wins
+  EXPECT_EQ(generate({0.0f, 3.0f, 2.0f, 1.9f, 0.0f}), 3);
+}
+
+TEST(SamplingTests, NoRepeatNgramCpu) {
+  auto config = OgaConfig::Create(MODEL_PATH "hf-internal-testing/tiny-random-gpt2-fp32");
+  config->Overlay(R"({ "model": { "vocab_size" : 5 } })");
+
+  auto model = OgaModel::Create(*config);
+  auto params = OgaGeneratorParams::Create(*model);
+  params->SetSearchOption("max_length", 10);
+  params->SetSearchOption("no_repeat_ngram_size", 2);
+
+  auto generator = OgaGenerator::Create(*model, *params);
+  auto generate = [&](std::vector<float> logits) {
+    generator->SetLogits(*OgaTensor::Create(logits.data(), std::array<int64_t, 2>{1LL, 5LL}));
+    generator->GenerateNextToken();
+    return generator->GetNextTokens()[0];
+  };
+
+  // Build the sequence 1, 2, 1
+  EXPECT_EQ(generate({0.0f, 10.0f, 0.0f, 0.0f, 0.0f}), 1);
+  EXPECT_EQ(generate({0.0f, 0.0f, 10.0f, 0.0f, 0.0f}), 2);
+  EXPECT_EQ(generate({0.0f, 10.0f, 0.0f, 0.0f, 0.0f}), 1);
+
+  // 2 would repeat the bigram 1, 2, so the next best token is chosen
+  EXPECT_EQ(generate({0.0f, 0.0f, 10.0f, 5.0f, 0.0f}), 3);
+  // After another 1, both 2 and 3 would repeat a bigram
+  EXPECT_EQ(generate({0.0f, 10.0f, 0.0f, 0.0f, 0.0f}), 1);
+  EXPECT_EQ(generate({0.0f, 0.0f, 1.0f, 10.0f, 0.5f}), 4);
+}
+
+TEST(SamplingTests, SeededParallelSamplingCpu) {
+  // Large enough for the rows to be sampled on the thread pool
+  const int batch_size = 32;
+  const int vocab_size = 32000;
+
+  auto config = OgaConfig::Create(MODEL_PATH "hf-internal-testing/tiny-random-gpt2-fp32");
+  config->Overlay(R"({ "model": { "vocab_size" : 32000 } })");
+  auto model = OgaModel::Create(*config);
+
+  std::vector<float> logits_cpu(vocab_size * batch_size);
+  std::mt19937 engine(0);
+  std::uniform_real_distribution<float> dist(0.0f, 4.0f);
+  std::generate(logits_cpu.begin(), logits_cpu.end(), [&] { return dist(engine); });
+
+  auto sample = [&](int num_rows) {
+    auto params = OgaGeneratorParams::Create(*model);
+    params->SetSearchOption("max_length", 10);
+    params->SetSearchOptionBool("do_sample", true);
+    params->SetSearchOption("top_k", 50);
+    params->SetSearchOption("top_p", 0.9f);
+    params->SetSearchOption("random_seed", 42);
+    params->SetSearchOption("batch_size", num_rows);
+
+    auto generator = OgaGenerator::Create(*model, *params);
+    generator->SetLogits(*OgaTensor::Create(logits_cpu.data(), std::array<int64_t, 2>{num_rows, vocab_size}));
+    std::vector<int32_t> tokens;
+    for (int i = 0; i < 3; i++) {
+      generator->GenerateNextToken();
+      auto next_tokens = generator->GetNextTokens();
+      tokens.insert(tokens.end(), next_tokens.begin(), next_tokens.end());
+      generator->SetLogits(*OgaTensor::Create(logits_cpu.data(), std::array<int64_t, 2>{num_rows, vocab_size}));
+    }
+    return tokens;
+  };
+
+  // Every row has its own random stream, so the tokens don't depend on the threads or the other rows
+  auto tokens = sample(batch_size);
+  EXPECT_EQ(tokens, sample(batch_size));
+
+  auto first_row_tokens = sample(1);
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ(first_row_tokens[i], tokens[i * batch_size]);
+}
+
+TEST(SamplingTests, LogprobsTopPCpu) {
+  const int batch_size = 2;
+  const int vocab_size = 5;
+  const int top_logprobs = 3;
+  std::vector<float> logits_cpu{2.0f, 1.5f, 1.25f, 0.25f, 0.5f,
+                                0.25f, 0.5f, 1.25f, 1.5f, 2.0f};
+
+  auto config = OgaConfig::Create(MODEL_PATH "hf-internal-testing/tiny-random-gpt2-fp32");
+  config->Overlay(R"({ "model": { "vocab_size" : 5 } })");
+  auto model = OgaModel::Create(*config);
+  auto params = OgaGeneratorParams::Create(*model);
+  params->SetSearchOption("max_length", 10);
+  params->SetSearchOptionBool("do_sample", true);
+  params->SetSearchOption("top_k", 0);
+  params->SetSearchOption("top_p", 0.9f);
+  params->SetSearchOption("temperature", 0.5f);
+  params->SetSearchOption("top_logprobs", top_logprobs);
+  params->SetSearchOption("batch_size", batch_size);
+
+  auto generator = OgaGenerator::Create(*model, *params);
+  generator->SetLogits(*OgaTensor::Create(logits_cpu.data(), std::array<int64_t, 2>{batch_size, vocab_size}));
+  generator->GenerateNextToken();
+
+  // The logprobs are the log-softmax of the logits, regardless of the temperature used for sampling
+  auto logprob = [&](int b, int32_t token) {
+    auto row = std::span<const float>(logits_cpu).subspan(b * vocab_size, vocab_size);
+    float sum = 0.0f;
+    for (float logit : row)
+      sum += std::exp(logit);
+    return row[token] - std::log(sum);
+  };
+
+  auto next_tokens = generator->GetNextTokens();
+  auto chosen = generator->GetNextTokenLogprobs();
+  std::span<const int32_t> top_tokens;
+  std::span<const float> top;
+  generator->GetNextTokenTopLogprobs(top_tokens, top);
+  ASSERT_EQ(chosen.size(), batch_size);
+  ASSERT_EQ(top_tokens.size(), batch_size * top_logprobs);
+
+  const std::array<std::array<int32_t, top_logprobs>, batch_size> expected_top_tokens{{{0, 1, 2}, {4, 3, 2}}};
+  for (int b = 0; b < batch_size; b++) {
+    EXPECT_NEAR(chosen[b], logprob(b, next_tokens[b]), 1e-5f);
+    for (int i = 0; i < top_logprobs; i++) {
+      EXPECT_EQ(top_tokens[b * top_logprobs + i], expected_top_tokens[b][i]);
+      EXPECT_NEAR(top[b * top_logprobs + i], logprob(b, expected_top_tokens[b][i]), 1e-5f);
+    }
+  }
+}
+
+// The vectorized CPU kernels of every instruction set the CPU supports give the same results as plain loops. The
+// lengths cover tails that are not a multiple of the 8 or 16 lanes, and the values include -inf, lowest() and ties.
+class CpuKernelTest : public ::testing::TestWithParam<const char*> {
+ protected:
+  void SetUp() override {
+    if (!Generators::SetCpuKernelInstructionSet(GetParam()))
+      GTEST_SKIP() << GetParam() << " is not supported by this CPU";
+  }
+  void TearDown() override { Generators::SetCpuKernelInstructionSet(""); }
+
+  static constexpr size_t lengths_[] = {1, 3, 7, 8, 9, 15, 16, 17, 31, 33, 64, 100, 1027};
+  static constexpr float temperatures_[] = {1.0f, 0.7f, 2.5f};
+
+  // Random scores with some entries masked to -inf or lowest(), like logits after a penalty or a constraint
+  static std::vector<float> Scores(size_t length, std::mt19937& engine) {
+    std::normal_distribution<float> distribution(0.0f, 5.0f);
+    std::vector<float> scores(length);
+    for (auto& score : scores)
+      score = distribution(engine);
+    for (size_t i = 2; i < length; i += 5)
+      scores[i] = (i / 5) % 2 ? -std::numeric_limits<float>::infinity() : std::numeric_limits<float>::lowest();
+    return scores;
+  }
+
+  static std::vector<double> ReferenceLogSoftmax(const std::vector<float>& scores, float temperature) {
+    const double max = *std::max_element(scores.begin(), scores.end());
+    double sum = 0.0;
+    for (float score : scores)
+      sum += std::exp((score - max) / temperature);
+    std::vector<double> result;
+    for (float score : scores)
+      result.push_back((score - max) / temperature - std::log(sum));
+    return result;
+  }
+};
+
+TEST_P(CpuKernelTest, MaxAndArgmax) {
+  std::mt19937 engine(0);
+  for (size_t length : lengths_) {
+    auto scores = Scores(length, engine);
+    EXPECT_EQ(Generators::MaxElement(scores), *std::max_element(scores.begin(), scores.end())) << length;
+    EXPECT_EQ(Generators::Argmax(scores), std::distance(scores.begin(), std::max_element(scores.begin(), scores.end()))) << length;
+
+    // Of several largest values, the first one wins, whichever lane or tail position the others are in
+    for (size_t first : {size_t{0}, length / 2, length - 1}) {
+      auto tied = scores;
+      const float max = *std::max_element(tied.begin(), tied.end()) + 1.0f;
+      for (size_t i = first; i < length; i += 3)
+        tied[i] = max;
+      tied[length - 1] = max;
+      EXPECT_EQ(Generators::Argmax(tied), first) << length;
+    }
+
+    // Every value equal, including all -inf
+    for (float value : {0.0f, -std::numeric_limits<float>::infinity()}) {
+      std::vector<float> same(length, value);
+      EXPECT_EQ(Generators::Argmax(same), 0) << length;
+      EXPECT_EQ(Generators::MaxElement(same), value) << length;
+    }
+  }
+}
+
+TEST_P(CpuKernelTest, Softmax) {
+  std::mt19937 engine(1);
+  for (size_t length : lengths_) {
+    for (float temperature : temperatures_) {
+      auto scores = Scores(length, engine);
+      auto expected = ReferenceLogSoftmax(scores, temperature);
+      Generators::Softmax(scores, temperature);
+      for (size_t i = 0; i < length; i++)
+        EXPECT_NEAR(scores[i], std::exp(expected[i]), 1e-5) << length << " " << temperature << " " << i;
+    }
+  }
+}
+
+TEST_P(CpuKernelTest, LogSoftmax) {
+  std::mt19937 engine(2);
+  for (size_t length : lengths_) {
+    for (float temperature : temperatures_) {
+      auto scores = Scores(length, engine);
+      auto expected = ReferenceLogSoftmax(scores, temperature);
+      Generators::LogSoftMax(scores, temperature);
+      for (size_t i = 0; i < length; i++) {
+        // Masked scores stay far below every other one, even if they overflow to -inf
+        if (expected[i] < -1e30)
+          EXPECT_LT(scores[i], -1e30f) << length << " " << temperature << " " << i;
+        else
+          EXPECT_NEAR(scores[i], expected[i], 1e-4 * std::max(1.0, std::abs(expected[i]))) << length << " " << temperature << " " << i;
+      }
+    }
+  }
+}
+
+TEST_P(CpuKernelTest, LogSumExpAndTemperature) {
+  std::mt19937 engine(3);
+  for (size_t length : lengths_) {
+    auto scores = Scores(length, engine);
+    const float max = *std::max_element(scores.begin(), scores.end());
+    double sum = 0.0;
+    for (float score : scores)
+      sum += std::exp(static_cast<double>(score) - max);
+    EXPECT_NEAR(Generators::LogSumExp(scores, max), std::log(sum), 1e-5) << length;
+
+    for (float temperature : temperatures_) {
+      auto scaled = scores;
+      Generators::ApplyTemperature(scaled, temperature);
+      for (size_t i = 0; i < length; i++) {
+        if (std::isinf(scores[i]))
+          EXPECT_EQ(scaled[i], scores[i]);
+        else
+          EXPECT_FLOAT_EQ(scaled[i], scores[i] * (1.0f / temperature)) << length << " " << temperature << " " << i;
+      }
+    }
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(SamplingTests, CpuKernelTest, ::testing::Values("scalar", "avx2", "avx512"),
+                         [](const ::testing::TestParamInfo<const char*>& info) { return std::string(info.param); });
+
 #if USE_CUDA
 TEST(SamplingTests, BatchedSamplingTopPCuda) {
   std::vector<int32_t> input_ids{0, 1, 2, 3};